@@ -1,24 +1,9 @@
 #!/bin/bash
 
-old_IFS="$IFS"
-IFS=$'\n'
+# Any arguments are passed on to opusenc, e.g. `./create-opus.sh -r report.txt' to optimize the settings per file.
 
-gcc opusenc.c -o opusenc -lopus
+gcc -O2 opusenc.c -o opusenc -lopus -lpthread -lm
 
-wav_files=`find '../gesplitste geluiden' -name \*.wav`
-first=true
-for i in $wav_files; do
-    opus_file="${i%.wav}.opus"
-    opus_file="./${opus_file#"../gesplitste geluiden/"}"
-    opus_packets_file="${opus_file}_packets"
-    pcm_file="${opus_file%.opus}.pcm"
-
-    mkdir -p "`dirname "$pcm_file"`"
-    sox "$i" -t raw -r 48000 -b 16 -c 1 -L -e signed-integer "$pcm_file"
-    ./opusenc "$pcm_file" "$opus_file" "$opus_packets_file"
-    rm "$pcm_file"
-done
+./opusenc "$@" '../gesplitste geluiden' .
 
 rm opusenc
-
-IFS="$old_IFS"
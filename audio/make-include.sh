@@ -9,7 +9,8 @@ opus_files=`find . -name \*.opus`
 
 echo "/**
  * This file contains all the includes for the opus audio fragments, which are in
- * files containing the concatinated opus packets, and files containing the sizes of these opus packets.
+ * files containing the concatinated opus packets, files containing the sizes of these opus packets, and files
+ * containing the loudness envelope of every opus packet.
  */" > "$global_header_file"
  
 echo "target_link_libraries(\${COMPONENT_LIB} INTERFACE" > "$global_cmake_file"
@@ -23,14 +24,15 @@ for opus_file in $opus_files; do
     head -n 1 "$header_file" | awk -F "[^_a-zA-Z0-9]" "{printf \$4}" >> "$global_cmake_file"
     echo '"' >> "$global_cmake_file"
 
-    echo -n "const " > "$header_file.tmp"
-    xxd --include "${opus_file}_packets" >> "$header_file.tmp"
-    cat "$header_file.tmp" >> "$header_file"
-
-    echo -n "                      \"-u " >> "$global_cmake_file"
-    head -n 1 "$header_file.tmp" | awk -F "[^_a-zA-Z0-9]" "{printf \$4}" >> "$global_cmake_file"
-    echo '"' >> "$global_cmake_file"
+    for suffix in _packets _envelope; do
+        echo -n "const " > "$header_file.tmp"
+        xxd --include "${opus_file}${suffix}" >> "$header_file.tmp"
+        cat "$header_file.tmp" >> "$header_file"
 
+        echo -n "                      \"-u " >> "$global_cmake_file"
+        head -n 1 "$header_file.tmp" | awk -F "[^_a-zA-Z0-9]" "{printf \$4}" >> "$global_cmake_file"
+        echo '"' >> "$global_cmake_file"
+    done
 
     rm "$header_file.tmp"
     echo "#include \"audio/${header_file#./}\"" >> "$global_header_file"
@@ -24,114 +24,998 @@
    SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
-/* This is meant to be a simple example of encoding and decoding audio
-   using Opus. It should make it easy to understand how the Opus API
-   works. For more information, see the full API documentation at:
-   https://www.opus-codec.org/docs/ */
-
 /**
+ * Encodes every WAV file in a directory tree into the opus assets of the firmware: a file containing the concatenated
+ * opus packets, a file containing the size of each of these packets as a native short, and a file containing the
+ * loudness envelope of the LEDs, one byte per packet.
+ * The WAV files are parsed, downmixed to mono and resampled to 48 kHz in here, and the files are divided over one
+ * worker thread per core, longest files first.
+ * With -r every file is encoded with the smallest combination of bitrate, frame duration, bandwidth and VBR whose
+ * distortion, as heard through the 8-bit DAC of the device, stays close to that of the default settings. The bytes saved
+ * per asset are written to the report.
+ * With -c only CELT packets are produced, which is what firmware built with CONFIG_SIPKIP_OPUS_CELT_ONLY can decode.
+ *
  * Needs libopus-dev
  */
 
+#define _XOPEN_SOURCE 700
+
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <errno.h>
 #include <string.h>
+#include <math.h>
+#include <time.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <opus/opus.h>
 #include <stdio.h>
 
-/*The frame size is hardcoded for this sample code but it doesn't have to be*/
 #define FRAME_SIZE 960
 #define SAMPLE_RATE 48000
 #define CHANNELS 1
 #define APPLICATION OPUS_APPLICATION_AUDIO
 #define BITRATE 24000
 
-#define MAX_FRAME_SIZE 6*960
+#define MAX_FRAME_SIZE (6*960)
 #define MAX_PACKET_SIZE (3*1276)
 
-int main(int argc, char **argv) {
-    char *in_file;
-    FILE *fin;
-    char *out_file;
-    FILE *fout;
-    char *out_file_packets;
-    FILE *fout_packets;
-    opus_int16 in[FRAME_SIZE * CHANNELS];
-    opus_int16 out[MAX_FRAME_SIZE * CHANNELS];
-    unsigned char encoded_bytes[MAX_PACKET_SIZE];
-    short n_encoded_bytes;
-    /*Holds the state of the encoder */
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+/* Zero crossings on each side of the windowed sinc of the resampler, its Kaiser window and its cutoff frequency
+ * relative to the Nyquist frequency of the lowest of both sample rates. */
+#define RESAMPLER_ZERO_CROSSINGS 16
+#define RESAMPLER_KAISER_BETA 8.6
+#define RESAMPLER_CUTOFF 0.95
+/* Sample rates for which the number of filter phases would exceed this aren't supported. */
+#define RESAMPLER_MAX_PHASES 4096
+
+/* The bitrates the optimizer searches run from this up to BITRATE. */
+#define OPTIMIZER_MIN_BITRATE 6000
+#define OPTIMIZER_BITRATE_STEP 1000
+/* Distortion in dB the optimizer may add on top of that of the default settings. */
+#define OPTIMIZER_DEFAULT_MARGIN 1.0
+
+/* The distortion is measured on 1024 point FFTs every 10 ms. */
+#define ANALYSIS_SIZE 1024
+#define ANALYSIS_HOP 480
+#define N_ANALYSIS_BANDS 21
+
+/* The envelope maps the RMS level of every frame from this many dB below full scale up to full scale onto 0..255. */
+#define ENVELOPE_FLOOR_DB 60.0
+
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+struct encoder_settings {
+    int bitrate;
+    int frame_size;
+    int bandwidth;
+    int vbr;
+};
+
+struct job {
+    char *in_path;
+    /* Path of the output files relative to the output directory, without an extension. */
+    char *out_name;
+    off_t size;
+    bool failed;
+    /* Filled in by the optimizer, the sizes include the .opus_packets file. */
+    struct encoder_settings settings;
+    size_t default_bytes, bytes;
+    double default_distortion, distortion;
+};
+
+struct codec {
     OpusEncoder *encoder;
-    int err;
+    OpusDecoder *decoder;
+    opus_int32 lookahead;
+};
 
-    if (argc != 4) {
-        fprintf(stderr, "usage: %s input.pcm output.opus output.opus_packets\n", argv[0]);
-        fprintf(stderr, "input has to be a 16-bit little-endian raw file\n");
-        return EXIT_FAILURE;
+struct wav {
+    unsigned int format;
+    unsigned int channels;
+    unsigned int sample_rate;
+    unsigned int bits_per_sample;
+    unsigned int block_align;
+    const unsigned char *data;
+    size_t n_frames;
+};
+
+struct buffer {
+    unsigned char *data;
+    size_t len, capacity;
+};
+
+static const struct encoder_settings default_settings = {
+    .bitrate = BITRATE,
+    .frame_size = FRAME_SIZE,
+    .bandwidth = OPUS_AUTO,
+    .vbr = 1,
+};
+
+/* Frame durations of 10, 20, 40 and 60 ms. */
+static const int optimizer_frame_sizes[] = {480, 960, 1920, 2880};
+static const int optimizer_bandwidths[] = {
+    OPUS_BANDWIDTH_NARROWBAND, OPUS_BANDWIDTH_MEDIUMBAND, OPUS_BANDWIDTH_WIDEBAND, OPUS_BANDWIDTH_SUPERWIDEBAND,
+    OPUS_BANDWIDTH_FULLBAND,
+};
+
+/* Band edges in units of 200 Hz, the same bands CELT uses. */
+static const int analysis_band_edges[N_ANALYSIS_BANDS + 1] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 10, 12, 14, 16, 20, 24, 28, 34, 40, 48, 60, 78, 100,
+};
+static int analysis_band_bins[N_ANALYSIS_BANDS + 1];
+static float analysis_band_floors[N_ANALYSIS_BANDS];
+static float analysis_window[ANALYSIS_SIZE];
+static float analysis_twiddles_re[ANALYSIS_SIZE / 2], analysis_twiddles_im[ANALYSIS_SIZE / 2];
+
+static const char *in_dir;
+static const char *out_dir;
+static const char *report_path;
+static int application = APPLICATION;
+static double optimizer_margin = OPTIMIZER_DEFAULT_MARGIN;
+
+static struct job *jobs;
+static size_t n_jobs;
+static size_t jobs_capacity;
+
+static pthread_mutex_t jobs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static size_t next_job;
+static size_t n_failed;
+static double total_seconds;
+
+static double time_now(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static uint16_t read_le16(const unsigned char *p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t read_le32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static bool buffer_append(struct buffer *buffer, const void *data, size_t len) {
+    if (buffer->len + len > buffer->capacity) {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        unsigned char *new_data;
+
+        while (capacity < buffer->len + len)
+            capacity *= 2;
+        if (!(new_data = realloc(buffer->data, capacity)))
+            return false;
+        buffer->data = new_data;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->len, data, len);
+    buffer->len += len;
+    return true;
+}
+
+/**
+ * Reads the whole file at once, the WAV files are small enough to not bother streaming them.
+ */
+static unsigned char *read_file(const char *path, size_t *len) {
+    FILE *file = fopen(path, "rb");
+    unsigned char *data = NULL;
+    long size;
+
+    if (!file)
+        return NULL;
+    if (fseek(file, 0, SEEK_END) || (size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET))
+        goto exit;
+    if (!(data = malloc(size ? size : 1)))
+        goto exit;
+    if (fread(data, 1, size, file) != (size_t)size) {
+        free(data);
+        data = NULL;
+        goto exit;
+    }
+    *len = size;
+
+exit:
+    fclose(file);
+    return data;
+}
+
+static bool write_file(const char *path, const void *data, size_t len) {
+    FILE *file = fopen(path, "wb");
+    bool ok;
+
+    if (!file)
+        return false;
+    ok = fwrite(data, 1, len, file) == len;
+    return !fclose(file) && ok;
+}
+
+/**
+ * Creates all parent directories of path, which may be done by multiple threads at the same time.
+ */
+static bool make_parent_dirs(const char *path) {
+    char *copy = strdup(path);
+    bool ok = true;
+
+    if (!copy)
+        return false;
+    for (char *p = strchr(copy + 1, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        if (mkdir(copy, 0777) && errno != EEXIST) {
+            ok = false;
+            break;
+        }
+        *p = '/';
+    }
+    free(copy);
+    return ok;
+}
+
+/**
+ * Finds the fmt and data chunks of a RIFF WAVE file, skipping any other chunks.
+ */
+static const char *parse_wav(const unsigned char *file, size_t len, struct wav *wav) {
+    bool has_fmt = false;
+    size_t pos = 12;
+
+    if (len < 12 || memcmp(file, "RIFF", 4) || memcmp(file + 8, "WAVE", 4))
+        return "not a RIFF WAVE file";
+
+    memset(wav, 0, sizeof(*wav));
+    while (pos + 8 <= len) {
+        const unsigned char *chunk = file + pos + 8;
+        size_t chunk_size = read_le32(file + pos + 4);
+
+        /* Tolerate a truncated last chunk, which some editors write for unfinished recordings. */
+        if (chunk_size > len - pos - 8)
+            chunk_size = len - pos - 8;
+
+        if (!memcmp(file + pos, "fmt ", 4)) {
+            if (chunk_size < 16)
+                return "truncated fmt chunk";
+            wav->format = read_le16(chunk);
+            wav->channels = read_le16(chunk + 2);
+            wav->sample_rate = read_le32(chunk + 4);
+            wav->block_align = read_le16(chunk + 12);
+            wav->bits_per_sample = read_le16(chunk + 14);
+            if (wav->format == WAVE_FORMAT_EXTENSIBLE && chunk_size >= 26)
+                wav->format = read_le16(chunk + 24);
+            has_fmt = true;
+        } else if (!memcmp(file + pos, "data", 4)) {
+            if (!has_fmt)
+                return "data chunk before fmt chunk";
+            wav->data = chunk;
+            wav->n_frames = wav->block_align ? chunk_size / wav->block_align : 0;
+            break;
+        }
+        /* Chunks are padded to an even size. */
+        pos += 8 + chunk_size + (chunk_size & 1);
     }
 
-    /*Create a new encoder state */
-    encoder = opus_encoder_create(SAMPLE_RATE, CHANNELS, APPLICATION, &err);
+    if (!wav->data)
+        return "no data chunk";
+    if (!wav->channels || !wav->sample_rate)
+        return "invalid fmt chunk";
+    if (!(wav->format == WAVE_FORMAT_PCM && (wav->bits_per_sample == 8 || wav->bits_per_sample == 16 ||
+                                             wav->bits_per_sample == 24 || wav->bits_per_sample == 32)) &&
+        !(wav->format == WAVE_FORMAT_IEEE_FLOAT && wav->bits_per_sample == 32))
+        return "unsupported sample format";
+    if (wav->block_align != wav->channels * wav->bits_per_sample / 8)
+        return "unsupported block alignment";
+    return NULL;
+}
+
+static float wav_sample(const struct wav *wav, const unsigned char *p) {
+    switch (wav->bits_per_sample) {
+    case 8:
+        return (p[0] - 128) / 128.0f;
+    case 16:
+        return (int16_t)read_le16(p) / 32768.0f;
+    case 24:
+        return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) / 2147483648.0f;
+    default:
+        if (wav->format == WAVE_FORMAT_IEEE_FLOAT) {
+            uint32_t bits = read_le32(p);
+            float sample;
+
+            memcpy(&sample, &bits, sizeof(sample));
+            return sample;
+        }
+        return (int32_t)read_le32(p) / 2147483648.0f;
+    }
+}
+
+/**
+ * Converts the samples to float and averages all channels, like `sox -c 1' does.
+ */
+static float *downmix_wav(const struct wav *wav) {
+    float *mono = malloc((wav->n_frames ? wav->n_frames : 1) * sizeof(*mono));
+    unsigned int bytes_per_sample = wav->bits_per_sample / 8;
+
+    if (!mono)
+        return NULL;
+    for (size_t i = 0; i < wav->n_frames; i++) {
+        const unsigned char *frame = wav->data + i * wav->block_align;
+        float sum = 0;
+
+        for (unsigned int j = 0; j < wav->channels; j++)
+            sum += wav_sample(wav, frame + j * bytes_per_sample);
+        mono[i] = sum / wav->channels;
+    }
+    return mono;
+}
+
+static unsigned int gcd(unsigned int a, unsigned int b) {
+    while (b) {
+        unsigned int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* Zeroth order modified Bessel function of the first kind, for the Kaiser window. */
+static double bessel_i0(double x) {
+    double sum = 1, term = 1;
+
+    for (int k = 1; k < 50 && term > sum * 1e-12; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+/**
+ * Resamples by the rational factor out_rate / in_rate with a polyphase Kaiser windowed sinc filter, see
+ * https://ccrma.stanford.edu/~jos/resample/ for the idea.
+ * The output is delayed by the group delay of the filter, so it lines up with the input.
+ */
+static float *resample(const float *in, size_t n_in, unsigned int in_rate, unsigned int out_rate, size_t *n_out) {
+    unsigned int divisor = gcd(in_rate, out_rate);
+    unsigned int up = out_rate / divisor;
+    unsigned int down = in_rate / divisor;
+    unsigned int max_factor = up > down ? up : down;
+    unsigned int n_taps = (2 * RESAMPLER_ZERO_CROSSINGS * max_factor + up - 1) / up;
+    size_t filter_len = (size_t)n_taps * up;
+    double cutoff = RESAMPLER_CUTOFF * 0.5 / max_factor;
+    float *filter = NULL;
+    float *out = NULL;
+
+    if (up > RESAMPLER_MAX_PHASES)
+        return NULL;
+
+    *n_out = ((uint64_t)n_in * up + down - 1) / down;
+    if (!(filter = malloc(filter_len * sizeof(*filter))) || !(out = malloc((*n_out ? *n_out : 1) * sizeof(*out))))
+        goto exit;
+
+    /* Store the filter per phase, so every output sample is a dot product of consecutive taps. */
+    for (size_t i = 0; i < filter_len; i++) {
+        double x = i - filter_len / 2.0;
+        double window_x = x / (filter_len / 2.0);
+        double sinc = x ? sin(2 * M_PI * cutoff * x) / (M_PI * x) : 2 * cutoff;
+        double window = bessel_i0(RESAMPLER_KAISER_BETA * sqrt(fmax(0, 1 - window_x * window_x))) /
+                        bessel_i0(RESAMPLER_KAISER_BETA);
+
+        filter[(i % up) * n_taps + i / up] = sinc * window * up;
+    }
+
+    for (size_t i = 0; i < *n_out; i++) {
+        uint64_t t = (uint64_t)i * down + filter_len / 2;
+        const float *taps = &filter[(t % up) * n_taps];
+        int64_t newest = t / up;
+        float sum = 0;
+
+        for (unsigned int k = 0; k < n_taps; k++) {
+            int64_t j = newest - k;
+
+            if (j >= 0 && (uint64_t)j < n_in)
+                sum += taps[k] * in[j];
+        }
+        out[i] = sum;
+    }
+
+exit:
+    free(filter);
+    return out;
+}
+
+/**
+ * Radix-2 decimation in time FFT of ANALYSIS_SIZE points, in place.
+ */
+static void fft(float *re, float *im) {
+    const unsigned int n = ANALYSIS_SIZE;
+
+    for (unsigned int i = 1, j = 0; i < n; i++) {
+        unsigned int bit = n >> 1;
+
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j |= bit;
+        if (i < j) {
+            float t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+
+    for (unsigned int len = 2; len <= n; len <<= 1) {
+        for (unsigned int i = 0; i < n; i += len) {
+            for (unsigned int k = 0; k < len / 2; k++) {
+                float w_re = analysis_twiddles_re[k * (n / len)], w_im = analysis_twiddles_im[k * (n / len)];
+                float *a_re = &re[i + k], *a_im = &im[i + k];
+                float *b_re = &re[i + k + len / 2], *b_im = &im[i + k + len / 2];
+                float t_re = *b_re * w_re - *b_im * w_im;
+                float t_im = *b_re * w_im + *b_im * w_re;
+
+                *b_re = *a_re - t_re;
+                *b_im = *a_im - t_im;
+                *a_re += t_re;
+                *a_im += t_im;
+            }
+        }
+    }
+}
+
+/**
+ * The firmware converts the decoded samples to 8 bits by dropping the low byte, this returns what comes out of the DAC.
+ */
+static float dac_sample(opus_int16 sample) {
+    return ((((sample + 32768) >> 8) & 0xFF) - 128) / 128.0f;
+}
+
+/**
+ * Calculates the power in each analysis band of every analysis frame of the DAC output of pcm.
+ */
+static float *band_powers(const opus_int16 *pcm, size_t n, size_t *n_frames) {
+    float *powers;
+
+    *n_frames = (n + ANALYSIS_HOP - 1) / ANALYSIS_HOP;
+    if (!(powers = malloc((*n_frames ? *n_frames : 1) * N_ANALYSIS_BANDS * sizeof(*powers))))
+        return NULL;
+
+    for (size_t frame = 0; frame < *n_frames; frame++) {
+        float re[ANALYSIS_SIZE], im[ANALYSIS_SIZE] = {0};
+
+        for (size_t i = 0; i < ANALYSIS_SIZE; i++) {
+            size_t j = frame * ANALYSIS_HOP + i;
+            re[i] = j < n ? dac_sample(pcm[j]) * analysis_window[i] : 0;
+        }
+        fft(re, im);
+
+        for (int band = 0; band < N_ANALYSIS_BANDS; band++) {
+            float power = 0;
+
+            for (int bin = analysis_band_bins[band]; bin < analysis_band_bins[band + 1]; bin++)
+                power += re[bin] * re[bin] + im[bin] * im[bin];
+            powers[frame * N_ANALYSIS_BANDS + band] = power;
+        }
+    }
+    return powers;
+}
+
+/**
+ * Returns the mean log spectral distance in dB between the DAC output of the reference and of the decoded candidate, over
+ * the bands in which either of both rises above the quantization noise of the DAC. Differences below that noise floor
+ * can't be heard on the device, so they don't count.
+ */
+static double spectral_distortion(const float *reference, const float *candidate, size_t n_frames) {
+    double sum = 0;
+    size_t n = 0;
+
+    for (size_t i = 0; i < n_frames * N_ANALYSIS_BANDS; i++) {
+        float floor = analysis_band_floors[i % N_ANALYSIS_BANDS];
+
+        if (reference[i] <= floor && candidate[i] <= floor)
+            continue;
+        sum += fabs(10 * log10((candidate[i] + floor) / (reference[i] + floor)));
+        n++;
+    }
+    return n ? sum / n : 0;
+}
+
+static void init_analysis(void) {
+    double window_energy = 0;
+    /* Quantization noise of the 8-bit DAC on the [-1, 1) scale. */
+    double noise_variance = (1 / 128.0) * (1 / 128.0) / 12;
+
+    for (int i = 0; i < ANALYSIS_SIZE; i++) {
+        analysis_window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / ANALYSIS_SIZE);
+        window_energy += analysis_window[i] * analysis_window[i];
+    }
+    for (int i = 0; i < ANALYSIS_SIZE / 2; i++) {
+        analysis_twiddles_re[i] = cos(-2 * M_PI * i / ANALYSIS_SIZE);
+        analysis_twiddles_im[i] = sin(-2 * M_PI * i / ANALYSIS_SIZE);
+    }
+    for (int band = 0; band <= N_ANALYSIS_BANDS; band++)
+        analysis_band_bins[band] = lrint(analysis_band_edges[band] * 200.0 * ANALYSIS_SIZE / SAMPLE_RATE);
+    for (int band = 0; band < N_ANALYSIS_BANDS; band++) {
+        analysis_band_floors[band] = noise_variance * window_energy *
+                                     (analysis_band_bins[band + 1] - analysis_band_bins[band]);
+    }
+}
+
+static size_t encoded_size(const struct buffer *opus, const struct buffer *opus_packets) {
+    return opus->len + opus_packets->len;
+}
+
+static const char *encode_pcm(OpusEncoder *encoder, const struct encoder_settings *settings, const opus_int16 *pcm,
+                              size_t n_samples, struct buffer *opus, struct buffer *opus_packets) {
+    opus->len = 0;
+    opus_packets->len = 0;
+
+    opus_encoder_ctl(encoder, OPUS_RESET_STATE);
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(settings->bitrate));
+    opus_encoder_ctl(encoder, OPUS_SET_BANDWIDTH(settings->bandwidth));
+    opus_encoder_ctl(encoder, OPUS_SET_VBR(settings->vbr));
+
+    /* The last frame is padded with silence. */
+    for (size_t i = 0; i < n_samples; i += settings->frame_size) {
+        opus_int16 in[MAX_FRAME_SIZE * CHANNELS] = {0};
+        unsigned char encoded_bytes[MAX_PACKET_SIZE];
+        short n_encoded_bytes;
+
+        memcpy(in, pcm + i, MIN((size_t)settings->frame_size, n_samples - i) * sizeof(*in));
+
+        n_encoded_bytes = opus_encode(encoder, in, settings->frame_size, encoded_bytes, MAX_PACKET_SIZE);
+        if (n_encoded_bytes < 0)
+            return opus_strerror(n_encoded_bytes);
+        if (!buffer_append(opus, encoded_bytes, n_encoded_bytes) ||
+            !buffer_append(opus_packets, &n_encoded_bytes, sizeof(n_encoded_bytes)))
+            return "out of memory";
+    }
+    return NULL;
+}
+
+/**
+ * Computes the RMS level of every frame that encode_pcm() encodes into a packet, so the firmware can pulse the LEDs
+ * with the audio without analysing it while it plays.
+ */
+static const char *envelope_pcm(const opus_int16 *pcm, size_t n_samples, int frame_size, struct buffer *envelope) {
+    envelope->len = 0;
+
+    for (size_t i = 0; i < n_samples; i += frame_size) {
+        double sum = 0.0, db;
+        unsigned char level;
+
+        for (size_t j = i; j < MIN(i + frame_size, n_samples); j++)
+            sum += (double)pcm[j] * pcm[j];
+        /* The last frame is padded with silence, like in encode_pcm(). */
+        db = 10.0 * log10(sum / frame_size / (32768.0 * 32768.0) + 1e-12);
+        level = lrint(fmax(0.0, fmin(1.0, (db + ENVELOPE_FLOOR_DB) / ENVELOPE_FLOOR_DB)) * UINT8_MAX);
+        if (!buffer_append(envelope, &level, sizeof(level)))
+            return "out of memory";
+    }
+    return NULL;
+}
+
+/**
+ * Decodes the packets like the firmware does, and measures the distortion against the reference band powers.
+ */
+static const char *measure_distortion(struct codec *codec, const struct buffer *opus, const struct buffer *opus_packets,
+                                      const float *reference, size_t n_reference_frames, size_t n_samples,
+                                      double *distortion) {
+    opus_int16 *decoded = malloc((n_samples + MAX_FRAME_SIZE + codec->lookahead) * sizeof(*decoded));
+    float *candidate = NULL;
+    const char *err = NULL;
+    size_t n_decoded = 0, n_candidate_frames;
+    const unsigned char *packet = opus->data;
+
+    if (!decoded)
+        return "out of memory";
+
+    opus_decoder_ctl(codec->decoder, OPUS_RESET_STATE);
+    for (size_t i = 0; i < opus_packets->len / sizeof(short); i++) {
+        short packet_size;
+        int frame_size;
+
+        memcpy(&packet_size, opus_packets->data + i * sizeof(short), sizeof(short));
+        frame_size = opus_decode(codec->decoder, packet, packet_size, decoded + n_decoded, MAX_FRAME_SIZE, 0);
+        if (frame_size < 0) {
+            err = opus_strerror(frame_size);
+            goto exit;
+        }
+        packet += packet_size;
+        n_decoded += frame_size;
+        if (n_decoded >= n_samples + codec->lookahead)
+            break;
+    }
+
+    /* The decoded audio lags behind by the lookahead of the encoder. */
+    if (n_decoded < n_samples + codec->lookahead)
+        memset(decoded + n_decoded, 0, (n_samples + codec->lookahead - n_decoded) * sizeof(*decoded));
+    if (!(candidate = band_powers(decoded + codec->lookahead, n_samples, &n_candidate_frames))) {
+        err = "out of memory";
+        goto exit;
+    }
+    *distortion = spectral_distortion(reference, candidate, MIN(n_reference_frames, n_candidate_frames));
+
+exit:
+    free(decoded);
+    free(candidate);
+    return err;
+}
+
+/**
+ * Searches the smallest stream whose distortion stays within the distortion of the default settings plus the margin.
+ * For every frame size, bandwidth and VBR setting the lowest passing bitrate is searched for with a bisection, which
+ * assumes the distortion doesn't increase with the bitrate. The best stream ends up in opus and opus_packets.
+ */
+static const char *optimize_pcm(struct codec *codec, struct job *job, const opus_int16 *pcm, size_t n_samples,
+                                struct buffer *opus, struct buffer *opus_packets) {
+    struct buffer candidate_opus = {0}, candidate_opus_packets = {0};
+    float *reference;
+    size_t n_reference_frames;
+    const char *err;
+    double threshold;
+    int n_bitrates = (BITRATE - OPTIMIZER_MIN_BITRATE) / OPTIMIZER_BITRATE_STEP + 1;
+
+    if (!(reference = band_powers(pcm, n_samples, &n_reference_frames)))
+        return "out of memory";
+
+    job->settings = default_settings;
+    if ((err = encode_pcm(codec->encoder, &job->settings, pcm, n_samples, opus, opus_packets)) ||
+        (err = measure_distortion(codec, opus, opus_packets, reference, n_reference_frames, n_samples,
+                                  &job->default_distortion)))
+        goto exit;
+    job->default_bytes = job->bytes = encoded_size(opus, opus_packets);
+    job->distortion = job->default_distortion;
+    threshold = job->default_distortion + optimizer_margin;
+
+    for (size_t i = 0; i < sizeof(optimizer_frame_sizes) / sizeof(*optimizer_frame_sizes); i++) {
+        for (size_t j = 0; j < sizeof(optimizer_bandwidths) / sizeof(*optimizer_bandwidths); j++) {
+            for (int vbr = 0; vbr <= 1; vbr++) {
+                int low = 0, high = n_bitrates - 1;
+
+                while (low <= high) {
+                    int middle = (low + high) / 2;
+                    struct encoder_settings settings = {
+                        .bitrate = OPTIMIZER_MIN_BITRATE + middle * OPTIMIZER_BITRATE_STEP,
+                        .frame_size = optimizer_frame_sizes[i],
+                        .bandwidth = optimizer_bandwidths[j],
+                        .vbr = vbr,
+                    };
+                    double distortion;
+                    size_t size;
+
+                    if ((err = encode_pcm(codec->encoder, &settings, pcm, n_samples, &candidate_opus,
+                                          &candidate_opus_packets)) ||
+                        (err = measure_distortion(codec, &candidate_opus, &candidate_opus_packets, reference,
+                                                  n_reference_frames, n_samples, &distortion)))
+                        goto exit;
+
+                    if (distortion > threshold) {
+                        low = middle + 1;
+                        continue;
+                    }
+                    high = middle - 1;
+
+                    size = encoded_size(&candidate_opus, &candidate_opus_packets);
+                    if (size < job->bytes) {
+                        struct buffer tmp;
+
+                        tmp = *opus;
+                        *opus = candidate_opus;
+                        candidate_opus = tmp;
+                        tmp = *opus_packets;
+                        *opus_packets = candidate_opus_packets;
+                        candidate_opus_packets = tmp;
+
+                        job->settings = settings;
+                        job->bytes = size;
+                        job->distortion = distortion;
+                    }
+                }
+            }
+        }
+    }
+
+exit:
+    free(reference);
+    free(candidate_opus.data);
+    free(candidate_opus_packets.data);
+    return err;
+}
+
+static const char *encode_job(struct codec *codec, struct job *job, double *seconds) {
+    unsigned char *file = NULL;
+    float *mono = NULL;
+    float *resampled = NULL;
+    opus_int16 *pcm = NULL;
+    struct buffer opus = {0}, opus_packets = {0}, envelope = {0};
+    char *out_path = NULL;
+    const char *err = NULL;
+    const float *samples;
+    size_t file_len, n_samples;
+    struct wav wav;
+
+    if (!(file = read_file(job->in_path, &file_len))) {
+        err = strerror(errno);
+        goto exit;
+    }
+    if ((err = parse_wav(file, file_len, &wav)))
+        goto exit;
+    if (!(mono = downmix_wav(&wav))) {
+        err = "out of memory";
+        goto exit;
+    }
+
+    if (wav.sample_rate == SAMPLE_RATE) {
+        samples = mono;
+        n_samples = wav.n_frames;
+    } else {
+        if (!(resampled = resample(mono, wav.n_frames, wav.sample_rate, SAMPLE_RATE, &n_samples))) {
+            err = "unsupported sample rate or out of memory";
+            goto exit;
+        }
+        samples = resampled;
+    }
+    *seconds = (double)n_samples / SAMPLE_RATE;
+
+    if (!(pcm = malloc((n_samples ? n_samples : 1) * sizeof(*pcm)))) {
+        err = "out of memory";
+        goto exit;
+    }
+    for (size_t i = 0; i < n_samples; i++)
+        pcm[i] = lrintf(fmaxf(-32768.0f, fminf(32767.0f, samples[i] * 32768.0f)));
+
+    if (report_path) {
+        err = optimize_pcm(codec, job, pcm, n_samples, &opus, &opus_packets);
+    } else {
+        job->settings = default_settings;
+        err = encode_pcm(codec->encoder, &job->settings, pcm, n_samples, &opus, &opus_packets);
+    }
+    if (err || (err = envelope_pcm(pcm, n_samples, job->settings.frame_size, &envelope)))
+        goto exit;
+
+    if (!(out_path = malloc(strlen(out_dir) + strlen(job->out_name) + sizeof("/.opus_envelope")))) {
+        err = "out of memory";
+        goto exit;
+    }
+    sprintf(out_path, "%s/%s.opus", out_dir, job->out_name);
+    if (!make_parent_dirs(out_path) || !write_file(out_path, opus.data, opus.len)) {
+        err = strerror(errno);
+        goto exit;
+    }
+    strcat(out_path, "_packets");
+    if (!write_file(out_path, opus_packets.data, opus_packets.len)) {
+        err = strerror(errno);
+        goto exit;
+    }
+    sprintf(out_path, "%s/%s.opus_envelope", out_dir, job->out_name);
+    if (!write_file(out_path, envelope.data, envelope.len))
+        err = strerror(errno);
+
+exit:
+    free(file);
+    free(mono);
+    free(resampled);
+    free(pcm);
+    free(opus.data);
+    free(opus_packets.data);
+    free(envelope.data);
+    free(out_path);
+    return err;
+}
+
+static void *encode_thread(void *arg) {
+    struct codec codec;
+    int err;
+
+    (void)arg;
+
+    /* Create a new encoder and decoder state, which are reset for every file. */
+    codec.encoder = opus_encoder_create(SAMPLE_RATE, CHANNELS, application, &err);
     if (err < 0) {
         fprintf(stderr, "failed to create an encoder: %s\n", opus_strerror(err));
-        return EXIT_FAILURE;
+        exit(EXIT_FAILURE);
     }
-    /* Set the desired bit-rate. You can also set other parameters if needed.
-       The Opus library is designed to have good defaults, so only set
-       parameters you know you need. Doing otherwise is likely to result
-       in worse quality, but better. */
-    err = opus_encoder_ctl(encoder, OPUS_SET_BITRATE(BITRATE));
+    codec.decoder = opus_decoder_create(SAMPLE_RATE, CHANNELS, &err);
     if (err < 0) {
-        fprintf(stderr, "failed to set bitrate: %s\n", opus_strerror(err));
-        return EXIT_FAILURE;
+        fprintf(stderr, "failed to create a decoder: %s\n", opus_strerror(err));
+        exit(EXIT_FAILURE);
     }
-    in_file = argv[1];
-    fin = fopen(in_file, "r");
-    if (fin == NULL) {
-        fprintf(stderr, "failed to open input file: %s\n", strerror(errno));
-        return EXIT_FAILURE;
+    opus_encoder_ctl(codec.encoder, OPUS_GET_LOOKAHEAD(&codec.lookahead));
+
+    for (;;) {
+        struct job *job;
+        const char *job_err;
+        double seconds = 0;
+
+        pthread_mutex_lock(&jobs_mutex);
+        job = next_job < n_jobs ? &jobs[next_job++] : NULL;
+        pthread_mutex_unlock(&jobs_mutex);
+        if (!job)
+            break;
+
+        job_err = encode_job(&codec, job, &seconds);
+
+        pthread_mutex_lock(&jobs_mutex);
+        if (job_err) {
+            fprintf(stderr, "%s: %s\n", job->in_path, job_err);
+            job->failed = true;
+            n_failed++;
+        } else {
+            total_seconds += seconds;
+        }
+        pthread_mutex_unlock(&jobs_mutex);
+    }
+
+    opus_encoder_destroy(codec.encoder);
+    opus_decoder_destroy(codec.decoder);
+    return NULL;
+}
+
+static int add_job(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    size_t path_len = strlen(path);
+    struct job job = {0};
+
+    (void)ftw;
+
+    if (type != FTW_F || path_len < 4 || strcmp(path + path_len - 4, ".wav"))
+        return 0;
+
+    if (n_jobs == jobs_capacity) {
+        size_t capacity = jobs_capacity ? jobs_capacity * 2 : 64;
+        struct job *new_jobs = realloc(jobs, capacity * sizeof(*jobs));
+
+        if (!new_jobs)
+            return -1;
+        jobs = new_jobs;
+        jobs_capacity = capacity;
     }
 
-    out_file = argv[2];
-    fout = fopen(out_file, "w");
-    if (fout == NULL) {
-        fprintf(stderr, "failed to open output file: %s\n", strerror(errno));
+    job.in_path = strdup(path);
+    job.out_name = strndup(path + strlen(in_dir) + 1, path_len - strlen(in_dir) - 1 - 4);
+    job.size = st->st_size;
+    if (!job.in_path || !job.out_name)
+        return -1;
+    jobs[n_jobs++] = job;
+    return 0;
+}
+
+/* Largest files first, so no thread is left encoding a long file at the end. */
+static int compare_jobs(const void *a, const void *b) {
+    const struct job *job_a = a, *job_b = b;
+
+    return (job_b->size > job_a->size) - (job_b->size < job_a->size);
+}
+
+static int compare_job_names(const void *a, const void *b) {
+    return strcmp(((const struct job *)a)->out_name, ((const struct job *)b)->out_name);
+}
+
+static const char *bandwidth_name(int bandwidth) {
+    switch (bandwidth) {
+    case OPUS_BANDWIDTH_NARROWBAND: return "NB";
+    case OPUS_BANDWIDTH_MEDIUMBAND: return "MB";
+    case OPUS_BANDWIDTH_WIDEBAND: return "WB";
+    case OPUS_BANDWIDTH_SUPERWIDEBAND: return "SWB";
+    case OPUS_BANDWIDTH_FULLBAND: return "FB";
+    default: return "auto";
+    }
+}
+
+/**
+ * Writes the chosen settings and the bytes saved compared to the default settings for every asset, the sizes include
+ * the .opus_packets files.
+ */
+static bool write_report(void) {
+    FILE *file = fopen(report_path, "w");
+    size_t total_default_bytes = 0, total_bytes = 0;
+
+    if (!file)
+        return false;
+
+    qsort(jobs, n_jobs, sizeof(*jobs), &compare_job_names);
+    fprintf(file, "# default_bytes bytes saved_bytes bitrate frame_ms bandwidth vbr default_distortion_db "
+                  "distortion_db asset\n");
+    for (size_t i = 0; i < n_jobs; i++) {
+        const struct job *job = &jobs[i];
+
+        if (job->failed)
+            continue;
+        fprintf(file, "%zu %zu %zu %d %g %s %s %.2f %.2f %s\n", job->default_bytes, job->bytes,
+                job->default_bytes - job->bytes, job->settings.bitrate, job->settings.frame_size * 1000.0 / SAMPLE_RATE,
+                bandwidth_name(job->settings.bandwidth), job->settings.vbr ? "vbr" : "cbr", job->default_distortion,
+                job->distortion, job->out_name);
+        total_default_bytes += job->default_bytes;
+        total_bytes += job->bytes;
+    }
+    fprintf(file, "# total: %zu -> %zu bytes, saved %zu bytes (%.1f%%)\n", total_default_bytes, total_bytes,
+            total_default_bytes - total_bytes,
+            total_default_bytes ? 100.0 * (total_default_bytes - total_bytes) / total_default_bytes : 0);
+    return !fclose(file);
+}
+
+int main(int argc, char **argv) {
+    pthread_t *threads;
+    long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool usage_error = false;
+    double start;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "cj:r:d:")) != -1) {
+        switch (opt) {
+        case 'c':
+            /* The restricted low delay application never uses SILK, so neither SILK-only nor hybrid packets. */
+            application = OPUS_APPLICATION_RESTRICTED_LOWDELAY;
+            break;
+        case 'j':
+            if ((n_threads = atoi(optarg)) <= 0)
+                usage_error = true;
+            break;
+        case 'r':
+            report_path = optarg;
+            break;
+        case 'd':
+            optimizer_margin = atof(optarg);
+            break;
+        default:
+            usage_error = true;
+            break;
+        }
+    }
+    if (usage_error || argc - optind != 2) {
+        fprintf(stderr, "usage: %s [-c] [-j threads] [-r report [-d margin_db]] wav_dir out_dir\n", argv[0]);
+        fprintf(stderr, "encodes every .wav file in wav_dir to a .opus, .opus_packets and .opus_envelope file in out_dir\n");
+        fprintf(stderr, "with -c, only CELT packets are produced\n");
+        fprintf(stderr, "with -r, the smallest settings within margin_db (default %g) of the distortion of the\n"
+                        "default settings after the 8-bit DAC are searched per file, and written to report\n",
+                OPTIMIZER_DEFAULT_MARGIN);
         return EXIT_FAILURE;
     }
-    
-    out_file_packets = argv[3];
-    fout_packets = fopen(out_file_packets, "w");
-    if (fout_packets == NULL) {
-        fprintf(stderr, "failed to open output file: %s\n", strerror(errno));
+    in_dir = argv[optind];
+    out_dir = argv[optind + 1];
+    for (size_t len = strlen(in_dir); len > 1 && in_dir[len - 1] == '/'; len--)
+        argv[optind][len - 1] = '\0';
+
+    init_analysis();
+
+    start = time_now();
+    if (nftw(in_dir, &add_job, 16, FTW_PHYS)) {
+        fprintf(stderr, "failed to find the input files: %s\n", strerror(errno));
         return EXIT_FAILURE;
     }
-    while (1) {
-        int i;
-        unsigned char pcm_bytes[MAX_FRAME_SIZE * CHANNELS * 2];
+    qsort(jobs, n_jobs, sizeof(*jobs), &compare_jobs);
 
-        /* Read a 16 bits/sample audio frame. */
-        fread(pcm_bytes, sizeof(short)*CHANNELS, FRAME_SIZE, fin);
-        if (feof(fin))
-            break;
-        /* Convert from little-endian ordering. */
-        for (i = 0; i < CHANNELS * FRAME_SIZE; i++)
-            in[i] = pcm_bytes[2 * i + 1] << 8 | pcm_bytes[2 * i];
-
-        /* Encode the frame. */
-        n_encoded_bytes = opus_encode(encoder, in, FRAME_SIZE, encoded_bytes, MAX_PACKET_SIZE);
-        if (n_encoded_bytes < 0) {
-            fprintf(stderr, "encode failed: %s\n", opus_strerror(n_encoded_bytes));
+    if (n_threads > (long)n_jobs)
+        n_threads = n_jobs ? n_jobs : 1;
+    if (!(threads = malloc(n_threads * sizeof(*threads)))) {
+        fprintf(stderr, "failed to allocate the threads\n");
+        return EXIT_FAILURE;
+    }
+    for (long i = 0; i < n_threads; i++) {
+        if (pthread_create(&threads[i], NULL, &encode_thread, NULL)) {
+            fprintf(stderr, "failed to create a thread\n");
             return EXIT_FAILURE;
         }
+    }
+    for (long i = 0; i < n_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    printf("Encoded %zu of %zu files (%.1f s of audio) in %.2f s using %ld threads\n", n_jobs - n_failed, n_jobs,
+           total_seconds, time_now() - start, n_threads);
+
+    if (report_path && !write_report()) {
+        fprintf(stderr, "failed to write the report: %s\n", strerror(errno));
+        n_failed++;
+    }
 
-        /* Write the encoded audio to file. */
-        fwrite(encoded_bytes, sizeof(char), n_encoded_bytes, fout);
-        fwrite(&n_encoded_bytes, sizeof(short), 1, fout_packets);
+    for (size_t i = 0; i < n_jobs; i++) {
+        free(jobs[i].in_path);
+        free(jobs[i].out_name);
     }
-    /*Destroy the encoder state*/
-    opus_encoder_destroy(encoder);
-    fclose(fin);
-    fclose(fout);
-    fclose(fout_packets);
-    return EXIT_SUCCESS;
+    free(jobs);
+    free(threads);
+    return n_failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,161 @@
+#!/bin/bash
+
+# Synchronises the opus files created by `create-opus.sh' with a SipKip connected over Bluetooth SPP, only uploading,
+# removing or renaming the files that differ according to the `manifest' command of the device.
+# Needs lrzsz (for `sx') and a bound rfcomm device, e.g. `rfcomm bind 0 <bdaddr>'.
+#
+# Usage: ./sync.sh [-n] tty local_dir remote_dir
+#   -n  Only print the commands that would be executed.
+
+dry_run=false
+if [ "$1" = "-n" ]; then
+    dry_run=true
+    shift
+fi
+
+if [ $# -ne 3 ]; then
+    echo "usage: $0 [-n] tty local_dir remote_dir" >&2
+    exit 1
+fi
+
+tty="$1"
+local_dir="${2%/}"
+remote_dir="${3%/}"
+prompt_re=$'^(.*\n)?[0-9]+@SipKip $'
+
+# Files received over XMODEM are padded with CTRL-Z to a multiple of the 1K block size, so the local files are padded
+# the same way before hashing and sending them, which makes the sizes and hashes on both sides comparable.
+padded_dir=`mktemp -d`
+trap 'rm -rf "$padded_dir"' EXIT
+
+read_until_prompt() {
+    local chunk output=
+    while IFS= read -r -d '>' -t 30 -u 3 chunk; do
+        output+="$chunk"
+        if [[ $output =~ $prompt_re ]]; then
+            # Consume the space after the prompt.
+            read -r -n 1 -t 1 -u 3 chunk
+            printf '%s' "${BASH_REMATCH[1]}"
+            return 0
+        fi
+        output+='>'
+    done
+    echo "Timed out waiting for the prompt of $tty" >&2
+    exit 1
+}
+
+# Quotes an argument for the shell of the device if needed, which understands "" quotes with backslash escapes.
+quote() {
+    if [[ $1 =~ [[:space:]\"\'\\] ]]; then
+        local escaped="${1//\\/\\\\}"
+        printf '"%s"' "${escaped//\"/\\\"}"
+    else
+        printf '%s' "$1"
+    fi
+}
+
+run() {
+    local line= arg
+    for arg in "$@"; do
+        line+="${line:+ }`quote "$arg"`"
+    done
+    echo "$line"
+    if ! $dry_run; then
+        printf '%s\n' "$line" >&3
+        read_until_prompt
+    fi
+}
+
+upload() {
+    local padded="$padded_dir/$1"
+    run rx "$remote_dir/$1"
+    if ! $dry_run; then
+        sx -k "$padded" <&3 >&3 || echo "Failed to send $1" >&2
+        read_until_prompt
+    fi
+}
+
+make_parent_dirs() {
+    local dir="${1%/*}" prefix= components component
+    [ "$dir" = "$1" ] && return
+    IFS=/ read -ra components <<< "$dir"
+    for component in "${components[@]}"; do
+        prefix="${prefix:+$prefix/}$component"
+        if [ -z "${remote_dirs[$prefix]}" ]; then
+            run mkdir "$remote_dir/$prefix"
+            remote_dirs[$prefix]=1
+        fi
+    done
+}
+
+stty -F "$tty" raw -echo || exit 1
+exec 3<>"$tty"
+read_until_prompt > /dev/null
+
+declare -A local_files remote_files remote_dirs renamed
+
+while IFS= read -r i; do
+    i="${i#./}"
+    size=`stat -c %s "$local_dir/$i"`
+    mkdir -p "`dirname "$padded_dir/$i"`"
+    {
+        cat "$local_dir/$i"
+        head -c $(( (1024 - size % 1024) % 1024 )) /dev/zero | tr '\0' '\032'
+    } > "$padded_dir/$i"
+    read -r sum size _ <<< "`cksum < "$padded_dir/$i"`"
+    local_files[$i]="$sum $size"
+done < <(cd "$local_dir" && find . -type f \( -name \*.opus -o -name \*.opus_packets -o -name \*.opus_envelope \))
+
+manifest_line="manifest `quote "$remote_dir"`"
+manifest=`printf '%s\n' "$manifest_line" >&3; read_until_prompt` || exit 1
+
+# `manifest' prints `cksum size path' lines, the path itself may contain spaces.
+while IFS=' ' read -r sum size path; do
+    [[ $path == *.opus || $path == *.opus_packets || $path == *.opus_envelope ]] || continue
+    remote_files[$path]="$sum $size"
+    dir="$path"
+    while [ "${dir%/*}" != "$dir" ]; do
+        dir="${dir%/*}"
+        remote_dirs[$dir]=1
+    done
+done <<< "$manifest"
+
+n_unchanged=0 n_uploaded=0 n_renamed=0 n_removed=0
+
+while IFS= read -r i; do
+    [ -z "$i" ] && continue
+    if [ "${remote_files[$i]}" = "${local_files[$i]}" ]; then
+        n_unchanged=$((n_unchanged + 1))
+        continue
+    fi
+
+    # Look for a file with the same content which isn't present locally anymore, and move that one into place.
+    source=
+    for j in "${!remote_files[@]}"; do
+        if [ -z "${local_files[$j]}" ] && [ -z "${renamed[$j]}" ] &&
+           [ "${remote_files[$j]}" = "${local_files[$i]}" ]; then
+            source="$j"
+            break
+        fi
+    done
+
+    [ -n "${remote_files[$i]}" ] && run rm "$remote_dir/$i"
+    make_parent_dirs "$i"
+    if [ -n "$source" ]; then
+        run mv "$remote_dir/$source" "$remote_dir/$i"
+        renamed[$source]=1
+        n_renamed=$((n_renamed + 1))
+    else
+        upload "$i"
+        n_uploaded=$((n_uploaded + 1))
+    fi
+done < <(printf '%s\n' "${!local_files[@]}" | sort)
+
+for j in "${!remote_files[@]}"; do
+    if [ -z "${local_files[$j]}" ] && [ -z "${renamed[$j]}" ]; then
+        run rm "$remote_dir/$j"
+        n_removed=$((n_removed + 1))
+    fi
+done
+
+echo "Unchanged: $n_unchanged, uploaded: $n_uploaded, renamed: $n_renamed, removed: $n_removed"
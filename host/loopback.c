@@ -0,0 +1,788 @@
+/**
+ * Loopback benchmark harness for the SPP shell (`spp_read_handle()'), the command table and the XMODEM receiver.
+ *
+ * The firmware sources are built for Linux against the shims in `shim/', the SPP file descriptor is one end of a
+ * socketpair, and LittleFS runs on a RAM block device. Between the shell and the client side of this harness sits a
+ * link model with a configurable latency, bandwidth and loss, which is scripted together with the workload:
+ *
+ *   link <latency_ms> <bytes_per_second> <loss_percent>  Change the link model (0 bytes per second is unlimited).
+ *   cmd <command line>                                   Run a command once, and print its round-trip time.
+ *   repeat <n> <command line>                            Run a command n times, and print min/avg/max round-trip time.
+ *   pipe <n> <command line>                              Send a command n times at once, and print the time until the
+ *                                                        last prompt. A %d in the command line is replaced by 0 to n-1.
+ *   put <local_file> <remote_path>                       Upload a file with `rx' and XMODEM 1K, and print throughput.
+ *   putrand <size> <remote_path>                         Same as put, with size bytes of random data.
+ *   rpcrand <size> <remote_path> <window>                Write size bytes of random data with `rpc' (see rpc.h), and
+ *                                                        read them back, keeping up to window requests in flight.
+ *   rpcls <remote_path>                                  List a directory with RPC_METHOD_LIST, and print the number
+ *                                                        of entries and requests.
+ *   session <n>                                          Connect client n if it isn't yet, and run the next lines on
+ *                                                        it. The script starts on client 0, the firmware refuses
+ *                                                        more than CONFIG_SIPKIP_SPP_MAX_SESSIONS.
+ *   timeout <ms>                                         Time to wait for a prompt before giving up (default 10 s).
+ *
+ * Every cmd line also prints how many writes the shell made to the SPP file descriptor, which on the device is the
+ * number of separate SPP writes and at least as many RFCOMM frames, and how many reads and writes of LittleFS files
+ * and block device operations the command made. The RAM block device is much faster than flash, so those counts tell
+ * more about file system work than the time. Empty lines and lines starting with `#' are ignored. See `bench.txt' for
+ * an example.
+ *
+ * Usage: ./loopback [-v] [-b baud] [-o] [-s fs_size] [script]
+ *   -v  Print the log output of the firmware to stderr.
+ *   -b  Make writing the log output as slow as on a UART with this many baud, like 115200 on the device.
+ *   -o  Print the output of the commands to stdout.
+ *   -s  Size of the RAM block device in bytes, defaults to 4 MiB.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_spp_api.h"
+
+#include "host.h"
+#include "main/sipkip-audio.h"
+#include "main/spp-task.h"
+#include "main/vfs-acceptor.h"
+#include "main/xmodem.h"
+#include "main/rpc.h"
+#include "main/deferred-log.h"
+#include "main/utils.h"
+
+#define LINK_MTU 990 /* Default RFCOMM MTU of the ESP32 SPP profile. */
+#define XMODEM_BLOCK_SIZE 1024
+#define XMODEM_MAX_RETRIES 10
+#define XMODEM_RESPONSE_TIMEOUT_MS 10000
+#define DEFAULT_FS_SIZE (4 * 1024 * 1024)
+#define DEFAULT_PROMPT_TIMEOUT_MS 10000
+
+struct link_chunk {
+    struct link_chunk *next;
+    int64_t deliver_at;
+    size_t len;
+    unsigned char data[];
+};
+
+struct link_direction {
+    const char *name;
+    int src, dst;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    struct link_chunk *head, *tail;
+    int64_t busy_until;
+    unsigned long long bytes, dropped;
+};
+
+static struct {
+    pthread_mutex_t mutex;
+    int64_t latency_us;
+    long bytes_per_second;
+    double loss;
+} link_model = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+/* One more client than the firmware has sessions, to see the last one refused. */
+#define MAX_CLIENTS (CONFIG_SIPKIP_SPP_MAX_SESSIONS + 1)
+
+static struct client {
+    bool open;
+    int fd;
+    struct link_direction to_device, to_client;
+} clients[MAX_CLIENTS];
+/* The client that the script lines are run on. */
+static int client_fd = -1;
+static int prompt_timeout_ms = DEFAULT_PROMPT_TIMEOUT_MS;
+static bool print_output = false;
+
+static void sleep_until_us(int64_t deadline) {
+    int64_t now;
+
+    while ((now = host_time_us()) < deadline) {
+        struct timespec duration = {
+            .tv_sec = (deadline - now) / 1000000,
+            .tv_nsec = (deadline - now) % 1000000 * 1000
+        };
+        nanosleep(&duration, NULL);
+    }
+}
+
+static bool write_all(int fd, const void *buf, size_t len) {
+    const unsigned char *p = buf;
+
+    while (len) {
+        ssize_t ret = write(fd, p, len);
+        if (ret < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+static void link_queue(struct link_direction *direction, struct link_chunk *chunk) {
+    pthread_mutex_lock(&direction->mutex);
+    if (direction->tail)
+        direction->tail->next = chunk;
+    else
+        direction->head = chunk;
+    direction->tail = chunk;
+    pthread_cond_signal(&direction->cond);
+    pthread_mutex_unlock(&direction->mutex);
+}
+
+/**
+ * Chunks are serialized one after another at the configured bandwidth, and delivered after the configured latency.
+ * Lost chunks are dropped as a whole, which the shell sees as missing bytes.
+ */
+static void *link_reader(void *arg) {
+    struct link_direction *direction = arg;
+    unsigned char buf[LINK_MTU];
+    ssize_t len;
+
+    while ((len = read(direction->src, buf, sizeof(buf))) > 0) {
+        int64_t now = host_time_us(), deliver_at;
+        bool drop;
+
+        pthread_mutex_lock(&link_model.mutex);
+        direction->busy_until = MAX(direction->busy_until, now);
+        if (link_model.bytes_per_second > 0)
+            direction->busy_until += len * 1000000LL / link_model.bytes_per_second;
+        deliver_at = direction->busy_until + link_model.latency_us;
+        drop = drand48() < link_model.loss;
+        pthread_mutex_unlock(&link_model.mutex);
+
+        if (drop) {
+            direction->dropped += len;
+            continue;
+        }
+
+        struct link_chunk *chunk = malloc(sizeof(*chunk) + len);
+        if (!chunk)
+            break;
+        chunk->next = NULL;
+        chunk->deliver_at = deliver_at;
+        chunk->len = len;
+        memcpy(chunk->data, buf, len);
+
+        link_queue(direction, chunk);
+    }
+
+    /* An empty chunk closes the other end once everything before it was delivered. */
+    struct link_chunk *eof = malloc(sizeof(*eof));
+    if (eof) {
+        pthread_mutex_lock(&link_model.mutex);
+        *eof = (struct link_chunk) { .deliver_at = MAX(direction->busy_until, host_time_us()) + link_model.latency_us };
+        pthread_mutex_unlock(&link_model.mutex);
+        link_queue(direction, eof);
+    }
+    return NULL;
+}
+
+static void *link_writer(void *arg) {
+    struct link_direction *direction = arg;
+
+    for (;;) {
+        struct link_chunk *chunk;
+
+        pthread_mutex_lock(&direction->mutex);
+        while (!direction->head)
+            pthread_cond_wait(&direction->cond, &direction->mutex);
+        chunk = direction->head;
+        direction->head = chunk->next;
+        if (!direction->head)
+            direction->tail = NULL;
+        pthread_mutex_unlock(&direction->mutex);
+
+        sleep_until_us(chunk->deliver_at);
+        if (!chunk->len) {
+            shutdown(direction->dst, SHUT_WR);
+            free(chunk);
+            break;
+        }
+        if (!write_all(direction->dst, chunk->data, chunk->len)) {
+            free(chunk);
+            break;
+        }
+        direction->bytes += chunk->len;
+        free(chunk);
+    }
+    return NULL;
+}
+
+static long wait_for_prompt(int timeout_ms);
+
+static void link_start(struct link_direction *direction) {
+    pthread_t reader, writer;
+
+    pthread_mutex_init(&direction->mutex, NULL);
+    pthread_cond_init(&direction->cond, NULL);
+    pthread_create(&reader, NULL, &link_reader, direction);
+    pthread_create(&writer, NULL, &link_writer, direction);
+    pthread_detach(reader);
+    pthread_detach(writer);
+}
+
+/**
+ * Connects client [i] the same way the Bluetooth stack does, if it isn't connected yet, and runs the next script lines
+ * on it. Returns whether a prompt was received.
+ */
+static bool open_session(int i) {
+    struct client *client = &clients[i];
+    int device_sockets[2], client_sockets[2];
+
+    client_fd = client->fd;
+    if (client->open)
+        return true;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, device_sockets) || socketpair(AF_UNIX, SOCK_STREAM, 0, client_sockets)) {
+        fprintf(stderr, "failed to create socketpair: %s\n", strerror(errno));
+        return false;
+    }
+    client_fd = client->fd = client_sockets[0];
+    client->to_device = (struct link_direction) {
+        .name = "to device", .src = client_sockets[1], .dst = device_sockets[1]
+    };
+    client->to_client = (struct link_direction) {
+        .name = "to client", .src = device_sockets[1], .dst = client_sockets[1]
+    };
+    link_start(&client->to_device);
+    link_start(&client->to_client);
+    client->open = true;
+
+    /* The stub of esp_spp_disconnect() takes the device end of the socketpair as handle. */
+    esp_spp_stack_cb(ESP_SPP_SRV_OPEN_EVT, &(esp_spp_cb_param_t) {
+        .srv_open = { .status = ESP_SPP_SUCCESS, .handle = device_sockets[0], .fd = device_sockets[0] }
+    });
+    return wait_for_prompt(prompt_timeout_ms) >= 0;
+}
+
+/**
+ * Reads from the shell until the prompt is seen, or [timeout_ms] passed. Returns the number of bytes read before the
+ * prompt, or -1 on a timeout.
+ */
+static long wait_for_prompt(int timeout_ms) {
+    static const char prompt[] = "@"DEVICE_NAME" > ";
+    char tail[sizeof(prompt)] = {0};
+    int64_t deadline = host_time_us() + timeout_ms * 1000LL;
+    long n_bytes = 0;
+
+    for (;;) {
+        int64_t remaining = deadline - host_time_us();
+        char c;
+
+        if (remaining <= 0 || poll(&(struct pollfd) { .fd = client_fd, .events = POLLIN }, 1,
+                                   (int)((remaining + 999) / 1000)) <= 0 || read(client_fd, &c, 1) != 1)
+            return -1;
+
+        if (print_output)
+            putchar(c);
+        memmove(tail, &tail[1], sizeof(tail) - 2);
+        tail[sizeof(tail) - 2] = c;
+        n_bytes++;
+        if (!strcmp(tail, prompt)) {
+            if (print_output)
+                putchar('\n');
+            return n_bytes - (sizeof(prompt) - 1);
+        }
+    }
+}
+
+/* Returns the round-trip time in microseconds, or -1 if no prompt was received in time. */
+static int64_t run_command(const char *line) {
+    int64_t start = host_time_us();
+
+    if (!write_all(client_fd, line, strlen(line)) || !write_all(client_fd, "\n", 1) ||
+        wait_for_prompt(prompt_timeout_ms) < 0)
+        return -1;
+    return host_time_us() - start;
+}
+
+/**
+ * Returns the time until the last of [n] prompts in microseconds, or -1 if they weren't all received in time. A "%d" in
+ * [line] is replaced by the index of the command.
+ */
+static int64_t pipe_command(const char *line, int n) {
+    int64_t start = host_time_us();
+    const char *index = strstr(line, "%d");
+    int prefix_len = index ? index - line : strlen(line);
+    size_t len = strlen(line) + 16, used = 0;
+    char *lines = malloc(n * (len + 1));
+    bool sent;
+
+    if (!lines)
+        return -1;
+    for (int i = 0; i < n; i++) {
+        if (index)
+            used += sprintf(&lines[used], "%.*s%d%s\n", prefix_len, line, i, &index[2]);
+        else
+            used += sprintf(&lines[used], "%s\n", line);
+    }
+    sent = write_all(client_fd, lines, used);
+    free(lines);
+    if (!sent)
+        return -1;
+    for (int i = 0; i < n; i++)
+        if (wait_for_prompt(prompt_timeout_ms) < 0)
+            return -1;
+    return host_time_us() - start;
+}
+
+static uint16_t crc16_ccitt(const unsigned char *buf, size_t buf_size) {
+    uint16_t crc = 0;
+
+    while (buf_size--) {
+        crc ^= (uint16_t)*buf++ << 8;
+        for (int i = 0; i < 8; i++)
+            crc = crc & 0x8000 ? crc << 1 ^ 0x1021 : crc << 1;
+    }
+    return crc;
+}
+
+/* Waits for one of the bytes in [expected], other bytes are ignored. */
+static int xmodem_wait_for(const char *expected, int timeout_ms) {
+    int64_t deadline = host_time_us() + timeout_ms * 1000LL;
+    unsigned char c;
+
+    for (;;) {
+        int64_t remaining = deadline - host_time_us();
+        if (remaining <= 0 || poll(&(struct pollfd) { .fd = client_fd, .events = POLLIN }, 1,
+                                   (int)((remaining + 999) / 1000)) <= 0 || read(client_fd, &c, 1) != 1)
+            return -1;
+        if (c && strchr(expected, c))
+            return c;
+    }
+}
+
+static bool xmodem_send(const unsigned char *data, size_t len) {
+    unsigned char block[3 + XMODEM_BLOCK_SIZE + 2];
+    unsigned char packet_number = 1;
+    int c;
+
+    if ((c = xmodem_wait_for("C", XMODEM_RESPONSE_TIMEOUT_MS)) < 0)
+        return false;
+
+    for (size_t offset = 0; offset < len; offset += XMODEM_BLOCK_SIZE, packet_number++) {
+        size_t block_len = MIN(len - offset, XMODEM_BLOCK_SIZE);
+        uint16_t crc;
+        int retry;
+
+        block[0] = XMODEM_STX;
+        block[1] = packet_number;
+        block[2] = ~packet_number;
+        memcpy(&block[3], &data[offset], block_len);
+        memset(&block[3 + block_len], XMODEM_CTRLZ, XMODEM_BLOCK_SIZE - block_len);
+        crc = crc16_ccitt(&block[3], XMODEM_BLOCK_SIZE);
+        block[3 + XMODEM_BLOCK_SIZE] = crc >> 8;
+        block[3 + XMODEM_BLOCK_SIZE + 1] = crc & 0xFF;
+
+        for (retry = 0; retry < XMODEM_MAX_RETRIES; retry++) {
+            if (!write_all(client_fd, block, sizeof(block)))
+                return false;
+            c = xmodem_wait_for((char []) {XMODEM_ACK, XMODEM_NAK, XMODEM_CAN, '\0'}, XMODEM_RESPONSE_TIMEOUT_MS);
+            if (c == XMODEM_ACK)
+                break;
+            if (c == XMODEM_CAN)
+                return false;
+        }
+        if (retry == XMODEM_MAX_RETRIES)
+            return false;
+    }
+
+    for (int retry = 0; retry < XMODEM_MAX_RETRIES; retry++) {
+        if (!write_all(client_fd, (char []) {XMODEM_EOT}, 1))
+            return false;
+        if (xmodem_wait_for((char []) {XMODEM_ACK, '\0'}, XMODEM_RESPONSE_TIMEOUT_MS) == XMODEM_ACK)
+            return true;
+    }
+    return false;
+}
+
+static void put(const unsigned char *data, size_t len, const char *remote_path) {
+    char line[SPP_MAX_ARG_LEN];
+    int64_t start = host_time_us(), elapsed;
+
+    snprintf(line, sizeof(line), "rx %s\n", remote_path);
+    if (!write_all(client_fd, line, strlen(line)) || !xmodem_send(data, len) ||
+        wait_for_prompt(prompt_timeout_ms) < 0) {
+        printf("put %s: failed\n", remote_path);
+        return;
+    }
+    elapsed = host_time_us() - start;
+    printf("put %s: %zu bytes in %.1f ms, %.1f KiB/s\n", remote_path, len, elapsed / 1000.0,
+           len / 1024.0 / (elapsed / 1000000.0));
+}
+
+/* Reads exactly [len] bytes from the client, or returns false after the prompt timeout. */
+static bool read_all(void *buf, size_t len) {
+    int64_t deadline = host_time_us() + prompt_timeout_ms * 1000LL;
+    unsigned char *p = buf;
+
+    while (len) {
+        int64_t remaining = deadline - host_time_us();
+        ssize_t ret;
+
+        if (remaining <= 0 || poll(&(struct pollfd) { .fd = client_fd, .events = POLLIN }, 1,
+                                   (int)((remaining + 999) / 1000)) <= 0 || (ret = read(client_fd, p, len)) <= 0)
+            return false;
+        p += ret;
+        len -= ret;
+    }
+    return true;
+}
+
+static bool rpc_send(uint16_t id, uint8_t method, uint8_t flags, const void *payload, size_t len) {
+    struct rpc_header header = { .len = len, .id = id, .method = method, .flags = flags };
+
+    return write_all(client_fd, &header, sizeof(header)) && write_all(client_fd, payload, len);
+}
+
+/* Receives a response with up to [len] bytes of result into [buf], and returns its status, or -1 if it failed. */
+static int32_t rpc_receive(struct rpc_header *header, void *buf, size_t len) {
+    unsigned char discard[RPC_MAX_DATA_LEN];
+    int32_t status;
+
+    if (!read_all(header, sizeof(*header)) || header->len < sizeof(status) || !read_all(&status, sizeof(status)))
+        return -1;
+    header->len -= sizeof(status);
+    if (header->len > len)
+        return read_all(buf, len) && read_all(discard, MIN(header->len - len, sizeof(discard))) ? ESP_ERR_INVALID_SIZE :
+                                                                                                 -1;
+    return read_all(buf, header->len) ? status : -1;
+}
+
+/**
+ * Writes [len] bytes of [data] to [remote_path] in RPC_MAX_DATA_LEN requests, or reads them back and compares them if
+ * [write] is false, with up to [window] requests in flight. Returns the time it took in microseconds, or -1 on an error.
+ */
+static int64_t rpc_transfer(const unsigned char *data, size_t len, const char *remote_path, bool write, int window,
+                            unsigned long *out_of_order) {
+    size_t path_len = strlen(remote_path) + 1, n = (len + RPC_MAX_DATA_LEN - 1) / RPC_MAX_DATA_LEN, sent = 0, done = 0;
+    unsigned char *payload = malloc(sizeof(uint32_t) * 2 + path_len + RPC_MAX_DATA_LEN);
+    unsigned char result[RPC_MAX_DATA_LEN];
+    int64_t start = host_time_us();
+    int newest = -1;
+
+    if (!payload)
+        return -1;
+    while (done < n) {
+        if (sent < n && sent - done < (size_t)window) {
+            uint32_t offset = sent * RPC_MAX_DATA_LEN, chunk_len = MIN(len - offset, RPC_MAX_DATA_LEN);
+            size_t payload_len;
+
+            memcpy(payload, &offset, sizeof(offset));
+            if (write) {
+                memcpy(&payload[sizeof(offset)], remote_path, path_len);
+                memcpy(&payload[sizeof(offset) + path_len], &data[offset], chunk_len);
+                payload_len = sizeof(offset) + path_len + chunk_len;
+            } else {
+                memcpy(&payload[sizeof(offset)], &chunk_len, sizeof(chunk_len));
+                memcpy(&payload[2 * sizeof(offset)], remote_path, path_len);
+                payload_len = 2 * sizeof(offset) + path_len - 1;
+            }
+            if (!rpc_send(sent, write ? RPC_METHOD_WRITE : RPC_METHOD_READ, write && !sent ? RPC_FLAG_TRUNCATE : 0,
+                          payload, payload_len))
+                break;
+            sent++;
+            continue;
+        }
+
+        struct rpc_header header;
+        uint32_t offset;
+
+        if (rpc_receive(&header, result, sizeof(result)) != ESP_OK || header.id >= n)
+            break;
+        offset = header.id * RPC_MAX_DATA_LEN;
+        if (!write && (header.len != MIN(len - offset, RPC_MAX_DATA_LEN) || memcmp(result, &data[offset], header.len)))
+            break;
+        if (header.id < newest)
+            (*out_of_order)++;
+        newest = MAX(newest, header.id);
+        done++;
+    }
+    free(payload);
+    return done == n ? host_time_us() - start : -1;
+}
+
+/* Switches the shell to RPC, returns whether it answered with the version of rpc.h. */
+static bool rpc_open(void) {
+    char reply[32] = {0};
+
+    /* The reply to the rpc command is a single line. */
+    if (write_all(client_fd, "rpc\n", 4)) {
+        for (size_t i = 0; i < sizeof(reply) - 1 && read_all(&reply[i], 1) && reply[i] != '\n'; i++);
+    }
+    return atoi(&reply[4]) == RPC_VERSION;
+}
+
+/* Switches back to the shell, which prints a prompt after the response, returns whether that worked. */
+static bool rpc_close(void) {
+    struct rpc_header header;
+
+    return rpc_send(0, RPC_METHOD_CLOSE, 0, NULL, 0) && rpc_receive(&header, NULL, 0) == ESP_OK &&
+           wait_for_prompt(prompt_timeout_ms) >= 0;
+}
+
+static void rpc_rand(size_t len, const char *remote_path, int window) {
+    unsigned char *data = malloc(len);
+    unsigned long out_of_order = 0;
+    int64_t write_us = -1, read_us = -1;
+
+    if (!data)
+        return;
+    for (size_t i = 0; i < len; i++)
+        data[i] = lrand48();
+
+    if (rpc_open()) {
+        write_us = rpc_transfer(data, len, remote_path, true, window, &out_of_order);
+        if (write_us >= 0)
+            read_us = rpc_transfer(data, len, remote_path, false, window, &out_of_order);
+        if (!rpc_close())
+            read_us = -1;
+    }
+    if (read_us < 0)
+        printf("rpcrand %s: failed\n", remote_path);
+    else
+        printf("rpcrand %s: %zu bytes written in %.1f ms, %.1f KiB/s, read in %.1f ms, %.1f KiB/s, %lu out of order\n",
+               remote_path, len, write_us / 1000.0, len / 1024.0 / (write_us / 1000000.0), read_us / 1000.0,
+               len / 1024.0 / (read_us / 1000000.0), out_of_order);
+    free(data);
+}
+
+static void rpc_ls(const char *remote_path) {
+    size_t path_len = strlen(remote_path) + 1;
+    unsigned char payload[sizeof(uint32_t) + SPP_MAX_ARG_LEN], result[RPC_MAX_DATA_LEN];
+    unsigned long n_dirs = 0, n_bytes = 0, n_requests = 0;
+    uint32_t index = 0;
+    bool ok = rpc_open();
+    int64_t start = host_time_us();
+
+    memcpy(&payload[sizeof(index)], remote_path, path_len);
+    while (ok) {
+        struct rpc_header header;
+        size_t len = 0;
+
+        memcpy(payload, &index, sizeof(index));
+        if (!rpc_send(n_requests++, RPC_METHOD_LIST, 0, payload, sizeof(index) + path_len - 1) ||
+            rpc_receive(&header, result, sizeof(result)) != ESP_OK) {
+            ok = false;
+            break;
+        }
+        if (!header.len)
+            break;
+        /* uint32_t size, uint32_t mtime, uint8_t directory, name, NUL. */
+        while (len < header.len) {
+            uint32_t size;
+
+            memcpy(&size, &result[len], sizeof(size));
+            n_dirs += result[len + 2 * sizeof(uint32_t)];
+            n_bytes += size;
+            len += 2 * sizeof(uint32_t) + 1;
+            len += strnlen((char *)&result[len], header.len - len) + 1;
+            index++;
+        }
+    }
+    if (!rpc_close() || !ok)
+        printf("rpcls %s: failed\n", remote_path);
+    else
+        printf("rpcls %s: %lu entries, %lu directories, %lu bytes in %.2f ms, %lu requests\n", remote_path,
+               (unsigned long)index, n_dirs, n_bytes, (host_time_us() - start) / 1000.0, n_requests);
+}
+
+static void run_script(FILE *script) {
+    char line[SPP_MAX_ARG_LEN + 64];
+
+    while (fgets(line, sizeof(line), script)) {
+        char *arg;
+        int n;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!line[0] || line[0] == '#')
+            continue;
+
+        if (!strncmp(line, "link ", 5)) {
+            double latency_ms, loss_percent;
+            long bytes_per_second;
+            if (sscanf(&line[5], "%lf %ld %lf", &latency_ms, &bytes_per_second, &loss_percent) != 3) {
+                fprintf(stderr, "Invalid link line: %s\n", line);
+                continue;
+            }
+            pthread_mutex_lock(&link_model.mutex);
+            link_model.latency_us = latency_ms * 1000;
+            link_model.bytes_per_second = bytes_per_second;
+            link_model.loss = loss_percent / 100.0;
+            pthread_mutex_unlock(&link_model.mutex);
+            printf("link: %.1f ms latency, %ld B/s, %.2f%% loss\n", latency_ms, bytes_per_second, loss_percent);
+        } else if (!strncmp(line, "session ", 8)) {
+            n = atoi(&line[8]);
+            if (n < 0 || n >= MAX_CLIENTS) {
+                fprintf(stderr, "Invalid session line: %s\n", line);
+                continue;
+            }
+            if (!clients[n].open)
+                printf("session %d: %s\n", n, open_session(n) ? "connected" : "no prompt");
+            else
+                open_session(n);
+        } else if (!strncmp(line, "timeout ", 8)) {
+            prompt_timeout_ms = atoi(&line[8]);
+        } else if (!strncmp(line, "cmd ", 4)) {
+            unsigned long writes = host_vfs_stream_writes(), file_calls, bd_calls, end_file_calls, end_bd_calls;
+            int64_t rtt;
+            host_vfs_fs_calls(&file_calls, &bd_calls);
+            rtt = run_command(&line[4]);
+            host_vfs_fs_calls(&end_file_calls, &end_bd_calls);
+            if (rtt < 0)
+                printf("cmd %s: timed out\n", &line[4]);
+            else
+                printf("cmd %s: %.2f ms, %lu writes, %lu file calls, %lu block device calls\n", &line[4], rtt / 1000.0,
+                       host_vfs_stream_writes() - writes, end_file_calls - file_calls, end_bd_calls - bd_calls);
+        } else if (!strncmp(line, "repeat ", 7)) {
+            int64_t rtt, min = INT64_MAX, max = 0, total = 0;
+            int offset, timeouts = 0;
+            if (sscanf(&line[7], "%d %n", &n, &offset) != 1 || n <= 0) {
+                fprintf(stderr, "Invalid repeat line: %s\n", line);
+                continue;
+            }
+            arg = &line[7 + offset];
+            for (int i = 0; i < n; i++) {
+                if ((rtt = run_command(arg)) < 0) {
+                    timeouts++;
+                    continue;
+                }
+                min = MIN(min, rtt);
+                max = MAX(max, rtt);
+                total += rtt;
+            }
+            if (timeouts == n)
+                printf("repeat %d %s: timed out\n", n, arg);
+            else
+                printf("repeat %d %s: min %.2f ms, avg %.2f ms, max %.2f ms, %d timeouts\n", n, arg, min / 1000.0,
+                       total / 1000.0 / (n - timeouts), max / 1000.0, timeouts);
+        } else if (!strncmp(line, "pipe ", 5)) {
+            int64_t elapsed;
+            int offset;
+            if (sscanf(&line[5], "%d %n", &n, &offset) != 1 || n <= 0) {
+                fprintf(stderr, "Invalid pipe line: %s\n", line);
+                continue;
+            }
+            arg = &line[5 + offset];
+            if ((elapsed = pipe_command(arg, n)) < 0)
+                printf("pipe %d %s: timed out\n", n, arg);
+            else
+                printf("pipe %d %s: %.2f ms, %.2f ms per command\n", n, arg, elapsed / 1000.0,
+                       elapsed / 1000.0 / n);
+        } else if (!strncmp(line, "put ", 4)) {
+            char local_path[SPP_MAX_ARG_LEN], remote_path[SPP_MAX_ARG_LEN];
+            unsigned char *data = NULL;
+            long len;
+            FILE *file;
+            if (sscanf(&line[4], "%255s %255s", local_path, remote_path) != 2 || !(file = fopen(local_path, "rb"))) {
+                fprintf(stderr, "Invalid put line, or couldn't open local file: %s\n", line);
+                continue;
+            }
+            fseek(file, 0, SEEK_END);
+            len = ftell(file);
+            fseek(file, 0, SEEK_SET);
+            if ((data = malloc(len)) && fread(data, 1, len, file) == len)
+                put(data, len, remote_path);
+            free(data);
+            fclose(file);
+        } else if (!strncmp(line, "putrand ", 8)) {
+            char remote_path[SPP_MAX_ARG_LEN];
+            unsigned char *data;
+            long len;
+            if (sscanf(&line[8], "%ld %255s", &len, remote_path) != 2 || len <= 0 || !(data = malloc(len))) {
+                fprintf(stderr, "Invalid putrand line: %s\n", line);
+                continue;
+            }
+            for (long i = 0; i < len; i++)
+                data[i] = lrand48();
+            put(data, len, remote_path);
+            free(data);
+        } else if (!strncmp(line, "rpcrand ", 8)) {
+            char remote_path[SPP_MAX_ARG_LEN];
+            long len;
+            int window;
+            if (sscanf(&line[8], "%ld %255s %d", &len, remote_path, &window) != 3 || len <= 0 || window <= 0) {
+                fprintf(stderr, "Invalid rpcrand line: %s\n", line);
+                continue;
+            }
+            rpc_rand(len, remote_path, window);
+        } else if (!strncmp(line, "rpcls ", 6)) {
+            char remote_path[SPP_MAX_ARG_LEN];
+            if (sscanf(&line[6], "%255s", remote_path) != 1) {
+                fprintf(stderr, "Invalid rpcls line: %s\n", line);
+                continue;
+            }
+            rpc_ls(remote_path);
+        } else {
+            fprintf(stderr, "Unknown script line: %s\n", line);
+        }
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t fs_size = DEFAULT_FS_SIZE;
+    int opt;
+    FILE *script = stdin;
+
+    while ((opt = getopt(argc, argv, "vb:os:")) != -1) {
+        switch (opt) {
+        case 'v':
+            host_log_level = ESP_LOG_INFO;
+            break;
+        case 'b':
+            host_log_baud = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            print_output = true;
+            break;
+        case 's':
+            fs_size = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-v] [-b baud] [-o] [-s fs_size] [script]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc && !(script = fopen(argv[optind], "r"))) {
+        fprintf(stderr, "failed to open script: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    if (host_vfs_mount(fs_size) != ESP_OK) {
+        fprintf(stderr, "failed to mount LittleFS on the RAM block device\n");
+        return EXIT_FAILURE;
+    }
+    dac_write_opus_mutex = xSemaphoreCreateMutex();
+    deferred_log_setup();
+
+    spp_task_task_start_up();
+    if (!open_session(0)) {
+        fprintf(stderr, "no prompt received from the shell\n");
+        return EXIT_FAILURE;
+    }
+
+    run_script(script);
+
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        struct link_direction *to_device = &clients[i].to_device, *to_client = &clients[i].to_client;
+
+        if (clients[i].open)
+            printf("session %d link %s: %llu bytes, %llu dropped; %s: %llu bytes, %llu dropped\n", i, to_device->name,
+                   to_device->bytes, to_device->dropped, to_client->name, to_client->bytes, to_client->dropped);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,262 @@
+/**
+ * Simulator for the muxed inputs: replays a scripted input trace through the muxed GPIO scanner (`muxed-gpio.c') and
+ * the gesture engine (`muxed-gestures.c') of the firmware, on top of a model of the 200 Hz mux (`shim/mux-model.c')
+ * and a FreeRTOS that runs in virtual time (`shim/sim-freertos.c'). The results only depend on the trace, so they can
+ * be compared between versions of the firmware:
+ *
+ *   latency <us>                                     Time between a mux edge and its interrupt (default 2 us).
+ *   config <input|all> <debounce_ms> <long_press_ms> <multi_press_window_ms>
+ *                                                    Gesture timing of an input, before the first at, bounce or run.
+ *   at <ms> <input> <0|1>                            Release or press an input at the given time.
+ *   bounce <ms> <input> <0|1> <n> <interval_us>      Same as at, but the contact bounces n times first.
+ *   run <ms>                                         Keep simulating until the given time.
+ *   standby <ms>                                     Put the mux in standby at the given time, until an input wakes it.
+ *
+ * Times are absolute and have to increase. Every gesture is printed with the virtual time at which the firmware
+ * reported it, and its latency since the at or bounce line of its input. Empty lines and lines starting with `#' are
+ * ignored. See `mux-trace.txt' for an example.
+ *
+ * Only the time the simulation took on the host is printed to stderr, so everything on stdout can be compared as is.
+ * `make check' compares it for `mux-trace.txt' against `mux-trace.expected', which is regenerated with
+ * `./muxsim mux-trace.txt > mux-trace.expected' when a change of the results is intended.
+ *
+ * Usage: ./muxsim [-v] [-t] [script]
+ *   -v  Print the log output of the firmware to stderr.
+ *   -t  Print the input trace of the firmware at the end, as the inputs command would.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "host-sim.h"
+#include "main/muxed-gpio.h"
+#include "main/muxed-gestures.h"
+#include "main/input-trace.h"
+#include "main/stats.h"
+#include "main/utils.h"
+
+#define DEFAULT_DEBOUNCE_MS 10
+#define DEFAULT_LONG_PRESS_MS 1000
+#define DEFAULT_MULTI_PRESS_WINDOW_MS 400
+
+esp_log_level_t host_log_level = ESP_LOG_NONE;
+unsigned long host_log_baud = 0;
+
+static const char *const input_names[MUXED_INPUT_N] = {
+    [MUXED_INPUT_STAR_L_BUTTON] = "star_l_button", [MUXED_INPUT_TRIANGLE_L_BUTTON] = "triangle_l_button",
+    [MUXED_INPUT_SQUARE_L_BUTTON] = "square_l_button", [MUXED_INPUT_HEART_L_BUTTON] = "heart_l_button",
+    [MUXED_INPUT_HEART_R_BUTTON] = "heart_r_button", [MUXED_INPUT_SQUARE_R_BUTTON] = "square_r_button",
+    [MUXED_INPUT_TRIANGLE_R_BUTTON] = "triangle_r_button", [MUXED_INPUT_STAR_R_BUTTON] = "star_r_button",
+    [MUXED_INPUT_STAR_L_CLIP] = "star_l_clip", [MUXED_INPUT_TRIANGLE_L_CLIP] = "triangle_l_clip",
+    [MUXED_INPUT_SQUARE_L_CLIP] = "square_l_clip", [MUXED_INPUT_HEART_L_CLIP] = "heart_l_clip",
+    [MUXED_INPUT_HEART_R_CLIP] = "heart_r_clip", [MUXED_INPUT_SQUARE_R_CLIP] = "square_r_clip",
+    [MUXED_INPUT_TRIANGLE_R_CLIP] = "triangle_r_clip", [MUXED_INPUT_STAR_R_CLIP] = "star_r_clip",
+    [MUXED_INPUT_BEAK_SWITCH] = "beak_switch", [MUXED_INPUT_LEARN_SWITCH] = "learn_switch",
+    [MUXED_INPUT_PLAY_SWITCH] = "play_switch"
+};
+
+static const char *const gesture_names[] = {
+    [MUXED_GESTURE_PRESS] = "press",
+    [MUXED_GESTURE_RELEASE] = "release",
+    [MUXED_GESTURE_LONG_PRESS] = "long_press",
+    [MUXED_GESTURE_MULTI_PRESS] = "multi_press"
+};
+
+struct latency {
+    unsigned long n;
+    int64_t min, max, total;
+};
+
+static struct muxed_gesture_config configs[MUXED_INPUT_N];
+static bool started = false;
+/* The time of the last at or bounce line of every input. */
+static int64_t input_changed_us[MUXED_INPUT_N];
+static struct latency latencies[sizeof(gesture_names) / sizeof(*gesture_names)];
+
+/* The counters of `main/stats.h', without the rest of stats.c, which needs the tasks and heap of the device. */
+struct stats_counters stats_counters = {0};
+
+/* The simulator plays no clips, so there are no errors in the input trace to name. */
+const char *esp_err_to_name(esp_err_t code) {
+    return code == ESP_OK ? "ESP_OK" : "ESP_FAIL";
+}
+
+static int parse_input(const char *name) {
+    for (enum muxed_inputs i = MUXED_INPUT_MIN; i <= MUXED_INPUT_MAX; i++)
+        if (!strcmp(name, input_names[i]))
+            return i;
+    return -1;
+}
+
+static void on_gesture(const struct muxed_gesture_event *event) {
+    int64_t now_us = esp_timer_get_time(), latency_us = now_us - input_changed_us[event->input];
+    struct latency *latency = &latencies[event->gesture];
+
+    printf("%10.3f ms %-18s %-12s count %u latency %.3f ms\n", now_us / 1000.0, input_names[event->input],
+           gesture_names[event->gesture], event->count, latency_us / 1000.0);
+
+    if (!latency->n || latency_us < latency->min)
+        latency->min = latency_us;
+    if (!latency->n || latency_us > latency->max)
+        latency->max = latency_us;
+    latency->total += latency_us;
+    latency->n++;
+}
+
+static void start(void) {
+    if (started)
+        return;
+    started = true;
+    muxed_gestures_setup(&configs, &on_gesture);
+}
+
+static bool run_until(double ms) {
+    int64_t until_us = ms * 1000;
+
+    start();
+    if (until_us < esp_timer_get_time()) {
+        fprintf(stderr, "Time %.3f ms is in the past\n", ms);
+        return false;
+    }
+    host_sim_run_until(until_us);
+    return true;
+}
+
+static void run_script(FILE *script) {
+    char line[256];
+
+    while (fgets(line, sizeof(line), script)) {
+        char name[64];
+        double ms;
+        int input, level, n, interval_us;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        if (!line[0] || line[0] == '#')
+            continue;
+
+        if (!strncmp(line, "latency ", 8)) {
+            host_mux_set_interrupt_latency(atoll(&line[8]));
+        } else if (!strncmp(line, "config ", 7)) {
+            struct muxed_gesture_config config;
+            unsigned int debounce_ms, long_press_ms, multi_press_window_ms;
+            if (sscanf(&line[7], "%63s %u %u %u", name, &debounce_ms, &long_press_ms, &multi_press_window_ms) != 4 ||
+                ((input = parse_input(name)) < 0 && strcmp(name, "all")) || started) {
+                fprintf(stderr, "Invalid config line: %s\n", line);
+                continue;
+            }
+            config = (struct muxed_gesture_config) {
+                .debounce_ms = debounce_ms,
+                .long_press_ms = long_press_ms,
+                .multi_press_window_ms = multi_press_window_ms
+            };
+            for (enum muxed_inputs i = MUXED_INPUT_MIN; i <= MUXED_INPUT_MAX; i++)
+                if (input < 0 || i == input)
+                    configs[i] = config;
+        } else if (!strncmp(line, "at ", 3)) {
+            if (sscanf(&line[3], "%lf %63s %d", &ms, name, &level) != 3 || (input = parse_input(name)) < 0) {
+                fprintf(stderr, "Invalid at line: %s\n", line);
+                continue;
+            }
+            if (!run_until(ms))
+                continue;
+            input_changed_us[input] = esp_timer_get_time();
+            host_mux_set_input(input, level);
+        } else if (!strncmp(line, "bounce ", 7)) {
+            if (sscanf(&line[7], "%lf %63s %d %d %d", &ms, name, &level, &n, &interval_us) != 5 ||
+                (input = parse_input(name)) < 0 || n < 0 || interval_us <= 0) {
+                fprintf(stderr, "Invalid bounce line: %s\n", line);
+                continue;
+            }
+            if (!run_until(ms))
+                continue;
+            input_changed_us[input] = esp_timer_get_time();
+            for (int i = 0; i < 2 * n; i++) {
+                host_mux_set_input(input, i % 2 ? !level : level);
+                host_sim_run_until(esp_timer_get_time() + interval_us);
+            }
+            host_mux_set_input(input, level);
+        } else if (!strncmp(line, "run ", 4)) {
+            run_until(atof(&line[4]));
+        } else if (!strncmp(line, "standby ", 8)) {
+            if (run_until(atof(&line[8])))
+                muxed_gpio_standby();
+        } else {
+            fprintf(stderr, "Unknown line: %s\n", line);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    FILE *script = stdin;
+    struct timespec begin, end;
+    double simulated_s, host_ms;
+    int64_t max_wake_latency_us;
+    unsigned long wakes;
+    bool print_trace = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "vt")) != -1) {
+        switch (opt) {
+        case 'v':
+            host_log_level = ESP_LOG_DEBUG;
+            break;
+        case 't':
+            print_trace = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-v] [-t] [script]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind < argc && !(script = fopen(argv[optind], "r"))) {
+        fprintf(stderr, "failed to open script: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    for (enum muxed_inputs i = MUXED_INPUT_MIN; i <= MUXED_INPUT_MAX; i++)
+        configs[i] = (struct muxed_gesture_config) {
+            .debounce_ms = DEFAULT_DEBOUNCE_MS,
+            .long_press_ms = DEFAULT_LONG_PRESS_MS,
+            .multi_press_window_ms = DEFAULT_MULTI_PRESS_WINDOW_MS
+        };
+
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    run_script(script);
+    start();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    /* Avoid dividing by zero for an empty script. */
+    simulated_s = MAX(esp_timer_get_time(), 1) / 1e6;
+    host_ms = (end.tv_sec - begin.tv_sec) * 1e3 + (end.tv_nsec - begin.tv_nsec) / 1e6;
+    printf("simulated %.3f s: %lu mux interrupts (%.0f/s), %lu task switches (%.1f/s)\n", simulated_s,
+           host_mux_interrupts(), host_mux_interrupts() / simulated_s, host_sim_task_switches(),
+           host_sim_task_switches() / simulated_s);
+    fprintf(stderr, "simulated in %.3f ms on the host\n", host_ms);
+    for (int i = 0; i < sizeof(latencies) / sizeof(*latencies); i++)
+        if (latencies[i].n)
+            printf("%s latency: min %.3f ms, avg %.3f ms, max %.3f ms over %lu\n", gesture_names[i],
+                   latencies[i].min / 1000.0, latencies[i].total / 1000.0 / latencies[i].n, latencies[i].max / 1000.0,
+                   latencies[i].n);
+    if (stats_counters.input_events)
+        printf("input handling latency: min %.3f ms, avg %.3f ms, max %.3f ms over %"PRIu32"\n",
+               stats_counters.input_latency_min_us / 1000.0,
+               stats_counters.input_latency_total_us / 1000.0 / stats_counters.input_events,
+               stats_counters.input_latency_max_us / 1000.0, stats_counters.input_events);
+    if ((wakes = host_mux_wakes(&max_wake_latency_us)))
+        printf("%lu wakeups from standby, max %.3f ms until the first sample\n", wakes, max_wake_latency_us / 1000.0);
+    if (print_trace) {
+        input_trace_print(stdout, CONFIG_SIPKIP_INPUT_TRACE_LEN);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,192 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+
+struct host_task {
+    pthread_t thread;
+    TaskFunction_t fn;
+    void *param;
+};
+
+struct host_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty, not_full;
+    UBaseType_t length, item_size, count, head;
+    unsigned char *items;
+};
+
+static struct timespec host_ticks_to_deadline(TickType_t ticks) {
+    struct timespec deadline;
+    uint64_t ms = (uint64_t)ticks * portTICK_PERIOD_MS;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ms / 1000;
+    deadline.tv_nsec += (ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    return deadline;
+}
+
+/* Returns false if the wait timed out. */
+static bool host_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, TickType_t ticks,
+                           const struct timespec *deadline) {
+    if (!ticks)
+        return false;
+    if (ticks == portMAX_DELAY)
+        return !pthread_cond_wait(cond, mutex);
+    return pthread_cond_timedwait(cond, mutex, deadline) != ETIMEDOUT;
+}
+
+static __thread struct host_task *current_task = NULL;
+
+static void *host_task_entry(void *arg) {
+    struct host_task *task = arg;
+    current_task = task;
+    task->fn(task->param);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param, UBaseType_t priority,
+                       TaskHandle_t *created_task) {
+    struct host_task *task = malloc(sizeof(*task));
+
+    if (!task)
+        return pdFAIL;
+
+    task->fn = fn;
+    task->param = param;
+    if (pthread_create(&task->thread, NULL, &host_task_entry, task)) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(task->thread);
+
+    if (created_task)
+        *created_task = task;
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (!task)
+        pthread_exit(NULL);
+    pthread_cancel(task->thread);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    uint64_t ms = (uint64_t)ticks * portTICK_PERIOD_MS;
+    struct timespec duration = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000 };
+
+    while (nanosleep(&duration, &duration) && errno == EINTR);
+}
+
+/* Only the DAC task is ever suspended, which doesn't exist on the host. */
+void vTaskSuspend(TaskHandle_t task) {
+    (void)task;
+}
+
+void vTaskResume(TaskHandle_t task) {
+    (void)task;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return current_task;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (TickType_t)(((uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000) / portTICK_PERIOD_MS);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    struct host_queue *queue = calloc(1, sizeof(*queue));
+
+    if (!queue)
+        return NULL;
+
+    queue->length = length;
+    queue->item_size = item_size;
+    if (item_size && !(queue->items = malloc(length * item_size))) {
+        free(queue);
+        return NULL;
+    }
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_cond_destroy(&queue->not_full);
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait) {
+    struct timespec deadline = host_ticks_to_deadline(ticks_to_wait);
+
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == queue->length) {
+        if (!host_cond_wait(&queue->not_full, &queue->mutex, ticks_to_wait, &deadline)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFAIL;
+        }
+    }
+    if (queue->item_size)
+        memcpy(&queue->items[(queue->head + queue->count) % queue->length * queue->item_size], item,
+               queue->item_size);
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait) {
+    struct timespec deadline = host_ticks_to_deadline(ticks_to_wait);
+
+    pthread_mutex_lock(&queue->mutex);
+    while (!queue->count) {
+        if (!host_cond_wait(&queue->not_empty, &queue->mutex, ticks_to_wait, &deadline)) {
+            pthread_mutex_unlock(&queue->mutex);
+            return pdFAIL;
+        }
+    }
+    if (queue->item_size)
+        memcpy(buffer, &queue->items[queue->head * queue->item_size], queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    UBaseType_t count;
+
+    pthread_mutex_lock(&queue->mutex);
+    count = queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+    return count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    SemaphoreHandle_t mutex = xQueueCreate(1, 0);
+
+    /* A mutex starts out available. */
+    if (mutex)
+        xSemaphoreGive(mutex);
+    return mutex;
+}
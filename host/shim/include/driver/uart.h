@@ -0,0 +1,6 @@
+#ifndef DRIVER_UART_H
+#define DRIVER_UART_H
+
+/* Nothing from this header is used on the host. */
+
+#endif /* DRIVER_UART_H */
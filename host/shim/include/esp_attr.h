@@ -0,0 +1,7 @@
+#ifndef ESP_ATTR_H
+#define ESP_ATTR_H
+
+/* Everything runs from the same memory on the host. */
+#define IRAM_ATTR
+
+#endif /* ESP_ATTR_H */
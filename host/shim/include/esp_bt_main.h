@@ -0,0 +1,6 @@
+#ifndef ESP_BT_MAIN_H
+#define ESP_BT_MAIN_H
+
+/* Nothing from this header is used on the host. */
+
+#endif /* ESP_BT_MAIN_H */
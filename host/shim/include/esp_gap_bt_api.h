@@ -0,0 +1,69 @@
+#ifndef ESP_GAP_BT_API_H
+#define ESP_GAP_BT_API_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+
+#define ESP_BD_ADDR_LEN 6
+#define ESP_BT_GAP_MAX_BDNAME_LEN 248
+#define ESP_BT_PIN_CODE_LEN 16
+
+typedef uint8_t esp_bd_addr_t[ESP_BD_ADDR_LEN];
+typedef uint8_t esp_bt_pin_code_t[ESP_BT_PIN_CODE_LEN];
+
+typedef enum {
+    ESP_BT_STATUS_SUCCESS = 0,
+    ESP_BT_STATUS_FAIL
+} esp_bt_status_t;
+
+typedef enum {
+    ESP_BT_NON_CONNECTABLE,
+    ESP_BT_CONNECTABLE
+} esp_bt_connection_mode_t;
+
+typedef enum {
+    ESP_BT_NON_DISCOVERABLE,
+    ESP_BT_LIMITED_DISCOVERABLE,
+    ESP_BT_GENERAL_DISCOVERABLE
+} esp_bt_discovery_mode_t;
+
+typedef enum {
+    ESP_BT_GAP_AUTH_CMPL_EVT = 4,
+    ESP_BT_GAP_PIN_REQ_EVT,
+    ESP_BT_GAP_CFM_REQ_EVT,
+    ESP_BT_GAP_KEY_NOTIF_EVT,
+    ESP_BT_GAP_KEY_REQ_EVT,
+    ESP_BT_GAP_MODE_CHG_EVT = 13
+} esp_bt_gap_cb_event_t;
+
+typedef union {
+    struct {
+        esp_bd_addr_t bda;
+        esp_bt_status_t stat;
+        uint8_t device_name[ESP_BT_GAP_MAX_BDNAME_LEN + 1];
+    } auth_cmpl;
+    struct {
+        esp_bd_addr_t bda;
+        bool min_16_digit;
+    } pin_req;
+    struct {
+        esp_bd_addr_t bda;
+        uint32_t num_val;
+    } cfm_req;
+    struct {
+        esp_bd_addr_t bda;
+        uint32_t passkey;
+    } key_notif;
+    struct {
+        esp_bd_addr_t bda;
+        int mode;
+    } mode_chg;
+} esp_bt_gap_cb_param_t;
+
+esp_err_t esp_bt_gap_set_scan_mode(esp_bt_connection_mode_t c_mode, esp_bt_discovery_mode_t d_mode);
+esp_err_t esp_bt_gap_pin_reply(esp_bd_addr_t bd_addr, bool accept, uint8_t pin_code_len, esp_bt_pin_code_t pin_code);
+esp_err_t esp_bt_gap_ssp_confirm_reply(esp_bd_addr_t bd_addr, bool accept);
+
+#endif /* ESP_GAP_BT_API_H */
@@ -0,0 +1,11 @@
+#ifndef ESP_LITTLEFS_H
+#define ESP_LITTLEFS_H
+
+#include <stddef.h>
+
+#include "esp_err.h"
+
+/* On the host the "storage" partition is a LittleFS instance on a RAM block device, see `vfs.c'. */
+esp_err_t esp_littlefs_info(const char *partition_label, size_t *total_bytes, size_t *used_bytes);
+
+#endif /* ESP_LITTLEFS_H */
@@ -0,0 +1,62 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+
+#include "sdkconfig.h"
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+/* Set through the `-v' option of the harness, logging to stderr distorts the measurements so it is off by default. */
+extern esp_log_level_t host_log_level;
+/* Set through the `-b' option of the harness, makes writing the log output take as long as on a UART with this many
+ * baud, like it does on the device. 0 doesn't wait. */
+extern unsigned long host_log_baud;
+
+uint32_t esp_log_timestamp(void);
+void esp_log_buffer_hex(const char *tag, const void *buffer, uint16_t buff_len);
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+    __attribute__((format(printf, 3, 4)));
+/* There is only the one level of host_log_level here, which tag "*" sets. */
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+
+/* Waits as long as writing [len] bytes of log output to the UART would, with a start and a stop bit per byte. */
+static inline void host_log_wait(int len) {
+    uint64_t ns;
+    struct timespec duration;
+
+    if (!host_log_baud || len <= 0)
+        return;
+    ns = (uint64_t)len * 10 * 1000000000 / host_log_baud;
+    duration = (struct timespec) { .tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000 };
+    while (nanosleep(&duration, &duration) && errno == EINTR);
+}
+
+#define LOG_COLOR(COLOR) "\033[0;" COLOR "m"
+#define LOG_COLOR_CYAN "36"
+#define LOG_COLOR_BLUE "34"
+#define LOG_RESET_COLOR "\033[0m"
+
+#define ESP_LOG_LEVEL(level, letter, tag, format, ...) do {                                                        \
+        if (host_log_level >= (level))                                                                             \
+            host_log_wait(fprintf(stderr, letter " (%lu) %s: " format "\n", (unsigned long)esp_log_timestamp(),   \
+                                  tag, ##__VA_ARGS__));                                                            \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_ERROR, "E", tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_WARN, "W", tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_INFO, "I", tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_DEBUG, "D", tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_LEVEL(ESP_LOG_VERBOSE, "V", tag, format, ##__VA_ARGS__)
+
+#endif /* ESP_LOG_H */
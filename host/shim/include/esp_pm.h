@@ -0,0 +1,6 @@
+#ifndef ESP_PM_H
+#define ESP_PM_H
+
+/* Power management is disabled on the host, CONFIG_PM_ENABLE isn't set in the shim sdkconfig.h. */
+
+#endif /* ESP_PM_H */
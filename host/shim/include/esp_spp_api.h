@@ -0,0 +1,68 @@
+#ifndef ESP_SPP_API_H
+#define ESP_SPP_API_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "esp_gap_bt_api.h"
+
+typedef enum {
+    ESP_SPP_SUCCESS = 0,
+    ESP_SPP_FAILURE
+} esp_spp_status_t;
+
+typedef uint16_t esp_spp_sec_t;
+#define ESP_SPP_SEC_AUTHENTICATE 0x0012
+#define ESP_SPP_MAX_MTU (3 * 330)
+
+typedef enum {
+    ESP_SPP_ROLE_MASTER = 0,
+    ESP_SPP_ROLE_SLAVE = 1
+} esp_spp_role_t;
+
+typedef enum {
+    ESP_SPP_INIT_EVT = 0,
+    ESP_SPP_UNINIT_EVT = 1,
+    ESP_SPP_DISCOVERY_COMP_EVT = 8,
+    ESP_SPP_OPEN_EVT = 26,
+    ESP_SPP_CLOSE_EVT = 27,
+    ESP_SPP_START_EVT = 28,
+    ESP_SPP_CL_INIT_EVT = 29,
+    ESP_SPP_DATA_IND_EVT = 30,
+    ESP_SPP_CONG_EVT = 31,
+    ESP_SPP_WRITE_EVT = 33,
+    ESP_SPP_SRV_OPEN_EVT = 34
+} esp_spp_cb_event_t;
+
+typedef union {
+    struct {
+        esp_spp_status_t status;
+    } init;
+    struct {
+        esp_spp_status_t status;
+        uint32_t port_status;
+        uint32_t handle;
+        bool async;
+    } close;
+    struct {
+        esp_spp_status_t status;
+        uint32_t handle;
+        uint8_t sec_id;
+        uint8_t scn;
+        bool use_co;
+    } start;
+    struct {
+        esp_spp_status_t status;
+        uint32_t handle;
+        uint32_t new_listen_handle;
+        int fd;
+        esp_bd_addr_t rem_bda;
+    } srv_open;
+} esp_spp_cb_param_t;
+
+esp_err_t esp_spp_vfs_register(void);
+esp_err_t esp_spp_start_srv(esp_spp_sec_t sec_mask, esp_spp_role_t role, uint8_t local_scn, const char *name);
+esp_err_t esp_spp_disconnect(uint32_t handle);
+
+#endif /* ESP_SPP_API_H */
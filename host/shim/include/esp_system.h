@@ -0,0 +1,10 @@
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+
+#include <stdint.h>
+
+/* The host has no heap of a fixed size, the stubs in `shim/stubs.c' report 0 for these. */
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+#endif /* ESP_SYSTEM_H */
@@ -0,0 +1,6 @@
+#ifndef ESP_VFS_H
+#define ESP_VFS_H
+
+/* Nothing from this header is used on the host. */
+
+#endif /* ESP_VFS_H */
@@ -0,0 +1,73 @@
+/**
+ * Minimal FreeRTOS API on top of POSIX threads, only covering what the shell and transfer stack use. Tasks are
+ * threads, priorities and stack sizes are ignored.
+ */
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOSConfig.h"
+
+typedef uint32_t TickType_t;
+typedef long BaseType_t;
+typedef unsigned long UBaseType_t;
+typedef void (*TaskFunction_t)(void *);
+
+typedef struct host_task *TaskHandle_t;
+typedef struct host_queue *QueueHandle_t;
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)((uint64_t)(ms) * configTICK_RATE_HZ / 1000))
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+/* The host counts as a single core, the threads of all tasks run on it. */
+#define portNUM_PROCESSORS 1
+
+static inline BaseType_t xPortGetCoreID(void) {
+    return 0;
+}
+
+/* Interrupts run as tasks or, in the simulator, from the scheduler, where the current task is NULL. */
+static inline BaseType_t xPortInIsrContext(void) {
+    return 0;
+}
+
+/* Critical sections are only implemented by the simulator in `shim/sim-freertos.c', which runs one task at a time. */
+typedef struct {
+    int unused;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { 0 }
+
+void vPortEnterCritical(portMUX_TYPE *mux);
+void vPortExitCritical(portMUX_TYPE *mux);
+
+#define portENTER_CRITICAL(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux) vPortExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux) vPortExitCritical(mux)
+/**
+ * The simulator switches to a task that an interrupt woke up once the interrupt yields, like the port does, or else at
+ * the next tick.
+ */
+void vPortYieldFromISR(void);
+#define portYIELD_FROM_ISR(higher_priority_task_woken)                                                             \
+    do {                                                                                                           \
+        if (higher_priority_task_woken)                                                                            \
+            vPortYieldFromISR();                                                                                   \
+    } while (0)
+
+#endif /* FREERTOS_H */
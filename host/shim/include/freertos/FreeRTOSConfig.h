@@ -0,0 +1,7 @@
+#ifndef FREERTOS_CONFIG_H
+#define FREERTOS_CONFIG_H
+
+#define configTICK_RATE_HZ CONFIG_FREERTOS_HZ
+#define configCPU_CLOCK_HZ 240000000UL
+
+#endif /* FREERTOS_CONFIG_H */
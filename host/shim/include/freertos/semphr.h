@@ -0,0 +1,16 @@
+#ifndef SEMPHR_H
+#define SEMPHR_H
+
+#include "freertos/queue.h"
+
+/* Semaphores are queues with items of size 0, like they are in FreeRTOS itself. */
+typedef QueueHandle_t SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+
+#define xSemaphoreCreateBinary() xQueueCreate(1, 0)
+#define xSemaphoreTake(semaphore, ticks_to_wait) xQueueReceive(semaphore, NULL, ticks_to_wait)
+#define xSemaphoreGive(semaphore) xQueueSend(semaphore, NULL, 0)
+#define vSemaphoreDelete(semaphore) vQueueDelete(semaphore)
+
+#endif /* SEMPHR_H */
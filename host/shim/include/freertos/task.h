@@ -0,0 +1,20 @@
+#ifndef TASK_H
+#define TASK_H
+
+#include "freertos/FreeRTOS.h"
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param, UBaseType_t priority,
+                       TaskHandle_t *created_task);
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+void vTaskSuspend(TaskHandle_t task);
+void vTaskResume(TaskHandle_t task);
+TickType_t xTaskGetTickCount(void);
+/* NULL for threads that weren't created with xTaskCreate(), like main(). */
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+/* Task notifications are only implemented by the simulator in `shim/sim-freertos.c'. */
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken);
+
+#endif /* TASK_H */
@@ -0,0 +1,3 @@
+#ifndef XTENSA_API_H
+#define XTENSA_API_H
+#endif /* XTENSA_API_H */
@@ -0,0 +1,65 @@
+/**
+ * Interface between the mux simulator and its shims, not visible to the firmware sources. See `muxsim.c'.
+ */
+#ifndef HOST_SIM_H
+#define HOST_SIM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "main/muxed-gpio.h"
+
+/**
+ * @brief     source of simulated interrupts
+ *
+ * [next] returns the first time after [after_us] at which the interrupt fires, or -1 if it doesn't fire until the source
+ * is registered again, [fire] runs the interrupt handler.
+ */
+struct host_sim_interrupt_source {
+    int64_t (*next)(int64_t after_us);
+    void (*fire)(int64_t now_us);
+};
+
+/**
+ * @brief     register the only interrupt source of the simulator, or register it again after its next time changed
+ */
+void host_sim_set_interrupt_source(const struct host_sim_interrupt_source *source);
+
+/**
+ * @brief     run the tasks and interrupts until the virtual time reaches [until_us]
+ *
+ * Tasks run in zero virtual time, until they block. Interrupts fire between tasks, after which the highest priority
+ * task that is ready runs first. Tasks of equal priority run in the order they were created.
+ */
+void host_sim_run_until(int64_t until_us);
+
+/**
+ * @brief     number of times a task was switched to since startup
+ */
+unsigned long host_sim_task_switches(void);
+
+/**
+ * @brief     set the level of an input of the mux model, as it would be on the pin while its mux phase is active
+ *
+ * Wakes up the mux if it's in standby and the input would wake up the hardware.
+ */
+void host_mux_set_input(enum muxed_inputs input, bool level);
+
+/**
+ * @brief     set the time between the edge of a mux phase and the moment its interrupt samples the inputs
+ */
+void host_mux_set_interrupt_latency(int64_t latency_us);
+
+/**
+ * @brief     number of mux phase and wake interrupts since scanning started
+ */
+unsigned long host_mux_interrupts(void);
+
+/**
+ * @brief     number of times the mux was woken up from standby
+ *
+ * [max_latency_us] is set to the longest time between a wakeup and the first sample of the input that caused it.
+ */
+unsigned long host_mux_wakes(int64_t *max_latency_us);
+
+#endif /* HOST_SIM_H */
@@ -0,0 +1,57 @@
+/**
+ * Force-included (`-include') into the firmware sources when building them for the host. Redirects the file system
+ * calls that the firmware makes to `vfs.c', which serves LITTLEFS_BASE_PATH from a LittleFS instance on a RAM block
+ * device, and gives every other file descriptor (the SPP stand-in) the non-blocking read semantics of the SPP VFS.
+ */
+#ifndef HOST_VFS_H
+#define HOST_VFS_H
+
+/* Included before anything else, so the firmware sources that need GNU extensions get them. */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+int host_vfs_open(const char *path, int flags, ...);
+int host_vfs_close(int fd);
+ssize_t host_vfs_read(int fd, void *buf, size_t count);
+ssize_t host_vfs_write(int fd, const void *buf, size_t count);
+int host_vfs_dprintf(int fd, const char *format, ...) __attribute__((format(printf, 2, 3)));
+FILE *host_vfs_fopen(const char *path, const char *mode);
+int host_vfs_unlink(const char *path);
+int host_vfs_rename(const char *src, const char *dst);
+int host_vfs_mkdir(const char *path, mode_t mode);
+int host_vfs_rmdir(const char *path);
+int host_vfs_stat(const char *path, struct stat *st);
+DIR *host_vfs_opendir(const char *path);
+struct dirent *host_vfs_readdir(DIR *dir);
+int host_vfs_closedir(DIR *dir);
+int host_vfs_chdir(const char *path);
+char *host_vfs_getcwd(char *buf, size_t size);
+
+/* Function-like macros, so `struct stat' and friends are left alone. */
+#define open(...) host_vfs_open(__VA_ARGS__)
+#define close(fd) host_vfs_close(fd)
+#define read(fd, buf, count) host_vfs_read(fd, buf, count)
+#define write(fd, buf, count) host_vfs_write(fd, buf, count)
+#define dprintf(fd, ...) host_vfs_dprintf(fd, __VA_ARGS__)
+#define fopen(path, mode) host_vfs_fopen(path, mode)
+#define remove(path) host_vfs_unlink(path)
+#define unlink(path) host_vfs_unlink(path)
+#define rename(src, dst) host_vfs_rename(src, dst)
+#define mkdir(path, mode) host_vfs_mkdir(path, mode)
+#define rmdir(path) host_vfs_rmdir(path)
+#define stat(path, st) host_vfs_stat(path, st)
+#define opendir(path) host_vfs_opendir(path)
+#define readdir(dir) host_vfs_readdir(dir)
+#define closedir(dir) host_vfs_closedir(dir)
+#define chdir(path) host_vfs_chdir(path)
+#define getcwd(buf, size) host_vfs_getcwd(buf, size)
+
+#endif /* HOST_VFS_H */
@@ -0,0 +1,34 @@
+/**
+ * Interface between the loopback harness and the shims, not visible to the firmware sources.
+ */
+#ifndef HOST_H
+#define HOST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+/**
+ * @brief     format and mount a LittleFS instance of [size] bytes in RAM at LITTLEFS_BASE_PATH
+ */
+esp_err_t host_vfs_mount(size_t size);
+
+/**
+ * @brief     number of writes the firmware made to file descriptors other than LittleFS files, like the SPP one
+ */
+unsigned long host_vfs_stream_writes(void);
+
+/**
+ * @brief     number of reads and writes the firmware made to LittleFS files, each of which is a VFS call on the device,
+ *            and the number of reads, programs and erases LittleFS made on the block device for them
+ */
+void host_vfs_fs_calls(unsigned long *file_calls, unsigned long *bd_calls);
+
+/**
+ * @brief     monotonic time in microseconds
+ */
+int64_t host_time_us(void);
+
+#endif /* HOST_H */
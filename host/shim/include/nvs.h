@@ -0,0 +1,6 @@
+#ifndef NVS_H
+#define NVS_H
+
+/* Nothing from this header is used on the host. */
+
+#endif /* NVS_H */
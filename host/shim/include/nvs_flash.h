@@ -0,0 +1,6 @@
+#ifndef NVS_FLASH_H
+#define NVS_FLASH_H
+
+/* Nothing from this header is used on the host. */
+
+#endif /* NVS_FLASH_H */
@@ -0,0 +1,10 @@
+#ifndef OPUS_H
+#define OPUS_H
+
+#include <stdint.h>
+
+/* There is no libopus on the host, only the types the firmware headers need are declared. */
+typedef int16_t opus_int16;
+typedef int32_t opus_int32;
+
+#endif /* OPUS_H */
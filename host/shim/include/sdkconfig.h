@@ -0,0 +1,27 @@
+/**
+ * Subset of the generated sdkconfig.h that is needed to build the shell and transfer stack on the host. Keep these in
+ * sync with `sdkconfig' in the root of the repository.
+ */
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+#define CONFIG_IDF_TARGET "linux"
+#define CONFIG_FREERTOS_HZ 500
+#define CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ 160
+#define CONFIG_LITTLEFS_PAGE_SIZE 256
+#define CONFIG_LITTLEFS_OBJ_NAME_LEN 64
+#define CONFIG_LITTLEFS_READ_SIZE 128
+#define CONFIG_LITTLEFS_WRITE_SIZE 128
+#define CONFIG_LITTLEFS_LOOKAHEAD_SIZE 128
+#define CONFIG_LITTLEFS_CACHE_SIZE 512
+#define CONFIG_LITTLEFS_BLOCK_CYCLES 512
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+#define CONFIG_LOG_MAXIMUM_LEVEL 3
+#define CONFIG_SIPKIP_INPUT_TRACE_LEN 256
+#define CONFIG_SIPKIP_SPP_TASK_QUEUE_LEN 32
+#define CONFIG_SIPKIP_SPP_MAX_SESSIONS 2
+#define CONFIG_SIPKIP_MAX_JOBS 2
+#define CONFIG_SIPKIP_JOB_OUTPUT_LEN 2048
+#define CONFIG_SIPKIP_DEFERRED_LOG_LEN 64
+
+#endif /* SDKCONFIG_H */
@@ -0,0 +1,272 @@
+/**
+ * Model of the muxed GPIO hardware under `main/muxed-gpio.c', implementing `main/muxed-gpio-hal.h' for the simulator.
+ *
+ * The LEDC timer is clocked from the 1 MHz REF_TICK through a divider with 8 fractional bits, so it counts up once
+ * every 19 or 20 us, and wraps after 2^MUX_PWM_BITS counts. The model computes at which REF_TICK every count starts,
+ * and from that the exact times at which the mux outputs go high at their hpoints. The phase interrupt samples the
+ * inputs a configurable latency after that edge.
+ *
+ * A button or clip reads as active when it's pressed, its mux output is high, and the pin isn't pulled low by its open
+ * drain LED output, which is active during the LED phase when one of the LEDs on its LEDC channel is lit.
+ *
+ * While scanning is paused the mux keeps running, and the wake interrupt fires as soon as a pressed button or clip
+ * reads high in its phase, the beak is pressed or the mode switch is moved. In standby the phase interrupts stop, and
+ * pressing a button or the beak or moving a switch calls the wake function right away. The time it takes the chip to
+ * leave light sleep isn't modelled. The LEDC timer keeps counting, so the phases are aligned the same after the mux
+ * resumes. Both the phase and the wake interrupts are counted.
+ */
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "esp_timer.h"
+
+#include "host-sim.h"
+#include "main/muxed-gpio-hal.h"
+#include "main/utils.h"
+
+#define REF_TICK_HZ 1000000ULL
+#define MUX_COUNTS_PER_PERIOD (1ULL << MUX_PWM_BITS)
+#define DEFAULT_INTERRUPT_LATENCY_US 2
+
+/* Duration of one count of the LEDC timer in REF_TICKs, with 8 fractional bits like the divider of the LEDC timer. */
+static const uint64_t ledc_divider = (REF_TICK_HZ << 8) / (MUX_PWM_FREQUENCY * MUX_COUNTS_PER_PERIOD);
+
+/* The LEDC channel that pulls the pin of every button and clip low, same as muxed_inouts_to_ledc_channel[].bc_channel. */
+static const int output_bc_channel[MUXED_OUTPUT_N] = {
+    [MUXED_OUTPUT_STAR_L_LED] = 4, [MUXED_OUTPUT_TRIANGLE_L_LED] = 5, [MUXED_OUTPUT_SQUARE_L_LED] = 4,
+    [MUXED_OUTPUT_HEART_L_LED] = 5, [MUXED_OUTPUT_HEART_R_LED] = 6, [MUXED_OUTPUT_SQUARE_R_LED] = 7,
+    [MUXED_OUTPUT_TRIANGLE_R_LED] = 6, [MUXED_OUTPUT_STAR_R_LED] = 7
+};
+
+static const uint64_t phase_hpoints[] = {
+    [MUXED_GPIO_HAL_PHASE_BUTTONS] = MUX_BUTTONS_HPOINT,
+    [MUXED_GPIO_HAL_PHASE_CLIPS] = MUX_CLIPS_HPOINT
+};
+
+static muxed_inputs_mask_t pressed_inputs = 0;
+static bool bc_channel_on[8] = { [4] = true, [5] = true, [6] = true, [7] = true };
+static int64_t interrupt_latency_us = DEFAULT_INTERRUPT_LATENCY_US;
+static muxed_gpio_hal_phase_fn phase_fn = NULL;
+static unsigned long interrupts = 0;
+static bool standby = false;
+/* The wake interrupts are armed while scanning is paused, until the first one fires. */
+static bool scanning_paused = false, wake_armed = false;
+/* The levels of the mode switch when the wake interrupts were armed. */
+static muxed_inputs_mask_t armed_switch_levels;
+static muxed_gpio_hal_wake_fn wake_fn = NULL;
+/* The time of the last wakeup and the phase that samples the input that caused it, until that phase is sampled. */
+static int64_t wake_us = -1;
+static enum muxed_gpio_hal_phase wake_phase;
+static unsigned long wakes = 0;
+static int64_t max_wake_latency_us = 0;
+
+/* The time at which count [count] of the LEDC timer starts, counting from the start of the simulation. */
+static int64_t count_start_us(uint64_t count) {
+    return count * ledc_divider >> 8;
+}
+
+/* The count of the LEDC timer at [time_us]. */
+static uint64_t count_at(int64_t time_us) {
+    return (((uint64_t)time_us + 1) * 256 - 1) / ledc_divider;
+}
+
+static bool is_in_phase(int64_t time_us, uint64_t hpoint) {
+    uint64_t count = count_at(time_us) % MUX_COUNTS_PER_PERIOD;
+
+    return count >= hpoint && count < hpoint + MUX_PHASE_DUTY;
+}
+
+/* The first edge after [after_us] of the phases in [phases], plus the interrupt latency. */
+static int64_t next_phase_edge(int64_t after_us, unsigned int phases) {
+    uint64_t period = after_us > interrupt_latency_us ?
+        count_at(after_us - interrupt_latency_us) / MUX_COUNTS_PER_PERIOD : 0;
+
+    for (;; period++) {
+        int64_t first_us = INT64_MAX;
+
+        for (enum muxed_gpio_hal_phase phase = 0; phase < MUXED_GPIO_HAL_PHASE_N; phase++) {
+            int64_t edge_us = count_start_us(period * MUX_COUNTS_PER_PERIOD + phase_hpoints[phase]) +
+                              interrupt_latency_us;
+            if ((phases & 1U << phase) && edge_us > after_us && edge_us < first_us)
+                first_us = edge_us;
+        }
+        if (first_us != INT64_MAX)
+            return first_us;
+    }
+}
+
+/* When the level interrupt of the paused scanner fires, if it does. */
+static int64_t next_wake_interrupt(int64_t after_us) {
+    muxed_inputs_mask_t buttons = MUXED_INPUT_BIT(MUXED_INPUT_BUTTONS_MAX + 1) - MUXED_INPUT_BIT(MUXED_INPUT_MIN);
+    muxed_inputs_mask_t clips = MUXED_INPUT_BIT(MUXED_INPUT_CLIPS_MAX + 1) - MUXED_INPUT_BIT(MUXED_INPUT_CLIPS_MIN);
+    muxed_inputs_mask_t mode_switch = MUXED_INPUT_BIT(MUXED_INPUT_LEARN_SWITCH) |
+                                      MUXED_INPUT_BIT(MUXED_INPUT_PLAY_SWITCH);
+    unsigned int phases = (pressed_inputs & buttons ? 1U << MUXED_GPIO_HAL_PHASE_BUTTONS : 0) |
+                          (pressed_inputs & clips ? 1U << MUXED_GPIO_HAL_PHASE_CLIPS : 0);
+
+    if (!wake_armed)
+        return -1;
+    if (pressed_inputs & MUXED_INPUT_BIT(MUXED_INPUT_BEAK_SWITCH) ||
+        (pressed_inputs & mode_switch) != armed_switch_levels)
+        return after_us + interrupt_latency_us;
+    /* A pin that reads high at the moment interrupts right away, otherwise at the start of its next phase. */
+    for (enum muxed_gpio_hal_phase phase = 0; phase < MUXED_GPIO_HAL_PHASE_N; phase++)
+        if ((phases & 1U << phase) && is_in_phase(after_us, phase_hpoints[phase]))
+            return after_us + interrupt_latency_us;
+    return phases ? next_phase_edge(after_us, phases) : -1;
+}
+
+static int64_t next_interrupt(int64_t after_us) {
+    if (scanning_paused)
+        return standby ? -1 : next_wake_interrupt(after_us);
+    return next_phase_edge(after_us, (1U << MUXED_GPIO_HAL_PHASE_N) - 1);
+}
+
+static void fire_interrupt(int64_t now_us) {
+    uint64_t count = count_at(now_us - interrupt_latency_us) % MUX_COUNTS_PER_PERIOD;
+
+    if (scanning_paused) {
+        /* The wake interrupts disable themselves until the mux resumes, and sample the phase that is active. */
+        interrupts++;
+        wake_armed = false;
+        for (enum muxed_gpio_hal_phase phase = 0; phase < MUXED_GPIO_HAL_PHASE_N; phase++)
+            if (is_in_phase(now_us, phase_hpoints[phase]))
+                phase_fn(phase);
+        wake_fn();
+        return;
+    }
+    for (enum muxed_gpio_hal_phase phase = 0; phase < MUXED_GPIO_HAL_PHASE_N; phase++) {
+        if (count == phase_hpoints[phase]) {
+            interrupts++;
+            if (wake_us >= 0 && phase == wake_phase) {
+                max_wake_latency_us = MAX(max_wake_latency_us, now_us - wake_us);
+                wake_us = -1;
+            }
+            phase_fn(phase);
+        }
+    }
+}
+
+void muxed_gpio_hal_setup(void) {
+    /* The LEDC timer starts counting at time 0, with all LEDs lit like on the hardware. */
+}
+
+static const struct host_sim_interrupt_source interrupt_source = {
+    .next = &next_interrupt,
+    .fire = &fire_interrupt
+};
+
+void muxed_gpio_hal_start_scanning(muxed_gpio_hal_phase_fn fn) {
+    phase_fn = fn;
+    host_sim_set_interrupt_source(&interrupt_source);
+}
+
+muxed_inputs_mask_t muxed_gpio_hal_sample(muxed_inputs_mask_t inputs) {
+    int64_t now_us = esp_timer_get_time();
+    bool led_phase = is_in_phase(now_us, MUX_LEDS_HPOINT);
+    muxed_inputs_mask_t levels = 0;
+
+    for (enum muxed_inputs i = MUXED_INPUT_MIN; i <= MUXED_INPUT_MAX; i++) {
+        bool level = pressed_inputs & inputs & MUXED_INPUT_BIT(i);
+
+        if (i <= MUXED_INPUT_CLIPS_MAX) {
+            enum muxed_outputs pin = i % MUXED_INPUT_N_BUTTONS;
+
+            level = level && is_in_phase(now_us, phase_hpoints[i <= MUXED_INPUT_BUTTONS_MAX ?
+                                                               MUXED_GPIO_HAL_PHASE_BUTTONS :
+                                                               MUXED_GPIO_HAL_PHASE_CLIPS]);
+            level = level && !(led_phase && bc_channel_on[output_bc_channel[pin]]);
+        }
+        if (level)
+            levels |= MUXED_INPUT_BIT(i);
+    }
+    return levels;
+}
+
+void muxed_gpio_hal_set_leds(bool (*levels)[MUXED_OUTPUT_N]) {
+    for (int i = 0; i < sizeof(bc_channel_on) / sizeof(*bc_channel_on); i++)
+        bc_channel_on[i] = false;
+    for (enum muxed_outputs i = MUXED_OUTPUT_MIN; i <= MUXED_OUTPUT_MAX; i++)
+        if ((*levels)[i])
+            bc_channel_on[output_bc_channel[i]] = true;
+}
+
+/* The model has no brightness, an LED counts as lit as soon as its fade starts. */
+void muxed_gpio_hal_fade_leds(const uint8_t (*levels)[MUXED_OUTPUT_N], uint32_t fade_ms) {
+    bool on[MUXED_OUTPUT_N];
+
+    for (enum muxed_outputs i = MUXED_OUTPUT_MIN; i <= MUXED_OUTPUT_MAX; i++)
+        on[i] = (*levels)[i];
+    muxed_gpio_hal_set_leds(&on);
+}
+
+static void arm_wake_interrupts(muxed_gpio_hal_wake_fn fn) {
+    scanning_paused = true;
+    wake_armed = true;
+    armed_switch_levels = pressed_inputs & (MUXED_INPUT_BIT(MUXED_INPUT_LEARN_SWITCH) |
+                                            MUXED_INPUT_BIT(MUXED_INPUT_PLAY_SWITCH));
+    wake_fn = fn;
+    /* Let the simulator pick up when the next interrupt is. */
+    host_sim_set_interrupt_source(&interrupt_source);
+}
+
+void muxed_gpio_hal_pause_scanning(muxed_gpio_hal_wake_fn fn) {
+    if (!scanning_paused)
+        arm_wake_interrupts(fn);
+}
+
+void muxed_gpio_hal_standby(muxed_gpio_hal_wake_fn fn) {
+    if (standby)
+        return;
+    standby = true;
+    arm_wake_interrupts(fn);
+}
+
+void muxed_gpio_hal_resume(void) {
+    if (!scanning_paused)
+        return;
+    standby = false;
+    scanning_paused = false;
+    wake_armed = false;
+    host_sim_set_interrupt_source(&interrupt_source);
+}
+
+void host_mux_set_input(enum muxed_inputs input, bool level) {
+    bool changed = level != !!(pressed_inputs & MUXED_INPUT_BIT(input));
+
+    if (level)
+        pressed_inputs |= MUXED_INPUT_BIT(input);
+    else
+        pressed_inputs &= ~MUXED_INPUT_BIT(input);
+
+    /* The wake interrupt of the paused scanner depends on the inputs. */
+    if (scanning_paused && !standby) {
+        host_sim_set_interrupt_source(&interrupt_source);
+        return;
+    }
+    /* The clips aren't powered in standby, the switches wake up in either direction. */
+    if (!standby || !wake_armed || wake_us >= 0 || !changed ||
+        (input >= MUXED_INPUT_CLIPS_MIN && input <= MUXED_INPUT_CLIPS_MAX) ||
+        (!level && input <= MUXED_INPUT_BEAK_SWITCH))
+        return;
+    wake_us = esp_timer_get_time();
+    wake_phase = MUXED_GPIO_HAL_PHASE_BUTTONS;
+    wakes++;
+    interrupts++;
+    wake_armed = false;
+    wake_fn();
+}
+
+void host_mux_set_interrupt_latency(int64_t latency_us) {
+    interrupt_latency_us = latency_us;
+}
+
+unsigned long host_mux_interrupts(void) {
+    return interrupts;
+}
+
+unsigned long host_mux_wakes(int64_t *max_latency_us) {
+    *max_latency_us = max_wake_latency_us;
+    return wakes;
+}
@@ -0,0 +1,318 @@
+/**
+ * Deterministic FreeRTOS API for the mux simulator. Unlike `freertos.c', tasks are coroutines that run one at a time
+ * in virtual time: a task runs without the clock advancing until it blocks, and the clock only advances to the next
+ * timeout or interrupt once every task is blocked. Replaying the same input trace therefore always gives the same
+ * result, independent of the load of the machine.
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ucontext.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_timer.h"
+
+#include "host-sim.h"
+
+#define SIM_STACK_SIZE (64 * 1024)
+#define SIM_TICK_US (1000000 / configTICK_RATE_HZ)
+#define SIM_NO_TIMEOUT -1
+
+struct host_task {
+    ucontext_t context;
+    TaskFunction_t fn;
+    void *param;
+    UBaseType_t priority;
+    struct host_task *next;
+    bool ready;
+    /* Set when the task was woken up by its timeout, instead of the event it waited for. */
+    bool timed_out;
+    int64_t wake_at_us;
+    uint32_t notify_count;
+    bool waiting_for_notify;
+    /* Notified by an interrupt that didn't yield yet, the task only runs at the next tick until it does. */
+    bool woken_from_isr;
+    struct host_queue *waiting_for_queue;
+    unsigned char stack[SIM_STACK_SIZE];
+};
+
+struct host_queue {
+    UBaseType_t length, item_size, count, head;
+    unsigned char *items;
+};
+
+static ucontext_t scheduler_context;
+static struct host_task *tasks = NULL, *current_task = NULL;
+static int64_t now_us = 0;
+static unsigned long task_switches = 0;
+
+static struct host_sim_interrupt_source interrupt_source;
+static int64_t next_interrupt_us = SIM_NO_TIMEOUT;
+
+static void sim_task_entry(void) {
+    current_task->fn(current_task->param);
+    fprintf(stderr, "sim: a task returned, which isn't allowed in FreeRTOS\n");
+    abort();
+}
+
+/* Timeouts expire on a tick interrupt, counting from the tick that is current when the task blocks. */
+static int64_t sim_ticks_to_wake_at(TickType_t ticks) {
+    if (ticks == portMAX_DELAY)
+        return SIM_NO_TIMEOUT;
+    return (now_us / SIM_TICK_US + ticks) * SIM_TICK_US;
+}
+
+/* Returns false if the task was woken up by its timeout. */
+static bool sim_block(int64_t wake_at_us) {
+    if (!current_task) {
+        fprintf(stderr, "sim: blocking outside of a task\n");
+        abort();
+    }
+    current_task->ready = false;
+    current_task->timed_out = false;
+    current_task->wake_at_us = wake_at_us;
+    swapcontext(&current_task->context, &scheduler_context);
+    return !current_task->timed_out;
+}
+
+static void sim_wake(struct host_task *task, bool timed_out) {
+    task->ready = true;
+    task->timed_out = timed_out;
+    task->wake_at_us = SIM_NO_TIMEOUT;
+    task->waiting_for_notify = false;
+    task->waiting_for_queue = NULL;
+    task->woken_from_isr = false;
+}
+
+/* Wakes up the highest priority task waiting for [queue], if any. */
+static void sim_wake_queue_waiter(struct host_queue *queue) {
+    struct host_task *waiter = NULL;
+
+    for (struct host_task *task = tasks; task; task = task->next)
+        if (task->waiting_for_queue == queue && (!waiter || task->priority > waiter->priority))
+            waiter = task;
+    if (waiter)
+        sim_wake(waiter, false);
+}
+
+static struct host_task *sim_next_ready_task(void) {
+    struct host_task *next = NULL;
+
+    for (struct host_task *task = tasks; task; task = task->next)
+        if (task->ready && (!next || task->priority > next->priority))
+            next = task;
+    return next;
+}
+
+void host_sim_set_interrupt_source(const struct host_sim_interrupt_source *source) {
+    interrupt_source = *source;
+    next_interrupt_us = interrupt_source.next(now_us);
+}
+
+void host_sim_run_until(int64_t until_us) {
+    for (;;) {
+        struct host_task *task = sim_next_ready_task();
+
+        if (task) {
+            current_task = task;
+            task_switches++;
+            swapcontext(&scheduler_context, &task->context);
+            current_task = NULL;
+            continue;
+        }
+
+        int64_t next_us = until_us;
+        if (next_interrupt_us != SIM_NO_TIMEOUT && next_interrupt_us < next_us)
+            next_us = next_interrupt_us;
+        for (task = tasks; task; task = task->next)
+            if (task->wake_at_us != SIM_NO_TIMEOUT && task->wake_at_us < next_us)
+                next_us = task->wake_at_us;
+
+        if (next_us > now_us)
+            now_us = next_us;
+        if (next_interrupt_us == now_us) {
+            interrupt_source.fire(now_us);
+            next_interrupt_us = interrupt_source.next(now_us);
+        }
+        for (task = tasks; task; task = task->next)
+            if (task->wake_at_us != SIM_NO_TIMEOUT && task->wake_at_us <= now_us)
+                sim_wake(task, true);
+
+        if (now_us >= until_us && !sim_next_ready_task())
+            break;
+    }
+}
+
+unsigned long host_sim_task_switches(void) {
+    return task_switches;
+}
+
+int64_t esp_timer_get_time(void) {
+    return now_us;
+}
+
+uint32_t esp_log_timestamp(void) {
+    return now_us / 1000;
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux) {
+    (void)mux;
+}
+
+void vPortExitCritical(portMUX_TYPE *mux) {
+    (void)mux;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param, UBaseType_t priority,
+                       TaskHandle_t *created_task) {
+    struct host_task *task = calloc(1, sizeof(*task)), **last;
+
+    if (!task)
+        return pdFAIL;
+
+    task->fn = fn;
+    task->param = param;
+    task->priority = priority;
+    task->ready = true;
+    task->wake_at_us = SIM_NO_TIMEOUT;
+    getcontext(&task->context);
+    task->context.uc_stack.ss_sp = task->stack;
+    task->context.uc_stack.ss_size = sizeof(task->stack);
+    task->context.uc_link = NULL;
+    makecontext(&task->context, &sim_task_entry, 0);
+
+    /* Keep the creation order, which decides between tasks of equal priority. */
+    for (last = &tasks; *last; last = &(*last)->next);
+    *last = task;
+
+    if (created_task)
+        *created_task = task;
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task) {
+    if (!task)
+        task = current_task;
+    task->ready = false;
+    task->wake_at_us = SIM_NO_TIMEOUT;
+    if (task == current_task)
+        swapcontext(&task->context, &scheduler_context);
+}
+
+void vTaskDelay(TickType_t ticks) {
+    sim_block(sim_ticks_to_wake_at(ticks));
+}
+
+void vTaskSuspend(TaskHandle_t task) {
+    (void)task;
+}
+
+void vTaskResume(TaskHandle_t task) {
+    (void)task;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+    return current_task;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return now_us / SIM_TICK_US;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_count_on_exit, TickType_t ticks_to_wait) {
+    uint32_t count;
+
+    if (!current_task->notify_count && ticks_to_wait) {
+        current_task->waiting_for_notify = true;
+        sim_block(sim_ticks_to_wake_at(ticks_to_wait));
+    }
+
+    count = current_task->notify_count;
+    if (count)
+        current_task->notify_count = clear_count_on_exit ? 0 : count - 1;
+    return count;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *higher_priority_task_woken) {
+    task->notify_count++;
+    if (!task->waiting_for_notify || task->woken_from_isr)
+        return;
+    if (current_task) {
+        sim_wake(task, false);
+    } else {
+        /* Interrupts fire while every task is blocked, so without a yield only the tick interrupt switches. */
+        task->woken_from_isr = true;
+        task->wake_at_us = (now_us / SIM_TICK_US + 1) * SIM_TICK_US;
+    }
+    if (higher_priority_task_woken)
+        *higher_priority_task_woken = pdTRUE;
+}
+
+void vPortYieldFromISR(void) {
+    for (struct host_task *task = tasks; task; task = task->next)
+        if (task->woken_from_isr)
+            sim_wake(task, false);
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    struct host_queue *queue = calloc(1, sizeof(*queue));
+
+    if (!queue)
+        return NULL;
+
+    queue->length = length;
+    queue->item_size = item_size;
+    if (item_size && !(queue->items = malloc(length * item_size))) {
+        free(queue);
+        return NULL;
+    }
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+    free(queue->items);
+    free(queue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait) {
+    int64_t wake_at_us = sim_ticks_to_wake_at(ticks_to_wait);
+
+    while (queue->count == queue->length) {
+        if (!ticks_to_wait)
+            return pdFAIL;
+        current_task->waiting_for_queue = queue;
+        if (!sim_block(wake_at_us))
+            return pdFAIL;
+    }
+    if (queue->item_size)
+        memcpy(&queue->items[(queue->head + queue->count) % queue->length * queue->item_size], item,
+               queue->item_size);
+    queue->count++;
+    sim_wake_queue_waiter(queue);
+    return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *buffer, TickType_t ticks_to_wait) {
+    int64_t wake_at_us = sim_ticks_to_wake_at(ticks_to_wait);
+
+    while (!queue->count) {
+        if (!ticks_to_wait)
+            return pdFAIL;
+        current_task->waiting_for_queue = queue;
+        if (!sim_block(wake_at_us))
+            return pdFAIL;
+    }
+    if (queue->item_size)
+        memcpy(buffer, &queue->items[queue->head * queue->item_size], queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    sim_wake_queue_waiter(queue);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+    return queue->count;
+}
@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_bt_device.h"
+#include "esp_gap_bt_api.h"
+#include "esp_spp_api.h"
+
+#include "host.h"
+#include "main/sipkip-audio.h"
+#include "main/opus-profile.h"
+#include "main/utils.h"
+
+esp_log_level_t host_log_level = ESP_LOG_NONE;
+unsigned long host_log_baud = 0;
+
+SemaphoreHandle_t dac_write_opus_mutex = NULL;
+/* The critical sections of the firmware aren't implemented outside of the simulator, a mutex does the same here. */
+static struct cancel_token *playback_cancel = NULL;
+static pthread_mutex_t playback_cancel_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+    case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+    case ESP_ERR_INVALID_VERSION: return "ESP_ERR_INVALID_VERSION";
+    case ESP_ERR_INVALID_MAC: return "ESP_ERR_INVALID_MAC";
+    case ESP_ERR_NOT_FINISHED: return "ESP_ERR_NOT_FINISHED";
+    default: return "UNKNOWN ERROR";
+    }
+}
+
+int64_t host_time_us(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+int64_t esp_timer_get_time(void) {
+    return host_time_us();
+}
+
+uint32_t esp_log_timestamp(void) {
+    return host_time_us() / 1000;
+}
+
+void esp_log_buffer_hex(const char *tag, const void *buffer, uint16_t buff_len) {
+    (void)tag, (void)buffer, (void)buff_len;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    va_list args;
+    int len;
+
+    (void)tag;
+    if (host_log_level < level)
+        return;
+    va_start(args, format);
+    len = vfprintf(stderr, format, args);
+    va_end(args);
+    host_log_wait(len);
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    if (!strcmp(tag, "*"))
+        host_log_level = level;
+}
+
+uint32_t esp_get_free_heap_size(void) {
+    return 0;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void) {
+    return 0;
+}
+
+esp_err_t esp_bt_dev_set_device_name(const char *name) {
+    (void)name;
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_set_scan_mode(esp_bt_connection_mode_t c_mode, esp_bt_discovery_mode_t d_mode) {
+    (void)c_mode, (void)d_mode;
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_pin_reply(esp_bd_addr_t bd_addr, bool accept, uint8_t pin_code_len, esp_bt_pin_code_t pin_code) {
+    (void)bd_addr, (void)accept, (void)pin_code_len, (void)pin_code;
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_gap_ssp_confirm_reply(esp_bd_addr_t bd_addr, bool accept) {
+    (void)bd_addr, (void)accept;
+    return ESP_OK;
+}
+
+esp_err_t esp_spp_vfs_register(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_spp_start_srv(esp_spp_sec_t sec_mask, esp_spp_role_t role, uint8_t local_scn, const char *name) {
+    (void)sec_mask, (void)role, (void)local_scn, (void)name;
+    return ESP_OK;
+}
+
+/* The loopback harness passes the device end of the socketpair as handle. */
+esp_err_t esp_spp_disconnect(uint32_t handle) {
+    shutdown(handle, SHUT_RDWR);
+    return ESP_OK;
+}
+
+/* Without libopus the uploaded clips can't be parsed, so every clip is accepted. */
+esp_err_t opus_profile_check_clip(FILE *out, const char *path) {
+    (void)out, (void)path;
+    return ESP_OK;
+}
+
+/**
+ * There is no DAC or decoder on the host, the packets are read like on the device, but instead of decoding them the
+ * playback time of each frame is slept away.
+ */
+esp_err_t dac_write_opus(struct opus_mem_or_file opus_mem_or_file, struct cancel_token *cancel) {
+    struct cancel_token own_cancel = {0};
+    unsigned char in[OPUS_MAX_PACKET_SIZE];
+    esp_err_t ret = ESP_OK;
+
+    if (!cancel)
+        cancel = &own_cancel;
+    xSemaphoreTake(dac_write_opus_mutex, portMAX_DELAY);
+    pthread_mutex_lock(&playback_cancel_mutex);
+    playback_cancel = cancel;
+    pthread_mutex_unlock(&playback_cancel_mutex);
+
+    for (unsigned int i = 0; i < opus_mem_or_file.opus_packets_len / sizeof(short); i++) {
+        int packet_size;
+
+        if (opus_mem_or_file.is_mem) {
+            packet_size = ((const short *)opus_mem_or_file.mem.opus_packets)[i];
+        } else {
+            packet_size = (fgetc(opus_mem_or_file.file.opus_packets) & 0xFF) |
+                          (fgetc(opus_mem_or_file.file.opus_packets) << 8);
+            if (packet_size < 0 || packet_size > sizeof(in) ||
+                fread(in, 1, packet_size, opus_mem_or_file.file.opus) < packet_size) {
+                ret = ESP_FAIL;
+                break;
+            }
+        }
+
+        if (cancel_token_cancelled(cancel)) {
+            ret = ESP_ERR_NOT_FINISHED;
+            break;
+        }
+        cancel_token_progress(cancel, i, opus_mem_or_file.opus_packets_len / sizeof(short));
+        vTaskDelay(pdMS_TO_TICKS(1000 * OPUS_FRAME_SIZE / OPUS_SAMPLE_RATE));
+    }
+
+    pthread_mutex_lock(&playback_cancel_mutex);
+    playback_cancel = NULL;
+    pthread_mutex_unlock(&playback_cancel_mutex);
+    xSemaphoreGive(dac_write_opus_mutex);
+    return ret;
+}
+
+void dac_write_opus_stop(void) {
+    pthread_mutex_lock(&playback_cancel_mutex);
+    if (playback_cancel)
+        cancel_token_cancel(playback_cancel);
+    pthread_mutex_unlock(&playback_cancel_mutex);
+}
@@ -0,0 +1,496 @@
+#define _GNU_SOURCE /* For fopencookie(). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "lfs.h"
+
+#include "host.h"
+#include "esp_littlefs.h"
+#include "main/sipkip-audio.h"
+#include "main/stats.h"
+
+#define HOST_VFS_FD_BASE 0x4000
+#define HOST_VFS_MAX_FILES 16
+#define HOST_VFS_BLOCK_SIZE LITTLEFS_BLOCK_SIZE
+#define HOST_VFS_PATH_MAX ((CONFIG_LITTLEFS_OBJ_NAME_LEN + 1) * LITTLEFS_MAX_DEPTH)
+/* Same attribute as esp_littlefs uses for CONFIG_LITTLEFS_USE_MTIME. */
+#define HOST_VFS_ATTR_MTIME ((uint8_t)'t')
+
+struct host_vfs_file {
+    bool used, written;
+    lfs_file_t file;
+    char path[HOST_VFS_PATH_MAX];
+};
+
+struct host_vfs_dir {
+    lfs_dir_t dir;
+    struct dirent dirent;
+};
+
+static pthread_mutex_t host_vfs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct host_vfs_file host_vfs_files[HOST_VFS_MAX_FILES];
+static char host_vfs_cwd[HOST_VFS_PATH_MAX] = "/";
+static unsigned char *host_vfs_ram;
+/* Writes to file descriptors that aren't LittleFS files, each of which would be a separate SPP write on the device. */
+static unsigned long host_vfs_stream_write_count = 0;
+/* Only counted with host_vfs_mutex held, which LittleFS is always called with. */
+static unsigned long host_vfs_file_call_count = 0, host_vfs_bd_call_count = 0;
+static struct lfs_config host_vfs_config;
+static lfs_t host_vfs_lfs;
+
+static int host_vfs_bd_read(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, void *buffer,
+                            lfs_size_t size) {
+    host_vfs_bd_call_count++;
+    stats_add(&stats_counters.flash_read_bytes, size);
+    memcpy(buffer, &host_vfs_ram[block * c->block_size + off], size);
+    return LFS_ERR_OK;
+}
+
+static int host_vfs_bd_prog(const struct lfs_config *c, lfs_block_t block, lfs_off_t off, const void *buffer,
+                            lfs_size_t size) {
+    host_vfs_bd_call_count++;
+    stats_add(&stats_counters.flash_write_bytes, size);
+    memcpy(&host_vfs_ram[block * c->block_size + off], buffer, size);
+    return LFS_ERR_OK;
+}
+
+static int host_vfs_bd_erase(const struct lfs_config *c, lfs_block_t block) {
+    host_vfs_bd_call_count++;
+    stats_add(&stats_counters.flash_erase_bytes, c->block_size);
+    memset(&host_vfs_ram[block * c->block_size], 0xFF, c->block_size);
+    return LFS_ERR_OK;
+}
+
+static int host_vfs_bd_sync(const struct lfs_config *c) {
+    (void)c;
+    return LFS_ERR_OK;
+}
+
+/* Sets errno from a LittleFS error code, and returns -1 if it is an error. */
+static int host_vfs_errno(int err) {
+    if (err >= 0)
+        return err;
+
+    switch (err) {
+    case LFS_ERR_NOENT: errno = ENOENT; break;
+    case LFS_ERR_EXIST: errno = EEXIST; break;
+    case LFS_ERR_NOTDIR: errno = ENOTDIR; break;
+    case LFS_ERR_ISDIR: errno = EISDIR; break;
+    case LFS_ERR_NOTEMPTY: errno = ENOTEMPTY; break;
+    case LFS_ERR_BADF: errno = EBADF; break;
+    case LFS_ERR_FBIG: errno = EFBIG; break;
+    case LFS_ERR_INVAL: errno = EINVAL; break;
+    case LFS_ERR_NOSPC: errno = ENOSPC; break;
+    case LFS_ERR_NOMEM: errno = ENOMEM; break;
+    case LFS_ERR_NAMETOOLONG: errno = ENAMETOOLONG; break;
+    default: errno = EIO; break;
+    }
+    return -1;
+}
+
+/**
+ * Makes [path] absolute and normalized, and returns the path inside the LittleFS instance, or NULL with errno set if
+ * [path] isn't below LITTLEFS_BASE_PATH.
+ */
+static const char *host_vfs_resolve(const char *path, char (*resolved)[HOST_VFS_PATH_MAX]) {
+    char joined[HOST_VFS_PATH_MAX * 2], *component, *save_ptr;
+    size_t len = 0;
+
+    snprintf(joined, sizeof(joined), "%s/%s", path[0] == '/' ? "" : host_vfs_cwd, path);
+    (*resolved)[0] = '\0';
+    for (component = strtok_r(joined, "/", &save_ptr); component; component = strtok_r(NULL, "/", &save_ptr)) {
+        if (!strcmp(component, "."))
+            continue;
+        if (!strcmp(component, "..")) {
+            char *last_slash = strrchr(*resolved, '/');
+            len = last_slash ? last_slash - *resolved : 0;
+            (*resolved)[len] = '\0';
+            continue;
+        }
+        if (len + 1 + strlen(component) >= sizeof(*resolved)) {
+            errno = ENAMETOOLONG;
+            return NULL;
+        }
+        len += sprintf(&(*resolved)[len], "/%s", component);
+    }
+    if (!len)
+        strcpy(*resolved, "/");
+
+    len = strlen(LITTLEFS_BASE_PATH);
+    if (strncmp(*resolved, LITTLEFS_BASE_PATH, len) || ((*resolved)[len] != '/' && (*resolved)[len] != '\0')) {
+        errno = ENOENT;
+        return NULL;
+    }
+    return (*resolved)[len] ? &(*resolved)[len] : "/";
+}
+
+static struct host_vfs_file *host_vfs_get_file(int fd) {
+    if (fd < HOST_VFS_FD_BASE || fd >= HOST_VFS_FD_BASE + HOST_VFS_MAX_FILES ||
+        !host_vfs_files[fd - HOST_VFS_FD_BASE].used)
+        return NULL;
+    return &host_vfs_files[fd - HOST_VFS_FD_BASE];
+}
+
+esp_err_t host_vfs_mount(size_t size) {
+    host_vfs_ram = malloc(size);
+    if (!host_vfs_ram)
+        return ESP_ERR_NO_MEM;
+
+    host_vfs_config = (struct lfs_config) {
+        .read = &host_vfs_bd_read,
+        .prog = &host_vfs_bd_prog,
+        .erase = &host_vfs_bd_erase,
+        .sync = &host_vfs_bd_sync,
+        .read_size = CONFIG_LITTLEFS_READ_SIZE,
+        .prog_size = CONFIG_LITTLEFS_WRITE_SIZE,
+        .block_size = HOST_VFS_BLOCK_SIZE,
+        .block_count = size / HOST_VFS_BLOCK_SIZE,
+        .cache_size = CONFIG_LITTLEFS_CACHE_SIZE,
+        .lookahead_size = CONFIG_LITTLEFS_LOOKAHEAD_SIZE,
+        .block_cycles = CONFIG_LITTLEFS_BLOCK_CYCLES
+    };
+
+    if (lfs_format(&host_vfs_lfs, &host_vfs_config) || lfs_mount(&host_vfs_lfs, &host_vfs_config))
+        return ESP_FAIL;
+    return ESP_OK;
+}
+
+esp_err_t esp_littlefs_info(const char *partition_label, size_t *total_bytes, size_t *used_bytes) {
+    lfs_ssize_t used;
+
+    (void)partition_label;
+    pthread_mutex_lock(&host_vfs_mutex);
+    used = lfs_fs_size(&host_vfs_lfs);
+    pthread_mutex_unlock(&host_vfs_mutex);
+    if (used < 0)
+        return ESP_FAIL;
+
+    *total_bytes = host_vfs_config.block_count * host_vfs_config.block_size;
+    *used_bytes = used * host_vfs_config.block_size;
+    return ESP_OK;
+}
+
+static int host_vfs_open_flags(const char *path, int lfs_flags) {
+    char resolved[HOST_VFS_PATH_MAX];
+    const char *lfs_path;
+    int fd, err;
+
+    pthread_mutex_lock(&host_vfs_mutex);
+    if (!(lfs_path = host_vfs_resolve(path, &resolved))) {
+        pthread_mutex_unlock(&host_vfs_mutex);
+        return -1;
+    }
+    for (fd = 0; fd < HOST_VFS_MAX_FILES && host_vfs_files[fd].used; fd++);
+    if (fd == HOST_VFS_MAX_FILES) {
+        pthread_mutex_unlock(&host_vfs_mutex);
+        errno = ENFILE;
+        return -1;
+    }
+
+    if ((err = lfs_file_open(&host_vfs_lfs, &host_vfs_files[fd].file, lfs_path, lfs_flags)) < 0) {
+        pthread_mutex_unlock(&host_vfs_mutex);
+        return host_vfs_errno(err);
+    }
+    host_vfs_files[fd].used = true;
+    host_vfs_files[fd].written = false;
+    strcpy(host_vfs_files[fd].path, lfs_path);
+    pthread_mutex_unlock(&host_vfs_mutex);
+    return HOST_VFS_FD_BASE + fd;
+}
+
+int host_vfs_open(const char *path, int flags, ...) {
+    int lfs_flags;
+
+    switch (flags & O_ACCMODE) {
+    case O_RDONLY: lfs_flags = LFS_O_RDONLY; break;
+    case O_WRONLY: lfs_flags = LFS_O_WRONLY; break;
+    default: lfs_flags = LFS_O_RDWR; break;
+    }
+    lfs_flags |= (flags & O_CREAT ? LFS_O_CREAT : 0) | (flags & O_EXCL ? LFS_O_EXCL : 0) |
+                 (flags & O_TRUNC ? LFS_O_TRUNC : 0) | (flags & O_APPEND ? LFS_O_APPEND : 0);
+    return host_vfs_open_flags(path, lfs_flags);
+}
+
+int host_vfs_close(int fd) {
+    struct host_vfs_file *file;
+    int err;
+
+    pthread_mutex_lock(&host_vfs_mutex);
+    if (!(file = host_vfs_get_file(fd))) {
+        pthread_mutex_unlock(&host_vfs_mutex);
+        return close(fd);
+    }
+    err = lfs_file_close(&host_vfs_lfs, &file->file);
+    if (err >= 0 && file->written) {
+        time_t mtime = time(NULL);
+        err = lfs_setattr(&host_vfs_lfs, file->path, HOST_VFS_ATTR_MTIME, &mtime, sizeof(mtime));
+    }
+    file->used = false;
+    pthread_mutex_unlock(&host_vfs_mutex);
+    return host_vfs_errno(err);
+}
+
+ssize_t host_vfs_read(int fd, void *buf, size_t count) {
+    struct host_vfs_file *file;
+    ssize_t ret;
+
+    pthread_mutex_lock(&host_vfs_mutex);
+    if ((file = host_vfs_get_file(fd))) {
+        host_vfs_file_call_count++;
+        ret = host_vfs_errno(lfs_file_read(&host_vfs_lfs, &file->file, buf, count));
+        pthread_mutex_unlock(&host_vfs_mutex);
+        return ret;
+    }
+    pthread_mutex_unlock(&host_vfs_mutex);
+
+    /* Like the SPP VFS, return 0 instead of blocking when no data is available. */
+    if (poll(&(struct pollfd) { .fd = fd, .events = POLLIN }, 1, 0) <= 0)
+        return 0;
+    return read(fd, buf, count);
+}
+
+ssize_t host_vfs_write(int fd, const void *buf, size_t count) {
+    struct host_vfs_file *file;
+    ssize_t ret;
+
+    pthread_mutex_lock(&host_vfs_mutex);
+    if ((file = host_vfs_get_file(fd))) {
+        host_vfs_file_call_count++;
+        ret = host_vfs_errno(lfs_file_write(&host_vfs_lfs, &file->file, buf, count));
+        file->written = true;
+        pthread_mutex_unlock(&host_vfs_mutex);
+        return ret;
+    }
+    host_vfs_stream_write_count++;
+    pthread_mutex_unlock(&host_vfs_mutex);
+
+    return write(fd, buf, count);
+}
+
+int host_vfs_dprintf(int fd, const char *format, ...) {
+    va_list args;
+    char *buf;
+    int len;
+
+    va_start(args, format);
+    len = vasprintf(&buf, format, args);
+    va_end(args);
+    if (len < 0)
+        return len;
+    len = host_vfs_write(fd, buf, len);
+    free(buf);
+    return len;
+}
+
+unsigned long host_vfs_stream_writes(void) {
+    unsigned long count;
+
+    pthread_mutex_lock(&host_vfs_mutex);
+    count = host_vfs_stream_write_count;
+    pthread_mutex_unlock(&host_vfs_mutex);
+    return count;
+}
+
+void host_vfs_fs_calls(unsigned long *file_calls, unsigned long *bd_calls) {
+    pthread_mutex_lock(&host_vfs_mutex);
+    *file_calls = host_vfs_file_call_count;
+    *bd_calls = host_vfs_bd_call_count;
+    pthread_mutex_unlock(&host_vfs_mutex);
+}
+
+static ssize_t host_vfs_cookie_read(void *cookie, char *buf, size_t size) {
+    return host_vfs_read((int)(intptr_t)cookie, buf, size);
+}
+
+static ssize_t host_vfs_cookie_write(void *cookie, const char *buf, size_t size) {
+    ssize_t ret = host_vfs_write((int)(intptr_t)cookie, buf, size);
+    /* A short write is reported as an error by returning 0. */
+    return ret < 0 ? 0 : ret;
+}
+
+static int host_vfs_cookie_seek(void *cookie, off64_t *offset, int whence) {
+    struct host_vfs_file *file;
+    lfs_soff_t ret;
+
+    pthread_mutex_lock(&host_vfs_mutex);
+    file = host_vfs_get_file((int)(intptr_t)cookie);
+    ret = lfs_file_seek(&host_vfs_lfs, &file->file, *offset,
+                        whence == SEEK_SET ? LFS_SEEK_SET : whence == SEEK_CUR ? LFS_SEEK_CUR : LFS_SEEK_END);
+    pthread_mutex_unlock(&host_vfs_mutex);
+    if (ret < 0)
+        return host_vfs_errno(ret);
+    *offset = ret;
+    return 0;
+}
+
+static int host_vfs_cookie_close(void *cookie) {
+    return host_vfs_close((int)(intptr_t)cookie);
+}
+
+FILE *host_vfs_fopen(const char *path, const char *mode) {
+    int lfs_flags, fd;
+    FILE *file;
+
+    switch (mode[0]) {
+    case 'r': lfs_flags = strchr(mode, '+') ? LFS_O_RDWR : LFS_O_RDONLY; break;
+    case 'w': lfs_flags = (strchr(mode, '+') ? LFS_O_RDWR : LFS_O_WRONLY) | LFS_O_CREAT | LFS_O_TRUNC; break;
+    case 'a': lfs_flags = (strchr(mode, '+') ? LFS_O_RDWR : LFS_O_WRONLY) | LFS_O_CREAT | LFS_O_APPEND; break;
+    default:
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if ((fd = host_vfs_open_flags(path, lfs_flags)) < 0)
+        return NULL;
+
+    file = fopencookie((void *)(intptr_t)fd, mode, (cookie_io_functions_t) {
+        .read = &host_vfs_cookie_read,
+        .write = &host_vfs_cookie_write,
+        .seek = &host_vfs_cookie_seek,
+        .close = &host_vfs_cookie_close
+    });
+    if (!file)
+        host_vfs_close(fd);
+    return file;
+}
+
+#define HOST_VFS_PATH_OP(path, op)                                                                                 \
+    ({                                                                                                             \
+        char resolved_[HOST_VFS_PATH_MAX];                                                                         \
+        const char *lfs_path;                                                                                      \
+        int ret_ = -1;                                                                                             \
+        pthread_mutex_lock(&host_vfs_mutex);                                                                       \
+        if ((lfs_path = host_vfs_resolve(path, &resolved_)))                                                       \
+            ret_ = host_vfs_errno(op);                                                                             \
+        pthread_mutex_unlock(&host_vfs_mutex);                                                                     \
+        ret_;                                                                                                      \
+    })
+
+int host_vfs_unlink(const char *path) {
+    return HOST_VFS_PATH_OP(path, lfs_remove(&host_vfs_lfs, lfs_path));
+}
+
+int host_vfs_mkdir(const char *path, mode_t mode) {
+    (void)mode;
+    return HOST_VFS_PATH_OP(path, lfs_mkdir(&host_vfs_lfs, lfs_path));
+}
+
+int host_vfs_rmdir(const char *path) {
+    struct lfs_info info;
+
+    return HOST_VFS_PATH_OP(path, lfs_stat(&host_vfs_lfs, lfs_path, &info) < 0 ? LFS_ERR_NOENT :
+                                  info.type != LFS_TYPE_DIR ? LFS_ERR_NOTDIR : lfs_remove(&host_vfs_lfs, lfs_path));
+}
+
+int host_vfs_rename(const char *src, const char *dst) {
+    char resolved_dst[HOST_VFS_PATH_MAX];
+    const char *lfs_path_dst;
+
+    pthread_mutex_lock(&host_vfs_mutex);
+    lfs_path_dst = host_vfs_resolve(dst, &resolved_dst);
+    pthread_mutex_unlock(&host_vfs_mutex);
+    if (!lfs_path_dst)
+        return -1;
+    return HOST_VFS_PATH_OP(src, lfs_rename(&host_vfs_lfs, lfs_path, lfs_path_dst));
+}
+
+int host_vfs_stat(const char *path, struct stat *st) {
+    struct lfs_info info;
+    time_t mtime = 0;
+
+    memset(st, 0, sizeof(*st));
+    if (HOST_VFS_PATH_OP(path, lfs_stat(&host_vfs_lfs, lfs_path, &info)) < 0)
+        return -1;
+    HOST_VFS_PATH_OP(path, lfs_getattr(&host_vfs_lfs, lfs_path, HOST_VFS_ATTR_MTIME, &mtime, sizeof(mtime)));
+
+    st->st_mode = info.type == LFS_TYPE_DIR ? S_IFDIR | 0777 : S_IFREG | 0666;
+    st->st_size = info.type == LFS_TYPE_DIR ? 0 : info.size;
+    st->st_mtime = mtime;
+    return 0;
+}
+
+DIR *host_vfs_opendir(const char *path) {
+    struct host_vfs_dir *dir = malloc(sizeof(*dir));
+
+    if (!dir) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (HOST_VFS_PATH_OP(path, lfs_dir_open(&host_vfs_lfs, &dir->dir, lfs_path)) < 0) {
+        free(dir);
+        return NULL;
+    }
+    return (DIR *)dir;
+}
+
+struct dirent *host_vfs_readdir(DIR *d) {
+    struct host_vfs_dir *dir = (struct host_vfs_dir *)d;
+    struct lfs_info info;
+    int ret;
+
+    pthread_mutex_lock(&host_vfs_mutex);
+    /* Like the ESP-IDF VFS, don't report `.' and `..'. */
+    do {
+        ret = lfs_dir_read(&host_vfs_lfs, &dir->dir, &info);
+    } while (ret > 0 && (!strcmp(info.name, ".") || !strcmp(info.name, "..")));
+    pthread_mutex_unlock(&host_vfs_mutex);
+    if (ret <= 0) {
+        host_vfs_errno(ret);
+        return NULL;
+    }
+
+    snprintf(dir->dirent.d_name, sizeof(dir->dirent.d_name), "%s", info.name);
+    dir->dirent.d_type = info.type == LFS_TYPE_DIR ? DT_DIR : DT_REG;
+    return &dir->dirent;
+}
+
+int host_vfs_closedir(DIR *d) {
+    struct host_vfs_dir *dir = (struct host_vfs_dir *)d;
+    int err;
+
+    pthread_mutex_lock(&host_vfs_mutex);
+    err = lfs_dir_close(&host_vfs_lfs, &dir->dir);
+    pthread_mutex_unlock(&host_vfs_mutex);
+    free(dir);
+    return host_vfs_errno(err);
+}
+
+int host_vfs_chdir(const char *path) {
+    char resolved[HOST_VFS_PATH_MAX];
+    struct stat st;
+
+    if (host_vfs_stat(path, &st))
+        return -1;
+    if (!S_ISDIR(st.st_mode)) {
+        errno = ENOTDIR;
+        return -1;
+    }
+    pthread_mutex_lock(&host_vfs_mutex);
+    host_vfs_resolve(path, &resolved);
+    strcpy(host_vfs_cwd, resolved);
+    pthread_mutex_unlock(&host_vfs_mutex);
+    return 0;
+}
+
+char *host_vfs_getcwd(char *buf, size_t size) {
+    pthread_mutex_lock(&host_vfs_mutex);
+    if (strlen(host_vfs_cwd) >= size) {
+        pthread_mutex_unlock(&host_vfs_mutex);
+        errno = ERANGE;
+        return NULL;
+    }
+    strcpy(buf, host_vfs_cwd);
+    pthread_mutex_unlock(&host_vfs_mutex);
+    return buf;
+}
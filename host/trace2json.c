@@ -0,0 +1,101 @@
+/**
+ * Converts the output of the trace command of the firmware to the JSON trace event format of Chrome, which Perfetto
+ * (https://ui.perfetto.dev) and chrome://tracing open. Every task becomes a thread, so the begin and end of a trace
+ * point pair up per task, also when the task moved to the other core in between. The records that interrupts made
+ * get a thread per core. The core a record was made on is kept as an argument of the event.
+ *
+ * Lines that aren't trace records, like the prompt and the command itself, are skipped, so the output of
+ * `./loopback -o' or a terminal log can be converted as is. Timestamps that wrapped around are unwrapped, per core.
+ *
+ * Usage: ./trace2json [trace] > trace.json
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+
+/* More than the ESP32 has, the records of other cores are skipped. */
+#define MAX_CORES 8
+#define MAX_TASKS 64
+#define MAX_POINT_NAME_LEN 32
+
+struct core {
+    bool seen;
+    uint32_t last_timestamp_us;
+    uint64_t wraps_us;
+};
+
+static struct core cores[MAX_CORES];
+static uint32_t tasks[MAX_TASKS];
+static int n_tasks = 0;
+
+/* Remembers [task] to name its thread, returns false if there are too many. */
+static bool task_seen(uint32_t task) {
+    for (int i = 0; i < n_tasks; i++)
+        if (tasks[i] == task)
+            return true;
+    if (n_tasks == MAX_TASKS)
+        return false;
+    tasks[n_tasks++] = task;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    FILE *trace = stdin;
+    char line[256], name[MAX_POINT_NAME_LEN], phase;
+    unsigned long records = 0;
+    uint32_t timestamp_us, arg, task;
+    int core;
+    bool first = true;
+
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [trace]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (argc == 2 && !(trace = fopen(argv[1], "r"))) {
+        fprintf(stderr, "failed to open trace: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+
+    printf("{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    while (fgets(line, sizeof(line), trace)) {
+        if (sscanf(line, "%d %"SCNu32" %c %31s %"SCNu32" %"SCNx32, &core, &timestamp_us, &phase, name, &arg,
+                   &task) != 6 || core < 0 || core >= MAX_CORES || !strchr("BEi", phase) || (task && !task_seen(task)))
+            continue;
+
+        /* The records of a core are printed oldest first. */
+        if (cores[core].seen && timestamp_us < cores[core].last_timestamp_us)
+            cores[core].wraps_us += UINT64_C(1) << 32;
+        cores[core].seen = true;
+        cores[core].last_timestamp_us = timestamp_us;
+
+        /* A task handle is an address, so it never collides with the thread ids of the interrupts, the cores. */
+        printf("%s{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %"PRIu64", \"pid\": 0, \"tid\": %"PRIu32", "
+               "\"args\": {\"arg\": %"PRIu32", \"core\": %d}%s}", first ? "" : ",\n", name, phase,
+               cores[core].wraps_us + timestamp_us, task ? task : (uint32_t)core, arg, core,
+               phase == 'i' ? ", \"s\": \"t\"" : "");
+        first = false;
+        records++;
+    }
+
+    /* Name the threads after the tasks, and after the cores for the interrupts. */
+    printf("%s{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 0, \"args\": {\"name\": \"SipKip\"}}",
+           first ? "" : ",\n");
+    for (core = 0; core < MAX_CORES; core++)
+        if (cores[core].seen)
+            printf(",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %d, "
+                   "\"args\": {\"name\": \"Interrupts on core %d\"}}", core, core);
+    for (int i = 0; i < n_tasks; i++)
+        printf(",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": %"PRIu32", "
+               "\"args\": {\"name\": \"Task 0x%08"PRIx32"\"}}", tasks[i], tasks[i]);
+    printf("\n]}\n");
+
+    fprintf(stderr, "%lu records\n", records);
+    if (trace != stdin)
+        fclose(trace);
+    return EXIT_SUCCESS;
+}
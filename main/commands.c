@@ -4,6 +4,7 @@
 #include <fcntl.h>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/stat.h>
 #include <sys/unistd.h>
 #include <ctype.h>
 #include <dirent.h>
@@ -16,6 +17,15 @@
 #include "vfs-acceptor.h"
 #include "sipkip-audio.h"
 #include "xmodem.h"
+#include "manifest.h"
+#include "opus-profile.h"
+#include "input-trace.h"
+#include "rpc.h"
+#include "jobs.h"
+#include "fs-tree.h"
+#include "stats.h"
+#include "trace.h"
+#include "deferred-log.h"
 #include "utils.h"
 
 static const char *const TAG = "commands";
@@ -30,44 +40,69 @@ static const char *const TAG = "commands";
     },
     
 #define IMPL_COMMAND(command_name)                                                                                 \
-    static esp_err_t command_##command_name(int argc, char **argv)
+    static esp_err_t command_##command_name(struct spp_session *session, int argc, char **argv)
 
 DECL_COMMAND(help) DECL_COMMAND(rx) DECL_COMMAND(rm) DECL_COMMAND(mv) DECL_COMMAND(cp) DECL_COMMAND(speak)
 DECL_COMMAND(mkdir) DECL_COMMAND(rmdir) DECL_COMMAND(ls) DECL_COMMAND(cwd) DECL_COMMAND(pwd) DECL_COMMAND(du)
+DECL_COMMAND(manifest) DECL_COMMAND(inputs) DECL_COMMAND(sessions) DECL_COMMAND(rpc) DECL_COMMAND(jobs)
+DECL_COMMAND(kill) DECL_COMMAND(stats) DECL_COMMAND(trace) DECL_COMMAND(log)
 
 const struct vfs_commands commands[] = {
     DEF_COMMAND(help, "[command_name]", "Prints help information about command [command_name].")
     DEF_COMMAND(rx, "[filename]", "Starts receiving file [filename] with protocol XMODEM.")
-    DEF_COMMAND(rm, "[filename]", "Removes file [filename].")
-    DEF_COMMAND(mv, "[src_name] [dst_name]", "Moves file or directory [src_name] to [dst_name].")
-    DEF_COMMAND(cp, "[src_filename] [dst_filename]", "Copies file [src_filename] to [dst_filename].")
-    DEF_COMMAND(speak, "[opus_filename] [opus_packets_filename]", "Plays the opus stream contained in [opus_filename]")
+    DEF_COMMAND(rm, "[-r] [name]", "Removes file [name], with -r also directory [name] and everything in it.")
+    DEF_COMMAND(mv, "[src_name] [dst_name]",
+                "Moves file or directory [src_name] to [dst_name], or into [dst_name] if it is a directory.")
+    DEF_COMMAND(cp, "[-r] [src_name] [dst_name]",
+                "Copies file [src_name] to [dst_name], or into [dst_name] if it is a directory, with -r also "
+                "directories.")
+    DEF_COMMAND(speak, "[opus_filename] [opus_packets_filename] [opus_envelope_filename]",
+                "Plays the opus stream contained in [opus_filename], [opus_envelope_filename] is optional.")
     DEF_COMMAND(mkdir, "[dirname]", "Creates directory [dirname].")
     DEF_COMMAND(rmdir, "[dirname]", "Removes directory [dirname] (only if it is empty).")
     DEF_COMMAND(ls, "[name]", "Lists files and directories in [name], or only [name] if [name] is a file.")
     DEF_COMMAND(cwd, "[dirname]", "Change current working directory to [dirname]")
     DEF_COMMAND(pwd, "", "Prints current working directory.")
     DEF_COMMAND(du, "", "Prints the disk usage and total capacity.")
+    DEF_COMMAND(manifest, "[dirname]", "Prints `cksum size path' of every file below [dirname], for syncing assets.")
+    DEF_COMMAND(inputs, "[n]", "Prints the last [n] (default all) input edges and gestures, and the clips they played.")
+    DEF_COMMAND(sessions, "", "Lists the connected clients, with their working directory and running command.")
+    DEF_COMMAND(rpc, "", "Switches this session to the binary protocol for host tools, see rpc.h.")
+    DEF_COMMAND(jobs, "", "Lists the commands that were started with a separate `&' at the end, and their progress.")
+    DEF_COMMAND(kill, "[job]", "Stops job [job] of the jobs command.")
+    DEF_COMMAND(stats, "[reset]", "Prints decode and input times, underruns, heap, traffic, tasks, or resets counters.")
+    DEF_COMMAND(trace, "[clear]", "Prints the trace points of every core for host/trace2json, or forgets them.")
+    DEF_COMMAND(log, "[tag] [level]",
+                "Sets the log level of [tag], or of all tags for *, to none, error, warn, info, debug or verbose. "
+                "Without arguments, prints the levels of the deferred tags and the dropped messages.")
     {0}
 };
 
+/* Resolves the path argument [arg] against the working directory of [session], or prints why it can't. */
+static bool resolve_path(struct spp_session *session, const char *arg, char (*path)[SPP_PATH_MAX]) {
+    if (spp_session_path(session, arg, path))
+        return true;
+    fprintf(session->out, "Path too long: %s!\n", arg);
+    return false;
+}
+
 IMPL_COMMAND(help) {
     /* General help. */
     if (argc == 1) {
-        dprintf(spp_fd, "Available commands:\n");
+        fprintf(session->out, "Available commands:\n");
         for (const struct vfs_commands *command = commands; command->name; command++)
-             dprintf(spp_fd, "\t* %s\n", command->name);
-        dprintf(spp_fd, "Type `help [command_name]' for more information about a specific command.\n");
+             fprintf(session->out, "\t* %s\n", command->name);
+        fprintf(session->out, "Type `help [command_name]' for more information about a specific command.\n");
         return ESP_OK;
     /* Help for specific command. */
     } else if (argc == 2) {
         const struct vfs_commands *command = find_command(argv[1]);
         if (!command) {
-            dprintf(spp_fd, "Unknown command: %s!\n", argv[1]);
+            fprintf(session->out, "Unknown command: %s!\n", argv[1]);
             return ESP_OK;
         }
 
-        dprintf(spp_fd, "%s", command->usage);
+        fprintf(session->out, "%s", command->usage);
         return ESP_OK;
     }
     /* Wrong amount of arguments. */
@@ -75,6 +110,7 @@ IMPL_COMMAND(help) {
 }
 
 IMPL_COMMAND(rx) {
+    char path[SPP_PATH_MAX];
     int littlefs_fd;
     bool remove_file = false;
     
@@ -82,102 +118,153 @@ IMPL_COMMAND(rx) {
         /* Wrong amount of arguments, or first argument isn't a path. */
         return ESP_ERR_INVALID_ARG;
 
-    if (strstr(argv[1], LITTLEFS_BASE_PATH"/") != argv[1]) {
-        dprintf(spp_fd, "Invalid file name: %s, doesn't start with %s\n", argv[1], LITTLEFS_BASE_PATH"/");
+    if (!resolve_path(session, argv[1], &path))
+        return ESP_OK;
+    if (strstr(path, LITTLEFS_BASE_PATH"/") != path) {
+        fprintf(session->out, "Invalid file name: %s, doesn't start with %s\n", argv[1], LITTLEFS_BASE_PATH"/");
         return ESP_OK;
     }
-    ESP_LOGI(TAG, "Detected valid filename: %s", argv[1]);
+    ESP_LOGI(TAG, "Detected valid filename: %s", path);
 
-    littlefs_fd = open(argv[1], O_WRONLY | O_CREAT | O_EXCL);
+    littlefs_fd = open(path, O_WRONLY | O_CREAT | O_EXCL);
     if (littlefs_fd < 0) {
-        dprintf(spp_fd, "Failed to open file %s: %s\n", argv[1], strerror(errno));
+        fprintf(session->out, "Failed to open file %s: %s\n", argv[1], strerror(errno));
         return ESP_OK;
     }
 
-    if (xmodem_receiver_start(spp_fd, littlefs_fd) != ESP_OK) {
-        dprintf(spp_fd, "Failed to receive file %s using XMODEM\n", argv[1]);
+    /* XMODEM writes to the file descriptor directly, the sender mustn't see anything after its first "C". */
+    fflush(session->out);
+    if (xmodem_receiver_start(session->fd, littlefs_fd) != ESP_OK) {
+        fprintf(session->out, "Failed to receive file %s using XMODEM\n", argv[1]);
         remove_file = true;
     }
 
-    /* Close file, and unlink if the transfer failed. */
+    /* Close file, and unlink if the transfer failed, or if it completes a clip the firmware can't play. */
     close(littlefs_fd);
+    if (!remove_file && opus_profile_check_clip(session->out, path) != ESP_OK) {
+        fprintf(session->out, "Rejecting %s, it doesn't match the %s opus profile of this firmware\n", argv[1],
+                OPUS_PROFILE_NAME);
+        remove_file = true;
+    }
     if (remove_file)
-        command_rm(argc, argv);
+        command_rm(session, argc, argv);
+    else
+        manifest_invalidate(path);
     return ESP_OK;
 }
 
+/* Whether the first argument is -r, the arguments after it are shifted by one. */
+static bool has_recursive_flag(int argc, char **argv) {
+    return argc > 1 && !strcmp(argv[1], "-r");
+}
+
+static void print_fs_tree_stats(struct spp_session *session, const char *action, const struct fs_tree_stats *stats) {
+    char size[32];
+    
+    fprintf(session->out, "%s %lu files, %lu directories, %s in %lu ms", action, stats->files, stats->dirs,
+            readable_file_size(stats->bytes, size), (unsigned long)(stats->us / 1000));
+    if (stats->bytes && stats->us)
+        fprintf(session->out, ", %lu KiB/s", (unsigned long)((uint64_t)stats->bytes * 1000000 / 1024 / stats->us));
+    fprintf(session->out, "\n");
+}
+
 IMPL_COMMAND(rm) {
-    int ret;
+    char path[SPP_PATH_MAX];
+    struct fs_tree_stats stats;
+    bool recursive = has_recursive_flag(argc, argv);
     
-    if (argc != 2)
+    if (argc != 2 + recursive)
         /* Wrong amount of arguments, or first argument isn't a path. */
         return ESP_ERR_INVALID_ARG;
     
-    ESP_LOGI(TAG, "Removing file: %s", argv[1]);
-    
-    ret = remove(argv[1]);
-    if (ret) {
-        dprintf(spp_fd, "Failed to remove file %s: %s\n", argv[1], strerror(errno));
+    if (!resolve_path(session, argv[1 + recursive], &path))
         return ESP_OK;
-    }
+    ESP_LOGI(TAG, "Removing %s: %s", recursive ? "tree" : "file", path);
+    
+    if (fs_tree_remove(path, recursive, &session->cancel, &stats))
+        fprintf(session->out, "Failed to remove %s: %s\n", stats.failed_path, strerror(errno));
+    manifest_invalidate(path);
+    if (recursive)
+        print_fs_tree_stats(session, "Removed", &stats);
     
     return ESP_OK;
 }
 
 IMPL_COMMAND(mv) {
-    int ret;
+    char src[SPP_PATH_MAX], dst[SPP_PATH_MAX];
+    struct fs_tree_stats stats;
     
     if (argc != 3)
         /* Wrong amount of arguments, or first and second argument isn't a path. */
         return ESP_ERR_INVALID_ARG;
     
-    ESP_LOGI(TAG, "Moving file: %s to %s", argv[1], argv[2]);
-    
-    ret = rename(argv[1], argv[2]);
-    if (ret) {
-        dprintf(spp_fd, "Failed to move file %s to %s: %s\n", argv[1], argv[2], strerror(errno));
+    if (!resolve_path(session, argv[1], &src) || !resolve_path(session, argv[2], &dst))
         return ESP_OK;
-    }
+    ESP_LOGI(TAG, "Moving file: %s to %s", src, dst);
+    
+    if (fs_tree_move(src, dst, &session->cancel, &stats))
+        fprintf(session->out, "Failed to move %s to %s, at %s: %s\n", argv[1], argv[2], stats.failed_path,
+                strerror(errno));
+    else if (stats.files)
+        /* Only a move that had to copy has anything to report. */
+        print_fs_tree_stats(session, "Moved", &stats);
+    /* A failed move can still have copied part of [src]. */
+    manifest_invalidate(src);
+    manifest_invalidate(dst);
     
     return ESP_OK;
 }
 
 IMPL_COMMAND(cp) {
-    int ret;
+    char src[SPP_PATH_MAX], dst[SPP_PATH_MAX];
+    struct fs_tree_stats stats;
+    bool recursive = has_recursive_flag(argc, argv);
     
-    if (argc != 3)
+    if (argc != 3 + recursive)
         /* Wrong amount of arguments, or first and second argument isn't a path. */
         return ESP_ERR_INVALID_ARG;
     
-    ESP_LOGI(TAG, "Copying file: %s to %s", argv[1], argv[2]);
-    
-    ret = copy_file(argv[1], argv[2]);
-    if (ret) {
-        dprintf(spp_fd, "Failed to copy file %s to %s: %s\n", argv[1], argv[2], strerror(errno));
+    if (!resolve_path(session, argv[1 + recursive], &src) || !resolve_path(session, argv[2 + recursive], &dst))
         return ESP_OK;
-    }
+    ESP_LOGI(TAG, "Copying %s: %s to %s", recursive ? "tree" : "file", src, dst);
+    
+    if (fs_tree_copy(src, dst, recursive, &session->cancel, &stats))
+        fprintf(session->out, "Failed to copy %s to %s, at %s: %s\n", argv[1 + recursive], argv[2 + recursive],
+                stats.failed_path, strerror(errno));
+    manifest_invalidate(dst);
+    print_fs_tree_stats(session, "Copied", &stats);
     
     return ESP_OK;
 }
 
 IMPL_COMMAND(speak) {
+    char paths[3][SPP_PATH_MAX];
     unsigned int file_opus_packets_len;
+    FILE *file_opus_envelope = NULL;
     
-    if (argc != 3)
+    if (argc != 3 && argc != 4)
         /* Wrong amount of arguments, or first and second argument isn't a path. */
         return ESP_ERR_INVALID_ARG;
     
-    ESP_LOGI(TAG, "Playing opus file: %s, with opus packets file: %s", argv[1], argv[2]);
+    for (int i = 1; i < argc; i++)
+        if (!resolve_path(session, argv[i], &paths[i - 1]))
+            return ESP_OK;
+    ESP_LOGI(TAG, "Playing opus file: %s, with opus packets file: %s", paths[0], paths[1]);
     
-    FILE *file_opus = fopen(argv[1], "rb");
+    FILE *file_opus = fopen(paths[0], "rb");
     if (!file_opus) {
-        dprintf(spp_fd, "Failed to open file %s: %s\n", argv[1], strerror(errno));
+        fprintf(session->out, "Failed to open file %s: %s\n", argv[1], strerror(errno));
         return ESP_OK;
     }
     
-    FILE *file_opus_packets = fopen(argv[2], "rb");
+    FILE *file_opus_packets = fopen(paths[1], "rb");
     if (!file_opus_packets) {
-        dprintf(spp_fd, "Failed to open file %s: %s\n", argv[2], strerror(errno));
+        fprintf(session->out, "Failed to open file %s: %s\n", argv[2], strerror(errno));
+        goto exit;
+    }
+    
+    if (argc == 4 && !(file_opus_envelope = fopen(paths[2], "rb"))) {
+        fprintf(session->out, "Failed to open file %s: %s\n", argv[3], strerror(errno));
         goto exit;
     }
     
@@ -185,30 +272,36 @@ IMPL_COMMAND(speak) {
     file_opus_packets_len = ftell(file_opus_packets);
     fseek(file_opus_packets, 0, SEEK_SET);
     
-    exit_dac_write_opus_loop = true;    
-    DAC_WRITE_OPUS(file_opus, file);
+    /* Cut the clip that is playing, instead of waiting for it. */
+    dac_write_opus_stop();
+    DAC_WRITE_OPUS(file_opus, file, &session->cancel);
     
 exit:
     if (file_opus)
         fclose(file_opus);
     if (file_opus_packets)
         fclose(file_opus_packets);
+    if (file_opus_envelope)
+        fclose(file_opus_envelope);
     
     return ESP_OK;
 }
 
 IMPL_COMMAND(mkdir) {
+    char path[SPP_PATH_MAX];
     int ret;
     
     if (argc != 2)
         /* Wrong amount of arguments, or first argument isn't a path. */
         return ESP_ERR_INVALID_ARG;
     
-    ESP_LOGI(TAG, "Creating directory: %s", argv[1]);
+    if (!resolve_path(session, argv[1], &path))
+        return ESP_OK;
+    ESP_LOGI(TAG, "Creating directory: %s", path);
     
-    ret = mkdir(argv[1], 0777);
+    ret = mkdir(path, 0777);
     if (ret) {
-        dprintf(spp_fd, "Failed to create directory %s: %s\n", argv[1], strerror(errno));
+        fprintf(session->out, "Failed to create directory %s: %s\n", argv[1], strerror(errno));
         return ESP_OK;
     }
     
@@ -216,17 +309,20 @@ IMPL_COMMAND(mkdir) {
 }
 
 IMPL_COMMAND(rmdir) {
+    char path[SPP_PATH_MAX];
     int ret;
     
     if (argc != 2)
         /* Wrong amount of arguments, or first argument isn't a path. */
         return ESP_ERR_INVALID_ARG;
     
-    ESP_LOGI(TAG, "Removing directory: %s\n", argv[1]);
+    if (!resolve_path(session, argv[1], &path))
+        return ESP_OK;
+    ESP_LOGI(TAG, "Removing directory: %s\n", path);
     
-    ret = rmdir(argv[1]);
+    ret = rmdir(path);
     if (ret) {
-        dprintf(spp_fd, "Failed to remove directory %s: %s\n", argv[1], strerror(errno));
+        fprintf(session->out, "Failed to remove directory %s: %s\n", argv[1], strerror(errno));
         return ESP_OK;
     }
     
@@ -234,20 +330,14 @@ IMPL_COMMAND(rmdir) {
 }
 
 IMPL_COMMAND(ls) {
-    char buffer[(CONFIG_LITTLEFS_OBJ_NAME_LEN + 1) * LITTLEFS_MAX_DEPTH];
-    if (argc == 1) {
-        if (!getcwd(buffer, sizeof(buffer) / sizeof(*buffer))) {
-            dprintf(spp_fd, "Couldn't determine current working directory: %s!\n", strerror(errno));
-            return ESP_OK;
-        }
-    } else if (argc == 2) {
-        strncpy(buffer, argv[1], sizeof(buffer) / sizeof(*buffer));
-    } else {
+    char buffer[SPP_PATH_MAX];
+    if (argc > 2)
         return ESP_ERR_INVALID_ARG;
-    }
+    if (!resolve_path(session, argc == 2 ? argv[1] : ".", &buffer))
+        return ESP_OK;
     DIR *dir = opendir(buffer);
     if (!dir) {
-        dprintf(spp_fd, "Couldn't open directory %s: %s!\n", buffer, strerror(errno));
+        fprintf(session->out, "Couldn't open directory %s: %s!\n", buffer, strerror(errno));
         return ESP_OK;
     }
 
@@ -256,7 +346,7 @@ IMPL_COMMAND(ls) {
         if (!de)
             break;
         
-        dprintf(spp_fd, "%s%s\n", de->d_name, &"/"[de->d_type != DT_DIR]); /* Print trailing `/' if it's a directory. */
+        fprintf(session->out, "%s%s\n", de->d_name, &"/"[de->d_type != DT_DIR]); /* Print trailing `/' if it's a directory. */
     }
 
     closedir(dir);
@@ -264,29 +354,35 @@ IMPL_COMMAND(ls) {
 }
 
 IMPL_COMMAND(cwd) {
+    char path[SPP_PATH_MAX];
+    struct stat st;
+    int ret;
+    
     if (argc != 2)
         /* Wrong amount of arguments, or first argument isn't a path. */
         return ESP_ERR_INVALID_ARG;
     
-    if (chdir(argv[1])) {
-        dprintf(spp_fd, "Couldn't change current working directory to %s: %s!\n", argv[1], strerror(errno));
+    if (!resolve_path(session, argv[1], &path))
+        return ESP_OK;
+    ret = stat(path, &st);
+    if (!ret && !S_ISDIR(st.st_mode)) {
+        errno = ENOTDIR;
+        ret = -1;
+    }
+    if (ret) {
+        fprintf(session->out, "Couldn't change current working directory to %s: %s!\n", argv[1], strerror(errno));
         return ESP_OK;
     }
+    strcpy(session->cwd, path);
     
     return ESP_OK;
 }
 
 IMPL_COMMAND(pwd) {
-    char buffer[(CONFIG_LITTLEFS_OBJ_NAME_LEN + 1) * LITTLEFS_MAX_DEPTH];
-    
     if (argc != 1)
         return ESP_ERR_INVALID_ARG;
     
-    if (!getcwd(buffer, sizeof(buffer) / sizeof(*buffer))) {
-        dprintf(spp_fd, "Couldn't determine current working directory: %s!\n", strerror(errno));
-        return ESP_OK;
-    }
-    dprintf(spp_fd, "%s\n", buffer);
+    fprintf(session->out, "%s\n", session->cwd);
     
     return ESP_OK;
 }
@@ -300,9 +396,139 @@ IMPL_COMMAND(du) {
     size_t total = 0UL, used = 0UL;
     ret = esp_littlefs_info("storage", &total, &used);
     if (ret != ESP_OK) {
-        dprintf(spp_fd, "Failed to get LITTLEFS partition information (%s).\n", esp_err_to_name(ret));
+        fprintf(session->out, "Failed to get LITTLEFS partition information (%s).\n", esp_err_to_name(ret));
     } else {
-        dprintf(spp_fd, "Used: %lu, total: %lu\n", used, total);
+        fprintf(session->out, "Used: %lu, total: %lu\n", used, total);
+    }
+    return ESP_OK;
+}
+
+IMPL_COMMAND(manifest) {
+    char buffer[SPP_PATH_MAX];
+    esp_err_t err;
+
+    if (argc > 2)
+        return ESP_ERR_INVALID_ARG;
+    if (!resolve_path(session, argc == 2 ? argv[1] : ".", &buffer))
+        return ESP_OK;
+
+    err = manifest_print(session->out, buffer);
+    if (err != ESP_OK)
+        fprintf(session->out, "Failed to create manifest of %s: %s\n", buffer, esp_err_to_name(err));
+
+    return ESP_OK;
+}
+
+IMPL_COMMAND(inputs) {
+    size_t n = CONFIG_SIPKIP_INPUT_TRACE_LEN;
+    char *end;
+
+    if (argc == 2) {
+        n = strtoul(argv[1], &end, 10);
+        if (*end)
+            return ESP_ERR_INVALID_ARG;
+    } else if (argc != 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    input_trace_print(session->out, n);
+    return ESP_OK;
+}
+
+IMPL_COMMAND(sessions) {
+    if (argc != 1)
+        return ESP_ERR_INVALID_ARG;
+
+    for (int i = 0; i < CONFIG_SIPKIP_SPP_MAX_SESSIONS; i++) {
+        const struct spp_session *other = &spp_sessions[i];
+        const struct vfs_commands *command = other->command;
+        int fd = other->fd;
+
+        if (fd < 0)
+            continue;
+        fprintf(session->out, "%d%s %s %s\n", fd, &"*"[other != session], other->cwd,
+                command ? command->name : "-");
+    }
+    return ESP_OK;
+}
+
+IMPL_COMMAND(rpc) {
+    if (argc != 1)
+        return ESP_ERR_INVALID_ARG;
+
+    fprintf(session->out, "RPC %d\n", RPC_VERSION);
+    session->rpc = true;
+    return ESP_OK;
+}
+
+IMPL_COMMAND(jobs) {
+    if (argc != 1)
+        return ESP_ERR_INVALID_ARG;
+
+    jobs_print(session->out);
+    return ESP_OK;
+}
+
+IMPL_COMMAND(kill) {
+    char *end;
+    unsigned long id;
+
+    if (argc != 2)
+        return ESP_ERR_INVALID_ARG;
+
+    id = strtoul(argv[1], &end, 10);
+    if (*end || !jobs_kill(id))
+        fprintf(session->out, "No such job: %s!\n", argv[1]);
+    return ESP_OK;
+}
+
+IMPL_COMMAND(stats) {
+    if (argc == 2 && !strcmp(argv[1], "reset")) {
+        stats_reset();
+        return ESP_OK;
+    } else if (argc != 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    stats_print(session->out);
+    return ESP_OK;
+}
+
+IMPL_COMMAND(trace) {
+    if (argc == 2 && !strcmp(argv[1], "clear")) {
+        trace_clear();
+        return ESP_OK;
+    } else if (argc != 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    trace_print(session->out);
+    return ESP_OK;
+}
+
+IMPL_COMMAND(log) {
+    static const char *const level_names[] = {
+        [ESP_LOG_NONE] = "none", [ESP_LOG_ERROR] = "error", [ESP_LOG_WARN] = "warn", [ESP_LOG_INFO] = "info",
+        [ESP_LOG_DEBUG] = "debug", [ESP_LOG_VERBOSE] = "verbose"
+    };
+    int level;
+
+    if (argc == 1) {
+        deferred_log_print(session->out);
+        return ESP_OK;
+    } else if (argc != 3) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (level = ESP_LOG_NONE; level <= ESP_LOG_VERBOSE; level++)
+        if (!strcmp(argv[2], level_names[level]))
+            break;
+    if (level > ESP_LOG_VERBOSE) {
+        fprintf(session->out, "No such log level: %s!\n", argv[2]);
+        return ESP_OK;
     }
+    /* Tags that only ESP_LOG*() uses aren't known here, esp_log_level_set() takes any name. */
+    if (!deferred_log_level_set(argv[1], level) && strcmp(argv[1], "*"))
+        fprintf(session->out, "Set %s to %s, it has no deferred messages\n", argv[1], level_names[level]);
     return ESP_OK;
 }
@@ -2,13 +2,16 @@
 #define COMMANDS_H
 
 #include <string.h>
+#include <stdbool.h>
 
 #include "esp_err.h"
 
+struct spp_session;
+
 struct vfs_commands {
     const char *name;
     const char *usage;
-    esp_err_t (*fn)(int argc, char **argv);
+    esp_err_t (*fn)(struct spp_session *session, int argc, char **argv);
 };
 
 extern const struct vfs_commands commands[];
@@ -22,4 +25,9 @@ static inline const struct vfs_commands *find_command(const char *name) {
     return command;
 }
 
+/* Whether [command] reads and writes the SPP file descriptor itself, so it can only run in the shell that started it. */
+static inline bool command_takes_over_fd(const struct vfs_commands *command) {
+    return !strcmp(command->name, "rx") || !strcmp(command->name, "rpc");
+}
+
 #endif /* COMMANDS_H */
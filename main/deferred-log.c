@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_err.h"
+
+#include "deferred-log.h"
+
+static const char *const TAG = "deferred-log";
+
+/* Just above the idle task, so formatting only takes time nothing else needs. */
+#define DEFERRED_LOG_PRIORITY 1
+#define DEFERRED_LOG_STACK_SIZE 3072
+/* Longer messages are cut off. */
+#define DEFERRED_LOG_LINE_MAX 160
+
+struct deferred_log_record {
+    uint32_t timestamp_ms;
+    const struct deferred_log_tag *tag;
+    const char *format;
+    uintptr_t args[DEFERRED_LOG_MAX_ARGS];
+    uint8_t level;
+};
+
+static const char level_letters[] = {
+    [ESP_LOG_NONE] = 'N', [ESP_LOG_ERROR] = 'E', [ESP_LOG_WARN] = 'W', [ESP_LOG_INFO] = 'I', [ESP_LOG_DEBUG] = 'D',
+    [ESP_LOG_VERBOSE] = 'V'
+};
+
+/* Only added to by the constructors, before any task runs. */
+static struct deferred_log_tag *tags = NULL;
+static QueueHandle_t deferred_log_queue = NULL;
+static uint32_t deferred_log_dropped = 0;
+
+static void format_record(const struct deferred_log_record *record) {
+    const char *name = record->tag->name;
+    char line[DEFERRED_LOG_LINE_MAX];
+
+    snprintf(line, sizeof(line), record->format, record->args[0], record->args[1], record->args[2], record->args[3]);
+    /* The same layout as ESP_LOG*(), with the time the record was made, in one write so other lines don't end up in
+     * the middle of it. */
+    esp_log_write(record->level, name, "%c (%"PRIu32") %s: %s\n", level_letters[record->level], record->timestamp_ms,
+                  name, line);
+}
+
+static void deferred_log_task_handler(void *arg) {
+    struct deferred_log_record record;
+    uint32_t reported_dropped = 0;
+
+    for (;;) {
+        uint32_t dropped;
+
+        xQueueReceive(deferred_log_queue, &record, portMAX_DELAY);
+        format_record(&record);
+        if (uxQueueMessagesWaiting(deferred_log_queue))
+            continue;
+        /* Caught up, report what didn't fit in the meantime. */
+        if ((dropped = __atomic_load_n(&deferred_log_dropped, __ATOMIC_RELAXED)) != reported_dropped) {
+            ESP_LOGW(TAG, "Dropped %"PRIu32" records, the queue was full", dropped - reported_dropped);
+            reported_dropped = dropped;
+        }
+    }
+}
+
+void deferred_log_register(struct deferred_log_tag *tag) {
+    tag->next = tags;
+    tags = tag;
+}
+
+void deferred_log_write(const struct deferred_log_tag *tag, esp_log_level_t level, const char *format,
+                        const uintptr_t args[DEFERRED_LOG_MAX_ARGS]) {
+    struct deferred_log_record record = {
+        .timestamp_ms = esp_log_timestamp(),
+        .tag = tag,
+        .format = format,
+        .level = level
+    };
+
+    memcpy(record.args, args, sizeof(record.args));
+    if (!deferred_log_queue)
+        format_record(&record);
+    else if (xQueueSend(deferred_log_queue, &record, 0) != pdTRUE)
+        __atomic_fetch_add(&deferred_log_dropped, 1, __ATOMIC_RELAXED);
+}
+
+esp_err_t deferred_log_setup(void) {
+    if (deferred_log_queue)
+        return ESP_OK;
+
+    if (!(deferred_log_queue = xQueueCreate(CONFIG_SIPKIP_DEFERRED_LOG_LEN, sizeof(struct deferred_log_record))))
+        return ESP_ERR_NO_MEM;
+    if (xTaskCreate(&deferred_log_task_handler, "Deferred log", DEFERRED_LOG_STACK_SIZE, NULL, DEFERRED_LOG_PRIORITY,
+                    NULL) != pdPASS) {
+        vQueueDelete(deferred_log_queue);
+        deferred_log_queue = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+int deferred_log_level_set(const char *tag_name, esp_log_level_t level) {
+    int n = 0;
+
+    esp_log_level_set(tag_name, level);
+    for (struct deferred_log_tag *tag = tags; tag; tag = tag->next) {
+        if (strcmp(tag_name, "*") && strcmp(tag_name, tag->name))
+            continue;
+        tag->level = level;
+        n++;
+    }
+    return n;
+}
+
+void deferred_log_print(FILE *out) {
+    for (const struct deferred_log_tag *tag = tags; tag; tag = tag->next)
+        fprintf(out, "%s %c\n", tag->name, level_letters[tag->level]);
+    fprintf(out, "%"PRIu32" records dropped\n", __atomic_load_n(&deferred_log_dropped, __ATOMIC_RELAXED));
+}
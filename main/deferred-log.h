@@ -0,0 +1,94 @@
+#ifndef DEFERRED_LOG_H
+#define DEFERRED_LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+/**
+ * Logging for hot paths, where formatting a line and writing it to the 115200 baud UART would take longer than the
+ * work itself. DLOGI() and friends only copy the format pointer and up to DEFERRED_LOG_MAX_ARGS arguments into a queue
+ * of CONFIG_SIPKIP_DEFERRED_LOG_LEN records, a low priority task formats them later. When the queue is full, the
+ * record is dropped and counted.
+ *
+ * Since the line is formatted later, the arguments have to be integers or pointers of at most 32 bits, which are
+ * passed on as uintptr_t, and strings have to live forever, like command names and string literals. Not for use in
+ * interrupts.
+ *
+ * Every tag has a level that can be changed at runtime with the log command, it's checked before anything is copied.
+ */
+
+#define DEFERRED_LOG_MAX_ARGS 4
+
+struct deferred_log_tag {
+    const char *name;
+    esp_log_level_t level;
+    struct deferred_log_tag *next;
+};
+
+/**
+ * Defines tag [var] with name [tag_name], at level CONFIG_LOG_DEFAULT_LEVEL. It's registered before app_main() runs,
+ * so the log command finds it before the first message.
+ */
+#define DEFERRED_LOG_TAG(var, tag_name)                                                                            \
+    static struct deferred_log_tag var = { .name = tag_name, .level = CONFIG_LOG_DEFAULT_LEVEL };                  \
+    static void __attribute__((constructor)) var##_register(void) {                                                \
+        deferred_log_register(&var);                                                                               \
+    }
+
+#define DEFERRED_LOG_NARGS_(_0, _1, _2, _3, _4, n, ...) n
+#define DEFERRED_LOG_NARGS(...) DEFERRED_LOG_NARGS_(_, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define DEFERRED_LOG_CAST_0()
+#define DEFERRED_LOG_CAST_1(a) (uintptr_t)(a)
+#define DEFERRED_LOG_CAST_2(a, b) DEFERRED_LOG_CAST_1(a), (uintptr_t)(b)
+#define DEFERRED_LOG_CAST_3(a, b, c) DEFERRED_LOG_CAST_2(a, b), (uintptr_t)(c)
+#define DEFERRED_LOG_CAST_4(a, b, c, d) DEFERRED_LOG_CAST_3(a, b, c), (uintptr_t)(d)
+#define DEFERRED_LOG_CAST__(n, ...) DEFERRED_LOG_CAST_##n(__VA_ARGS__)
+#define DEFERRED_LOG_CAST_(n, ...) DEFERRED_LOG_CAST__(n, __VA_ARGS__)
+/* More than DEFERRED_LOG_MAX_ARGS arguments don't compile. */
+#define DEFERRED_LOG_ARGS(...) DEFERRED_LOG_CAST_(DEFERRED_LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+
+#define DLOG(tag, log_level, format, ...) do {                                                                     \
+        if ((tag).level >= (log_level))                                                                            \
+            deferred_log_write(&(tag), log_level, format,                                                          \
+                               (const uintptr_t [DEFERRED_LOG_MAX_ARGS]) { DEFERRED_LOG_ARGS(__VA_ARGS__) });      \
+    } while (0)
+
+#define DLOGE(tag, format, ...) DLOG(tag, ESP_LOG_ERROR, format, ##__VA_ARGS__)
+#define DLOGW(tag, format, ...) DLOG(tag, ESP_LOG_WARN, format, ##__VA_ARGS__)
+#define DLOGI(tag, format, ...) DLOG(tag, ESP_LOG_INFO, format, ##__VA_ARGS__)
+#define DLOGD(tag, format, ...) DLOG(tag, ESP_LOG_DEBUG, format, ##__VA_ARGS__)
+#define DLOGV(tag, format, ...) DLOG(tag, ESP_LOG_VERBOSE, format, ##__VA_ARGS__)
+
+/**
+ * @brief     add [tag] to the tags the log command can set, called by DEFERRED_LOG_TAG()
+ */
+void deferred_log_register(struct deferred_log_tag *tag);
+
+/**
+ * @brief     queue a record, or format it right away if deferred_log_setup() wasn't called yet
+ */
+void deferred_log_write(const struct deferred_log_tag *tag, esp_log_level_t level, const char *format,
+                        const uintptr_t args[DEFERRED_LOG_MAX_ARGS]);
+
+/**
+ * @brief     create the queue and the task that formats the records
+ */
+esp_err_t deferred_log_setup(void);
+
+/**
+ * @brief     set the level of the tags named [tag_name], or of all tags for "*", returns the number of tags set
+ *
+ * Also sets the level of [tag_name] for ESP_LOG*(), so the deferred and the direct messages of a tag stay in line.
+ */
+int deferred_log_level_set(const char *tag_name, esp_log_level_t level);
+
+/**
+ * @brief     print the tags with their level, and the number of dropped records, to [out]
+ */
+void deferred_log_print(FILE *out);
+
+#endif /* DEFERRED_LOG_H */
@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "fs-tree.h"
+
+static const char *const TAG = "fs-tree";
+
+/* The state of one operation, the paths are extended and cut back in place while walking the tree. */
+struct fs_tree_op {
+    char src[FS_TREE_PATH_MAX], dst[FS_TREE_PATH_MAX];
+    char *buf;
+    uint32_t total;
+    struct cancel_token *cancel;
+    struct fs_tree_stats *stats;
+};
+
+/* Appends "/[name]" to [path] of length [len], and returns the new length, or 0 with errno set if it doesn't fit. */
+static size_t path_append(char *path, size_t len, const char *name) {
+    size_t name_len = strlen(name);
+
+    if (len + 1 + name_len >= FS_TREE_PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    path[len++] = '/';
+    memcpy(&path[len], name, name_len + 1);
+    return len + name_len;
+}
+
+static const char *path_basename(const char *path) {
+    const char *slash = strrchr(path, '/');
+
+    return slash ? slash + 1 : path;
+}
+
+static int fail(struct fs_tree_op *op, const char *path) {
+    int err = errno;
+
+    ESP_LOGE(TAG, "Failed on %s: %s", path, strerror(err));
+    snprintf(op->stats->failed_path, sizeof(op->stats->failed_path), "%s", path);
+    errno = err;
+    return -1;
+}
+
+static bool is_dir(const char *path) {
+    struct stat st;
+
+    return !stat(path, &st) && S_ISDIR(st.st_mode);
+}
+
+static int copy_file(struct fs_tree_op *op) {
+    int in, out;
+    ssize_t n = 0;
+
+    /* Before the destination is created, a cancel between files mustn't leave an empty copy behind. */
+    if (cancel_token_cancelled(op->cancel)) {
+        errno = ECANCELED;
+        return fail(op, op->src);
+    }
+    if ((in = open(op->src, O_RDONLY)) < 0)
+        return fail(op, op->src);
+    if ((out = open(op->dst, O_WRONLY | O_CREAT | O_TRUNC)) < 0) {
+        close(in);
+        return fail(op, op->dst);
+    }
+
+    while (!cancel_token_cancelled(op->cancel) && (n = read(in, op->buf, FS_TREE_BUF_LEN)) > 0) {
+        for (ssize_t written = 0, ret; written < n; written += ret) {
+            if ((ret = write(out, &op->buf[written], n - written)) < 0) {
+                n = -1;
+                break;
+            }
+        }
+        if (n < 0)
+            break;
+        op->stats->bytes += n;
+        cancel_token_progress(op->cancel, op->stats->bytes, op->total);
+    }
+    if (n > 0)
+        errno = ECANCELED;
+    close(in);
+    /* LittleFS only commits the file when it's closed, which can fail as well. */
+    if (close(out) && !n)
+        n = -1;
+
+    if (n) {
+        int err = errno;
+
+        /* Don't leave half a file behind. */
+        remove(op->dst);
+        errno = err;
+        return fail(op, op->dst);
+    }
+    op->stats->files++;
+    return 0;
+}
+
+static int copy_dir(struct fs_tree_op *op, int depth) {
+    size_t src_len = strlen(op->src), dst_len = strlen(op->dst);
+    struct dirent *dp;
+    int ret = 0;
+    DIR *dir;
+
+    if (depth >= LITTLEFS_MAX_DEPTH) {
+        errno = ENAMETOOLONG;
+        return fail(op, op->src);
+    }
+    if (mkdir(op->dst, 0777) && (errno != EEXIST || !is_dir(op->dst)))
+        return fail(op, op->dst);
+    if (!(dir = opendir(op->src)))
+        return fail(op, op->src);
+    op->stats->dirs++;
+
+    while (!ret && (dp = readdir(dir))) {
+        if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
+            continue;
+        if (cancel_token_cancelled(op->cancel)) {
+            errno = ECANCELED;
+            ret = fail(op, op->src);
+        } else if (!path_append(op->src, src_len, dp->d_name) || !path_append(op->dst, dst_len, dp->d_name)) {
+            ret = fail(op, op->src);
+        } else if (dp->d_type == DT_DIR) {
+            ret = copy_dir(op, depth + 1);
+        } else {
+            ret = copy_file(op);
+        }
+        op->src[src_len] = '\0';
+        op->dst[dst_len] = '\0';
+    }
+
+    closedir(dir);
+    return ret;
+}
+
+static int remove_dir(struct fs_tree_op *op, int depth) {
+    size_t len = strlen(op->src);
+    struct dirent *dp;
+    int ret = 0;
+    DIR *dir;
+
+    if (depth >= LITTLEFS_MAX_DEPTH) {
+        errno = ENAMETOOLONG;
+        return fail(op, op->src);
+    }
+    if (!(dir = opendir(op->src)))
+        return fail(op, op->src);
+
+    /* LittleFS keeps open directories in place when one of their entries is removed. */
+    while (!ret && (dp = readdir(dir))) {
+        if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
+            continue;
+        if (cancel_token_cancelled(op->cancel)) {
+            errno = ECANCELED;
+            ret = fail(op, op->src);
+        } else if (!path_append(op->src, len, dp->d_name)) {
+            ret = fail(op, op->src);
+        } else if (dp->d_type == DT_DIR) {
+            ret = remove_dir(op, depth + 1);
+        } else if (remove(op->src)) {
+            ret = fail(op, op->src);
+        } else {
+            op->stats->files++;
+            cancel_token_progress(op->cancel, op->stats->files + op->stats->dirs, 0);
+        }
+        op->src[len] = '\0';
+    }
+
+    closedir(dir);
+    if (!ret && rmdir(op->src))
+        ret = fail(op, op->src);
+    if (!ret)
+        op->stats->dirs++;
+    return ret;
+}
+
+static esp_err_t op_start(struct fs_tree_op *op, const char *src, const char *dst, struct cancel_token *cancel,
+                          struct fs_tree_stats *stats) {
+    *stats = (struct fs_tree_stats) { .us = esp_timer_get_time() };
+    *op = (struct fs_tree_op) { .cancel = cancel, .stats = stats };
+    if (strlen(src) >= FS_TREE_PATH_MAX || (dst && strlen(dst) >= FS_TREE_PATH_MAX)) {
+        errno = ENAMETOOLONG;
+        return ESP_ERR_INVALID_ARG;
+    }
+    strcpy(op->src, src);
+    if (dst)
+        strcpy(op->dst, dst);
+    return ESP_OK;
+}
+
+static int op_finish(struct fs_tree_op *op, int ret) {
+    int err = errno;
+
+    free(op->buf);
+    op->stats->us = esp_timer_get_time() - op->stats->us;
+    errno = err;
+    return ret;
+}
+
+/* Copies op->src to op->dst, both set up by the caller. */
+static int op_copy(struct fs_tree_op *op, bool recursive) {
+    struct stat st;
+
+    if (stat(op->src, &st))
+        return fail(op, op->src);
+    if (S_ISDIR(st.st_mode) && !recursive) {
+        errno = EISDIR;
+        return fail(op, op->src);
+    }
+    /* Copying a directory into itself would never end. */
+    if (S_ISDIR(st.st_mode) && !strncmp(op->dst, op->src, strlen(op->src)) &&
+        (op->dst[strlen(op->src)] == '/' || !op->dst[strlen(op->src)])) {
+        errno = EINVAL;
+        return fail(op, op->dst);
+    }
+    if (!(op->buf = malloc(FS_TREE_BUF_LEN))) {
+        errno = ENOMEM;
+        return fail(op, op->src);
+    }
+    if (S_ISDIR(st.st_mode))
+        return copy_dir(op, 0);
+    op->total = st.st_size;
+    return copy_file(op);
+}
+
+static int op_remove(struct fs_tree_op *op, bool recursive) {
+    struct stat st;
+
+    if (stat(op->src, &st))
+        return fail(op, op->src);
+    if (S_ISDIR(st.st_mode)) {
+        if (recursive)
+            return remove_dir(op, 0);
+        if (rmdir(op->src))
+            return fail(op, op->src);
+        op->stats->dirs++;
+        return 0;
+    }
+    if (remove(op->src))
+        return fail(op, op->src);
+    op->stats->files++;
+    return 0;
+}
+
+/* A destination that is an existing directory gets the name of the source appended. */
+static int op_into_dir(struct fs_tree_op *op) {
+    if (is_dir(op->dst) && !path_append(op->dst, strlen(op->dst), path_basename(op->src)))
+        return fail(op, op->dst);
+    return 0;
+}
+
+int fs_tree_copy(const char *src, const char *dst, bool recursive, struct cancel_token *cancel,
+                 struct fs_tree_stats *stats) {
+    struct fs_tree_op op;
+
+    if (op_start(&op, src, dst, cancel, stats) != ESP_OK)
+        return op_finish(&op, fail(&op, src));
+    if (op_into_dir(&op))
+        return op_finish(&op, -1);
+    return op_finish(&op, op_copy(&op, recursive));
+}
+
+int fs_tree_remove(const char *path, bool recursive, struct cancel_token *cancel, struct fs_tree_stats *stats) {
+    struct fs_tree_op op;
+
+    if (op_start(&op, path, NULL, cancel, stats) != ESP_OK)
+        return op_finish(&op, fail(&op, path));
+    return op_finish(&op, op_remove(&op, recursive));
+}
+
+int fs_tree_move(const char *src, const char *dst, struct cancel_token *cancel, struct fs_tree_stats *stats) {
+    struct fs_tree_op op;
+    int ret;
+
+    if (op_start(&op, src, dst, cancel, stats) != ESP_OK)
+        return op_finish(&op, fail(&op, src));
+    if (op_into_dir(&op))
+        return op_finish(&op, -1);
+    if (!rename(op.src, op.dst))
+        return op_finish(&op, 0);
+    if (errno != EXDEV)
+        return op_finish(&op, fail(&op, op.src));
+
+    ESP_LOGI(TAG, "Can't rename %s to %s, copying it", op.src, op.dst);
+    /* Only a copy that got every file across may remove the source, a cancelled or failed one leaves it alone. */
+    if ((ret = op_copy(&op, true)))
+        return op_finish(&op, ret);
+    if (cancel_token_cancelled(cancel)) {
+        errno = ECANCELED;
+        return op_finish(&op, fail(&op, op.src));
+    }
+    /* The copy counted the files and bytes, the removal only has to succeed. */
+    struct fs_tree_stats copied = *stats;
+    ret = op_remove(&op, true);
+    *stats = copied;
+    return op_finish(&op, ret);
+}
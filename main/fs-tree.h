@@ -0,0 +1,52 @@
+#ifndef FS_TREE_H
+#define FS_TREE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sipkip-audio.h"
+#include "utils.h"
+
+#define FS_TREE_PATH_MAX ((CONFIG_LITTLEFS_OBJ_NAME_LEN + 1) * LITTLEFS_MAX_DEPTH)
+/**
+ * Files are copied in chunks of this many bytes, a multiple of the LittleFS block size, so LittleFS reads whole blocks
+ * from flash past its cache instead of CONFIG_LITTLEFS_READ_SIZE at a time. The buffer is allocated once per operation,
+ * not per file.
+ */
+#define FS_TREE_BUF_LEN (4 * LITTLEFS_BLOCK_SIZE)
+
+/* What an operation did, and where it failed. */
+struct fs_tree_stats {
+    unsigned long files, dirs;
+    uint32_t bytes;
+    int64_t us;
+    /* The path of the file or directory the operation failed on, empty if it didn't fail. */
+    char failed_path[FS_TREE_PATH_MAX];
+};
+
+/**
+ * @brief     copy file [src] to [dst], or with [recursive] also directory [src] and everything below it
+ *
+ * If [dst] is an existing directory, [src] is copied into it. The directory tree is walked once, copying every file as
+ * it's found. The bytes copied are reported to [cancel], with the size of [src] as total if it's a file. Returns 0, or
+ * -1 with errno set, ECANCELED if [cancel] was cancelled, in which case the file that was being copied is removed. The
+ * files copied before the cancel stay, the ones after it aren't created.
+ */
+int fs_tree_copy(const char *src, const char *dst, bool recursive, struct cancel_token *cancel,
+                 struct fs_tree_stats *stats);
+
+/**
+ * @brief     remove file or empty directory [path], or with [recursive] also everything below it
+ */
+int fs_tree_remove(const char *path, bool recursive, struct cancel_token *cancel, struct fs_tree_stats *stats);
+
+/**
+ * @brief     move [src] to [dst], or into [dst] if it's an existing directory
+ *
+ * A rename within LittleFS moves files and directories across directories without copying. Only if the rename fails
+ * with EXDEV, because [src] and [dst] are on different file systems, [src] is copied and then removed. [src] is only
+ * removed once all of it was copied, if the copy fails or is cancelled it stays as it is.
+ */
+int fs_tree_move(const char *src, const char *dst, struct cancel_token *cancel, struct fs_tree_stats *stats);
+
+#endif /* FS_TREE_H */
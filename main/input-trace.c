@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+#include "esp_err.h"
+#include "esp_timer.h"
+
+#include "input-trace.h"
+#include "utils.h"
+
+static const char *const type_names[INPUT_TRACE_TYPE_N] = {
+    [INPUT_TRACE_EDGES_RISING] = "rising",
+    [INPUT_TRACE_EDGES_FALLING] = "falling",
+    [INPUT_TRACE_QUEUE_FULL] = "queue full",
+    [INPUT_TRACE_DEBOUNCE_REJECTED] = "bounce",
+    [INPUT_TRACE_GESTURE] = "gesture",
+    [INPUT_TRACE_PLAYBACK_STOP_REQUESTED] = "stop clip",
+    [INPUT_TRACE_PLAYBACK_START] = "clip start",
+    [INPUT_TRACE_PLAYBACK_END] = "clip end"
+};
+
+struct input_trace_record input_trace_ring[CONFIG_SIPKIP_INPUT_TRACE_LEN];
+uint32_t input_trace_head = 0;
+
+void input_trace_print(FILE *out, size_t n) {
+    uint32_t head = __atomic_load_n(&input_trace_head, __ATOMIC_RELAXED);
+    uint32_t now_us = esp_timer_get_time();
+
+    n = MIN(n, MIN(head, CONFIG_SIPKIP_INPUT_TRACE_LEN));
+    fprintf(out, "%"PRIu32" records, showing the last %u:\n", head, n);
+    for (uint32_t i = head - n; i != head; i++) {
+        struct input_trace_record record = input_trace_ring[i & (CONFIG_SIPKIP_INPUT_TRACE_LEN - 1)];
+        /* Unsigned, so it's right across the wrap of the timestamps. */
+        uint32_t age_us = now_us - record.timestamp_us;
+
+        fprintf(out, "%10.3f ms  %-10s ", age_us / -1000.0,
+                record.type < INPUT_TRACE_TYPE_N ? type_names[record.type] : "?");
+        if (record.input != INPUT_TRACE_NO_INPUT)
+            fprintf(out, "input %2u  ", record.input);
+        switch (record.type) {
+            case INPUT_TRACE_EDGES_RISING:
+            case INPUT_TRACE_EDGES_FALLING:
+            case INPUT_TRACE_QUEUE_FULL:
+                fprintf(out, "mask 0x%05"PRIx32"\n", record.arg);
+                break;
+            case INPUT_TRACE_DEBOUNCE_REJECTED:
+                fprintf(out, "after %"PRIu32" us\n", record.arg);
+                break;
+            case INPUT_TRACE_GESTURE:
+                fprintf(out, "gesture %"PRIu32" count %"PRIu32"\n", record.arg & UINT8_MAX, record.arg >> 8);
+                break;
+            case INPUT_TRACE_PLAYBACK_START:
+                fprintf(out, "%"PRIu32" packets\n", record.arg);
+                break;
+            case INPUT_TRACE_PLAYBACK_END:
+                fprintf(out, "%s\n", esp_err_to_name(record.arg));
+                break;
+            default:
+                fprintf(out, "\n");
+                break;
+        }
+    }
+}
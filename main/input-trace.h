@@ -0,0 +1,73 @@
+#ifndef INPUT_TRACE_H
+#define INPUT_TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_attr.h"
+#include "sdkconfig.h"
+
+/**
+ * A ring of the last CONFIG_SIPKIP_INPUT_TRACE_LEN things that happened to the inputs, from the edge seen by the mux
+ * interrupt up to the clip it started or stopped, so a press that "didn't work" can be traced back with the inputs
+ * command.
+ *
+ * Records are written from interrupts and tasks on both cores without a lock: a writer claims a slot by incrementing
+ * the head atomically and fills it in. The ring is only read by input_trace_print(), which may see a record that is
+ * being overwritten at that moment; that costs one garbled line, instead of a lock in the mux interrupt.
+ */
+
+#if CONFIG_SIPKIP_INPUT_TRACE_LEN & (CONFIG_SIPKIP_INPUT_TRACE_LEN - 1)
+#error "CONFIG_SIPKIP_INPUT_TRACE_LEN has to be a power of two"
+#endif
+
+enum input_trace_type {
+    INPUT_TRACE_EDGES_RISING,       /* [arg] is the mask of the inputs, sampled by the mux interrupt. */
+    INPUT_TRACE_EDGES_FALLING,      /* [arg] is the mask of the inputs, sampled by the mux interrupt. */
+    INPUT_TRACE_QUEUE_FULL,         /* [arg] is the mask of the edges that were dropped by the gesture engine. */
+    INPUT_TRACE_DEBOUNCE_REJECTED,  /* [arg] is how long in us [input] was at the other level. */
+    INPUT_TRACE_GESTURE,            /* [arg] is the enum muxed_gesture in the low byte and the count above it. */
+    INPUT_TRACE_PLAYBACK_STOP_REQUESTED, /* [input] asked the clip that is playing to stop. */
+    INPUT_TRACE_PLAYBACK_START,     /* [arg] is the number of packets of the clip. */
+    INPUT_TRACE_PLAYBACK_END,       /* [arg] is the esp_err_t with which the clip ended, ESP_ERR_NOT_FINISHED if cut. */
+
+    INPUT_TRACE_TYPE_N
+};
+
+#define INPUT_TRACE_NO_INPUT UINT8_MAX
+
+struct input_trace_record {
+    uint32_t timestamp_us; /* The low bits of esp_timer_get_time(), which wrap after 71 minutes. */
+    uint32_t arg;
+    uint8_t type;          /* enum input_trace_type. */
+    uint8_t input;         /* enum muxed_inputs, or INPUT_TRACE_NO_INPUT. */
+};
+
+extern struct input_trace_record input_trace_ring[CONFIG_SIPKIP_INPUT_TRACE_LEN];
+extern uint32_t input_trace_head;
+
+/**
+ * @brief     add a record to the ring, overwriting the oldest one
+ *
+ * Safe to call from interrupts. [timestamp_us] is passed in since the callers already have one, reading the timer
+ * again would cost more than the record itself.
+ */
+static inline void IRAM_ATTR input_trace_record(enum input_trace_type type, uint8_t input, uint32_t arg,
+                                                int64_t timestamp_us) {
+    uint32_t slot = __atomic_fetch_add(&input_trace_head, 1, __ATOMIC_RELAXED) & (CONFIG_SIPKIP_INPUT_TRACE_LEN - 1);
+
+    input_trace_ring[slot] = (struct input_trace_record) {
+        .timestamp_us = timestamp_us,
+        .arg = arg,
+        .type = type,
+        .input = input
+    };
+}
+
+/**
+ * @brief     print the last [n] records to [out], oldest first, with their time relative to now
+ */
+void input_trace_print(FILE *out, size_t n);
+
+#endif /* INPUT_TRACE_H */
@@ -0,0 +1,246 @@
+#define _GNU_SOURCE /* For fopencookie(). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_err.h"
+
+#include "jobs.h"
+#include "utils.h"
+
+static const char *const TAG = "jobs";
+
+/* The same as the reader tasks of the sessions, because speak decodes on it. */
+#define JOB_STACK_SIZE 24576
+/* Below the reader tasks, so the shell stays responsive while a job decodes or copies. */
+#define JOB_PRIORITY 4
+/* How long to wait before checking again whether the jobs of a closing session finished. */
+#define JOB_POLL_MS 10
+
+struct job {
+    unsigned int id;
+    /* The session that started the job, which prints its output and frees it. */
+    struct spp_session *owner;
+    const struct vfs_commands *command;
+    /* Set by the job task when the command returned, after which only the owner touches the job. */
+    bool done;
+    /* Set by jobs_kill(), the cancel token is also cancelled by others, like the playback of a clip being stopped. */
+    bool killed;
+    esp_err_t err;
+    /* The first CONFIG_SIPKIP_JOB_OUTPUT_LEN bytes of the output, and how many bytes after those were dropped. */
+    char output[CONFIG_SIPKIP_JOB_OUTPUT_LEN];
+    size_t output_len, output_dropped;
+    int argc;
+    char *argv[SPP_MAX_ARGC];
+    /* The arguments, each terminated by a NUL, they came from a single line so they fit. */
+    char args[SPP_LINE_BUF_LEN];
+    /* The copy of the owner the command runs on, with its own output stream, working directory and cancel token. */
+    struct spp_session session;
+};
+
+static struct job *jobs[CONFIG_SIPKIP_MAX_JOBS];
+static unsigned int last_job_id = 0;
+static SemaphoreHandle_t jobs_mutex = NULL;
+
+static void print_command_line(FILE *out, const struct job *job) {
+    for (int i = 0; i < job->argc; i++)
+        fprintf(out, " %s", job->argv[i]);
+    fprintf(out, "\n");
+}
+
+static ssize_t job_out_write(void *cookie, const char *buf, size_t size) {
+    struct job *job = cookie;
+    size_t len = MIN(size, sizeof(job->output) - job->output_len);
+
+    memcpy(&job->output[job->output_len], buf, len);
+    job->output_len += len;
+    job->output_dropped += size - len;
+    /* Claim the whole write, a command that prints a lot shouldn't fail on it. */
+    return size;
+}
+
+static void free_job(struct job *job) {
+    free(job);
+}
+
+static void job_task_handler(void *arg) {
+    struct job *job = arg;
+
+    ESP_LOGI(TAG, "Job %u of vfs fd %d started: %s", job->id, job->owner->fd, job->command->name);
+    job->err = job->command->fn(&job->session, job->argc, job->argv);
+    job->session.command = NULL;
+    fclose(job->session.out);
+    job->session.out = NULL;
+    ESP_LOGI(TAG, "Job %u finished: %s", job->id, esp_err_to_name(job->err));
+    __atomic_store_n(&job->done, true, __ATOMIC_RELEASE);
+    vTaskDelete(NULL);
+}
+
+esp_err_t jobs_setup(void) {
+    if (jobs_mutex)
+        return ESP_OK;
+
+    jobs_mutex = xSemaphoreCreateMutex();
+    return jobs_mutex ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void jobs_start(struct spp_session *session, const struct vfs_commands *command, int argc, char **argv) {
+    struct job *job;
+    size_t len = 0;
+    int slot;
+
+    if (command_takes_over_fd(command)) {
+        fprintf(session->out, "%s can't run in the background!\n", command->name);
+        return;
+    }
+    if (!(job = calloc(1, sizeof(*job)))) {
+        fprintf(session->out, "Out of memory!\n");
+        return;
+    }
+
+    job->owner = session;
+    job->command = command;
+    job->argc = argc;
+    for (int i = 0; i < argc; i++) {
+        size_t arg_len = strlen(argv[i]) + 1;
+
+        job->argv[i] = memcpy(&job->args[len], argv[i], arg_len);
+        len += arg_len;
+    }
+    job->session.fd = session->fd;
+    job->session.handle = session->handle;
+    job->session.command = command;
+    strcpy(job->session.cwd, session->cwd);
+    /* Unbuffered, the output goes straight into the job, a stdio buffer would only take up more RAM. */
+    job->session.out = fopencookie(job, "w", (cookie_io_functions_t) { .write = &job_out_write });
+    if (!job->session.out || setvbuf(job->session.out, NULL, _IONBF, 0)) {
+        fprintf(session->out, "Out of memory!\n");
+        if (job->session.out)
+            fclose(job->session.out);
+        free_job(job);
+        return;
+    }
+
+    xSemaphoreTake(jobs_mutex, portMAX_DELAY);
+    for (slot = 0; slot < CONFIG_SIPKIP_MAX_JOBS && jobs[slot]; slot++);
+    if (slot == CONFIG_SIPKIP_MAX_JOBS) {
+        xSemaphoreGive(jobs_mutex);
+        fprintf(session->out, "Too many jobs, the limit is %d!\n", CONFIG_SIPKIP_MAX_JOBS);
+        goto exit;
+    }
+    job->id = ++last_job_id;
+    jobs[slot] = job;
+    if (xTaskCreate(&job_task_handler, "Job", JOB_STACK_SIZE, job, JOB_PRIORITY, NULL) != pdPASS) {
+        jobs[slot] = NULL;
+        xSemaphoreGive(jobs_mutex);
+        fprintf(session->out, "Failed to create the job task!\n");
+        goto exit;
+    }
+    xSemaphoreGive(jobs_mutex);
+
+    /* Only this session frees the job, so it's still there. */
+    fprintf(session->out, "[%u]\n", job->id);
+    return;
+
+exit:
+    fclose(job->session.out);
+    free_job(job);
+}
+
+void jobs_print(FILE *out) {
+    xSemaphoreTake(jobs_mutex, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_SIPKIP_MAX_JOBS; i++) {
+        const struct job *job = jobs[i];
+        uint32_t done, total;
+
+        if (!job)
+            continue;
+        done = __atomic_load_n(&job->session.cancel.done, __ATOMIC_RELAXED);
+        total = __atomic_load_n(&job->session.cancel.total, __ATOMIC_RELAXED);
+        fprintf(out, "[%u] %d %s", job->id, job->owner->fd,
+                __atomic_load_n(&job->done, __ATOMIC_ACQUIRE) ? "done" :
+                job->killed ? "killing" : "running");
+        if (total)
+            fprintf(out, " %"PRIu32"/%"PRIu32" (%"PRIu32"%%)", done, total, (uint32_t)((uint64_t)done * 100 / total));
+        else if (done)
+            /* Walking a directory tree, of which the size isn't known up front. */
+            fprintf(out, " %"PRIu32, done);
+        print_command_line(out, job);
+    }
+    xSemaphoreGive(jobs_mutex);
+}
+
+bool jobs_kill(unsigned int id) {
+    bool found = false;
+
+    xSemaphoreTake(jobs_mutex, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_SIPKIP_MAX_JOBS; i++) {
+        if (jobs[i] && jobs[i]->id == id) {
+            cancel_token_cancel(&jobs[i]->session.cancel);
+            /* A job that already finished wasn't stopped by this, it's reported with how it finished. */
+            jobs[i]->killed = !__atomic_load_n(&jobs[i]->done, __ATOMIC_ACQUIRE);
+            found = true;
+        }
+    }
+    xSemaphoreGive(jobs_mutex);
+    return found;
+}
+
+void jobs_report(struct spp_session *session) {
+    xSemaphoreTake(jobs_mutex, portMAX_DELAY);
+    for (int i = 0; i < CONFIG_SIPKIP_MAX_JOBS; i++) {
+        struct job *job = jobs[i];
+
+        if (!job || job->owner != session || !__atomic_load_n(&job->done, __ATOMIC_ACQUIRE))
+            continue;
+        fprintf(session->out, "[%u] %s", job->id, job->killed ? "Killed" :
+                                                  job->err == ESP_OK ? "Done" : esp_err_to_name(job->err));
+        print_command_line(session->out, job);
+        fwrite(job->output, 1, job->output_len, session->out);
+        if (job->output_dropped) {
+            /* The output was most likely cut off in the middle of a line. */
+            if (job->output[job->output_len - 1] != '\n')
+                fputc('\n', session->out);
+            fprintf(session->out, "... %zu more bytes of output dropped\n", job->output_dropped);
+        }
+        if (job->err)
+            fprintf(session->out, "%s", job->command->usage);
+        jobs[i] = NULL;
+        free_job(job);
+    }
+    xSemaphoreGive(jobs_mutex);
+}
+
+void jobs_close(struct spp_session *session) {
+    for (;;) {
+        bool running = false;
+
+        xSemaphoreTake(jobs_mutex, portMAX_DELAY);
+        for (int i = 0; i < CONFIG_SIPKIP_MAX_JOBS; i++) {
+            struct job *job = jobs[i];
+
+            if (!job || job->owner != session)
+                continue;
+            cancel_token_cancel(&job->session.cancel);
+            if (__atomic_load_n(&job->done, __ATOMIC_ACQUIRE)) {
+                jobs[i] = NULL;
+                free_job(job);
+            } else {
+                running = true;
+            }
+        }
+        xSemaphoreGive(jobs_mutex);
+
+        if (!running)
+            break;
+        vTaskDelay(JOB_POLL_MS / portTICK_PERIOD_MS);
+    }
+}
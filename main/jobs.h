@@ -0,0 +1,59 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+#include "commands.h"
+#include "vfs-acceptor.h"
+
+/**
+ * Commands that end in a separate `&' run as jobs, each on its own task, so the shell stays responsive while a clip
+ * plays or a file is copied. A job runs on a copy of the session it was started from, with the working directory it
+ * had at that moment, and the first CONFIG_SIPKIP_JOB_OUTPUT_LEN bytes of its output are kept in memory. The output is
+ * printed by the session that started it, before the first prompt after the job finished.
+ *
+ * A job is stopped with the cancel token of its session, which the commands check where they can stop cleanly. The
+ * progress they report in the token is shown by the jobs command. The token is also cancelled when a clip that a job
+ * plays is stopped, only a job stopped by jobs_kill() is reported as killed.
+ */
+
+/**
+ * @brief     create the lock of the job table, called before the first session is served
+ */
+esp_err_t jobs_setup(void);
+
+/**
+ * @brief     run [command] with [argc] and [argv] as a job of [session], and print its job number
+ *
+ * The arguments are copied. Commands that take over the file descriptor can't run as a job, at most
+ * CONFIG_SIPKIP_MAX_JOBS jobs can run at once.
+ */
+void jobs_start(struct spp_session *session, const struct vfs_commands *command, int argc, char **argv);
+
+/**
+ * @brief     print the jobs of all sessions to [out], with the progress of those that are running
+ */
+void jobs_print(FILE *out);
+
+/**
+ * @brief     cancel job [id], returns false if there is no such job
+ */
+bool jobs_kill(unsigned int id);
+
+/**
+ * @brief     print the status and output of the jobs of [session] that finished, and forget them
+ *
+ * Called by the session before its prompts.
+ */
+void jobs_report(struct spp_session *session);
+
+/**
+ * @brief     cancel the jobs of [session], and wait for them to finish, called before the session is closed
+ */
+void jobs_close(struct spp_session *session);
+
+#endif /* JOBS_H */
@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_err.h"
+
+#include "manifest.h"
+#include "sipkip-audio.h"
+#include "utils.h"
+
+static const char *const TAG = "manifest";
+
+#define MANIFEST_PATH_MAX ((CONFIG_LITTLEFS_OBJ_NAME_LEN + 1) * LITTLEFS_MAX_DEPTH)
+
+/* Guards the cache file, and the path below. */
+static SemaphoreHandle_t manifest_mutex = NULL;
+/* Nothing below this path is cached since it was last invalidated, so the chunks of one RPC write only load it once. */
+static char last_invalidated[MANIFEST_PATH_MAX] = "";
+
+struct manifest_entry {
+    char *path;
+    uint32_t cksum;
+    unsigned long size;
+    long long mtime;
+};
+
+struct manifest {
+    struct manifest_entry *entries;
+    size_t n_entries, capacity;
+};
+
+static int manifest_compare_entries(const void *a, const void *b) {
+    return strcmp(((const struct manifest_entry *)a)->path, ((const struct manifest_entry *)b)->path);
+}
+
+static esp_err_t manifest_add_entry(struct manifest *manifest, const char *path, uint32_t cksum, unsigned long size,
+                                    long long mtime) {
+    if (manifest->n_entries == manifest->capacity) {
+        size_t capacity = manifest->capacity ? manifest->capacity * 2 : 64;
+        struct manifest_entry *entries = realloc(manifest->entries, capacity * sizeof(*entries));
+        if (!entries)
+            return ESP_ERR_NO_MEM;
+
+        manifest->entries = entries;
+        manifest->capacity = capacity;
+    }
+
+    char *path_copy = strdup(path);
+    if (!path_copy)
+        return ESP_ERR_NO_MEM;
+
+    manifest->entries[manifest->n_entries++] = (struct manifest_entry) {
+        .path = path_copy,
+        .cksum = cksum,
+        .size = size,
+        .mtime = mtime
+    };
+    return ESP_OK;
+}
+
+static void manifest_free(struct manifest *manifest) {
+    for (size_t i = 0; i < manifest->n_entries; i++)
+        free(manifest->entries[i].path);
+    free(manifest->entries);
+    *manifest = (struct manifest) {0};
+}
+
+/**
+ * CRC as used by the POSIX `cksum' utility, so that the host can hash its local files without any custom tools.
+ */
+static uint32_t manifest_cksum_update(uint32_t crc, const unsigned char *buf, size_t buf_size) {
+    while (buf_size--) {
+        crc ^= (uint32_t)*buf++ << 24;
+        for (int i = 0; i < 8; i++)
+            if (crc & 0x80000000)
+                crc = crc << 1 ^ 0x04C11DB7;
+            else
+                crc <<= 1;
+    }
+    return crc;
+}
+
+static uint32_t manifest_cksum_finish(uint32_t crc, unsigned long size) {
+    /* The length of the file is appended least significant byte first, using as few bytes as possible. */
+    for (; size; size >>= 8)
+        crc = manifest_cksum_update(crc, (unsigned char []) {size & 0xFF}, 1);
+    return ~crc;
+}
+
+static esp_err_t manifest_cksum_file(const char *path, unsigned char *buf, uint32_t *cksum, unsigned long *size) {
+    uint32_t crc = 0;
+    unsigned long total = 0;
+    ssize_t ret;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        ESP_LOGE(TAG, "Failed to open file %s: %s", path, strerror(errno));
+        return ESP_FAIL;
+    }
+
+    while ((ret = read(fd, buf, MANIFEST_READ_BUF_SIZE)) > 0) {
+        crc = manifest_cksum_update(crc, buf, ret);
+        total += ret;
+    }
+    close(fd);
+
+    if (ret < 0) {
+        ESP_LOGE(TAG, "Failed to read file %s: %s", path, strerror(errno));
+        return ESP_FAIL;
+    }
+
+    *cksum = manifest_cksum_finish(crc, total);
+    *size = total;
+    return ESP_OK;
+}
+
+/**
+ * Loads the cache, a missing or corrupted cache only means that the hashes have to be recomputed.
+ */
+static esp_err_t manifest_load(struct manifest *manifest) {
+    char line[MANIFEST_PATH_MAX + 64];
+    esp_err_t err = ESP_OK;
+    FILE *file = fopen(MANIFEST_CACHE_PATH, "r");
+
+    if (!file)
+        return ESP_OK;
+
+    while (err == ESP_OK && fgets(line, sizeof(line) / sizeof(*line), file)) {
+        unsigned long cksum, size;
+        long long mtime;
+        int path_offset;
+
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%lu %lu %lld %n", &cksum, &size, &mtime, &path_offset) != 3 || line[path_offset] != '/') {
+            ESP_LOGW(TAG, "Ignoring malformed line in %s: %s", MANIFEST_CACHE_PATH, line);
+            continue;
+        }
+        err = manifest_add_entry(manifest, &line[path_offset], cksum, size, mtime);
+    }
+    fclose(file);
+
+    qsort(manifest->entries, manifest->n_entries, sizeof(*manifest->entries), &manifest_compare_entries);
+    return err;
+}
+
+static esp_err_t manifest_save(const struct manifest *manifest) {
+    FILE *file = fopen(MANIFEST_CACHE_PATH".tmp", "w");
+
+    if (!file) {
+        ESP_LOGE(TAG, "Failed to open file %s: %s", MANIFEST_CACHE_PATH".tmp", strerror(errno));
+        return ESP_FAIL;
+    }
+
+    for (size_t i = 0; i < manifest->n_entries; i++) {
+        const struct manifest_entry *entry = &manifest->entries[i];
+        fprintf(file, "%lu %lu %lld %s\n", (unsigned long)entry->cksum, entry->size, entry->mtime, entry->path);
+    }
+
+    if (fclose(file)) {
+        ESP_LOGE(TAG, "Failed to write file %s: %s", MANIFEST_CACHE_PATH".tmp", strerror(errno));
+        return ESP_FAIL;
+    }
+    /* Replace the old cache in one go, so an interrupted update never leaves a truncated cache behind. */
+    if (rename(MANIFEST_CACHE_PATH".tmp", MANIFEST_CACHE_PATH)) {
+        ESP_LOGE(TAG, "Failed to move file %s to %s: %s", MANIFEST_CACHE_PATH".tmp", MANIFEST_CACHE_PATH,
+                 strerror(errno));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * Adds all files below [path] to [manifest], reusing the hash from [cached] if size and modification time match.
+ */
+static esp_err_t manifest_walk(const char *path, int depth, const struct manifest *cached, struct manifest *manifest,
+                               unsigned char *buf) {
+    struct dirent *dp;
+    esp_err_t err = ESP_OK;
+    DIR *dir;
+
+    if (depth >= LITTLEFS_MAX_DEPTH) {
+        ESP_LOGW(TAG, "Max directory nesting depth reached: %d!", LITTLEFS_MAX_DEPTH);
+        return ESP_OK;
+    }
+
+    dir = opendir(path);
+    if (!dir) {
+        ESP_LOGE(TAG, "Failed to open directory %s: %s!", path, strerror(errno));
+        return ESP_FAIL;
+    }
+
+    while (err == ESP_OK && (dp = readdir(dir)) != NULL) {
+        /* Accomodate for leading slashes, length of the path argument and trailing NUL character. */
+        char d_path[(CONFIG_LITTLEFS_OBJ_NAME_LEN + 1) + strlen(path) + 1];
+
+        if (!strcmp(dp->d_name, ".") || !strcmp(dp->d_name, ".."))
+            continue;
+
+        snprintf(d_path, sizeof(d_path) / sizeof(*d_path), "%s/%s", path, dp->d_name);
+
+        if (dp->d_type == DT_DIR) {
+            err = manifest_walk(d_path, depth + 1, cached, manifest, buf);
+        } else if (strcmp(d_path, MANIFEST_CACHE_PATH) && strcmp(d_path, MANIFEST_CACHE_PATH".tmp")) {
+            const struct manifest_entry key = { .path = d_path }, *entry;
+            unsigned long size;
+            uint32_t cksum;
+            struct stat st;
+
+            if (stat(d_path, &st)) {
+                ESP_LOGE(TAG, "Failed to stat file %s: %s", d_path, strerror(errno));
+                err = ESP_FAIL;
+                break;
+            }
+
+            /*
+             * Modification times only have a resolution of seconds, so size is checked as well. The clock restarts at
+             * every boot, the writes that could reuse the modification time of an entry have dropped it already.
+             */
+            entry = bsearch(&key, cached->entries, cached->n_entries, sizeof(*cached->entries),
+                            &manifest_compare_entries);
+            if (entry && entry->size == st.st_size && entry->mtime == (long long)st.st_mtime) {
+                cksum = entry->cksum;
+                size = entry->size;
+            } else if ((err = manifest_cksum_file(d_path, buf, &cksum, &size)) != ESP_OK) {
+                break;
+            }
+            err = manifest_add_entry(manifest, d_path, cksum, size, st.st_mtime);
+        }
+    }
+
+    closedir(dir);
+    return err;
+}
+
+esp_err_t manifest_print(FILE *out, const char *dirname) {
+    struct manifest cached = {0}, manifest = {0};
+    char path[MANIFEST_PATH_MAX];
+    unsigned char *buf = NULL;
+    size_t path_len;
+    esp_err_t err;
+
+    /* Make the path absolute and strip trailing slashes, so it can be compared against the cached paths. */
+    if (dirname[0] == '/') {
+        strncpy(path, dirname, sizeof(path) / sizeof(*path) - 1);
+        path[sizeof(path) / sizeof(*path) - 1] = '\0';
+    } else {
+        if (!getcwd(path, sizeof(path) / sizeof(*path)))
+            return ESP_FAIL;
+        path_len = strlen(path);
+        snprintf(&path[path_len], sizeof(path) / sizeof(*path) - path_len, "/%s", dirname);
+    }
+    for (path_len = strlen(path); path_len > 1 && path[path_len - 1] == '/'; path[--path_len] = '\0');
+
+    if (strncmp(path, LITTLEFS_BASE_PATH, strlen(LITTLEFS_BASE_PATH)) ||
+        (path[strlen(LITTLEFS_BASE_PATH)] != '/' && path[strlen(LITTLEFS_BASE_PATH)] != '\0')) {
+        ESP_LOGE(TAG, "Path %s doesn't start with %s", path, LITTLEFS_BASE_PATH);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    buf = malloc(MANIFEST_READ_BUF_SIZE);
+    if (!buf)
+        return ESP_ERR_NO_MEM;
+
+    xSemaphoreTake(manifest_mutex, portMAX_DELAY);
+    last_invalidated[0] = '\0';
+    if ((err = manifest_load(&cached)) != ESP_OK)
+        goto exit;
+
+    /* Entries outside of [dirname] are kept as they are, only [dirname] itself is walked. */
+    for (size_t i = 0; i < cached.n_entries; i++) {
+        const struct manifest_entry *entry = &cached.entries[i];
+        if (!strncmp(entry->path, path, path_len) && entry->path[path_len] == '/')
+            continue;
+        if ((err = manifest_add_entry(&manifest, entry->path, entry->cksum, entry->size, entry->mtime)) != ESP_OK)
+            goto exit;
+    }
+    if ((err = manifest_walk(path, 0, &cached, &manifest, buf)) != ESP_OK)
+        goto exit;
+
+    qsort(manifest.entries, manifest.n_entries, sizeof(*manifest.entries), &manifest_compare_entries);
+    if ((err = manifest_save(&manifest)) != ESP_OK)
+        goto exit;
+
+    for (size_t i = 0; i < manifest.n_entries; i++) {
+        const struct manifest_entry *entry = &manifest.entries[i];
+        if (!strncmp(entry->path, path, path_len) && entry->path[path_len] == '/')
+            fprintf(out, "%lu %lu %s\n", (unsigned long)entry->cksum, entry->size, &entry->path[path_len + 1]);
+    }
+
+exit:
+    xSemaphoreGive(manifest_mutex);
+    manifest_free(&cached);
+    manifest_free(&manifest);
+    free(buf);
+    return err;
+}
+
+esp_err_t manifest_invalidate(const char *path) {
+    struct manifest cached = {0};
+    size_t path_len = strlen(path), n_entries = 0;
+    esp_err_t err = ESP_OK;
+
+    xSemaphoreTake(manifest_mutex, portMAX_DELAY);
+    if (!strcmp(path, last_invalidated) || (err = manifest_load(&cached)) != ESP_OK)
+        goto exit;
+
+    /* Drop [path] and the entries below it, the rest stays sorted. */
+    for (size_t i = 0; i < cached.n_entries; i++) {
+        struct manifest_entry *entry = &cached.entries[i];
+        if (!strncmp(entry->path, path, path_len) && (entry->path[path_len] == '\0' || entry->path[path_len] == '/'))
+            free(entry->path);
+        else
+            cached.entries[n_entries++] = *entry;
+    }
+    if (n_entries < cached.n_entries) {
+        ESP_LOGI(TAG, "Dropping %u cached hashes of %s", (unsigned int)(cached.n_entries - n_entries), path);
+        cached.n_entries = n_entries;
+        if ((err = manifest_save(&cached)) != ESP_OK)
+            goto exit;
+    }
+    strncpy(last_invalidated, path, sizeof(last_invalidated) / sizeof(*last_invalidated) - 1);
+
+exit:
+    xSemaphoreGive(manifest_mutex);
+    manifest_free(&cached);
+    return err;
+}
+
+esp_err_t manifest_setup(void) {
+    if (manifest_mutex)
+        return ESP_OK;
+
+    manifest_mutex = xSemaphoreCreateMutex();
+    return manifest_mutex ? ESP_OK : ESP_ERR_NO_MEM;
+}
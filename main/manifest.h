@@ -0,0 +1,41 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stdio.h>
+
+#include "esp_err.h"
+
+#include "sipkip-audio.h"
+
+/**
+ * The manifest cache lives next to the assets themselves, it is skipped when walking the file tree.
+ */
+#define MANIFEST_CACHE_NAME ".manifest"
+#define MANIFEST_CACHE_PATH LITTLEFS_BASE_PATH"/"MANIFEST_CACHE_NAME
+#define MANIFEST_READ_BUF_SIZE 1024
+
+/**
+ * @brief     update the cached manifest of all files on the LITTLEFS partition, and print the entries below
+ *            [dirname] to [out]
+ *
+ * Every entry is printed as "<cksum> <size> <path>\n", with <path> relative to [dirname], which is the same format
+ * as the output of the POSIX `cksum' utility. Hashes are only recomputed for files of which the size or modification
+ * time differ from the cached entry, or of which the entry was dropped by manifest_invalidate().
+ */
+esp_err_t manifest_print(FILE *out, const char *dirname);
+
+/**
+ * @brief     drop the cached hashes of file [path], or of everything below directory [path]
+ *
+ * The clock restarts at every boot, so a file that is rewritten with the same size can get the modification time of
+ * its cached entry. Everything that writes to the LITTLEFS partition calls this once it's done writing, so the next
+ * manifest hashes those files again. [path] has to be absolute.
+ */
+esp_err_t manifest_invalidate(const char *path);
+
+/**
+ * @brief     create the mutex that guards the cache, before the first manifest_print() or manifest_invalidate()
+ */
+esp_err_t manifest_setup(void);
+
+#endif /* MANIFEST_H */
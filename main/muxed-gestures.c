@@ -0,0 +1,250 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "muxed-gestures.h"
+#include "input-trace.h"
+#include "utils.h"
+
+static const char *const TAG = "muxed-gestures";
+
+#define GESTURE_QUEUE_LEN 16
+
+enum input_state {
+    INPUT_STATE_RELEASED,
+    INPUT_STATE_PRESSED,
+    INPUT_STATE_LONG_PRESSED,
+    INPUT_STATE_MULTI_PRESS_WINDOW, /* Released, but a press now continues the series. */
+
+    INPUT_STATE_N
+};
+
+enum input_trigger {
+    INPUT_TRIGGER_PRESS,
+    INPUT_TRIGGER_RELEASE,
+    INPUT_TRIGGER_DEADLINE,
+
+    INPUT_TRIGGER_N
+};
+
+#define GESTURE_BIT(gesture) (1U << (gesture))
+
+/**
+ * The state machine of every input. The deadline of a state is armed when it is entered: the long press time for
+ * INPUT_STATE_PRESSED, the multi-press window for INPUT_STATE_MULTI_PRESS_WINDOW, and none for the others.
+ */
+static const struct transition {
+    enum input_state next_state;
+    unsigned int gestures; /* Bits of enum muxed_gesture to report, in the order of the enum. */
+} transitions[INPUT_STATE_N][INPUT_TRIGGER_N] = {
+    [INPUT_STATE_RELEASED] = {
+        [INPUT_TRIGGER_PRESS]    = { INPUT_STATE_PRESSED, GESTURE_BIT(MUXED_GESTURE_PRESS) },
+        [INPUT_TRIGGER_RELEASE]  = { INPUT_STATE_RELEASED, 0 },
+        [INPUT_TRIGGER_DEADLINE] = { INPUT_STATE_RELEASED, 0 }
+    },
+    [INPUT_STATE_PRESSED] = {
+        [INPUT_TRIGGER_PRESS]    = { INPUT_STATE_PRESSED, 0 },
+        [INPUT_TRIGGER_RELEASE]  = { INPUT_STATE_MULTI_PRESS_WINDOW, GESTURE_BIT(MUXED_GESTURE_RELEASE) },
+        [INPUT_TRIGGER_DEADLINE] = { INPUT_STATE_LONG_PRESSED, GESTURE_BIT(MUXED_GESTURE_LONG_PRESS) }
+    },
+    [INPUT_STATE_LONG_PRESSED] = {
+        [INPUT_TRIGGER_PRESS]    = { INPUT_STATE_LONG_PRESSED, 0 },
+        /* A long press ends the series, the next press starts a new one. */
+        [INPUT_TRIGGER_RELEASE]  = { INPUT_STATE_RELEASED, GESTURE_BIT(MUXED_GESTURE_RELEASE) },
+        [INPUT_TRIGGER_DEADLINE] = { INPUT_STATE_LONG_PRESSED, 0 }
+    },
+    [INPUT_STATE_MULTI_PRESS_WINDOW] = {
+        [INPUT_TRIGGER_PRESS]    = {
+            INPUT_STATE_PRESSED, GESTURE_BIT(MUXED_GESTURE_PRESS) | GESTURE_BIT(MUXED_GESTURE_MULTI_PRESS)
+        },
+        [INPUT_TRIGGER_RELEASE]  = { INPUT_STATE_MULTI_PRESS_WINDOW, 0 },
+        [INPUT_TRIGGER_DEADLINE] = { INPUT_STATE_RELEASED, 0 }
+    }
+};
+
+struct input {
+    struct muxed_gesture_config config;
+    enum input_state state;
+    /* The level reported by the scanner, and the level after debouncing. */
+    bool raw_level, level;
+    /* The time of the last change of raw_level. */
+    int64_t raw_timestamp_us;
+    /* The deadline of the current state, 0 if it has none. */
+    int64_t deadline_us;
+    /* The number of presses in the current series. */
+    unsigned int count;
+};
+
+/* The edges reported by the muxed GPIO task, with the levels of all inputs right after these edges. */
+struct edges {
+    muxed_inputs_mask_t mask;
+    muxed_inputs_mask_t levels;
+    int64_t timestamp_us;
+};
+
+static struct input inputs[MUXED_INPUT_N];
+static muxed_gesture_fn gesture_fn = NULL;
+static QueueHandle_t gesture_queue = NULL;
+static TaskHandle_t gesture_task_handle = NULL;
+
+static void enter_state(struct input *input, enum input_state state, int64_t timestamp_us) {
+    input->state = state;
+    input->deadline_us = 0;
+    switch (state) {
+        case INPUT_STATE_RELEASED:
+            input->count = 0;
+            break;
+        case INPUT_STATE_PRESSED:
+            if (input->config.long_press_ms)
+                input->deadline_us = timestamp_us + input->config.long_press_ms * 1000LL;
+            break;
+        case INPUT_STATE_MULTI_PRESS_WINDOW:
+            if (input->config.multi_press_window_ms)
+                input->deadline_us = timestamp_us + input->config.multi_press_window_ms * 1000LL;
+            else
+                enter_state(input, INPUT_STATE_RELEASED, timestamp_us);
+            break;
+        default:
+            break;
+    }
+}
+
+static void fire_trigger(enum muxed_inputs i, enum input_trigger trigger, int64_t timestamp_us) {
+    struct input *input = &inputs[i];
+    const struct transition *transition = &transitions[input->state][trigger];
+
+    unsigned int count = trigger == INPUT_TRIGGER_PRESS ? ++input->count : input->count;
+
+    /* Entering a state may reset the count, the gestures are reported with the count of the series they end. */
+    enter_state(input, transition->next_state, timestamp_us);
+    for (enum muxed_gesture gesture = MUXED_GESTURE_PRESS; gesture <= MUXED_GESTURE_MULTI_PRESS; gesture++) {
+        if (!(transition->gestures & GESTURE_BIT(gesture)))
+            continue;
+
+        struct muxed_gesture_event event = {
+            .input = i,
+            .gesture = gesture,
+            .count = count,
+            .timestamp_us = timestamp_us
+        };
+
+        ESP_LOGD(TAG, "Input %d gesture %d count %u", i, gesture, count);
+        input_trace_record(INPUT_TRACE_GESTURE, i, gesture | count << 8, timestamp_us);
+        gesture_fn(&event);
+    }
+}
+
+/**
+ * Fires the triggers of all inputs of which the debounce time or deadline passed, and returns the earliest time at
+ * which that has to be done again, or 0 if nothing is pending.
+ */
+static int64_t process_inputs(int64_t now_us) {
+    int64_t next_us = 0;
+
+    for (enum muxed_inputs i = MUXED_INPUT_MIN; i <= MUXED_INPUT_MAX; i++) {
+        struct input *input = &inputs[i];
+
+        if (input->raw_level != input->level) {
+            int64_t settled_us = input->raw_timestamp_us + input->config.debounce_ms * 1000LL;
+
+            if (now_us >= settled_us) {
+                input->level = input->raw_level;
+                fire_trigger(i, input->level ? INPUT_TRIGGER_PRESS : INPUT_TRIGGER_RELEASE, input->raw_timestamp_us);
+            } else if (!next_us || settled_us < next_us) {
+                next_us = settled_us;
+            }
+        }
+
+        if (input->deadline_us && now_us >= input->deadline_us)
+            fire_trigger(i, INPUT_TRIGGER_DEADLINE, input->deadline_us);
+        if (input->deadline_us && (!next_us || input->deadline_us < next_us))
+            next_us = input->deadline_us;
+    }
+
+    return next_us;
+}
+
+static void on_edges(const struct muxed_inputs_event *event) {
+    struct edges edges = {
+        .mask = event->mask,
+        .levels = muxed_gpio_get_input_levels(),
+        .timestamp_us = event->timestamp_us
+    };
+
+    if (xQueueSend(gesture_queue, &edges, 0) != pdTRUE) {
+        input_trace_record(INPUT_TRACE_QUEUE_FULL, INPUT_TRACE_NO_INPUT, edges.mask, edges.timestamp_us);
+        ESP_LOGW(TAG, "Gesture queue full, dropped edges 0x%08"PRIx32, edges.mask);
+    }
+}
+
+static void muxed_gestures_task_handler(void *arg) {
+    /**
+     * Inputs that are already active start out pressed without reporting it, so they can still be long pressed. Their
+     * edges since are waiting in the queue.
+     */
+    muxed_inputs_mask_t levels = muxed_gpio_wait_for_input_levels();
+    int64_t now_us = esp_timer_get_time();
+
+    for (enum muxed_inputs i = MUXED_INPUT_MIN; i <= MUXED_INPUT_MAX; i++) {
+        inputs[i].raw_level = inputs[i].level = levels & MUXED_INPUT_BIT(i);
+        inputs[i].raw_timestamp_us = now_us;
+        inputs[i].count = inputs[i].level;
+        enter_state(&inputs[i], inputs[i].level ? INPUT_STATE_PRESSED : INPUT_STATE_RELEASED, now_us);
+    }
+
+    int64_t next_us = process_inputs(now_us);
+
+    for (;;) {
+        struct edges edges;
+        TickType_t timeout = portMAX_DELAY;
+
+        if (next_us) {
+            int64_t remaining_us = next_us - esp_timer_get_time();
+
+            /**
+             * A timeout expires on a tick interrupt, so it ends up to a tick early. That only costs another iteration,
+             * while rounding up to make sure it's late would add a tick to the latency of every gesture.
+             */
+            timeout = remaining_us > 0 ? MAX(pdMS_TO_TICKS((remaining_us + 999) / 1000), 1) : 0;
+        }
+
+        if (pdTRUE == xQueueReceive(gesture_queue, &edges, timeout)) {
+            for (enum muxed_inputs i = MUXED_INPUT_MIN; i <= MUXED_INPUT_MAX; i++) {
+                if (!(edges.mask & MUXED_INPUT_BIT(i)))
+                    continue;
+                /* Going back to the debounced level before it settled means the previous edge was a bounce. */
+                if (inputs[i].raw_level != inputs[i].level && !(edges.levels & MUXED_INPUT_BIT(i)) == !inputs[i].level)
+                    input_trace_record(INPUT_TRACE_DEBOUNCE_REJECTED, i,
+                                       edges.timestamp_us - inputs[i].raw_timestamp_us, edges.timestamp_us);
+                /* The rising and falling edges of an input may have been merged, the level tells which came last. */
+                inputs[i].raw_level = edges.levels & MUXED_INPUT_BIT(i);
+                inputs[i].raw_timestamp_us = edges.timestamp_us;
+            }
+        }
+
+        next_us = process_inputs(esp_timer_get_time());
+    }
+}
+
+void muxed_gestures_setup(const struct muxed_gesture_config (*configs)[MUXED_INPUT_N], muxed_gesture_fn fn) {
+    gesture_fn = fn;
+    gesture_queue = xQueueCreate(GESTURE_QUEUE_LEN, sizeof(struct edges));
+    if (!gesture_queue) {
+        ESP_LOGE(TAG, "Failed to create the gesture queue\n");
+        return;
+    }
+
+    for (enum muxed_inputs i = MUXED_INPUT_MIN; i <= MUXED_INPUT_MAX; i++)
+        inputs[i].config = (*configs)[i];
+    muxed_gpio_setup(&on_edges);
+
+    xTaskCreate(&muxed_gestures_task_handler, "Gesture task", 2560, NULL, 14, &gesture_task_handle);
+    if (!gesture_task_handle)
+        ESP_LOGE(TAG, "Failed to create the gesture task\n");
+}
@@ -0,0 +1,45 @@
+#ifndef MUXED_GESTURES_H
+#define MUXED_GESTURES_H
+
+#include <stdint.h>
+
+#include "muxed-gpio.h"
+
+enum muxed_gesture {
+    MUXED_GESTURE_PRESS,      /* The input became active after debouncing. */
+    MUXED_GESTURE_RELEASE,    /* The input became inactive after debouncing. */
+    MUXED_GESTURE_LONG_PRESS, /* The input is kept active for long_press_ms, it is still active. */
+    MUXED_GESTURE_MULTI_PRESS /* The input was pressed again within multi_press_window_ms of the previous release. */
+};
+
+/**
+ * Timing of the gestures of one input, a long_press_ms or multi_press_window_ms of 0 disables that gesture.
+ */
+struct muxed_gesture_config {
+    uint16_t debounce_ms;
+    uint16_t long_press_ms;
+    uint16_t multi_press_window_ms;
+};
+
+/**
+ * Every press is reported as MUXED_GESTURE_PRESS right away, a MUXED_GESTURE_MULTI_PRESS follows it when it's the
+ * second or later press of a series, with the number of presses in [count].
+ */
+struct muxed_gesture_event {
+    enum muxed_inputs input;
+    enum muxed_gesture gesture;
+    unsigned int count;
+    int64_t timestamp_us;
+};
+
+typedef void (*muxed_gesture_fn)(const struct muxed_gesture_event *event);
+
+/**
+ * @brief     set up the muxed GPIO, and report the gestures of every input to [fn]
+ *
+ * [fn] is called from the gesture task, so it shouldn't block for long. Inputs that are already active at setup don't
+ * report a press, but still report a long press if they're kept active.
+ */
+void muxed_gestures_setup(const struct muxed_gesture_config (*configs)[MUXED_INPUT_N], muxed_gesture_fn fn);
+
+#endif /* MUXED_GESTURES_H */
@@ -0,0 +1,480 @@
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+#include "soc/ledc_periph.h"
+#include "soc/gpio_reg.h"
+#include "soc/soc.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+
+#include "muxed-gpio-hal.h"
+#include "utils.h"
+
+static const char *const TAG = "muxed-gpio-hal";
+
+#define GPIO_NUM_MUX_BUTTONS_OUT  GPIO_NUM_4
+#define GPIO_NUM_MUX_CLIPS_OUT    GPIO_NUM_5        
+
+/* These are all the buttons on the tail. */
+#define GPIO_NUM_STAR_L_INOUT     GPIO_NUM_21
+#define GPIO_NUM_TRIANGLE_L_INOUT GPIO_NUM_19
+#define GPIO_NUM_SQUARE_L_INOUT   GPIO_NUM_27
+#define GPIO_NUM_HEART_L_INOUT    GPIO_NUM_14
+#define GPIO_NUM_HEART_R_INOUT    GPIO_NUM_12
+#define GPIO_NUM_SQUARE_R_INOUT   GPIO_NUM_13
+#define GPIO_NUM_TRIANGLE_R_INOUT GPIO_NUM_18
+#define GPIO_NUM_STAR_R_INOUT     GPIO_NUM_16
+/* This is the beak button. */
+#define GPIO_NUM_BEAK_IN          GPIO_NUM_15
+/* These are the inputs for the switch. */
+#define GPIO_NUM_SWITCH_LEARN_IN  GPIO_NUM_34
+#define GPIO_NUM_SWITCH_PLAY_IN   GPIO_NUM_35
+/* These are the outputs for the LEDs. */
+#define GPIO_NUM_LED_L_OUT        GPIO_NUM_22
+#define GPIO_NUM_LED_M_OUT        GPIO_NUM_26
+#define GPIO_NUM_LED_R_OUT        GPIO_NUM_17
+
+#define GPIO_PIN_BIT_MASK_OUT     ((1ULL << GPIO_NUM_LED_L_OUT)        | (1ULL << GPIO_NUM_LED_M_OUT)        |     \
+                                   (1ULL << GPIO_NUM_LED_R_OUT)        | (1ULL << GPIO_NUM_MUX_BUTTONS_OUT)  |     \
+                                   (1ULL << GPIO_NUM_MUX_CLIPS_OUT))
+#define GPIO_PIN_BIT_MASK_INOUT   ((1ULL << GPIO_NUM_STAR_L_INOUT)     | (1ULL << GPIO_NUM_TRIANGLE_L_INOUT) |     \
+                                   (1ULL << GPIO_NUM_SQUARE_L_INOUT)   | (1ULL << GPIO_NUM_HEART_L_INOUT)    |     \
+                                   (1ULL << GPIO_NUM_HEART_R_INOUT)    | (1ULL << GPIO_NUM_SQUARE_R_INOUT)   |     \
+                                   (1ULL << GPIO_NUM_TRIANGLE_R_INOUT) | (1ULL << GPIO_NUM_STAR_R_INOUT))
+#define GPIO_PIN_BIT_MASK_IN      ((1ULL << GPIO_NUM_BEAK_IN)          | (1ULL << GPIO_NUM_SWITCH_LEARN_IN)  |     \
+                                   (1ULL << GPIO_NUM_SWITCH_PLAY_IN))
+
+#define MUX_TIMER_BITS_TMP(bits)                                                                                   \
+    LEDC_TIMER_##bits##_BIT
+#define MUX_TIMER_BITS(bits)                                                                                       \
+    MUX_TIMER_BITS_TMP(bits)
+
+
+static const enum muxed_gpio_hal_phase gpio_num_to_mux_phase[GPIO_NUM_MAX] = {
+    [GPIO_NUM_MUX_BUTTONS_OUT] = MUXED_GPIO_HAL_PHASE_BUTTONS,
+    [GPIO_NUM_MUX_CLIPS_OUT] = MUXED_GPIO_HAL_PHASE_CLIPS
+};
+
+static const gpio_num_t muxed_inouts_to_gpio_num[] = {
+    /* 0..7 are inputs for the buttons that can be read if GPIO_NUM_MUX_BUTTONS_OUT is set high. */
+    [MUXED_INPUT_STAR_L_BUTTON] = GPIO_NUM_STAR_L_INOUT, [MUXED_INPUT_TRIANGLE_L_BUTTON] = GPIO_NUM_TRIANGLE_L_INOUT,
+    [MUXED_INPUT_SQUARE_L_BUTTON] = GPIO_NUM_SQUARE_L_INOUT, [MUXED_INPUT_HEART_L_BUTTON] = GPIO_NUM_HEART_L_INOUT,
+    [MUXED_INPUT_HEART_R_BUTTON] = GPIO_NUM_HEART_R_INOUT, [MUXED_INPUT_SQUARE_R_BUTTON] = GPIO_NUM_SQUARE_R_INOUT,
+    [MUXED_INPUT_TRIANGLE_R_BUTTON] = GPIO_NUM_TRIANGLE_R_INOUT, [MUXED_INPUT_STAR_R_BUTTON] = GPIO_NUM_STAR_R_INOUT,
+    /* 8..15 are inputs for the clips that can be read if GPIO_NUM_MUX_CLIPS_OUT is set high. */
+    [MUXED_INPUT_STAR_L_CLIP] = GPIO_NUM_STAR_L_INOUT, [MUXED_INPUT_TRIANGLE_L_CLIP] = GPIO_NUM_TRIANGLE_L_INOUT,
+    [MUXED_INPUT_SQUARE_L_CLIP] = GPIO_NUM_SQUARE_L_INOUT, [MUXED_INPUT_HEART_L_CLIP] = GPIO_NUM_HEART_L_INOUT,
+    [MUXED_INPUT_HEART_R_CLIP] = GPIO_NUM_HEART_R_INOUT, [MUXED_INPUT_SQUARE_R_CLIP] = GPIO_NUM_SQUARE_R_INOUT,
+    [MUXED_INPUT_TRIANGLE_R_CLIP] = GPIO_NUM_TRIANGLE_R_INOUT, [MUXED_INPUT_STAR_R_CLIP] = GPIO_NUM_STAR_R_INOUT,
+    /* The following GPIOs are only ever used as inputs. */
+    [MUXED_INPUT_BEAK_SWITCH] = GPIO_NUM_BEAK_IN,
+    [MUXED_INPUT_LEARN_SWITCH] = GPIO_NUM_SWITCH_LEARN_IN, [MUXED_INPUT_PLAY_SWITCH] = GPIO_NUM_SWITCH_PLAY_IN
+};
+
+/*                          { GPIO_NUM_LED_*_OUT, GPIO_NUM_*_*_INOUT } */
+static const struct { ledc_channel_t lmr_channel, bc_channel; } muxed_inouts_to_ledc_channel[] = {
+    [MUXED_OUTPUT_STAR_L_LED] = { .lmr_channel = LEDC_CHANNEL_0, .bc_channel = LEDC_CHANNEL_4 },
+    [MUXED_OUTPUT_TRIANGLE_L_LED] = { .lmr_channel = LEDC_CHANNEL_0, .bc_channel = LEDC_CHANNEL_5 },
+    [MUXED_OUTPUT_SQUARE_L_LED] = { .lmr_channel = LEDC_CHANNEL_1, .bc_channel = LEDC_CHANNEL_4 },
+    [MUXED_OUTPUT_HEART_L_LED] = { .lmr_channel = LEDC_CHANNEL_1, .bc_channel = LEDC_CHANNEL_5 },
+    [MUXED_OUTPUT_HEART_R_LED] = { .lmr_channel = LEDC_CHANNEL_1, .bc_channel = LEDC_CHANNEL_6 },
+    [MUXED_OUTPUT_SQUARE_R_LED] = { .lmr_channel = LEDC_CHANNEL_1, .bc_channel = LEDC_CHANNEL_7 },
+    [MUXED_OUTPUT_TRIANGLE_R_LED] = { .lmr_channel = LEDC_CHANNEL_0, .bc_channel = LEDC_CHANNEL_6 },
+    [MUXED_OUTPUT_STAR_R_LED] = { .lmr_channel = LEDC_CHANNEL_0, .bc_channel = LEDC_CHANNEL_7 }
+};
+
+/**
+ *                           |___               ______               ______               ______
+ * GPIO_NUM_LED_*_OUT:       |   |             |      |             |      |             |      |
+ *                           |    ^^^^^^^^^^^^^        ^^^^^^^^^^^^^        ^^^^^^^^^^^^^        ^^^
+ *                           |    ______               ______               ______               ___
+ * GPIO_NUM_MUX_CLIPS_OUT:   |   |      |             |      |             |      |             |
+ *                           |^^^        ^^^^^^^^^^^^^        ^^^^^^^^^^^^^        ^^^^^^^^^^^^^
+ *                           |           ______               ______               ______
+ * GPIO_NUM_MUX_BUTTONS_OUT: |          |      |             |      |             |      |
+ *                           |^^^^^^^^^^        ^^^^^^^^^^^^^       ^^^^^^^^^^^^^^        ^^^^^^^^^^
+ */
+    
+static const ledc_timer_config_t ledc_timer0_config = {
+    .speed_mode       = LEDC_HIGH_SPEED_MODE,
+    .timer_num        = LEDC_TIMER_0, 
+    .duty_resolution  = MUX_TIMER_BITS(MUX_PWM_BITS),
+    .freq_hz          = MUX_PWM_FREQUENCY,
+    .clk_cfg          = LEDC_USE_REF_TICK
+};
+
+static const ledc_channel_config_t ledc_channel_configs[] = {
+    {
+        .speed_mode     = LEDC_HIGH_SPEED_MODE,
+        .channel        = LEDC_CHANNEL_0,
+        .timer_sel      = LEDC_TIMER_0,
+        .intr_type      = LEDC_INTR_DISABLE,
+        .gpio_num       = GPIO_NUM_LED_L_OUT,
+        .duty           = MUX_PHASE_DUTY,
+        .hpoint         = MUX_LEDS_HPOINT /* Set the timer value at which the output will be latched. */
+    },
+    {
+        .speed_mode     = LEDC_HIGH_SPEED_MODE,
+        .channel        = LEDC_CHANNEL_1,
+        .timer_sel      = LEDC_TIMER_0,
+        .intr_type      = LEDC_INTR_DISABLE,
+        .gpio_num       = GPIO_NUM_LED_M_OUT,
+        .duty           = MUX_PHASE_DUTY,
+        .hpoint         = MUX_LEDS_HPOINT /* Set the timer value at which the output will be latched. */
+    },
+    {
+        .speed_mode     = LEDC_HIGH_SPEED_MODE,
+        .channel        = LEDC_CHANNEL_0,
+        .timer_sel      = LEDC_TIMER_0,
+        .intr_type      = LEDC_INTR_DISABLE,
+        .gpio_num       = GPIO_NUM_LED_R_OUT,
+        .duty           = MUX_PHASE_DUTY,
+        .hpoint         = MUX_LEDS_HPOINT /* Set the timer value at which the output will be latched. */
+    },
+    {
+        .speed_mode     = LEDC_HIGH_SPEED_MODE,
+        .channel        = LEDC_CHANNEL_2,
+        .timer_sel      = LEDC_TIMER_0,
+        .intr_type      = LEDC_INTR_DISABLE,
+        .gpio_num       = GPIO_NUM_MUX_BUTTONS_OUT,
+        .duty           = MUX_PHASE_DUTY,
+        .hpoint         = MUX_BUTTONS_HPOINT, /* Set the timer value at which the output will be latched. */
+    },
+    {
+        .speed_mode     = LEDC_HIGH_SPEED_MODE,
+        .channel        = LEDC_CHANNEL_3,
+        .timer_sel      = LEDC_TIMER_0,
+        .intr_type      = LEDC_INTR_DISABLE,
+        .gpio_num       = GPIO_NUM_MUX_CLIPS_OUT,
+        .duty           = MUX_PHASE_DUTY,
+        .hpoint         = MUX_CLIPS_HPOINT, /* Set the timer value at which the output will be latched. */
+    }
+};
+
+static const uint64_t gpio_pin_bit_mask_inout = GPIO_PIN_BIT_MASK_INOUT;
+static const uint64_t gpio_pin_bit_mask_in = GPIO_PIN_BIT_MASK_IN;
+
+static const gpio_config_t gpio_configs[] = {
+    {
+        /* Set as output mode. */
+        .mode         = GPIO_MODE_OUTPUT,
+        /* Bit mask of the pins that you want to set as outputs. */
+        .pin_bit_mask = GPIO_PIN_BIT_MASK_OUT,
+        /* Disable pull-down mode. */
+        .pull_down_en = 0,
+        /* Disable interrupts. */
+        .intr_type    = GPIO_INTR_DISABLE
+    },
+    {
+        /* Bit mask of the pins, use inputs here. */
+        .pin_bit_mask = gpio_pin_bit_mask_in,
+        /* Set as input mode. */
+        .mode         = GPIO_MODE_INPUT,
+        /* Enable pull-down mode. */
+        .pull_down_en = 1,
+        /* The switches are sampled by the scanner. */
+        .intr_type    = GPIO_INTR_DISABLE
+    },
+    {
+        /* Bit mask of the pins, use input/open drain output here. */
+        .pin_bit_mask = gpio_pin_bit_mask_inout,
+        /* Set as input/output mode. */
+        .mode         = GPIO_MODE_INPUT_OUTPUT_OD,
+        /* Enable pull-down mode. */
+        .pull_down_en = 1,
+        /* The buttons and clips are sampled by the scanner. */
+        .intr_type    = GPIO_INTR_DISABLE
+    }
+};
+
+/* The LEDC channels of the LEDs, see muxed_inouts_to_ledc_channel. */
+static const ledc_channel_t led_ledc_channels[] = {
+    LEDC_CHANNEL_0, LEDC_CHANNEL_1, LEDC_CHANNEL_4, LEDC_CHANNEL_5, LEDC_CHANNEL_6, LEDC_CHANNEL_7
+};
+
+/* The mux outputs of which the rising edges start the phases. */
+static const gpio_num_t mux_gpio_nums[] = { GPIO_NUM_MUX_BUTTONS_OUT, GPIO_NUM_MUX_CLIPS_OUT };
+
+static muxed_gpio_hal_phase_fn phase_fn = NULL;
+static muxed_gpio_hal_wake_fn wake_fn = NULL;
+/**
+ * Taken while the LED channels or the interrupts are changed, so a fade can't start while the mux goes to standby, and
+ * scanning can't be paused and resumed at the same time.
+ */
+static SemaphoreHandle_t leds_mutex = NULL;
+/* The duty every LED channel is set or fading to, all LEDs are lit by muxed_gpio_hal_setup(). */
+static uint32_t channel_duties[LEDC_CHANNEL_MAX] = {
+    [LEDC_CHANNEL_0] = MUX_PHASE_DUTY, [LEDC_CHANNEL_1] = MUX_PHASE_DUTY, [LEDC_CHANNEL_4] = MUX_PHASE_DUTY,
+    [LEDC_CHANNEL_5] = MUX_PHASE_DUTY, [LEDC_CHANNEL_6] = MUX_PHASE_DUTY, [LEDC_CHANNEL_7] = MUX_PHASE_DUTY
+};
+static bool standby = false;
+/* The phase interrupts are off and the wakeup interrupts armed, in standby as well. */
+static bool scanning_paused = false;
+#if CONFIG_PM_ENABLE
+/* The mux stops in light sleep, so it's only allowed in standby. */
+static esp_pm_lock_handle_t pm_lock = NULL;
+#endif
+
+/**
+ * The rising edges of the mux outputs are exactly the hpoints of their LEDC channels, so the interrupts on these two
+ * pins, which can be read back since they're in/outputs, are always aligned with the phases.
+ */
+static void IRAM_ATTR gpio_mux_phase_interrupt_handler(void *arg) {
+    gpio_num_t gpio_num = (gpio_num_t)(intptr_t)arg;
+    
+    /* An edge that was latched before scanning resumed is outside of its phase by now. */
+    if (REG_READ(GPIO_IN_REG) >> gpio_num & 1)
+        phase_fn(gpio_num_to_mux_phase[gpio_num]);
+}
+
+/**
+ * The wakeup interrupts are level triggered, so they're disabled right away, muxed_gpio_hal_resume() cleans them up.
+ */
+static void IRAM_ATTR gpio_wake_interrupt_handler(void *arg) {
+    uint32_t gpio_levels = REG_READ(GPIO_IN_REG);
+    
+    for (enum muxed_inputs i = MUXED_INPUT_MIN; i <= MUXED_INPUT_MAX; i++)
+        if (i <= MUXED_INPUT_BUTTONS_MAX || i >= MUXED_INPUT_SWITCH_MIN)
+            gpio_intr_disable(muxed_inouts_to_gpio_num[i]);
+    /* With the mux running, the phase that woke the scanner is sampled right away instead of a period later. */
+    if (!standby)
+        for (int i = 0; i < sizeof(mux_gpio_nums) / sizeof(*mux_gpio_nums); i++)
+            if (gpio_levels >> mux_gpio_nums[i] & 1)
+                phase_fn(gpio_num_to_mux_phase[mux_gpio_nums[i]]);
+    wake_fn();
+}
+
+void muxed_gpio_hal_setup(void) {
+    /* Configure GPIO with the given settings. */
+    for (int i = 0; i < sizeof(gpio_configs) / sizeof(*gpio_configs); i++)
+        ESP_ERROR_CHECK(gpio_config(&gpio_configs[i]));
+
+    ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer0_config));
+    
+    for (int i = 0; i < sizeof(ledc_channel_configs) / sizeof(*ledc_channel_configs); i++) {
+        gpio_num_t gpio_num = ledc_channel_configs[i].gpio_num;
+        ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel_configs[i]));
+        if (gpio_num == GPIO_NUM_MUX_BUTTONS_OUT || gpio_num == GPIO_NUM_MUX_CLIPS_OUT) {
+            /**
+             * We also need these two GPIOs to function as inputs, since we're getting the level of them
+             * in the interrupt for the clips and buttons.
+             */
+            ESP_ERROR_CHECK(gpio_set_direction(gpio_num, GPIO_MODE_INPUT_OUTPUT));
+            esp_rom_gpio_connect_out_signal(gpio_num,
+                                            ledc_periph_signal[ledc_channel_configs[i].speed_mode].sig_out0_idx + 
+                                                ledc_channel_configs[i].channel, 
+                                            ledc_channel_configs[i].flags.output_invert, 0);
+        }
+        ESP_ERROR_CHECK(ledc_update_duty(ledc_channel_configs[i].speed_mode, ledc_channel_configs[i].channel));
+    }
+   
+    /* Output the same signal on the star, triangle... in/outputs as on the LED_* outputs, but then inverted. */
+    for (enum muxed_outputs i = MUXED_OUTPUT_MIN; i <= MUXED_OUTPUT_MAX; i++) {
+       ledc_channel_config_t config = ledc_channel_configs[0];
+       config.gpio_num = muxed_inouts_to_gpio_num[i];
+       config.channel = muxed_inouts_to_ledc_channel[i].bc_channel;
+       config.flags.output_invert = 1;
+       ESP_ERROR_CHECK(ledc_channel_config(&config));
+       /**
+        * Hack to use open drain outputs for the star, triangle... in/outputs, since ledc_channel_config()
+        * always sets the pin to regular outputs. But if we would only call gpio_set_direction() here, the
+        * signal would get disconnected from the pin, so we have to call esp_rom_gpio_connect_out_signal()
+        * again (which is normally called in ledc_channel_config()).
+        */
+       ESP_ERROR_CHECK(gpio_set_direction(config.gpio_num, GPIO_MODE_INPUT_OUTPUT_OD));
+       esp_rom_gpio_connect_out_signal(config.gpio_num,
+                                       ledc_periph_signal[config.speed_mode].sig_out0_idx + config.channel, 
+                                       config.flags.output_invert, 0);
+       ESP_ERROR_CHECK(ledc_update_duty(config.speed_mode, config.channel));
+    }
+    
+    ESP_ERROR_CHECK(ledc_fade_func_install(0));
+    
+    leds_mutex = xSemaphoreCreateMutex();
+    if (!leds_mutex)
+        ESP_LOGE(TAG, "Failed to create the LED mutex\n");
+    
+    ESP_ERROR_CHECK(esp_sleep_enable_gpio_wakeup());
+#if CONFIG_PM_ENABLE
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "mux", &pm_lock));
+    ESP_ERROR_CHECK(esp_pm_lock_acquire(pm_lock));
+#endif
+}
+
+void muxed_gpio_hal_start_scanning(muxed_gpio_hal_phase_fn fn) {
+    phase_fn = fn;
+    ESP_ERROR_CHECK(gpio_install_isr_service(0));
+    for (int i = 0; i < sizeof(mux_gpio_nums) / sizeof(*mux_gpio_nums); i++) {
+        ESP_ERROR_CHECK(gpio_set_intr_type(mux_gpio_nums[i], GPIO_INTR_POSEDGE));
+        ESP_ERROR_CHECK(gpio_isr_handler_add(mux_gpio_nums[i], &gpio_mux_phase_interrupt_handler,
+                                             (void *)(intptr_t)mux_gpio_nums[i]));
+        ESP_ERROR_CHECK(gpio_intr_enable(mux_gpio_nums[i]));
+    }
+    ESP_LOGD(TAG, "Scanning the mux at %lu Hz", MUX_PWM_FREQUENCY);
+}
+
+muxed_inputs_mask_t IRAM_ATTR muxed_gpio_hal_sample(muxed_inputs_mask_t inputs) {
+    /* Read all GPIOs at the same moment, GPIO_IN1_REG holds GPIO 32..39. */
+    uint64_t gpio_levels = REG_READ(GPIO_IN_REG) | (uint64_t)REG_READ(GPIO_IN1_REG) << 32;
+    muxed_inputs_mask_t levels = 0;
+    
+    for (enum muxed_inputs i = MUXED_INPUT_MIN; i <= MUXED_INPUT_MAX; i++)
+        if ((inputs & MUXED_INPUT_BIT(i)) && (gpio_levels >> muxed_inouts_to_gpio_num[i] & 1))
+            levels |= MUXED_INPUT_BIT(i);
+    return levels;
+}
+
+/**
+ * The LEDs are a matrix of the lmr and bc channels, an LED lights while both its channels are active, which they all
+ * are from the start of the LED phase until their duty. So every channel gets the duty of the brightest LED on it, and
+ * an LED lights at the lower duty of its two channels.
+ */
+static void fade_led_channels(const uint8_t (*levels)[MUXED_OUTPUT_N], uint32_t fade_ms) {
+    ledc_mode_t speed_mode = ledc_channel_configs[0].speed_mode;
+    uint8_t channel_levels[LEDC_CHANNEL_MAX] = { 0 };
+    
+    for (enum muxed_outputs i = MUXED_OUTPUT_MIN; i <= MUXED_OUTPUT_MAX; i++) {
+        ledc_channel_t lmr_channel = muxed_inouts_to_ledc_channel[i].lmr_channel;
+        ledc_channel_t bc_channel = muxed_inouts_to_ledc_channel[i].bc_channel;
+        
+        channel_levels[lmr_channel] = MAX(channel_levels[lmr_channel], (*levels)[i]);
+        channel_levels[bc_channel] = MAX(channel_levels[bc_channel], (*levels)[i]);
+    }
+    
+    xSemaphoreTake(leds_mutex, portMAX_DELAY);
+    for (int i = 0; i < sizeof(led_ledc_channels) / sizeof(*led_ledc_channels); i++) {
+        ledc_channel_t channel = led_ledc_channels[i];
+        uint32_t duty = channel_levels[channel] * MUX_PHASE_DUTY / UINT8_MAX;
+        
+        /* In standby the duty is only remembered, muxed_gpio_hal_resume() applies it. */
+        if (duty == channel_duties[channel] || (channel_duties[channel] = duty, standby))
+            continue;
+        /* The fade hardware steps once per PWM period, shorter fades are just a jump. */
+        if (fade_ms * MUX_PWM_FREQUENCY >= 1000) {
+            ledc_set_fade_with_time(speed_mode, channel, duty, fade_ms);
+            ledc_fade_start(speed_mode, channel, LEDC_FADE_NO_WAIT);
+        } else {
+            ledc_set_duty(speed_mode, channel, duty);
+            ledc_update_duty(speed_mode, channel);
+        }
+    }
+    xSemaphoreGive(leds_mutex);
+}
+
+void muxed_gpio_hal_set_leds(bool (*levels)[MUXED_OUTPUT_N]) {
+    uint8_t brightness[MUXED_OUTPUT_N];
+    
+    for (enum muxed_outputs i = MUXED_OUTPUT_MIN; i <= MUXED_OUTPUT_MAX; i++)
+        brightness[i] = (*levels)[i] ? UINT8_MAX : 0;
+    fade_led_channels(&brightness, 0);
+}
+
+void muxed_gpio_hal_fade_leds(const uint8_t (*levels)[MUXED_OUTPUT_N], uint32_t fade_ms) {
+    fade_led_channels(levels, fade_ms);
+}
+
+/**
+ * Turns the phase interrupts off and arms the wakeup interrupts of the buttons, clips, beak and switches. The buttons
+ * and clips share their pins, which only read high while a button or clip is active and its mux output is high.
+ */
+static void pause_phase_interrupts(muxed_gpio_hal_wake_fn fn) {
+    wake_fn = fn;
+    for (int i = 0; i < sizeof(mux_gpio_nums) / sizeof(*mux_gpio_nums); i++)
+        gpio_set_intr_type(mux_gpio_nums[i], GPIO_INTR_DISABLE);
+    
+    /* Wake up on a pressed button, clip or beak, or a switch that is moved away from where it is now. */
+    for (enum muxed_inputs i = MUXED_INPUT_MIN; i <= MUXED_INPUT_MAX; i++) {
+        gpio_num_t gpio_num = muxed_inouts_to_gpio_num[i];
+        
+        if (i > MUXED_INPUT_BUTTONS_MAX && i < MUXED_INPUT_SWITCH_MIN)
+            continue;
+        ESP_ERROR_CHECK(gpio_isr_handler_add(gpio_num, &gpio_wake_interrupt_handler, NULL));
+        ESP_ERROR_CHECK(gpio_wakeup_enable(gpio_num, i >= MUXED_INPUT_LEARN_SWITCH && gpio_get_level(gpio_num) ?
+                                                     GPIO_INTR_LOW_LEVEL : GPIO_INTR_HIGH_LEVEL));
+        ESP_ERROR_CHECK(gpio_intr_enable(gpio_num));
+    }
+    scanning_paused = true;
+}
+
+void muxed_gpio_hal_pause_scanning(muxed_gpio_hal_wake_fn fn) {
+    xSemaphoreTake(leds_mutex, portMAX_DELAY);
+    if (!scanning_paused)
+        pause_phase_interrupts(fn);
+    xSemaphoreGive(leds_mutex);
+    ESP_LOGD(TAG, "Scanning paused");
+}
+
+void muxed_gpio_hal_standby(muxed_gpio_hal_wake_fn fn) {
+    ledc_mode_t speed_mode = ledc_channel_configs[0].speed_mode;
+    
+    xSemaphoreTake(leds_mutex, portMAX_DELAY);
+    if (standby) {
+        xSemaphoreGive(leds_mutex);
+        return;
+    }
+    standby = true;
+    
+    for (int i = 0; i < sizeof(led_ledc_channels) / sizeof(*led_ledc_channels); i++) {
+        /* Setting the duty waits for a fade that is still running, which would enable the output again when it ends. */
+        ledc_set_duty(speed_mode, led_ledc_channels[i], channel_duties[led_ledc_channels[i]]);
+        /* The bc channels are inverted, so their pins are released and can be read as inputs. */
+        ledc_stop(speed_mode, led_ledc_channels[i], 0);
+    }
+    /* Keep powering the buttons, so a pressed button reads high without the mux running. */
+    ledc_stop(speed_mode, ledc_channel_configs[3].channel, 1);
+    ledc_stop(speed_mode, ledc_channel_configs[4].channel, 0);
+    /* Arm the wakeup interrupts again, even if scanning was paused, the switches may have moved since. */
+    pause_phase_interrupts(fn);
+    xSemaphoreGive(leds_mutex);
+    
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_release(pm_lock);
+#endif
+    ESP_LOGD(TAG, "Mux in standby");
+}
+
+void muxed_gpio_hal_resume(void) {
+    ledc_mode_t speed_mode = ledc_channel_configs[0].speed_mode;
+    
+    xSemaphoreTake(leds_mutex, portMAX_DELAY);
+    if (!scanning_paused) {
+        xSemaphoreGive(leds_mutex);
+        return;
+    }
+    
+    for (enum muxed_inputs i = MUXED_INPUT_MIN; i <= MUXED_INPUT_MAX; i++) {
+        gpio_num_t gpio_num = muxed_inouts_to_gpio_num[i];
+        
+        if (i > MUXED_INPUT_BUTTONS_MAX && i < MUXED_INPUT_SWITCH_MIN)
+            continue;
+        gpio_wakeup_disable(gpio_num);
+        gpio_set_intr_type(gpio_num, GPIO_INTR_DISABLE);
+        gpio_isr_handler_remove(gpio_num);
+    }
+    
+    if (standby) {
+#if CONFIG_PM_ENABLE
+        esp_pm_lock_acquire(pm_lock);
+#endif
+        /* Updating the duty enables the outputs again, the LEDC timer kept running so the phases stay aligned. */
+        ledc_update_duty(speed_mode, ledc_channel_configs[3].channel);
+        ledc_update_duty(speed_mode, ledc_channel_configs[4].channel);
+        for (int i = 0; i < sizeof(led_ledc_channels) / sizeof(*led_ledc_channels); i++) {
+            ledc_set_duty(speed_mode, led_ledc_channels[i], channel_duties[led_ledc_channels[i]]);
+            ledc_update_duty(speed_mode, led_ledc_channels[i]);
+        }
+        standby = false;
+    }
+    
+    for (int i = 0; i < sizeof(mux_gpio_nums) / sizeof(*mux_gpio_nums); i++)
+        gpio_set_intr_type(mux_gpio_nums[i], GPIO_INTR_POSEDGE);
+    scanning_paused = false;
+    xSemaphoreGive(leds_mutex);
+    ESP_LOGD(TAG, "Scanning resumed");
+}
@@ -0,0 +1,104 @@
+#ifndef MUXED_GPIO_HAL_H
+#define MUXED_GPIO_HAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "muxed-gpio.h"
+
+/**
+ * The hardware under muxed-gpio.c: the LEDC timer and channels that multiplex the LEDs, buttons and clips onto the same
+ * pins, and the GPIOs the inputs are read from. muxed-gpio-hal.c implements it on the ESP32, and the host simulator
+ * implements it with a model of the mux, see host/shim/mux-model.c.
+ */
+
+#define MUX_PWM_FREQUENCY   200UL                    /* 200 Hz. */
+#define MUX_PWM_BITS        8                        /* Dutycycle is max 255. */
+
+#define MUX_PWM_MAX                                                                                                \
+    ((1UL << MUX_PWM_BITS) - 1UL)
+
+/* Every period has a phase for the LEDs, the clips and the buttons, in that order, starting at these timer values. */
+#define MUX_LEDS_HPOINT     0
+#define MUX_CLIPS_HPOINT    (MUX_PWM_MAX / 3)
+#define MUX_BUTTONS_HPOINT  (MUX_PWM_MAX * 2 / 3)
+#define MUX_PHASE_DUTY      (MUX_PWM_MAX / 3 - 2)    /* Leave 2 / MUX_PWM_MAXth of the dutycycle as margin. */
+
+enum muxed_gpio_hal_phase {
+    MUXED_GPIO_HAL_PHASE_BUTTONS,
+    MUXED_GPIO_HAL_PHASE_CLIPS,
+
+    MUXED_GPIO_HAL_PHASE_N
+};
+
+/**
+ * Called from an interrupt at the start of every phase of the mux, while the inputs of that phase can be sampled.
+ */
+typedef void (*muxed_gpio_hal_phase_fn)(enum muxed_gpio_hal_phase phase);
+
+/**
+ * Called from an interrupt when an input changes while the mux is in standby.
+ */
+typedef void (*muxed_gpio_hal_wake_fn)(void);
+
+/**
+ * @brief     configure the GPIOs and start the LEDC timer and channels that drive the mux, with all LEDs lit
+ */
+void muxed_gpio_hal_setup(void);
+
+/**
+ * @brief     call [fn] at the start of every phase of the mux from now on
+ */
+void muxed_gpio_hal_start_scanning(muxed_gpio_hal_phase_fn fn);
+
+/**
+ * @brief     stop calling the phase function while the mux keeps running, and call [fn] once a button, clip or the beak
+ *            reads active, or a switch is moved
+ *
+ * A pressed button or clip pulls its pin high during its own phase, so the pins are watched with level interrupts
+ * instead of sampling them twice per period. The phase that is active when an input wakes the scanner is sampled
+ * right away, before [fn] is called. Scanning continues after muxed_gpio_hal_resume(). Does nothing if scanning is
+ * already paused.
+ */
+void muxed_gpio_hal_pause_scanning(muxed_gpio_hal_wake_fn fn);
+
+/**
+ * @brief     sample the levels of [inputs] at once
+ *
+ * Can be called from the phase interrupt. The buttons and clips only read as active during their own phase, the
+ * switches aren't muxed and can be sampled at any time.
+ */
+muxed_inputs_mask_t muxed_gpio_hal_sample(muxed_inputs_mask_t inputs);
+
+/**
+ * @brief     light the LEDs of which [levels] is set during the LED phase, and turn off the others
+ */
+void muxed_gpio_hal_set_leds(bool (*levels)[MUXED_OUTPUT_N]);
+
+/**
+ * @brief     fade the brightness of the LEDs to [levels] in the background, in [fade_ms]
+ *
+ * The fades run in hardware, without using the CPU. A channel that is still fading blocks the call until its fade
+ * ends, so fades should be started at least [fade_ms] apart. LEDs that share both their channels with lit LEDs light
+ * up as well, as with muxed_gpio_hal_set_leds().
+ */
+void muxed_gpio_hal_fade_leds(const uint8_t (*levels)[MUXED_OUTPUT_N], uint32_t fade_ms);
+
+/**
+ * @brief     stop the mux and turn off the LEDs, so the chip can go to light sleep, and call [fn] once a button or the
+ *            beak is pressed, or a switch is moved
+ *
+ * The phases aren't reported in standby, also if scanning was paused before. The LEDs keep the levels they're set to,
+ * and light up with them again after muxed_gpio_hal_resume(). Does nothing if the mux is already in standby.
+ */
+void muxed_gpio_hal_standby(muxed_gpio_hal_wake_fn fn);
+
+/**
+ * @brief     restart the mux after muxed_gpio_hal_standby(), in the same phase alignment as before, and the phase
+ *            function after muxed_gpio_hal_pause_scanning()
+ *
+ * Must not be called from an interrupt. Does nothing if the mux is scanning.
+ */
+void muxed_gpio_hal_resume(void);
+
+#endif /* MUXED_GPIO_HAL_H */
@@ -1,393 +1,205 @@
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdlib.h>
 
 #include "freertos/FreeRTOS.h"
-#include "freertos/queue.h"
 #include "freertos/task.h"
-#include "driver/gpio.h"
-#include "driver/ledc.h"
-#include "soc/ledc_periph.h"
 #include "esp_log.h"
-#include "esp_cpu.h"
+#include "esp_timer.h"
 
 #include "muxed-gpio.h"
+#include "muxed-gpio-hal.h"
+#include "input-trace.h"
+#include "stats.h"
+#include "trace.h"
 
 static const char *const TAG = "muxed-gpio";
 
-#define GPIO_NUM_MUX_BUTTONS_OUT  GPIO_NUM_4
-#define GPIO_NUM_MUX_CLIPS_OUT    GPIO_NUM_5        
-
-/* These are all the buttons on the tail. */
-#define GPIO_NUM_STAR_L_INOUT     GPIO_NUM_21
-#define GPIO_NUM_TRIANGLE_L_INOUT GPIO_NUM_19
-#define GPIO_NUM_SQUARE_L_INOUT   GPIO_NUM_27
-#define GPIO_NUM_HEART_L_INOUT    GPIO_NUM_14
-#define GPIO_NUM_HEART_R_INOUT    GPIO_NUM_12
-#define GPIO_NUM_SQUARE_R_INOUT   GPIO_NUM_13
-#define GPIO_NUM_TRIANGLE_R_INOUT GPIO_NUM_18
-#define GPIO_NUM_STAR_R_INOUT     GPIO_NUM_16
-/* This is the beak button. */
-#define GPIO_NUM_BEAK_IN          GPIO_NUM_15
-/* These are the inputs for the switch. */
-#define GPIO_NUM_SWITCH_LEARN_IN  GPIO_NUM_34
-#define GPIO_NUM_SWITCH_PLAY_IN   GPIO_NUM_35
-/* These are the outputs for the LEDs. */
-#define GPIO_NUM_LED_L_OUT        GPIO_NUM_22
-#define GPIO_NUM_LED_M_OUT        GPIO_NUM_26
-#define GPIO_NUM_LED_R_OUT        GPIO_NUM_17
-
-#define GPIO_PIN_BIT_MASK_OUT     ((1ULL << GPIO_NUM_LED_L_OUT)        | (1ULL << GPIO_NUM_LED_M_OUT)        |     \
-                                   (1ULL << GPIO_NUM_LED_R_OUT)        | (1ULL << GPIO_NUM_MUX_BUTTONS_OUT)  |     \
-                                   (1ULL << GPIO_NUM_MUX_CLIPS_OUT))
-#define GPIO_PIN_BIT_MASK_INOUT   ((1ULL << GPIO_NUM_STAR_L_INOUT)     | (1ULL << GPIO_NUM_TRIANGLE_L_INOUT) |     \
-                                   (1ULL << GPIO_NUM_SQUARE_L_INOUT)   | (1ULL << GPIO_NUM_HEART_L_INOUT)    |     \
-                                   (1ULL << GPIO_NUM_HEART_R_INOUT)    | (1ULL << GPIO_NUM_SQUARE_R_INOUT)   |     \
-                                   (1ULL << GPIO_NUM_TRIANGLE_R_INOUT) | (1ULL << GPIO_NUM_STAR_R_INOUT))
-#define GPIO_PIN_BIT_MASK_IN      ((1ULL << GPIO_NUM_BEAK_IN)          | (1ULL << GPIO_NUM_SWITCH_LEARN_IN)  |     \
-                                   (1ULL << GPIO_NUM_SWITCH_PLAY_IN))
-
-#define MUX_PWM_FREQUENCY   200UL                    /* 200 Hz. */
-#define MUX_PWM_BITS        8                        /* Dutycycle is max 255. */
-
-#define MUX_PWM_MAX                                                                                                \
-    ((1UL << MUX_PWM_BITS) - 1UL)
-#define MUX_TIMER_BITS_TMP(bits)                                                                                   \
-    LEDC_TIMER_##bits##_BIT
-#define MUX_TIMER_BITS(bits)                                                                                       \
-    MUX_TIMER_BITS_TMP(bits)
-    
-struct muxed_gpio_msg {
-    bool levels[MUXED_INPUT_N];
-};
-
-struct interrupt_handler_args {
-    gpio_num_t gpio_num;
-    QueueHandle_t queue;
-};
+#define MUXED_INPUT_MASK_RANGE(min, max) (MUXED_INPUT_BIT((max) + 1) - MUXED_INPUT_BIT(min))
+#define MUXED_INPUT_MASK_SWITCHES MUXED_INPUT_MASK_RANGE(MUXED_INPUT_SWITCH_MIN, MUXED_INPUT_SWITCH_MAX)
+/* The mode switch stays in a position, unlike the buttons, clips and beak. */
+#define MUXED_INPUT_MASK_MODE_SWITCH MUXED_INPUT_MASK_RANGE(MUXED_INPUT_LEARN_SWITCH, MUXED_INPUT_PLAY_SWITCH)
 
 struct task_handler_args {
-    QueueHandle_t queue;
     muxed_inputs_on_changed_fn fn;
 };
 
-static const enum muxed_inputs gpio_num_to_muxed_inouts[][GPIO_NUM_MAX] = {{
-    /* 0..7 are inputs for the buttons that can be read if GPIO_NUM_MUX_BUTTONS_OUT is set high. */
-    [GPIO_NUM_STAR_L_INOUT] = MUXED_INPUT_STAR_L_BUTTON, [GPIO_NUM_TRIANGLE_L_INOUT] = MUXED_INPUT_TRIANGLE_L_BUTTON,
-    [GPIO_NUM_SQUARE_L_INOUT] = MUXED_INPUT_SQUARE_L_BUTTON, [GPIO_NUM_HEART_L_INOUT] = MUXED_INPUT_HEART_L_BUTTON,
-    [GPIO_NUM_HEART_R_INOUT] = MUXED_INPUT_HEART_R_BUTTON, [GPIO_NUM_SQUARE_R_INOUT] = MUXED_INPUT_SQUARE_R_BUTTON,
-    [GPIO_NUM_TRIANGLE_R_INOUT] = MUXED_INPUT_TRIANGLE_R_BUTTON, [GPIO_NUM_STAR_R_INOUT] = MUXED_INPUT_STAR_R_BUTTON,
-    /* 8..15 are inputs for the clips that can be read if GPIO_NUM_MUX_CLIPS_OUT is set high. */
-    [GPIO_NUM_BEAK_IN] = MUXED_INPUT_BEAK_SWITCH,
-    [GPIO_NUM_SWITCH_LEARN_IN] = MUXED_INPUT_LEARN_SWITCH, [GPIO_NUM_SWITCH_PLAY_IN] = MUXED_INPUT_PLAY_SWITCH
-}, {
-    /* 0..7 are inputs for the buttons that can be read if GPIO_NUM_MUX_BUTTONS_OUT is set high. */
-    [GPIO_NUM_STAR_L_INOUT] = MUXED_INPUT_STAR_L_CLIP, [GPIO_NUM_TRIANGLE_L_INOUT] = MUXED_INPUT_TRIANGLE_L_CLIP,
-    [GPIO_NUM_SQUARE_L_INOUT] = MUXED_INPUT_SQUARE_L_CLIP, [GPIO_NUM_HEART_L_INOUT] = MUXED_INPUT_HEART_L_CLIP,
-    [GPIO_NUM_HEART_R_INOUT] = MUXED_INPUT_HEART_R_CLIP, [GPIO_NUM_SQUARE_R_INOUT] = MUXED_INPUT_SQUARE_R_CLIP,
-    [GPIO_NUM_TRIANGLE_R_INOUT] = MUXED_INPUT_TRIANGLE_R_CLIP, [GPIO_NUM_STAR_R_INOUT] = MUXED_INPUT_STAR_R_CLIP,
-    /* 8..15 are inputs for the clips that can be read if GPIO_NUM_MUX_CLIPS_OUT is set high. */
-    [GPIO_NUM_BEAK_IN] = MUXED_INPUT_BEAK_SWITCH,
-    [GPIO_NUM_SWITCH_LEARN_IN] = MUXED_INPUT_LEARN_SWITCH, [GPIO_NUM_SWITCH_PLAY_IN] = MUXED_INPUT_PLAY_SWITCH
-}};
-static const gpio_num_t muxed_inouts_to_gpio_num[] = {
-    /* 0..7 are inputs for the buttons that can be read if GPIO_NUM_MUX_BUTTONS_OUT is set high. */
-    [MUXED_INPUT_STAR_L_BUTTON] = GPIO_NUM_STAR_L_INOUT, [MUXED_INPUT_TRIANGLE_L_BUTTON] = GPIO_NUM_TRIANGLE_L_INOUT,
-    [MUXED_INPUT_SQUARE_L_BUTTON] = GPIO_NUM_SQUARE_L_INOUT, [MUXED_INPUT_HEART_L_BUTTON] = GPIO_NUM_HEART_L_INOUT,
-    [MUXED_INPUT_HEART_R_BUTTON] = GPIO_NUM_HEART_R_INOUT, [MUXED_INPUT_SQUARE_R_BUTTON] = GPIO_NUM_SQUARE_R_INOUT,
-    [MUXED_INPUT_TRIANGLE_R_BUTTON] = GPIO_NUM_TRIANGLE_R_INOUT, [MUXED_INPUT_STAR_R_BUTTON] = GPIO_NUM_STAR_R_INOUT,
-    /* 8..15 are inputs for the clips that can be read if GPIO_NUM_MUX_CLIPS_OUT is set high. */
-    [MUXED_INPUT_STAR_L_CLIP] = GPIO_NUM_STAR_L_INOUT, [MUXED_INPUT_TRIANGLE_L_CLIP] = GPIO_NUM_TRIANGLE_L_INOUT,
-    [MUXED_INPUT_SQUARE_L_CLIP] = GPIO_NUM_SQUARE_L_INOUT, [MUXED_INPUT_HEART_L_CLIP] = GPIO_NUM_HEART_L_INOUT,
-    [MUXED_INPUT_HEART_R_CLIP] = GPIO_NUM_HEART_R_INOUT, [MUXED_INPUT_SQUARE_R_CLIP] = GPIO_NUM_SQUARE_R_INOUT,
-    [MUXED_INPUT_TRIANGLE_R_CLIP] = GPIO_NUM_TRIANGLE_R_INOUT, [MUXED_INPUT_STAR_R_CLIP] = GPIO_NUM_STAR_R_INOUT,
-    /* The following GPIOs are only ever used as inputs. */
-    [MUXED_INPUT_BEAK_SWITCH] = GPIO_NUM_BEAK_IN,
-    [MUXED_INPUT_LEARN_SWITCH] = GPIO_NUM_SWITCH_LEARN_IN, [MUXED_INPUT_PLAY_SWITCH] = GPIO_NUM_SWITCH_PLAY_IN
+/**
+ * Instead of an interrupt per edge of every in/output, which would fire on every PWM period for as long as a button is
+ * kept pressed, all inputs are sampled at once at the start of the mux phases. The switches aren't muxed, they are
+ * sampled along with the buttons.
+ */
+static const muxed_inputs_mask_t mux_phase_inputs[] = {
+    [MUXED_GPIO_HAL_PHASE_BUTTONS] = MUXED_INPUT_MASK_RANGE(MUXED_INPUT_BUTTONS_MIN, MUXED_INPUT_BUTTONS_MAX) |
+                                     MUXED_INPUT_MASK_SWITCHES,
+    [MUXED_GPIO_HAL_PHASE_CLIPS]   = MUXED_INPUT_MASK_RANGE(MUXED_INPUT_CLIPS_MIN, MUXED_INPUT_CLIPS_MAX)
 };
 
-/*                          { GPIO_NUM_LED_*_OUT, GPIO_NUM_*_*_INOUT } */
-static const struct { ledc_channel_t lmr_channel, bc_channel; } muxed_inouts_to_ledc_channel[] = {
-    [MUXED_OUTPUT_STAR_L_LED] = { .lmr_channel = LEDC_CHANNEL_0, .bc_channel = LEDC_CHANNEL_4 },
-    [MUXED_OUTPUT_TRIANGLE_L_LED] = { .lmr_channel = LEDC_CHANNEL_0, .bc_channel = LEDC_CHANNEL_5 },
-    [MUXED_OUTPUT_SQUARE_L_LED] = { .lmr_channel = LEDC_CHANNEL_1, .bc_channel = LEDC_CHANNEL_4 },
-    [MUXED_OUTPUT_HEART_L_LED] = { .lmr_channel = LEDC_CHANNEL_1, .bc_channel = LEDC_CHANNEL_5 },
-    [MUXED_OUTPUT_HEART_R_LED] = { .lmr_channel = LEDC_CHANNEL_1, .bc_channel = LEDC_CHANNEL_6 },
-    [MUXED_OUTPUT_SQUARE_R_LED] = { .lmr_channel = LEDC_CHANNEL_1, .bc_channel = LEDC_CHANNEL_7 },
-    [MUXED_OUTPUT_TRIANGLE_R_LED] = { .lmr_channel = LEDC_CHANNEL_0, .bc_channel = LEDC_CHANNEL_6 },
-    [MUXED_OUTPUT_STAR_R_LED] = { .lmr_channel = LEDC_CHANNEL_0, .bc_channel = LEDC_CHANNEL_7 }
-};
+static TaskHandle_t gpio_task_handle = NULL;
 
+/* The levels of all inputs at the last scan, only written by the scanner. */
+static volatile muxed_inputs_mask_t input_levels;
 /**
- *                           |___               ______               ______               ______
- * GPIO_NUM_LED_*_OUT:       |   |             |      |             |      |             |      |
- *                           |    ^^^^^^^^^^^^^        ^^^^^^^^^^^^^        ^^^^^^^^^^^^^        ^^^
- *                           |    ______               ______               ______               ___
- * GPIO_NUM_MUX_CLIPS_OUT:   |   |      |             |      |             |      |             |
- *                           |^^^        ^^^^^^^^^^^^^        ^^^^^^^^^^^^^        ^^^^^^^^^^^^^
- *                           |           ______               ______               ______
- * GPIO_NUM_MUX_BUTTONS_OUT: |          |      |             |      |             |      |
- *                           |^^^^^^^^^^        ^^^^^^^^^^^^^       ^^^^^^^^^^^^^^        ^^^^^^^^^^
+ * The bits of the mux phases that weren't scanned since setup. The first scan of a phase only takes the levels of its
+ * inputs, so inputs that are already active at setup don't show up as edges.
  */
-    
-static const ledc_timer_config_t ledc_timer0_config = {
-    .speed_mode       = LEDC_HIGH_SPEED_MODE,
-    .timer_num        = LEDC_TIMER_0, 
-    .duty_resolution  = MUX_TIMER_BITS(MUX_PWM_BITS),
-    .freq_hz          = MUX_PWM_FREQUENCY,
-    .clk_cfg          = LEDC_USE_REF_TICK
-};
+static volatile unsigned int unscanned_phases = 0;
+/**
+ * The bits of the mux phases that were scanned with none of the buttons, clips and the beak active since scanning last
+ * resumed. Once a full period was quiet, the scanner asks the GPIO task to pause scanning until an input is active.
+ */
+static volatile unsigned int quiet_phases = 0;
+/* Set by the scanner when all phases are quiet, until the GPIO task resumed scanning after the pause. */
+static volatile bool pause_pending = false;
+/* Set by the wakeup interrupt of the paused scanner or the standby mux, the GPIO task resumes the mux. */
+static volatile bool resume_pending = false;
 
-static const ledc_channel_config_t ledc_channel_configs[] = {
-    {
-        .speed_mode     = LEDC_HIGH_SPEED_MODE,
-        .channel        = LEDC_CHANNEL_0,
-        .timer_sel      = LEDC_TIMER_0,
-        .intr_type      = LEDC_INTR_DISABLE,
-        .gpio_num       = GPIO_NUM_LED_L_OUT,
-        .duty           = MUX_PWM_MAX / 3 - 2, /* Leave 2 / MUX_PWM_MAXth of the dutycycle as margin. */
-        .hpoint         = 0 /* Set the timer value at which the output will be latched. */
-    },
-    {
-        .speed_mode     = LEDC_HIGH_SPEED_MODE,
-        .channel        = LEDC_CHANNEL_1,
-        .timer_sel      = LEDC_TIMER_0,
-        .intr_type      = LEDC_INTR_DISABLE,
-        .gpio_num       = GPIO_NUM_LED_M_OUT,
-        .duty           = MUX_PWM_MAX / 3 - 2, /* Leave 2 / MUX_PWM_MAXth of the dutycycle as margin. */
-        .hpoint         = 0 /* Set the timer value at which the output will be latched. */
-    },
-    {
-        .speed_mode     = LEDC_HIGH_SPEED_MODE,
-        .channel        = LEDC_CHANNEL_0,
-        .timer_sel      = LEDC_TIMER_0,
-        .intr_type      = LEDC_INTR_DISABLE,
-        .gpio_num       = GPIO_NUM_LED_R_OUT,
-        .duty           = MUX_PWM_MAX / 3 - 2, /* Leave 2 / MUX_PWM_MAXth of the dutycycle as margin. */
-        .hpoint         = 0 /* Set the timer value at which the output will be latched. */
-    },
-    {
-        .speed_mode     = LEDC_HIGH_SPEED_MODE,
-        .channel        = LEDC_CHANNEL_2,
-        .timer_sel      = LEDC_TIMER_0,
-        .intr_type      = LEDC_INTR_DISABLE,
-        .gpio_num       = GPIO_NUM_MUX_BUTTONS_OUT,
-        .duty           = MUX_PWM_MAX / 3 - 2, /* Leave 2 / MUX_PWM_MAXth of the dutycycle as margin. */
-        .hpoint         = MUX_PWM_MAX * 2 / 3, /* Set the timer value at which the output will be latched. */
-    },
-    {
-        .speed_mode     = LEDC_HIGH_SPEED_MODE,
-        .channel        = LEDC_CHANNEL_3,
-        .timer_sel      = LEDC_TIMER_0,
-        .intr_type      = LEDC_INTR_DISABLE,
-        .gpio_num       = GPIO_NUM_MUX_CLIPS_OUT,
-        .duty           = MUX_PWM_MAX / 3 - 2, /* Leave 2 / MUX_PWM_MAXth of the dutycycle as margin. */
-        .hpoint         = MUX_PWM_MAX / 3, /* Set the timer value at which the output will be latched. */
-    }
+/**
+ * The edges that weren't handled by the GPIO task yet, indexed by enum muxed_input_edge. The timestamp is that of the
+ * first edge that made the mask non-zero.
+ */
+static portMUX_TYPE pending_events_lock = portMUX_INITIALIZER_UNLOCKED;
+static struct muxed_inputs_event pending_events[] = {
+    [MUXED_INPUT_EDGE_RISING] = { .edge = MUXED_INPUT_EDGE_RISING },
+    [MUXED_INPUT_EDGE_FALLING] = { .edge = MUXED_INPUT_EDGE_FALLING }
 };
 
-static const uint64_t gpio_pin_bit_mask_inout = GPIO_PIN_BIT_MASK_INOUT;
-static const uint64_t gpio_pin_bit_mask_in = GPIO_PIN_BIT_MASK_IN;
-
-static const gpio_config_t gpio_configs[] = {
-    {
-        /* Set as output mode. */
-        .mode         = GPIO_MODE_OUTPUT,
-        /* Bit mask of the pins that you want to set as outputs. */
-        .pin_bit_mask = GPIO_PIN_BIT_MASK_OUT,
-        /* Disable pull-down mode. */
-        .pull_down_en = 0,
-        /* Disable interrupts. */
-        .intr_type    = GPIO_INTR_DISABLE
-    },
-    {
-        /* Bit mask of the pins, use inputs here. */
-        .pin_bit_mask = gpio_pin_bit_mask_in,
-        /* Set as input mode. */
-        .mode         = GPIO_MODE_INPUT,
-        /* Enable pull-down mode. */
-        .pull_down_en = 1,
-        /* Enable interrupt on rising edge. */
-        .intr_type    = GPIO_INTR_POSEDGE
-    },
-    {
-        /* Bit mask of the pins, use input/open drain output here. */
-        .pin_bit_mask = gpio_pin_bit_mask_inout,
-        /* Set as input/output mode. */
-        .mode         = GPIO_MODE_INPUT_OUTPUT_OD,
-        /* Enable pull-down mode. */
-        .pull_down_en = 1,
-        /* Enable interrupt on rising edge. */
-        .intr_type    = GPIO_INTR_POSEDGE
+static void IRAM_ATTR on_mux_phase(enum muxed_gpio_hal_phase phase) {
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    muxed_inputs_mask_t phase_inputs = mux_phase_inputs[phase];
+    muxed_inputs_mask_t levels = (input_levels & ~phase_inputs) | muxed_gpio_hal_sample(phase_inputs);
+    muxed_inputs_mask_t changed = levels ^ input_levels;
+    bool seeding = unscanned_phases & (1U << phase);
+    
+    input_levels = levels;
+    unscanned_phases &= ~(1U << phase);
+    quiet_phases = levels & phase_inputs & ~MUXED_INPUT_MASK_MODE_SWITCH ? 0 : quiet_phases | 1U << phase;
+    if (quiet_phases == (1U << MUXED_GPIO_HAL_PHASE_N) - 1 && !unscanned_phases && !pause_pending) {
+        pause_pending = true;
+        vTaskNotifyGiveFromISR(gpio_task_handle, &higher_priority_task_woken);
     }
-};
-
-static TaskHandle_t gpio_task_handle = NULL;
-
-static void IRAM_ATTR gpio_buttons_and_clips_interrupt_handler(void *arg) {
-    static esp_cpu_cycle_count_t last_cycle_count[MUXED_INPUT_N];
-    /* Get input from buttons if true, and from clips if false. */
-    bool muxed_input_buttons;
-    struct interrupt_handler_args *args = arg;
-    esp_cpu_cycle_count_t cycle_count = esp_cpu_get_cycle_count();
+    if (seeding || !changed) {
+        portYIELD_FROM_ISR(higher_priority_task_woken);
+        return;
+    }
+    TRACE_INSTANT(TRACE_MUX_ISR, changed);
     
-    if ((muxed_input_buttons = gpio_get_level(GPIO_NUM_MUX_BUTTONS_OUT)) || gpio_get_level(GPIO_NUM_MUX_CLIPS_OUT)) {
-        enum muxed_inputs muxed_inouts = gpio_num_to_muxed_inouts[!muxed_input_buttons][args->gpio_num];
-        uint32_t difference = cycle_count - last_cycle_count[muxed_inouts];
-
-        last_cycle_count[muxed_inouts] = cycle_count;
-        /* 1.1 times difference in time that it takes for the interrupt to be triggered if a button is kept pressed. */
-        if (difference <= (configCPU_CLOCK_HZ / MUX_PWM_FREQUENCY / 100UL * 110UL))
-            return;
-        /* Get input. */
-        if (gpio_get_level(args->gpio_num)) {
-            struct muxed_gpio_msg msg = {0};
-            msg.levels[muxed_inouts] = 1;
-       
-            xQueueSendFromISR(args->queue, &msg, NULL);
-        }
+    int64_t timestamp_us = esp_timer_get_time();
+    muxed_inputs_mask_t edges[] = {
+        [MUXED_INPUT_EDGE_RISING] = changed & levels,
+        [MUXED_INPUT_EDGE_FALLING] = changed & ~levels
+    };
+    
+    portENTER_CRITICAL_ISR(&pending_events_lock);
+    for (enum muxed_input_edge edge = MUXED_INPUT_EDGE_RISING; edge <= MUXED_INPUT_EDGE_FALLING; edge++) {
+        if (!edges[edge])
+            continue;
+        input_trace_record(edge == MUXED_INPUT_EDGE_RISING ? INPUT_TRACE_EDGES_RISING : INPUT_TRACE_EDGES_FALLING,
+                           INPUT_TRACE_NO_INPUT, edges[edge], timestamp_us);
+        if (!pending_events[edge].mask)
+            pending_events[edge].timestamp_us = timestamp_us;
+        pending_events[edge].mask |= edges[edge];
     }
+    portEXIT_CRITICAL_ISR(&pending_events_lock);
+    
+    vTaskNotifyGiveFromISR(gpio_task_handle, &higher_priority_task_woken);
+    /* Switch to the GPIO task as soon as the interrupt returns, instead of at the next tick. */
+    portYIELD_FROM_ISR(higher_priority_task_woken);
 }
 
-static void IRAM_ATTR gpio_switches_interrupt_handler(void *arg) {
-    struct interrupt_handler_args *args = arg;
-    /* Get input. */
-    /* Whether MUX_BUTTONS or MUX_CLIPS is high doesn't matter here. */
-    if (gpio_get_level(args->gpio_num)) {
-        struct muxed_gpio_msg msg = {0};
-        msg.levels[gpio_num_to_muxed_inouts[0][args->gpio_num]] = 1;
-
-        xQueueSendFromISR(args->queue, &msg, NULL);
-    }
+static void IRAM_ATTR on_wake(void) {
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    
+    resume_pending = true;
+    vTaskNotifyGiveFromISR(gpio_task_handle, &higher_priority_task_woken);
+    portYIELD_FROM_ISR(higher_priority_task_woken);
 }
 
 static void muxed_gpio_task_handler(void *arg) {
-    struct muxed_gpio_msg msg;
     struct task_handler_args *args = arg;
     
-    for (;;)
-        if (pdTRUE == xQueueReceive(args->queue, &msg, (TickType_t)portMAX_DELAY))
-            args->fn(&msg.levels);
-}
-
-void muxed_gpio_setup(muxed_inputs_on_changed_fn fn) {
-    QueueHandle_t queue;
-    
-    /* Configure GPIO with the given settings. */
-    for (int i = 0; i < sizeof(gpio_configs) / sizeof(*gpio_configs); i++)
-        ESP_ERROR_CHECK(gpio_config(&gpio_configs[i]));
-
-    ESP_ERROR_CHECK(ledc_timer_config(&ledc_timer0_config));
-    
-    for (int i = 0; i < sizeof(ledc_channel_configs) / sizeof(*ledc_channel_configs); i++) {
-        gpio_num_t gpio_num = ledc_channel_configs[i].gpio_num;
-        ESP_ERROR_CHECK(ledc_channel_config(&ledc_channel_configs[i]));
-        if (gpio_num == GPIO_NUM_MUX_BUTTONS_OUT || gpio_num == GPIO_NUM_MUX_CLIPS_OUT) {
-            /**
-             * We also need these two GPIOs to function as inputs, since we're getting the level of them
-             * in the interrupt for the clips and buttons.
-             */
-            ESP_ERROR_CHECK(gpio_set_direction(gpio_num, GPIO_MODE_INPUT_OUTPUT));
-            esp_rom_gpio_connect_out_signal(gpio_num,
-                                            ledc_periph_signal[ledc_channel_configs[i].speed_mode].sig_out0_idx + 
-                                                ledc_channel_configs[i].channel, 
-                                            ledc_channel_configs[i].flags.output_invert, 0);
+    for (;;) {
+        struct muxed_inputs_event events[sizeof(pending_events) / sizeof(*pending_events)];
+        
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        
+        /* The input that woke the mux is picked up by the first scan of its phase, like any other edge. */
+        if (resume_pending) {
+            resume_pending = false;
+            quiet_phases = 0;
+            muxed_gpio_hal_resume();
+            pause_pending = false;
+        } else if (pause_pending && quiet_phases == (1U << MUXED_GPIO_HAL_PHASE_N) - 1) {
+            /* Without an active input, the level interrupts of the pins replace the interrupts of the phases. */
+            muxed_gpio_hal_pause_scanning(&on_wake);
+        } else {
+            pause_pending = false;
         }
-        ESP_ERROR_CHECK(ledc_update_duty(ledc_channel_configs[i].speed_mode, ledc_channel_configs[i].channel));
-    }
-   
-    /* Output the same signal on the star, triangle... in/outputs as on the LED_* outputs, but then inverted. */
-    for (enum muxed_outputs i = MUXED_OUTPUT_MIN; i <= MUXED_OUTPUT_MAX; i++) {
-       ledc_channel_config_t config = ledc_channel_configs[0];
-       config.gpio_num = muxed_inouts_to_gpio_num[i];
-       config.channel = muxed_inouts_to_ledc_channel[i].bc_channel;
-       config.flags.output_invert = 1;
-       ESP_ERROR_CHECK(ledc_channel_config(&config));
-       /**
-        * Hack to use open drain outputs for the star, triangle... in/outputs, since ledc_channel_config()
-        * always sets the pin to regular outputs. But if we would only call gpio_set_direction() here, the
-        * signal would get disconnected from the pin, so we have to call esp_rom_gpio_connect_out_signal()
-        * again (which is normally called in ledc_channel_config()).
-        */
-       ESP_ERROR_CHECK(gpio_set_direction(config.gpio_num, GPIO_MODE_INPUT_OUTPUT_OD));
-       esp_rom_gpio_connect_out_signal(config.gpio_num,
-                                       ledc_periph_signal[config.speed_mode].sig_out0_idx + config.channel, 
-                                       config.flags.output_invert, 0);
-       ESP_ERROR_CHECK(ledc_update_duty(config.speed_mode, config.channel));
-    }
-    
-    queue = xQueueCreate(50, sizeof(struct muxed_gpio_msg));
-    if (!queue) {
-        ESP_LOGE(TAG, "Failed to create queue for the GPIO interrupt\n");
-        return;
-    }
-    
-    /* Register interrupt callbacks for the buttons and clips in/outputs. */
-    ESP_ERROR_CHECK(gpio_install_isr_service(0));
-    uint64_t bit_mask = gpio_pin_bit_mask_inout;
-    for (int test_bit = 0; test_bit < sizeof(gpio_pin_bit_mask_inout) * 8; test_bit++, bit_mask >>= 1) {
-        if (bit_mask & 1) {
-            struct interrupt_handler_args *args = malloc(sizeof(*args));
-            args->gpio_num = test_bit;
-            args->queue = queue;
-            ESP_ERROR_CHECK(gpio_isr_handler_add(args->gpio_num, &gpio_buttons_and_clips_interrupt_handler, args));
+        
+        /* Take all edges that arrived since the last time at once, which merges them into one event per edge. */
+        portENTER_CRITICAL(&pending_events_lock);
+        for (int i = 0; i < sizeof(events) / sizeof(*events); i++) {
+            events[i] = pending_events[i];
+            pending_events[i].mask = 0;
         }
-    }
-    
-    /* Register interrupt callbacks for the switches inputs. */
-    bit_mask = gpio_pin_bit_mask_in;
-    for (int test_bit = 0; test_bit < sizeof(gpio_pin_bit_mask_in) * 8; test_bit++, bit_mask >>= 1) {
-        if (bit_mask & 1) {
-            struct interrupt_handler_args *args = malloc(sizeof(*args));
-            args->gpio_num = test_bit;
-            args->queue = queue;
-            ESP_ERROR_CHECK(gpio_isr_handler_add(args->gpio_num, &gpio_switches_interrupt_handler, args));
+        portEXIT_CRITICAL(&pending_events_lock);
+        
+        for (int i = 0; i < sizeof(events) / sizeof(*events); i++) {
+            if (!events[i].mask)
+                continue;
+            stats_input_latency(esp_timer_get_time() - events[i].timestamp_us);
+            args->fn(&events[i]);
         }
     }
-  
+}
+
+void muxed_gpio_setup(muxed_inputs_on_changed_fn fn) {
+    muxed_gpio_hal_setup();
+    
+    /* The task has to exist before the interrupts that notify it are enabled. */
     struct task_handler_args *args = malloc(sizeof(*args));
-    args->queue = queue;
     args->fn = fn;
-    xTaskCreate(&muxed_gpio_task_handler, "GPIO task handler", 1024, args, 15, &gpio_task_handle);
+    xTaskCreate(&muxed_gpio_task_handler, "GPIO task handler", 2048, args, 15, &gpio_task_handle);
     if (!gpio_task_handle) {
         ESP_LOGE(TAG, "Failed to create the GPIO handler task\n");
         return;
     }
-
-#if 0
-    // Turn off LEDC or PWM
-    for (int i = 0; i < sizeof(ledc_channel_configs) / sizeof(*ledc_channel_configs); i++)
-        ESP_ERROR_CHECK(ledc_stop(ledc_channel_configs[i].speed_mode, ledc_channel_configs[i].channel, 0));
-    gpio_uninstall_isr_service();
     
-    if (gpio_task_handle)
-        vTaskDelete(gpio_task_handle);
-    if (queue)
-        vQueueDelete(queue);
-#endif
+    /**
+     * The switches aren't muxed, so they can be sampled right away. The buttons and clips can only be sampled in their
+     * mux phase, the first scan of every phase takes their levels.
+     */
+    input_levels = muxed_gpio_hal_sample(MUXED_INPUT_MASK_SWITCHES);
+    unscanned_phases = (1U << MUXED_GPIO_HAL_PHASE_N) - 1;
+    muxed_gpio_hal_start_scanning(&on_mux_phase);
+}
+
+void muxed_gpio_standby(void) {
+    muxed_gpio_hal_standby(&on_wake);
 }
 
 void muxed_gpio_set_output_levels(bool (*levels)[MUXED_OUTPUT_N]) {
-    /* Set output to LEDs. */
-    bool lmr_channel_on[] = { [LEDC_CHANNEL_0] = false, [LEDC_CHANNEL_1] = false };
-    bool bc_channel_on[] = {
-        [LEDC_CHANNEL_4] = false, [LEDC_CHANNEL_5] = false, [LEDC_CHANNEL_6] = false, [LEDC_CHANNEL_7] = false
-    };
-    
-    for (enum muxed_outputs i = MUXED_OUTPUT_MIN; i <= MUXED_OUTPUT_MAX; i++)
-        if ((*levels)[i])
-            lmr_channel_on[muxed_inouts_to_ledc_channel[i].lmr_channel] = 
-                bc_channel_on[muxed_inouts_to_ledc_channel[i].bc_channel] = true;
-    for (ledc_channel_t i = LEDC_CHANNEL_0; i <= LEDC_CHANNEL_1; i++) {
-        ledc_set_duty(ledc_channel_configs[0].speed_mode, i, lmr_channel_on[i] ? ledc_channel_configs[0].duty : 0);
-        ledc_update_duty(ledc_channel_configs[0].speed_mode, i);
-    }
-    for (ledc_channel_t i = LEDC_CHANNEL_4; i <= LEDC_CHANNEL_7; i++) {
-        ledc_set_duty(ledc_channel_configs[0].speed_mode, i, bc_channel_on[i] ? ledc_channel_configs[0].duty : 0);
-        ledc_update_duty(ledc_channel_configs[0].speed_mode, i);
-    }
+    muxed_gpio_hal_set_leds(levels);
+}
+
+void muxed_gpio_fade_output_levels(const uint8_t (*levels)[MUXED_OUTPUT_N], uint32_t fade_ms) {
+    muxed_gpio_hal_fade_leds(levels, fade_ms);
 }
 
 void muxed_gpio_get_input_switch_levels(bool (*levels)[MUXED_INPUT_N]) {
+    muxed_inputs_mask_t switch_levels = muxed_gpio_hal_sample(MUXED_INPUT_MASK_SWITCHES);
+    
     for (enum muxed_inputs i = MUXED_INPUT_SWITCH_MIN; i <= MUXED_INPUT_SWITCH_MAX; i++)
-        (*levels)[i] = gpio_get_level(muxed_inouts_to_gpio_num[i]);
+        (*levels)[i] = switch_levels & MUXED_INPUT_BIT(i);
+}
+
+muxed_inputs_mask_t muxed_gpio_get_input_levels(void) {
+    return input_levels;
+}
+
+muxed_inputs_mask_t muxed_gpio_wait_for_input_levels(void) {
+    /* Takes one mux period, which is shorter than a tick. */
+    while (unscanned_phases)
+        vTaskDelay(1);
+    return input_levels;
 }
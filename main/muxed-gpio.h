@@ -2,6 +2,7 @@
 #define MUXED_GPIO_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 enum muxed_inputs {
     MUXED_INPUT_MIN = 0, /* 0 */
@@ -63,10 +64,60 @@ enum muxed_outputs {
     MUXED_OUTPUT_N /* 8 */
 };
 
-typedef void (*muxed_inputs_on_changed_fn)(volatile bool (*)[MUXED_INPUT_N]);
+/* Every entry of enum muxed_inputs is a bit in a mask. */
+typedef uint32_t muxed_inputs_mask_t;
+
+#define MUXED_INPUT_BIT(input) ((muxed_inputs_mask_t)1 << (input))
+#define MUXED_INPUT_MASK_ALL (MUXED_INPUT_BIT(MUXED_INPUT_N) - 1)
+
+enum muxed_input_edge {
+    MUXED_INPUT_EDGE_RISING,
+    MUXED_INPUT_EDGE_FALLING
+};
+
+/**
+ * The inputs are sampled at the start of every mux phase, so edges are detected with a resolution of one PWM period.
+ * Edges that arrive while the previous event is being handled are merged into one event per direction, the timestamp
+ * is the esp_timer_get_time() of the first of these edges.
+ */
+struct muxed_inputs_event {
+    muxed_inputs_mask_t mask;
+    enum muxed_input_edge edge;
+    int64_t timestamp_us;
+};
+
+typedef void (*muxed_inputs_on_changed_fn)(const struct muxed_inputs_event *event);
 
 void muxed_gpio_setup(muxed_inputs_on_changed_fn fn);
 void muxed_gpio_set_output_levels(bool (*levels)[MUXED_OUTPUT_N]);
 void muxed_gpio_get_input_switch_levels(bool (*levels)[MUXED_INPUT_N]);
 
+/**
+ * @brief     fade the LEDs to the brightness in [levels], 0 is off and UINT8_MAX fully lit, in [fade_ms]
+ *
+ * The fade runs in hardware, see muxed_gpio_hal_fade_leds().
+ */
+void muxed_gpio_fade_output_levels(const uint8_t (*levels)[MUXED_OUTPUT_N], uint32_t fade_ms);
+
+/**
+ * @brief     stop scanning the inputs and turn off the LEDs until a button or the beak is pressed, or a switch is moved
+ *
+ * Lets the chip go to light sleep, if that's enabled. The mux resumes by itself, and the input that woke it is
+ * reported as usual, with the latency of waking up added to its edge.
+ */
+void muxed_gpio_standby(void);
+
+/**
+ * @brief     get the levels of all inputs as sampled by the last scan of their mux phase
+ */
+muxed_inputs_mask_t muxed_gpio_get_input_levels(void);
+
+/**
+ * @brief     wait until every mux phase was scanned since muxed_gpio_setup(), and get the levels of all inputs then
+ *
+ * Until then, muxed_gpio_get_input_levels() only has the levels of the switches. Edges are only reported after it, so
+ * these levels are what the first edge of every input changes.
+ */
+muxed_inputs_mask_t muxed_gpio_wait_for_input_levels(void);
+
 #endif /* MUXED_GPIO_H */
@@ -0,0 +1,107 @@
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "muxed-leds.h"
+#include "stats.h"
+
+static const char *const TAG = "muxed-leds";
+
+/* Notification bits of the LED task. */
+#define LEDS_NOTIFY_PATTERN  BIT0
+#define LEDS_NOTIFY_ENVELOPE BIT1
+
+static TaskHandle_t leds_task_handle = NULL;
+/* The pattern passed to muxed_leds_play(), taken over by the LED task when it's notified. */
+static const struct muxed_led_pattern *volatile next_pattern = NULL;
+/* The level and fade time passed to muxed_leds_set_envelope(), in one word so they're always read together. */
+static volatile uint32_t next_envelope = UINT8_MAX;
+
+static void muxed_leds_task_handler(void *arg) {
+    const struct muxed_led_pattern *pattern = NULL;
+    size_t keyframe = 0;
+    /* The tick at which the current keyframe ends, counting from the end of the previous one so there's no drift. */
+    TickType_t keyframe_end = 0;
+    /* The levels of the current keyframe, which are scaled by the envelope. All LEDs are lit at setup. */
+    uint8_t levels[MUXED_OUTPUT_N], envelope_level = UINT8_MAX;
+
+    memset(levels, UINT8_MAX, sizeof(levels));
+    for (;;) {
+        TickType_t timeout = portMAX_DELAY;
+        uint32_t notified = 0;
+        uint16_t fade_ms = 0;
+        uint8_t scaled_levels[MUXED_OUTPUT_N];
+        struct stats_cycles start_cycles;
+
+        if (pattern) {
+            TickType_t remaining = keyframe_end - xTaskGetTickCount();
+            /* The tick count wraps, a remaining time of more than half the range means the keyframe already ended. */
+            timeout = remaining < portMAX_DELAY / 2 ? remaining : 0;
+        }
+
+        xTaskNotifyWait(0, UINT32_MAX, &notified, timeout);
+        start_cycles = stats_cycles_start();
+
+        if (notified & LEDS_NOTIFY_ENVELOPE) {
+            uint32_t envelope = next_envelope;
+
+            envelope_level = envelope & UINT8_MAX;
+            fade_ms = envelope >> 8;
+        }
+        /* Without a notification the timeout expired, which means the current keyframe ended. */
+        if (!notified || (notified & LEDS_NOTIFY_PATTERN)) {
+            if (notified) {
+                pattern = next_pattern;
+                keyframe = 0;
+                keyframe_end = xTaskGetTickCount();
+            } else if (++keyframe == pattern->n_keyframes) {
+                keyframe = 0;
+                if (!pattern->loop)
+                    pattern = NULL;
+            }
+            if (pattern && !pattern->n_keyframes)
+                pattern = NULL;
+
+            if (pattern) {
+                const struct muxed_led_keyframe *current = &pattern->keyframes[keyframe];
+
+                ESP_LOGD(TAG, "Keyframe %u of %u, fade %u ms, hold %u ms", keyframe, pattern->n_keyframes,
+                         current->fade_ms, current->hold_ms);
+                memcpy(levels, current->levels, sizeof(levels));
+                fade_ms = current->fade_ms;
+                keyframe_end += pdMS_TO_TICKS(current->fade_ms + current->hold_ms);
+            } else if (!(notified & LEDS_NOTIFY_ENVELOPE)) {
+                continue;
+            }
+        }
+
+        for (enum muxed_outputs i = MUXED_OUTPUT_MIN; i <= MUXED_OUTPUT_MAX; i++)
+            scaled_levels[i] = levels[i] * envelope_level / UINT8_MAX;
+        muxed_gpio_fade_output_levels(&scaled_levels, fade_ms);
+        if (notified & LEDS_NOTIFY_ENVELOPE)
+            stats_envelope_fade(stats_cycles_since(start_cycles));
+    }
+}
+
+void muxed_leds_setup(void) {
+    xTaskCreate(&muxed_leds_task_handler, "LED task", 2048, NULL, 5, &leds_task_handle);
+    if (!leds_task_handle)
+        ESP_LOGE(TAG, "Failed to create the LED task\n");
+}
+
+void muxed_leds_play(const struct muxed_led_pattern *pattern) {
+    next_pattern = pattern;
+    if (leds_task_handle)
+        xTaskNotify(leds_task_handle, LEDS_NOTIFY_PATTERN, eSetBits);
+}
+
+void muxed_leds_set_envelope(uint8_t level, uint16_t fade_ms) {
+    next_envelope = level | (uint32_t)fade_ms << 8;
+    if (leds_task_handle)
+        xTaskNotify(leds_task_handle, LEDS_NOTIFY_ENVELOPE, eSetBits);
+}
@@ -0,0 +1,49 @@
+#ifndef MUXED_LEDS_H
+#define MUXED_LEDS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "muxed-gpio.h"
+
+/**
+ * One step of an LED pattern: the LEDs fade from the previous keyframe to [levels] in [fade_ms], and stay there for
+ * [hold_ms] before the next keyframe starts.
+ */
+struct muxed_led_keyframe {
+    uint8_t levels[MUXED_OUTPUT_N]; /* Brightness of every LED, 0 is off and UINT8_MAX fully lit. */
+    uint16_t fade_ms;
+    uint16_t hold_ms;
+};
+
+struct muxed_led_pattern {
+    const struct muxed_led_keyframe *keyframes;
+    size_t n_keyframes;
+    bool loop; /* Start over after the last keyframe, instead of keeping it. */
+};
+
+/**
+ * @brief     start the LED task, which plays the patterns independently of the caller
+ *
+ * The fades between keyframes run in hardware, the task only wakes up at the start of every keyframe.
+ */
+void muxed_leds_setup(void);
+
+/**
+ * @brief     play [pattern] from its first keyframe, or freeze the LEDs at their current levels if it's NULL
+ *
+ * [pattern] has to stay valid while it's playing. A fade that is in progress finishes before the new pattern starts.
+ */
+void muxed_leds_play(const struct muxed_led_pattern *pattern);
+
+/**
+ * @brief     scale the brightness of the LEDs by [level], fading to it in [fade_ms]
+ *
+ * Meant to be called for every audio frame with the loudness envelope of the clip, so the LEDs pulse with the audio.
+ * Only the latest level is kept, if the LED task is still busy with a fade the intermediate levels are skipped.
+ * UINT8_MAX restores the full brightness of the pattern.
+ */
+void muxed_leds_set_envelope(uint8_t level, uint16_t fade_ms);
+
+#endif /* MUXED_LEDS_H */
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+#include "esp_log.h"
+#include "esp_err.h"
+#include "opus.h"
+
+#include "opus-profile.h"
+#include "sipkip-audio.h"
+#include "utils.h"
+
+static const char *const TAG = "opus-profile";
+
+/**
+ * The TOC byte of every opus packet starts with its configuration, configurations 0 up to 11 are SILK-only, 12 up to 15
+ * are hybrid and 16 up to 31 are CELT-only. The stereo flag follows it, see RFC 6716 section 3.1.
+ */
+#define OPUS_TOC_CONFIG(toc) ((toc) >> 3)
+#define OPUS_TOC_STEREO(toc) ((toc) & 0x4)
+#define OPUS_TOC_CONFIG_CELT_ONLY 16
+
+#define OPUS_MAX_FRAMES_PER_PACKET 48
+
+#ifdef CONFIG_SIPKIP_OPUS_CELT_ONLY
+/**
+ * Internal CELT entry points of libopus, which are declared here because celt.h can only be included with the private
+ * build configuration of the library. The requests are the ones opus_decoder.c uses to drive the CELT decoder.
+ */
+typedef struct OpusCustomDecoder CELTDecoder;
+
+int celt_decoder_get_size(int channels);
+int celt_decoder_init(CELTDecoder *st, opus_int32 sampling_rate, int channels);
+int celt_decode_with_ec(CELTDecoder *st, const unsigned char *data, int len, opus_int16 *pcm, int frame_size,
+                        void *dec, int accum);
+int opus_custom_decoder_ctl(CELTDecoder *st, int request, ...);
+
+#define CELT_SET_END_BAND_REQUEST 10012
+#define CELT_SET_SIGNALLING_REQUEST 10016
+
+struct opus_profile_decoder {
+    CELTDecoder *celt;
+};
+
+esp_err_t opus_profile_decoder_create(struct opus_profile_decoder **decoder) {
+    int err;
+
+    *decoder = malloc(sizeof(**decoder));
+    if (!*decoder)
+        return ESP_ERR_NO_MEM;
+
+    (*decoder)->celt = malloc(celt_decoder_get_size(1));
+    if (!(*decoder)->celt) {
+        free(*decoder);
+        return ESP_ERR_NO_MEM;
+    }
+
+    err = celt_decoder_init((*decoder)->celt, OPUS_SAMPLE_RATE, 1);
+    if (err != OPUS_OK) {
+        ESP_LOGE(TAG, "Failed to initialize CELT decoder: %s", opus_strerror(err));
+        opus_profile_decoder_destroy(*decoder);
+        return ESP_FAIL;
+    }
+    /* Opus packets don't carry the CELT signalling bits of Opus Custom. */
+    opus_custom_decoder_ctl((*decoder)->celt, CELT_SET_SIGNALLING_REQUEST, 0);
+    return ESP_OK;
+}
+
+void opus_profile_decoder_destroy(struct opus_profile_decoder *decoder) {
+    if (!decoder)
+        return;
+    free(decoder->celt);
+    free(decoder);
+}
+
+int opus_profile_decode(struct opus_profile_decoder *decoder, const unsigned char *packet, int len, opus_int16 *pcm,
+                        int max_frame_size) {
+    const unsigned char *frames[OPUS_MAX_FRAMES_PER_PACKET];
+    opus_int16 frame_sizes[OPUS_MAX_FRAMES_PER_PACKET];
+    unsigned char toc;
+    int n_frames, frame_size, end_band;
+
+    if (opus_profile_check_packet(packet, len) != ESP_OK)
+        return OPUS_INVALID_PACKET;
+
+    n_frames = opus_packet_parse(packet, len, &toc, frames, frame_sizes, NULL);
+    frame_size = opus_packet_get_samples_per_frame(packet, OPUS_SAMPLE_RATE);
+    if (n_frames * frame_size > max_frame_size)
+        return OPUS_BUFFER_TOO_SMALL;
+
+    /* The same band limits as opus_decoder.c uses, medium band doesn't exist in CELT. */
+    switch (opus_packet_get_bandwidth(packet)) {
+        case OPUS_BANDWIDTH_NARROWBAND:
+            end_band = 13;
+            break;
+        case OPUS_BANDWIDTH_MEDIUMBAND:
+        case OPUS_BANDWIDTH_WIDEBAND:
+            end_band = 17;
+            break;
+        case OPUS_BANDWIDTH_SUPERWIDEBAND:
+            end_band = 19;
+            break;
+        default:
+            end_band = 21;
+            break;
+    }
+    opus_custom_decoder_ctl(decoder->celt, CELT_SET_END_BAND_REQUEST, end_band);
+
+    for (int i = 0; i < n_frames; i++) {
+        int ret = celt_decode_with_ec(decoder->celt, frames[i], frame_sizes[i], pcm + i * frame_size, frame_size, NULL,
+                                      0);
+        if (ret < 0)
+            return ret;
+    }
+    return n_frames * frame_size;
+}
+#else
+struct opus_profile_decoder {
+    OpusDecoder *opus;
+};
+
+esp_err_t opus_profile_decoder_create(struct opus_profile_decoder **decoder) {
+    int err;
+
+    *decoder = malloc(sizeof(**decoder));
+    if (!*decoder)
+        return ESP_ERR_NO_MEM;
+
+    (*decoder)->opus = opus_decoder_create(OPUS_SAMPLE_RATE, 1, &err);
+    if (err < 0) {
+        ESP_LOGE(TAG, "Failed to create decoder: %s", opus_strerror(err));
+        free(*decoder);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void opus_profile_decoder_destroy(struct opus_profile_decoder *decoder) {
+    if (!decoder)
+        return;
+    opus_decoder_destroy(decoder->opus);
+    free(decoder);
+}
+
+int opus_profile_decode(struct opus_profile_decoder *decoder, const unsigned char *packet, int len, opus_int16 *pcm,
+                        int max_frame_size) {
+    return opus_decode(decoder->opus, packet, len, pcm, max_frame_size, 0);
+}
+#endif
+
+esp_err_t opus_profile_check_packet(const unsigned char *packet, int len) {
+    const unsigned char *frames[OPUS_MAX_FRAMES_PER_PACKET];
+    opus_int16 frame_sizes[OPUS_MAX_FRAMES_PER_PACKET];
+    unsigned char toc;
+    int n_frames;
+
+    if (len <= 0)
+        return ESP_ERR_INVALID_SIZE;
+
+    n_frames = opus_packet_parse(packet, len, &toc, frames, frame_sizes, NULL);
+    if (n_frames < 0 || n_frames * opus_packet_get_samples_per_frame(packet, OPUS_SAMPLE_RATE) > OPUS_MAX_FRAME_SIZE)
+        return ESP_ERR_INVALID_SIZE;
+#ifdef CONFIG_SIPKIP_OPUS_CELT_ONLY
+    if (OPUS_TOC_CONFIG(toc) < OPUS_TOC_CONFIG_CELT_ONLY || OPUS_TOC_STEREO(toc))
+        return ESP_ERR_NOT_SUPPORTED;
+#endif
+    return ESP_OK;
+}
+
+esp_err_t opus_profile_check_clip(FILE *out, const char *path) {
+    static const char opus_extension[] = ".opus", opus_packets_extension[] = ".opus_packets";
+    size_t path_len = strlen(path), base_len;
+    char *opus_path = NULL, *opus_packets_path = NULL;
+    FILE *opus = NULL, *opus_packets = NULL;
+    unsigned char *packet = NULL;
+    esp_err_t ret = ESP_OK;
+    long opus_size, offset = 0;
+
+    if (path_len >= strlen(opus_packets_extension) &&
+        !strcmp(path + path_len - strlen(opus_packets_extension), opus_packets_extension))
+        base_len = path_len - strlen(opus_packets_extension);
+    else if (path_len >= strlen(opus_extension) && !strcmp(path + path_len - strlen(opus_extension), opus_extension))
+        base_len = path_len - strlen(opus_extension);
+    else
+        return ESP_OK;
+
+    opus_path = malloc(base_len + sizeof(opus_packets_extension));
+    opus_packets_path = malloc(base_len + sizeof(opus_packets_extension));
+    packet = malloc(OPUS_MAX_PACKET_SIZE);
+    if (!opus_path || !opus_packets_path || !packet) {
+        ret = ESP_ERR_NO_MEM;
+        goto exit;
+    }
+    sprintf(opus_path, "%.*s%s", (int)base_len, path, opus_extension);
+    sprintf(opus_packets_path, "%.*s%s", (int)base_len, path, opus_packets_extension);
+
+    opus = fopen(opus_path, "r");
+    opus_packets = fopen(opus_packets_path, "r");
+    if (!opus || !opus_packets) {
+        /* The other half of the clip hasn't been uploaded yet. */
+        if (errno != ENOENT)
+            ret = ESP_FAIL;
+        goto exit;
+    }
+
+    fseek(opus, 0, SEEK_END);
+    opus_size = ftell(opus);
+    fseek(opus, 0, SEEK_SET);
+
+    for (int i = 0;; i++) {
+        int lsb = fgetc(opus_packets), msb = fgetc(opus_packets);
+        int packet_size;
+
+        /* An odd trailing byte can only be padding. */
+        if (lsb == EOF || msb == EOF)
+            break;
+        packet_size = (short)(lsb | msb << 8);
+        if (packet_size == OPUS_PROFILE_PADDING_PACKET_SIZE)
+            break;
+
+        if (packet_size <= 0 || packet_size > OPUS_MAX_PACKET_SIZE || offset + packet_size > opus_size) {
+            fprintf(out, "Packet %d has an invalid size of %d bytes\n", i, packet_size);
+            ret = ESP_ERR_INVALID_SIZE;
+            break;
+        }
+        if (fread(packet, 1, packet_size, opus) < packet_size) {
+            ret = ESP_FAIL;
+            break;
+        }
+        offset += packet_size;
+
+        ret = opus_profile_check_packet(packet, packet_size);
+        if (ret == ESP_ERR_NOT_SUPPORTED) {
+            fprintf(out, "Packet %d (TOC 0x%02x) can't be decoded by the %s decoder of this firmware\n", i, packet[0],
+                    OPUS_PROFILE_NAME);
+            break;
+        } else if (ret != ESP_OK) {
+            fprintf(out, "Packet %d is malformed\n", i);
+            break;
+        }
+    }
+
+exit:
+    if (ret != ESP_OK)
+        ESP_LOGW(TAG, "Clip %.*s doesn't match the %s profile: %s", (int)base_len, path, OPUS_PROFILE_NAME,
+                 esp_err_to_name(ret));
+    if (opus)
+        fclose(opus);
+    if (opus_packets)
+        fclose(opus_packets);
+    free(opus_path);
+    free(opus_packets_path);
+    free(packet);
+    return ret;
+}
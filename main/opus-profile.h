@@ -0,0 +1,61 @@
+#ifndef OPUS_PROFILE_H
+#define OPUS_PROFILE_H
+
+#include <stdio.h>
+
+#include "sdkconfig.h"
+
+#include "esp_err.h"
+#include "opus.h"
+
+/**
+ * The decoder profile the firmware is built with, see CONFIG_SIPKIP_OPUS_CELT_ONLY. The CELT-only profile calls the
+ * CELT decoder of libopus directly, so the SILK and hybrid decoders are left out of the firmware by the linker.
+ */
+#ifdef CONFIG_SIPKIP_OPUS_CELT_ONLY
+#define OPUS_PROFILE_NAME "CELT-only"
+#else
+#define OPUS_PROFILE_NAME "full"
+#endif
+
+/* XMODEM pads a .opus_packets file with CTRL-Z, which reads as this size, which is larger than any valid packet. */
+#define OPUS_PROFILE_PADDING_PACKET_SIZE 0x1A1A
+
+struct opus_profile_decoder;
+
+esp_err_t opus_profile_decoder_create(struct opus_profile_decoder **decoder);
+void opus_profile_decoder_destroy(struct opus_profile_decoder *decoder);
+
+/**
+ * @brief     decode one opus packet with the decoder of the profile, like opus_decode() without FEC
+ *
+ * @return    the number of decoded samples, or a negative opus error code
+ */
+int opus_profile_decode(struct opus_profile_decoder *decoder, const unsigned char *packet, int len, opus_int16 *pcm,
+                        int max_frame_size);
+
+/**
+ * @brief     check whether a packet can be decoded by the profile
+ *
+ * @return
+ *          - ESP_OK                on success
+ *          - ESP_ERR_INVALID_SIZE  if the packet is malformed, or decodes to more than OPUS_MAX_FRAME_SIZE samples
+ *          - ESP_ERR_NOT_SUPPORTED if the packet uses a mode or channel count the profile can't decode
+ */
+esp_err_t opus_profile_check_packet(const unsigned char *packet, int len);
+
+/**
+ * @brief     check every packet of the clip of which [path] is the .opus or .opus_packets file
+ *
+ * Nothing is checked when the other file of the clip doesn't exist (yet), or when [path] isn't part of a clip. The
+ * first offending packet is printed to [out].
+ *
+ * @return
+ *          - ESP_OK                if the clip can be played, or isn't complete yet
+ *          - ESP_ERR_INVALID_SIZE  if the packet sizes don't match the .opus file, or a packet is malformed
+ *          - ESP_ERR_NOT_SUPPORTED if a packet can't be decoded by the profile
+ *          - ESP_FAIL              if the files couldn't be read
+ */
+esp_err_t opus_profile_check_clip(FILE *out, const char *path);
+
+#endif /* OPUS_PROFILE_H */
@@ -0,0 +1,407 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <sys/unistd.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_littlefs.h"
+
+#include "rpc.h"
+#include "commands.h"
+#include "manifest.h"
+#include "stats.h"
+#include "utils.h"
+
+static const char *const TAG = "rpc";
+
+#define RPC_WORKER_QUEUE_LEN 4
+/* How long to wait before checking again whether the worker answered the pending requests of a closing session. */
+#define RPC_PENDING_POLL_MS 10
+/* The length of the result of RPC_METHOD_STAT, and of the entries of RPC_METHOD_LIST before their name. */
+#define RPC_STAT_LEN (2 * sizeof(uint32_t) + 1)
+
+struct rpc_request {
+    struct spp_session *session;
+    struct rpc_header header;
+    /* The path of a read or write, resolved when the request arrived so the session may change directory meanwhile. */
+    char path[SPP_PATH_MAX];
+    /* One byte longer than header.len, so the last string in it is always terminated. */
+    char payload[];
+};
+
+static QueueHandle_t rpc_worker_queue = NULL;
+/* Responses from the worker and from the session tasks are written as whole frames. */
+static SemaphoreHandle_t rpc_write_mutex = NULL;
+
+static esp_err_t rpc_write(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+
+    while (len) {
+        ssize_t ret = write(fd, p, len);
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Couldn't write to vfs fd %d: %s!", fd, strerror(errno));
+            return ESP_FAIL;
+        }
+        stats_add(&stats_counters.spp_tx_bytes, ret);
+        p += ret;
+        len -= ret;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t rpc_respond(const struct rpc_request *request, esp_err_t err, const void *result, size_t len) {
+    struct rpc_header header = {
+        .len = sizeof(int32_t) + len,
+        .id = request->header.id,
+        .method = request->header.method
+    };
+    int32_t status = err;
+    char *frame = malloc(sizeof(header) + header.len);
+    esp_err_t ret;
+
+    if (!frame)
+        return ESP_ERR_NO_MEM;
+    /* One write per frame, so it goes out in as few SPP writes as possible. */
+    memcpy(frame, &header, sizeof(header));
+    memcpy(&frame[sizeof(header)], &status, sizeof(status));
+    if (len)
+        memcpy(&frame[sizeof(header) + sizeof(status)], result, len);
+
+    xSemaphoreTake(rpc_write_mutex, portMAX_DELAY);
+    ret = rpc_write(request->session->fd, frame, sizeof(header) + header.len);
+    xSemaphoreGive(rpc_write_mutex);
+    free(frame);
+    return ret;
+}
+
+/* Reads exactly [len] bytes, first from the [*pending_len] bytes at [*pending] that the shell already read. */
+static esp_err_t rpc_read(struct spp_session *session, const char **pending, size_t *pending_len, void *buf,
+                          size_t len) {
+    char *p = buf;
+    size_t n = MIN(len, *pending_len);
+
+    memcpy(p, *pending, n);
+    *pending += n;
+    *pending_len -= n;
+    p += n;
+    len -= n;
+    while (len) {
+        ssize_t ret = spp_read(session->fd, p, len, portMAX_DELAY);
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Couldn't read from vfs fd %d: %s!", session->fd, strerror(errno));
+            return ESP_FAIL;
+        }
+        p += ret;
+        len -= ret;
+    }
+    return ESP_OK;
+}
+
+static void rpc_run_command(struct rpc_request *request, const struct vfs_commands *command) {
+    struct spp_session *session = request->session;
+    const char *end = &request->payload[request->header.len];
+    char *argv[SPP_MAX_ARGC] = { (char *)command->name };
+    char *output = NULL;
+    size_t output_len = 0;
+    FILE *out = session->out;
+    esp_err_t err = ESP_OK;
+    int argc = 1;
+
+    for (char *arg = request->payload; arg < end; arg += strlen(arg) + 1) {
+        if (argc == SPP_MAX_ARGC) {
+            err = ESP_ERR_INVALID_ARG;
+            break;
+        }
+        argv[argc++] = arg;
+    }
+    /* A write request does what rx does. */
+    if (command_takes_over_fd(command))
+        err = ESP_ERR_NOT_SUPPORTED;
+
+    if (err == ESP_OK) {
+        /* The output of the command becomes the result. */
+        if (!(session->out = open_memstream(&output, &output_len))) {
+            session->out = out;
+            err = ESP_ERR_NO_MEM;
+        } else {
+            session->command = command;
+            err = command->fn(session, argc, argv);
+            session->command = NULL;
+            fclose(session->out);
+            session->out = out;
+        }
+    }
+    rpc_respond(request, err, output, output_len);
+    free(output);
+}
+
+static void rpc_read_file(struct rpc_request *request) {
+    uint32_t offset, len;
+    char *result = NULL;
+    FILE *file = NULL;
+    size_t n = 0;
+    esp_err_t err = ESP_OK;
+
+    memcpy(&offset, request->payload, sizeof(offset));
+    memcpy(&len, &request->payload[sizeof(offset)], sizeof(len));
+    len = MIN(len, RPC_MAX_DATA_LEN);
+
+    if (len && !(result = malloc(len))) {
+        err = ESP_ERR_NO_MEM;
+    } else if (!(file = fopen(request->path, "rb")) || fseek(file, offset, SEEK_SET)) {
+        ESP_LOGE(TAG, "Couldn't read %s at %"PRIu32": %s", request->path, offset, strerror(errno));
+        err = ESP_ERR_NOT_FOUND;
+    } else {
+        n = fread(result, 1, len, file);
+        if (n < len && ferror(file))
+            err = ESP_FAIL;
+    }
+    if (file)
+        fclose(file);
+    rpc_respond(request, err, result, n);
+    free(result);
+}
+
+static void rpc_write_file(struct rpc_request *request) {
+    const char *data = &request->payload[sizeof(uint32_t)];
+    const char *end = &request->payload[request->header.len];
+    uint32_t offset;
+    FILE *file = NULL;
+    esp_err_t err = ESP_OK;
+
+    memcpy(&offset, request->payload, sizeof(offset));
+    /* The data starts after the NUL of the path. */
+    data += strlen(data) + 1;
+
+    if (!(request->header.flags & RPC_FLAG_TRUNCATE))
+        file = fopen(request->path, "r+b");
+    if (!file && (request->header.flags & RPC_FLAG_TRUNCATE || errno == ENOENT))
+        file = fopen(request->path, "wb");
+    if (!file || fseek(file, offset, SEEK_SET)) {
+        ESP_LOGE(TAG, "Couldn't write %s at %"PRIu32": %s", request->path, offset, strerror(errno));
+        err = ESP_ERR_NOT_FOUND;
+    } else if (data < end && fwrite(data, end - data, 1, file) != 1) {
+        err = ESP_FAIL;
+    }
+    if (file && fclose(file))
+        err = ESP_FAIL;
+    if (file)
+        manifest_invalidate(request->path);
+    rpc_respond(request, err, NULL, 0);
+}
+
+static void rpc_worker_task_handler(void *arg) {
+    for (;;) {
+        struct rpc_request *request;
+
+        if (xQueueReceive(rpc_worker_queue, &request, portMAX_DELAY) != pdTRUE)
+            continue;
+        if (request->header.method == RPC_METHOD_READ)
+            rpc_read_file(request);
+        else
+            rpc_write_file(request);
+        __atomic_sub_fetch(&request->session->rpc_pending, 1, __ATOMIC_RELEASE);
+        free(request);
+    }
+}
+
+esp_err_t rpc_setup(void) {
+    if (rpc_worker_queue)
+        return ESP_OK;
+
+    rpc_write_mutex = xSemaphoreCreateMutex();
+    rpc_worker_queue = xQueueCreate(RPC_WORKER_QUEUE_LEN, sizeof(struct rpc_request *));
+    if (!rpc_write_mutex || !rpc_worker_queue ||
+        xTaskCreate(&rpc_worker_task_handler, "RPC worker", 3072, NULL, 5, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create the RPC worker");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+/* Puts the result of RPC_METHOD_STAT for [st] at [result], returns its length. */
+static size_t rpc_put_stat(char *result, const struct stat *st) {
+    uint32_t size = st->st_size, mtime = st->st_mtime;
+
+    memcpy(result, &size, sizeof(size));
+    memcpy(&result[sizeof(size)], &mtime, sizeof(mtime));
+    result[sizeof(size) + sizeof(mtime)] = S_ISDIR(st->st_mode);
+    return RPC_STAT_LEN;
+}
+
+static void rpc_list(struct rpc_request *request) {
+    char result[RPC_MAX_DATA_LEN];
+    char path[SPP_PATH_MAX + CONFIG_LITTLEFS_OBJ_NAME_LEN + 1];
+    struct dirent *de;
+    uint32_t index;
+    size_t len = 0;
+    DIR *dir;
+
+    memcpy(&index, request->payload, sizeof(index));
+    if (!(dir = opendir(request->path))) {
+        rpc_respond(request, ESP_ERR_NOT_FOUND, NULL, 0);
+        return;
+    }
+    while ((de = readdir(dir))) {
+        size_t name_len = strlen(de->d_name) + 1;
+        /* An entry that can't be stat'ed is still listed, without its size and mtime. */
+        struct stat st = { .st_mode = de->d_type == DT_DIR ? S_IFDIR : S_IFREG };
+
+        if (index) {
+            index--;
+            continue;
+        }
+        if (len + RPC_STAT_LEN + name_len > sizeof(result))
+            break;
+        sprintf(path, "%s/%s", request->path, de->d_name);
+        stat(path, &st);
+        len += rpc_put_stat(&result[len], &st);
+        memcpy(&result[len], de->d_name, name_len);
+        len += name_len;
+    }
+    closedir(dir);
+    rpc_respond(request, ESP_OK, result, len);
+}
+
+/* Returns whether [request] was handed to the worker, which frees it then. */
+static bool rpc_dispatch(struct rpc_request *request) {
+    struct spp_session *session = request->session;
+    size_t n_commands = 0;
+    size_t path_offset = request->header.method == RPC_METHOD_READ ? 2 * sizeof(uint32_t) : sizeof(uint32_t);
+
+    while (commands[n_commands].name)
+        n_commands++;
+
+    switch (request->header.method) {
+    case RPC_METHOD_METHODS: {
+        char names[RPC_MAX_DATA_LEN];
+        size_t len = 0;
+
+        for (const struct vfs_commands *command = commands; command->name; command++) {
+            size_t name_len = strlen(command->name) + 1;
+            if (len + name_len > sizeof(names))
+                break;
+            memcpy(&names[len], command->name, name_len);
+            len += name_len;
+        }
+        rpc_respond(request, ESP_OK, names, len);
+        return false;
+    }
+    case RPC_METHOD_READ:
+    case RPC_METHOD_WRITE:
+        if (request->header.len < path_offset) {
+            rpc_respond(request, ESP_ERR_INVALID_SIZE, NULL, 0);
+            return false;
+        }
+        if (!spp_session_path(session, &request->payload[path_offset], &request->path)) {
+            rpc_respond(request, ESP_ERR_INVALID_ARG, NULL, 0);
+            return false;
+        }
+        __atomic_add_fetch(&session->rpc_pending, 1, __ATOMIC_RELAXED);
+        xQueueSend(rpc_worker_queue, &request, portMAX_DELAY);
+        return true;
+    case RPC_METHOD_STAT: {
+        struct stat st;
+        char result[RPC_STAT_LEN];
+
+        if (!spp_session_path(session, request->payload, &request->path) || stat(request->path, &st)) {
+            rpc_respond(request, ESP_ERR_NOT_FOUND, NULL, 0);
+            return false;
+        }
+        rpc_respond(request, ESP_OK, result, rpc_put_stat(result, &st));
+        return false;
+    }
+    case RPC_METHOD_LIST:
+        if (request->header.len < sizeof(uint32_t)) {
+            rpc_respond(request, ESP_ERR_INVALID_SIZE, NULL, 0);
+            return false;
+        }
+        if (!spp_session_path(session, &request->payload[sizeof(uint32_t)], &request->path)) {
+            rpc_respond(request, ESP_ERR_INVALID_ARG, NULL, 0);
+            return false;
+        }
+        rpc_list(request);
+        return false;
+    case RPC_METHOD_DF: {
+        size_t total = 0, used = 0;
+        uint32_t result[2];
+        esp_err_t err = esp_littlefs_info("storage", &total, &used);
+
+        result[0] = used;
+        result[1] = total;
+        rpc_respond(request, err, result, err == ESP_OK ? sizeof(result) : 0);
+        return false;
+    }
+    default:
+        if (request->header.method < n_commands)
+            rpc_run_command(request, &commands[request->header.method]);
+        else
+            rpc_respond(request, ESP_ERR_NOT_SUPPORTED, NULL, 0);
+        return false;
+    }
+}
+
+esp_err_t rpc_serve(struct spp_session *session, const char *buf, size_t len) {
+    esp_err_t err;
+
+    ESP_LOGI(TAG, "Serving RPC on vfs fd %d", session->fd);
+    for (;;) {
+        struct rpc_header header;
+        struct rpc_request *request;
+
+        if ((err = rpc_read(session, &buf, &len, &header, sizeof(header))) != ESP_OK)
+            break;
+
+        if (header.len > RPC_MAX_REQUEST_LEN) {
+            /* Skip the payload to stay in sync with the frames. */
+            char discard[64];
+            struct rpc_request skipped = { .session = session, .header = header };
+
+            for (uint32_t left = header.len; left && err == ESP_OK; left -= MIN(left, sizeof(discard)))
+                err = rpc_read(session, &buf, &len, discard, MIN(left, sizeof(discard)));
+            if (err != ESP_OK)
+                break;
+            rpc_respond(&skipped, ESP_ERR_INVALID_SIZE, NULL, 0);
+            continue;
+        }
+
+        if (!(request = malloc(sizeof(*request) + header.len + 1))) {
+            err = ESP_ERR_NO_MEM;
+            break;
+        }
+        request->session = session;
+        request->header = header;
+        request->payload[header.len] = '\0';
+        if ((err = rpc_read(session, &buf, &len, request->payload, header.len)) != ESP_OK) {
+            free(request);
+            break;
+        }
+
+        if (header.method == RPC_METHOD_CLOSE) {
+            while (__atomic_load_n(&session->rpc_pending, __ATOMIC_ACQUIRE))
+                vTaskDelay(RPC_PENDING_POLL_MS / portTICK_PERIOD_MS);
+            err = rpc_respond(request, ESP_OK, NULL, 0);
+            free(request);
+            break;
+        }
+        if (!rpc_dispatch(request))
+            free(request);
+    }
+
+    /* The worker mustn't write to the file descriptor after the session is given to another client. */
+    while (__atomic_load_n(&session->rpc_pending, __ATOMIC_ACQUIRE))
+        vTaskDelay(RPC_PENDING_POLL_MS / portTICK_PERIOD_MS);
+    ESP_LOGI(TAG, "Done serving RPC on vfs fd %d: %s", session->fd, esp_err_to_name(err));
+    return err;
+}
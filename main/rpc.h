@@ -0,0 +1,86 @@
+#ifndef RPC_H
+#define RPC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+
+#include "vfs-acceptor.h"
+
+/**
+ * Binary protocol for host tools, entered with the `rpc' command of the shell. After its "RPC <version>" reply, the
+ * client sends request frames and the shell answers every request with one response frame, until a RPC_METHOD_CLOSE
+ * request returns to the text shell.
+ *
+ * A frame is a little-endian struct rpc_header followed by len bytes of payload. The payload of every response starts
+ * with the int32_t esp_err_t of the request, followed by its result. A method below RPC_METHOD_MIN is the index of a
+ * command in commands[], its payload is the arguments after the command name, each terminated by a NUL, and its result
+ * is the output of the command: the free text the shell would print, including its error messages, which most commands
+ * report with ESP_OK. Host tools should use the methods from RPC_METHOD_MIN on where there is one, RPC_METHOD_LIST
+ * instead of ls, RPC_METHOD_STAT instead of ls of a file and RPC_METHOD_DF instead of du. The other commands, like
+ * manifest, inputs, sessions, jobs, stats and trace, only have their text output.
+ *
+ * The commands run one after another in the order they arrive, as they share the working directory of the session.
+ * Reads and writes of files run on a worker task, so a client can keep several of them in flight, and their responses
+ * can arrive before those of requests that were sent earlier. Requests are matched to responses by their id.
+ */
+#define RPC_VERSION 1
+/* The most data a single read or write request transfers. */
+#define RPC_MAX_DATA_LEN 4096
+/* The longest request payload, a write of RPC_MAX_DATA_LEN bytes. Longer requests fail with ESP_ERR_INVALID_SIZE. */
+#define RPC_MAX_REQUEST_LEN (sizeof(uint32_t) + SPP_PATH_MAX + RPC_MAX_DATA_LEN)
+
+enum rpc_method {
+    RPC_METHOD_MIN = 0xF0,
+
+    /* Result: the names of the commands in method order, each terminated by a NUL. */
+    RPC_METHOD_METHODS = RPC_METHOD_MIN,
+    /**
+     * Payload: uint32_t offset, uint32_t len, path. Result: up to len bytes of the file, at most RPC_MAX_DATA_LEN,
+     * fewer at its end.
+     */
+    RPC_METHOD_READ,
+    /**
+     * Payload: uint32_t offset, path, NUL, data. Creates the file if it doesn't exist, RPC_FLAG_TRUNCATE truncates
+     * it first. Result: none.
+     */
+    RPC_METHOD_WRITE,
+    /* Payload: path. Result: uint32_t size, uint32_t mtime, uint8_t 1 for a directory. */
+    RPC_METHOD_STAT,
+    /* Result: uint32_t used bytes, uint32_t total bytes of LittleFS. */
+    RPC_METHOD_DF,
+    /**
+     * Payload: uint32_t index, path of a directory. Result: its entries from the index-th on, as many as fit in
+     * RPC_MAX_DATA_LEN, each the result of RPC_METHOD_STAT followed by the name and a NUL. An empty result means there
+     * are no more, the next request continues at the index after the last entry that was returned.
+     */
+    RPC_METHOD_LIST,
+    /* Returns to the text shell once the responses of all requests before it were sent. Result: none. */
+    RPC_METHOD_CLOSE = 0xFF
+};
+
+#define RPC_FLAG_TRUNCATE 0x01
+
+struct rpc_header {
+    uint32_t len;
+    uint16_t id;
+    uint8_t method;
+    uint8_t flags;
+} __attribute__((packed));
+
+/**
+ * @brief     create the worker task and its queue, called before the first session is served
+ */
+esp_err_t rpc_setup(void);
+
+/**
+ * @brief     serve RPC requests on [session], starting with the [len] bytes at [buf] that the shell read after the rpc
+ *            command line, until it's closed
+ *
+ * Returns ESP_OK after a RPC_METHOD_CLOSE request, or an error if the connection failed. The client has to wait for the
+ * response to RPC_METHOD_CLOSE before it sends command lines again.
+ */
+esp_err_t rpc_serve(struct spp_session *session, const char *buf, size_t len);
+
+#endif /* RPC_H */
@@ -16,13 +16,16 @@
 #include "freertos/task.h"
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
+#include "freertos/event_groups.h"
 #include "esp_chip_info.h"
 #include "esp_flash.h"
+#include "esp_partition.h"
 #include "esp_timer.h"
 #include "esp_check.h"
 #include "esp_task_wdt.h"
 #include "esp_littlefs.h"
 #include "esp_log.h"
+#include "esp_pm.h"
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "esp_vfs.h"
@@ -41,9 +44,42 @@
 #include "vfs-acceptor.h"
 #include "sipkip-audio.h"
 #include "muxed-gpio.h"
+#include "muxed-gestures.h"
+#include "muxed-leds.h"
+#include "opus-profile.h"
+#include "input-trace.h"
+#include "stats.h"
+#include "trace.h"
+#include "deferred-log.h"
 #include "utils.h"
 
 static const char *const TAG = "sipkip-audio";
+/* For the messages of every clip, which are written while the next one may already be decoded. */
+DEFERRED_LOG_TAG(clip_log, "sipkip-audio")
+
+/* Events which wake up the main loop, it blocks on these bits while there is nothing to do. */
+#define APP_EVENT_INPUT_PRESSED     BIT0
+#define APP_EVENT_MODE_CHANGED      BIT1
+#define APP_EVENT_PLAYBACK_FINISHED BIT2
+#define APP_EVENT_FORMAT_REQUESTED  BIT3
+#define APP_EVENT_ALL               (APP_EVENT_INPUT_PRESSED | APP_EVENT_MODE_CHANGED | APP_EVENT_PLAYBACK_FINISHED | \
+                                     APP_EVENT_FORMAT_REQUESTED)
+
+/* The main loop puts the mux in standby after this long without events, stopping its interrupts. */
+#define STANDBY_TIMEOUT_MS          (5 * 60 * 1000)
+
+/* The DMA buffers of the DAC, these can hold DAC_DMA_DRAIN_MS of audio that still plays after the last write. */
+#define DAC_DESC_NUM                4
+#define DAC_BUF_SIZE                2048
+#define DAC_DMA_DRAIN_MS            (DAC_DESC_NUM * DAC_BUF_SIZE * 1000 / OPUS_SAMPLE_RATE)
+
+/* Timing of the gestures of the inputs. */
+#define INPUT_DEBOUNCE_MS           10
+#define INPUT_MULTI_PRESS_WINDOW_MS 400
+
+/* The interval at which the LEDs are rotated in music mode, and how long they take to fade to the next LED. */
+#define LED_ROTATE_INTERVAL_MS 100
+#define LED_ROTATE_FADE_MS     50
 
 static TaskHandle_t dac_write_data_task_handle = NULL;
 SemaphoreHandle_t dac_write_opus_mutex = NULL;
@@ -57,25 +93,76 @@ enum mode {
 static volatile enum mode mode = MUSIC;
 static volatile bool mode_changed = true;
 
-volatile bool exit_dac_write_opus_loop = false;
-static volatile bool gpio_states[] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-static bool gpio_output_states[] = {1, 0, 0, 0, 0, 0, 0, 0};
+/* Inputs that were pressed, but not handled yet. */
+static volatile muxed_inputs_mask_t pending_inputs = 0;
+/**
+ * Whether the beak button is kept pressed since boot, in which case a long press formats the LITTLEFS partition. A
+ * button that is already pressed at setup doesn't report a press, so any press or release after boot clears this.
+ */
+static volatile bool beak_pressed_since_boot = true;
+static EventGroupHandle_t app_events = NULL;
+
+#define LED_ROTATE_KEYFRAME(led)                                                                                    \
+    { .levels = { [led] = UINT8_MAX }, .fade_ms = LED_ROTATE_FADE_MS,                                              \
+      .hold_ms = LED_ROTATE_INTERVAL_MS - LED_ROTATE_FADE_MS }
+
+/* Music mode rotates the lit LED, the other modes keep whichever LED was lit. */
+static const struct muxed_led_keyframe led_rotate_keyframes[] = {
+    LED_ROTATE_KEYFRAME(MUXED_OUTPUT_STAR_L_LED), LED_ROTATE_KEYFRAME(MUXED_OUTPUT_TRIANGLE_L_LED),
+    LED_ROTATE_KEYFRAME(MUXED_OUTPUT_SQUARE_L_LED), LED_ROTATE_KEYFRAME(MUXED_OUTPUT_HEART_L_LED),
+    LED_ROTATE_KEYFRAME(MUXED_OUTPUT_HEART_R_LED), LED_ROTATE_KEYFRAME(MUXED_OUTPUT_SQUARE_R_LED),
+    LED_ROTATE_KEYFRAME(MUXED_OUTPUT_TRIANGLE_R_LED), LED_ROTATE_KEYFRAME(MUXED_OUTPUT_STAR_R_LED)
+};
+static const struct muxed_led_pattern led_rotate_pattern = {
+    .keyframes = led_rotate_keyframes,
+    .n_keyframes = sizeof(led_rotate_keyframes) / sizeof(*led_rotate_keyframes),
+    .loop = true
+};
+static const struct muxed_led_pattern led_first_pattern = {
+    .keyframes = led_rotate_keyframes,
+    .n_keyframes = 1,
+    .loop = false
+};
+
+/* The token of the clip that is playing, which dac_write_opus_stop() cancels. */
+static struct cancel_token *playback_cancel = NULL;
+static portMUX_TYPE playback_cancel_lock = portMUX_INITIALIZER_UNLOCKED;
 
-static OpusDecoder *decoder = NULL;
+static struct opus_profile_decoder *decoder = NULL;
+#if CONFIG_PM_ENABLE
+/* Keeps the CPU at full speed while decoding, so a frame never takes longer to decode than to play. */
+static esp_pm_lock_handle_t decoder_pm_lock = NULL;
+#endif
 static struct dac_data {
     dac_continuous_handle_t handle;
     uint8_t *data_front, *data_back;
     size_t data_front_size;
 } *dac_data = NULL;
+/**
+ * Whether the DAC is enabled, only changed with dac_write_opus_mutex held. A clip leaves it on, so the next clip of a
+ * sequence starts without a gap, and the main loop turns it off once it has nothing more to play.
+ */
+static volatile bool dac_enabled = false;
+/**
+ * When the last write to the DAC returned, or 0 before the first write of a clip. A write blocks until its last byte
+ * is in the DMA buffers, so those are about full then, and a next write that comes more than DAC_DMA_DRAIN_MS later
+ * found them empty.
+ */
+static int64_t dac_last_write_us = 0;
 
 static void dac_write_data_synchronously(void *data) {
     struct dac_data *dac_data = data;
-    ESP_LOGI(TAG, "Audio size %lu bytes, playing at frequency %d Hz synchronously", dac_data->data_front_size, 
-             OPUS_SAMPLE_RATE);
+    DLOGI(clip_log, "Audio size %lu bytes, playing at frequency %d Hz synchronously", dac_data->data_front_size,
+          OPUS_SAMPLE_RATE);
     for (;;) {
         if (dac_data->data_front_size > 0) {
+            if (dac_last_write_us && esp_timer_get_time() - dac_last_write_us > DAC_DMA_DRAIN_MS * 1000)
+                stats_add(&stats_counters.dac_underruns, 1);
+            TRACE_BEGIN(TRACE_DAC_WRITE_DATA, dac_data->data_front_size);
             ESP_ERROR_CHECK(dac_continuous_write(dac_data->handle, dac_data->data_front, dac_data->data_front_size,
                                                  NULL, -1));
+            TRACE_END(TRACE_DAC_WRITE_DATA, dac_data->data_front_size);
+            dac_last_write_us = esp_timer_get_time();
             dac_data->data_front_size = 0;
         } else {
             vTaskDelay(10 / portTICK_PERIOD_MS);
@@ -83,13 +170,35 @@ static void dac_write_data_synchronously(void *data) {
     }
 }
 
-esp_err_t dac_write_opus(struct opus_mem_or_file opus_mem_or_file) {
+esp_err_t dac_write_opus(struct opus_mem_or_file opus_mem_or_file, struct cancel_token *cancel) {
+    struct cancel_token own_cancel = {0};
     opus_int16 out[OPUS_MAX_FRAME_SIZE];
     bool suspended = true;
     esp_err_t ret = ESP_OK;
+    /* The time spent decoding, and the cycles spent reading and publishing the envelope, to compare them per frame. */
+    int64_t decode_us = 0;
+    uint64_t envelope_cycles = 0;
+    int n_envelope_frames = 0;
+    uint16_t frame_ms = 0;
    
+    if (!cancel)
+        cancel = &own_cancel;
     xSemaphoreTake(dac_write_opus_mutex, portMAX_DELAY);
-    exit_dac_write_opus_loop = false;
+    portENTER_CRITICAL(&playback_cancel_lock);
+    playback_cancel = cancel;
+    portEXIT_CRITICAL(&playback_cancel_lock);
+    /* The DAC writer is suspended between clips, the gap before this one isn't an underrun. */
+    dac_last_write_us = 0;
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_acquire(decoder_pm_lock);
+#endif
+    input_trace_record(INPUT_TRACE_PLAYBACK_START, INPUT_TRACE_NO_INPUT,
+                       opus_mem_or_file.opus_packets_len / sizeof(short), esp_timer_get_time());
+    TRACE_BEGIN(TRACE_DAC_WRITE_OPUS, opus_mem_or_file.opus_packets_len / sizeof(short));
+    if (!dac_enabled) {
+        ESP_ERROR_CHECK(dac_continuous_enable(dac_data->handle));
+        dac_enabled = true;
+    }
 
     for (int packet_size_index = 0, packet_size_total = 0, packet_size = 0;
          packet_size_index < opus_mem_or_file.opus_packets_len / sizeof(short);
@@ -97,9 +206,21 @@ esp_err_t dac_write_opus(struct opus_mem_or_file opus_mem_or_file) {
             ((const short *)opus_mem_or_file.mem.opus_packets)[packet_size_index] : 
             (fgetc(opus_mem_or_file.file.opus_packets) & 0xFF) | (fgetc(opus_mem_or_file.file.opus_packets) << 8),
          packet_size_index++) {
-        int frame_size;
+        int frame_size, envelope_level = EOF;
         void *in;
         bool free_after_decode;
+        int64_t start_us, frame_decode_us;
+        struct stats_cycles start_cycles = stats_cycles_start();
+        uint32_t frame_envelope_cycles;
+        
+        /* The envelope has a byte for every packet, also for the ones that are skipped. */
+        if (packet_size_index > 0) {
+            if (opus_mem_or_file.is_mem)
+                envelope_level = opus_mem_or_file.mem.opus_envelope[packet_size_index - 1];
+            else if (opus_mem_or_file.file.opus_envelope)
+                envelope_level = fgetc(opus_mem_or_file.file.opus_envelope);
+        }
+        frame_envelope_cycles = stats_cycles_since(start_cycles);
     
         if (packet_size <= 0)
             continue;
@@ -130,7 +251,13 @@ esp_err_t dac_write_opus(struct opus_mem_or_file opus_mem_or_file) {
          * a constant frame size. However, that may not be the case for all encoders,so the decoder must always check 
          * the frame size returned.
          */
-        frame_size = opus_decode(decoder, in, packet_size, out, OPUS_MAX_FRAME_SIZE, 0);
+        TRACE_BEGIN(TRACE_OPUS_DECODE, packet_size);
+        start_us = esp_timer_get_time();
+        frame_size = opus_profile_decode(decoder, in, packet_size, out, OPUS_MAX_FRAME_SIZE);
+        TRACE_END(TRACE_OPUS_DECODE, packet_size);
+        frame_decode_us = esp_timer_get_time() - start_us;
+        decode_us += frame_decode_us;
+        stats_decode_time(frame_decode_us);
         
         /* Free memory if apliccable. */
         if (free_after_decode)
@@ -149,10 +276,11 @@ esp_err_t dac_write_opus(struct opus_mem_or_file opus_mem_or_file) {
         while (dac_write_data_task_handle && !suspended && dac_data->data_front_size)
             vTaskDelay(10 / portTICK_PERIOD_MS);
         
-        if (exit_dac_write_opus_loop) {
+        if (cancel_token_cancelled(cancel)) {
             ret = ESP_ERR_NOT_FINISHED;
             break;
         }
+        cancel_token_progress(cancel, packet_size_index, opus_mem_or_file.opus_packets_len / sizeof(short));
         
         /* Swap front and back buffer. */
         uint8_t *data_tmp = dac_data->data_front;
@@ -161,6 +289,17 @@ esp_err_t dac_write_opus(struct opus_mem_or_file opus_mem_or_file) {
         dac_data->data_front_size = sizeof(*dac_data->data_front) * frame_size;
         dac_data->data_back = data_tmp;
         
+        /* The LEDs follow the loudness of the frame that starts playing now, fading to it over the frame. */
+        if (envelope_level != EOF) {
+            start_cycles = stats_cycles_start();
+            frame_ms = frame_size * 1000 / OPUS_SAMPLE_RATE;
+            muxed_leds_set_envelope(envelope_level, frame_ms);
+            frame_envelope_cycles += stats_cycles_since(start_cycles);
+            envelope_cycles += frame_envelope_cycles;
+            stats_envelope_publish(frame_envelope_cycles);
+            n_envelope_frames++;
+        }
+        
         if (!dac_write_data_task_handle) {
             xTaskCreate(&dac_write_data_synchronously, "DAC write data", 2048, dac_data, 10, 
                         &dac_write_data_task_handle);
@@ -170,34 +309,134 @@ esp_err_t dac_write_opus(struct opus_mem_or_file opus_mem_or_file) {
         }
     }
 
+    /* Let the last frame reach the DMA buffers, they play out while the next clip starts or the main loop idles. */
+    while (dac_write_data_task_handle && !suspended && dac_data->data_front_size)
+        vTaskDelay(10 / portTICK_PERIOD_MS);
+    
     vTaskSuspend(dac_write_data_task_handle);
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_release(decoder_pm_lock);
+#endif
+    if (n_envelope_frames) {
+        muxed_leds_set_envelope(UINT8_MAX, frame_ms);
+        DLOGD(clip_log, "Publishing the envelope took avg %lu cycles per frame, decoding %lu cycles, over %d frames",
+              (uint32_t)(envelope_cycles / n_envelope_frames),
+              (uint32_t)(decode_us * CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ / n_envelope_frames), n_envelope_frames);
+    }
+    input_trace_record(INPUT_TRACE_PLAYBACK_END, INPUT_TRACE_NO_INPUT, ret, esp_timer_get_time());
+    TRACE_END(TRACE_DAC_WRITE_OPUS, ret);
+    /* The token may go away once this returns. */
+    portENTER_CRITICAL(&playback_cancel_lock);
+    playback_cancel = NULL;
+    portEXIT_CRITICAL(&playback_cancel_lock);
     xSemaphoreGive(dac_write_opus_mutex);
+    xEventGroupSetBits(app_events, APP_EVENT_PLAYBACK_FINISHED);
     
     return ret;
 }
 
+/**
+ * Turns the DAC off, unless a clip is playing. Called by the main loop once nothing was played for DAC_DMA_DRAIN_MS,
+ * so the DMA buffers have played out. The DAC runs from the APLL, which is kept on while it's enabled.
+ */
+static void dac_disable_when_idle(void) {
+    if (xSemaphoreTake(dac_write_opus_mutex, 0) != pdTRUE)
+        return;
+    if (dac_enabled) {
+        ESP_ERROR_CHECK(dac_continuous_disable(dac_data->handle));
+        dac_enabled = false;
+    }
+    xSemaphoreGive(dac_write_opus_mutex);
+}
+
+void dac_write_opus_stop(void) {
+    portENTER_CRITICAL(&playback_cancel_lock);
+    if (playback_cancel)
+        cancel_token_cancel(playback_cancel);
+    portEXIT_CRITICAL(&playback_cancel_lock);
+}
+
+/**
+ * The linker sends the calls to these esp_partition functions here, see `CMakeLists.txt', which counts the bytes read,
+ * written and erased on the flash by LittleFS, and by NVS.
+ */
+esp_err_t __real_esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size);
+esp_err_t __real_esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src,
+                                     size_t size);
+esp_err_t __real_esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size);
+
+esp_err_t __wrap_esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size) {
+    stats_add(&stats_counters.flash_read_bytes, size);
+    return __real_esp_partition_read(partition, src_offset, dst, size);
+}
+
+esp_err_t __wrap_esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src,
+                                     size_t size) {
+    stats_add(&stats_counters.flash_write_bytes, size);
+    return __real_esp_partition_write(partition, dst_offset, src, size);
+}
 
-static void on_gpio_states_changed(volatile bool (*states)[19]) {
+esp_err_t __wrap_esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size) {
+    stats_add(&stats_counters.flash_erase_bytes, size);
+    return __real_esp_partition_erase_range(partition, offset, size);
+}
+
+
+/**
+ * Clears the given inputs from the pending inputs, and returns whether any of them was pending.
+ */
+static bool take_pending_inputs(muxed_inputs_mask_t mask) {
+    return __atomic_fetch_and(&pending_inputs, ~mask, __ATOMIC_RELAXED) & mask;
+}
+
+static void on_gesture(const struct muxed_gesture_event *event) {
     bool input_switch_levels[19];
     enum mode new_mode;
     
-    for (int i = 0; i < sizeof(*states); i++) {
-        if ((*states)[i]) {
-            gpio_states[i] = 1;
-            exit_dac_write_opus_loop = true;
+    if (event->input == MUXED_INPUT_LEARN_SWITCH || event->input == MUXED_INPUT_PLAY_SWITCH) {
+        if (event->gesture != MUXED_GESTURE_PRESS && event->gesture != MUXED_GESTURE_RELEASE)
+            return;
+        
+        muxed_gpio_get_input_switch_levels(&input_switch_levels);
+        if (input_switch_levels[MUXED_INPUT_LEARN_SWITCH])
+            new_mode = LEARN;
+        else if (input_switch_levels[MUXED_INPUT_PLAY_SWITCH])
+            new_mode = PLAY;
+        else
+            new_mode = MUSIC;
+        
+        if (new_mode != mode) {
+            mode = new_mode;
+            mode_changed = true;
+            /* The clip of the old mode stops, like it does for a button. */
+            input_trace_record(INPUT_TRACE_PLAYBACK_STOP_REQUESTED, event->input, 0, event->timestamp_us);
+            dac_write_opus_stop();
+            muxed_leds_play(mode == MUSIC ? &led_rotate_pattern : NULL);
+            xEventGroupSetBits(app_events, APP_EVENT_MODE_CHANGED);
         }
+        return;
     }
-    muxed_gpio_get_input_switch_levels(&input_switch_levels);
-    if (input_switch_levels[MUXED_INPUT_LEARN_SWITCH])
-        new_mode = LEARN;
-    else if (input_switch_levels[MUXED_INPUT_PLAY_SWITCH])
-        new_mode = PLAY;
-    else
-        new_mode = MUSIC;
     
-    if (new_mode != mode)
-        mode_changed = true;
-    mode = new_mode;
+    switch (event->gesture) {
+        case MUXED_GESTURE_PRESS:
+            if (event->input == MUXED_INPUT_BEAK_SWITCH)
+                beak_pressed_since_boot = false;
+            __atomic_fetch_or(&pending_inputs, MUXED_INPUT_BIT(event->input), __ATOMIC_RELAXED);
+            input_trace_record(INPUT_TRACE_PLAYBACK_STOP_REQUESTED, event->input, 0, event->timestamp_us);
+            dac_write_opus_stop();
+            xEventGroupSetBits(app_events, APP_EVENT_INPUT_PRESSED);
+            break;
+        case MUXED_GESTURE_RELEASE:
+            if (event->input == MUXED_INPUT_BEAK_SWITCH)
+                beak_pressed_since_boot = false;
+            break;
+        case MUXED_GESTURE_LONG_PRESS:
+            if (event->input == MUXED_INPUT_BEAK_SWITCH && beak_pressed_since_boot)
+                xEventGroupSetBits(app_events, APP_EVENT_FORMAT_REQUESTED);
+            break;
+        default:
+            break;
+    }
 }
 
 /**
@@ -259,11 +498,12 @@ static void list_file_tree(const char *const path, int depth) {
 }
 
 static esp_err_t play_littlefs_opus_file(const char *starts_with) {
-    FILE *littlefs_file_opus = NULL, *littlefs_file_opus_packets = NULL;
+    FILE *littlefs_file_opus = NULL, *littlefs_file_opus_packets = NULL, *littlefs_file_opus_envelope = NULL;
     glob_t glob_buf = {0};
     char *glob_path;
     char opus_path[(CONFIG_LITTLEFS_OBJ_NAME_LEN + 1) * LITTLEFS_MAX_DEPTH];
     char opus_packets_path[(CONFIG_LITTLEFS_OBJ_NAME_LEN + 1) * LITTLEFS_MAX_DEPTH];
+    char opus_envelope_path[(CONFIG_LITTLEFS_OBJ_NAME_LEN + 1) * LITTLEFS_MAX_DEPTH];
     esp_err_t ret = ESP_OK;
     
     sprintf(opus_path, "%s*.opus", starts_with);
@@ -302,10 +542,16 @@ static esp_err_t play_littlefs_opus_file(const char *starts_with) {
         goto exit;
     }
     
+    /* Clips uploaded before the envelope existed don't have one, they play without pulsing the LEDs. */
+    sprintf(opus_envelope_path, "%s_envelope", glob_path);
+    littlefs_file_opus_envelope = fopen(opus_envelope_path, "r");
+    if (!littlefs_file_opus_envelope)
+        ESP_LOGD(TAG, "No envelope %s: %s", opus_envelope_path, strerror(errno));
+    
     fseek(littlefs_file_opus_packets, 0, SEEK_END);
     unsigned int littlefs_file_opus_packets_len = ftell(littlefs_file_opus_packets);
     fseek(littlefs_file_opus_packets, 0, SEEK_SET);
-    ret = DAC_WRITE_OPUS(littlefs_file_opus, file);
+    ret = DAC_WRITE_OPUS(littlefs_file_opus, file, NULL);
     
 exit:
     g_globfree(&glob_buf);
@@ -313,6 +559,8 @@ exit:
         fclose(littlefs_file_opus);
     if (littlefs_file_opus_packets)
         fclose(littlefs_file_opus_packets);
+    if (littlefs_file_opus_envelope)
+        fclose(littlefs_file_opus_envelope);
     
     return ret;
 }
@@ -321,10 +569,10 @@ static void mode_learn(void) {
     if (mode_changed) {
         switch (esp_random() % 2) {
             case 0:
-                DAC_WRITE_OPUS(__leren_laten_we_ontdekken_en_leren__met_mijn_prachtige_veren__opus, mem);
+                DAC_WRITE_OPUS(__leren_laten_we_ontdekken_en_leren__met_mijn_prachtige_veren__opus, mem, NULL);
                 break;
             case 1:
-                DAC_WRITE_OPUS(__leren_laten_we_eens_kijken_of_je_deze_vragen_kunt_beantwoorden_opus, mem);
+                DAC_WRITE_OPUS(__leren_laten_we_eens_kijken_of_je_deze_vragen_kunt_beantwoorden_opus, mem, NULL);
                 break;
         }
         mode_changed = false;
@@ -335,13 +583,14 @@ static void mode_play(void) {
     if (mode_changed) {
         switch (esp_random() % 3) {
             case 0:
-                DAC_WRITE_OPUS(__spelen_groep_1_druk_op_een_toets_of_plaats_een_knijper_om_te_spelen_opus, mem);
+                DAC_WRITE_OPUS(__spelen_groep_1_druk_op_een_toets_of_plaats_een_knijper_om_te_spelen_opus, mem, NULL);
                 break;
             case 1:
-                DAC_WRITE_OPUS(__spelen_groep_1_hoi__ik_ben_een_sierlijke_pauw__laten_we_spelen__hoeraa___opus, mem);
+                DAC_WRITE_OPUS(__spelen_groep_1_hoi__ik_ben_een_sierlijke_pauw__laten_we_spelen__hoeraa___opus, mem,
+                               NULL);
                 break;
             case 2:
-                DAC_WRITE_OPUS(__spelen_groep_1_laten_we_ontdekken_en_leren__met_mijn_prachtige_veren__opus, mem);
+                DAC_WRITE_OPUS(__spelen_groep_1_laten_we_ontdekken_en_leren__met_mijn_prachtige_veren__opus, mem, NULL);
                 break;
         }
         mode_changed = false;
@@ -352,110 +601,83 @@ static void mode_music(void) {
     static bool even = false;
     
     if (mode_changed) {
-        DAC_WRITE_OPUS(__muziek______tijd_voor_muziek__druk_op_een_toets_om_naar_muziek_te_luisteren_opus, mem);
+        DAC_WRITE_OPUS(__muziek______tijd_voor_muziek__druk_op_een_toets_om_naar_muziek_te_luisteren_opus, mem, NULL);
         mode_changed = false;
     }
     
-    if (gpio_states[MUXED_INPUT_HEART_L_BUTTON] || 
-        gpio_states[MUXED_INPUT_HEART_R_BUTTON]) {
-        gpio_states[MUXED_INPUT_HEART_L_BUTTON] = 0;
-        gpio_states[MUXED_INPUT_HEART_R_BUTTON] = 0;
-        if (DAC_WRITE_OPUS(__muziek_ik_ben_zo_blij__opus, mem) == ESP_ERR_NOT_FINISHED)
-            goto exit;
+    if (take_pending_inputs(MUXED_INPUT_BIT(MUXED_INPUT_HEART_L_BUTTON) |
+                            MUXED_INPUT_BIT(MUXED_INPUT_HEART_R_BUTTON))) {
+        if (DAC_WRITE_OPUS(__muziek_ik_ben_zo_blij__opus, mem, NULL) == ESP_ERR_NOT_FINISHED)
+            return;
         if (even)
-            DAC_WRITE_OPUS(__muziek_blije_muziekjes_muziekje_5_opus, mem);
+            DAC_WRITE_OPUS(__muziek_blije_muziekjes_muziekje_5_opus, mem, NULL);
         else
-            DAC_WRITE_OPUS(__muziek_blije_muziekjes_muziekje_6_opus, mem);
+            DAC_WRITE_OPUS(__muziek_blije_muziekjes_muziekje_6_opus, mem, NULL);
         even = !even;
     }
-    if (gpio_states[MUXED_INPUT_HEART_L_CLIP] || 
-        gpio_states[MUXED_INPUT_HEART_R_CLIP]) {
-        gpio_states[MUXED_INPUT_HEART_L_CLIP] = 0;
-        gpio_states[MUXED_INPUT_HEART_R_CLIP] = 0;
+    if (take_pending_inputs(MUXED_INPUT_BIT(MUXED_INPUT_HEART_L_CLIP) |
+                            MUXED_INPUT_BIT(MUXED_INPUT_HEART_R_CLIP))) {
         play_littlefs_opus_file("/littlefs/music/heart_clip/");
     }
-    if (gpio_states[MUXED_INPUT_SQUARE_L_BUTTON] || 
-        gpio_states[MUXED_INPUT_SQUARE_R_BUTTON]) {
-        gpio_states[MUXED_INPUT_SQUARE_L_BUTTON] = 0;
-        gpio_states[MUXED_INPUT_SQUARE_R_BUTTON] = 0;
-        if (DAC_WRITE_OPUS(__muziek_ik_voel_me_een_beetje_verdrietig_opus, mem) == ESP_ERR_NOT_FINISHED)
-            goto exit;
+    if (take_pending_inputs(MUXED_INPUT_BIT(MUXED_INPUT_SQUARE_L_BUTTON) |
+                            MUXED_INPUT_BIT(MUXED_INPUT_SQUARE_R_BUTTON))) {
+        if (DAC_WRITE_OPUS(__muziek_ik_voel_me_een_beetje_verdrietig_opus, mem, NULL) == ESP_ERR_NOT_FINISHED)
+            return;
         if (even)
-            DAC_WRITE_OPUS(__muziek_verdrietige_muziekjes_muziekje_7_opus, mem);
+            DAC_WRITE_OPUS(__muziek_verdrietige_muziekjes_muziekje_7_opus, mem, NULL);
         else
-            DAC_WRITE_OPUS(__muziek_verdrietige_muziekjes_muziekje_8_opus, mem);
+            DAC_WRITE_OPUS(__muziek_verdrietige_muziekjes_muziekje_8_opus, mem, NULL);
         even = !even;
     }
-    if (gpio_states[MUXED_INPUT_SQUARE_L_CLIP] || 
-        gpio_states[MUXED_INPUT_SQUARE_R_CLIP]) {
-        gpio_states[MUXED_INPUT_SQUARE_L_CLIP] = 0;
-        gpio_states[MUXED_INPUT_SQUARE_R_CLIP] = 0;
+    if (take_pending_inputs(MUXED_INPUT_BIT(MUXED_INPUT_SQUARE_L_CLIP) |
+                            MUXED_INPUT_BIT(MUXED_INPUT_SQUARE_R_CLIP))) {
         play_littlefs_opus_file("/littlefs/music/square_clip/");
     }
-    if (gpio_states[MUXED_INPUT_TRIANGLE_L_BUTTON] || 
-        gpio_states[MUXED_INPUT_TRIANGLE_R_BUTTON]) {
-        gpio_states[MUXED_INPUT_TRIANGLE_L_BUTTON] = 0;
-        gpio_states[MUXED_INPUT_TRIANGLE_R_BUTTON] = 0;
-        if (DAC_WRITE_OPUS(__muziek_ik_ben_boos__opus, mem) == ESP_ERR_NOT_FINISHED)
-            goto exit;
+    if (take_pending_inputs(MUXED_INPUT_BIT(MUXED_INPUT_TRIANGLE_L_BUTTON) |
+                            MUXED_INPUT_BIT(MUXED_INPUT_TRIANGLE_R_BUTTON))) {
+        if (DAC_WRITE_OPUS(__muziek_ik_ben_boos__opus, mem, NULL) == ESP_ERR_NOT_FINISHED)
+            return;
         if (even)
-            DAC_WRITE_OPUS(__muziek_boze_muziekjes_muziekje_3_opus, mem);
+            DAC_WRITE_OPUS(__muziek_boze_muziekjes_muziekje_3_opus, mem, NULL);
         else
-            DAC_WRITE_OPUS(__muziek_boze_muziekjes_muziekje_4_opus, mem);
+            DAC_WRITE_OPUS(__muziek_boze_muziekjes_muziekje_4_opus, mem, NULL);
         even = !even;
     }
-    if (gpio_states[MUXED_INPUT_TRIANGLE_L_CLIP] || 
-        gpio_states[MUXED_INPUT_TRIANGLE_R_CLIP]) {
-        gpio_states[MUXED_INPUT_TRIANGLE_L_CLIP] = 0;
-        gpio_states[MUXED_INPUT_TRIANGLE_R_CLIP] = 0;
+    if (take_pending_inputs(MUXED_INPUT_BIT(MUXED_INPUT_TRIANGLE_L_CLIP) |
+                            MUXED_INPUT_BIT(MUXED_INPUT_TRIANGLE_R_CLIP))) {
         play_littlefs_opus_file("/littlefs/music/triangle_clip/");
     }
-    if (gpio_states[MUXED_INPUT_STAR_L_BUTTON] || 
-        gpio_states[MUXED_INPUT_STAR_R_BUTTON]) {
-        gpio_states[MUXED_INPUT_STAR_L_BUTTON] = 0;
-        gpio_states[MUXED_INPUT_STAR_R_BUTTON] = 0;
-        if (DAC_WRITE_OPUS(__muziek_wat_een_verassing__opus, mem) == ESP_ERR_NOT_FINISHED)
-            goto exit;
+    if (take_pending_inputs(MUXED_INPUT_BIT(MUXED_INPUT_STAR_L_BUTTON) |
+                            MUXED_INPUT_BIT(MUXED_INPUT_STAR_R_BUTTON))) {
+        if (DAC_WRITE_OPUS(__muziek_wat_een_verassing__opus, mem, NULL) == ESP_ERR_NOT_FINISHED)
+            return;
         if (even)
-            DAC_WRITE_OPUS(__muziek_verbaasde_muziekjes_muziekje_1_opus, mem);
+            DAC_WRITE_OPUS(__muziek_verbaasde_muziekjes_muziekje_1_opus, mem, NULL);
         else
-            DAC_WRITE_OPUS(__muziek_verbaasde_muziekjes_muziekje_2_opus, mem);
+            DAC_WRITE_OPUS(__muziek_verbaasde_muziekjes_muziekje_2_opus, mem, NULL);
         even = !even;
     }
-    if (gpio_states[MUXED_INPUT_STAR_L_CLIP] || 
-        gpio_states[MUXED_INPUT_STAR_R_CLIP]) {
-        gpio_states[MUXED_INPUT_STAR_L_CLIP] = 0;
-        gpio_states[MUXED_INPUT_STAR_R_CLIP] = 0;
+    if (take_pending_inputs(MUXED_INPUT_BIT(MUXED_INPUT_STAR_L_CLIP) |
+                            MUXED_INPUT_BIT(MUXED_INPUT_STAR_R_CLIP))) {
         play_littlefs_opus_file("/littlefs/music/star_clip/");
     }
-    if (gpio_states[MUXED_INPUT_BEAK_SWITCH]) {
-        gpio_states[MUXED_INPUT_BEAK_SWITCH] = 0;
+    if (take_pending_inputs(MUXED_INPUT_BIT(MUXED_INPUT_BEAK_SWITCH))) {
         if (play_littlefs_opus_file("/littlefs/music/beak_switch/") == ESP_ERR_NOT_FINISHED)
-            goto exit;
+            return;
         if (even)
-            DAC_WRITE_OPUS(__muziek_snavel_knop_het_is_tijd_om_te_zingen___muziekje_9_opus, mem);
+            DAC_WRITE_OPUS(__muziek_snavel_knop_het_is_tijd_om_te_zingen___muziekje_9_opus, mem, NULL);
         else
-            DAC_WRITE_OPUS(__muziek_snavel_knop_wil_je_mij_horen_zingen___muziekje_10_opus, mem);
+            DAC_WRITE_OPUS(__muziek_snavel_knop_wil_je_mij_horen_zingen___muziekje_10_opus, mem, NULL);
         even = !even;
     }
-    
-exit:
-    for (int i = 0; i < 8; i++)
-        if (gpio_output_states[i]) {
-            gpio_output_states[i] = 0;
-            gpio_output_states[(i + 1) & 7] = 1;
-            break;
-        }
 }
 
 void app_main(void) {
-    int err;
-
     dac_continuous_handle_t dac_handle;
     dac_continuous_config_t cont_cfg = {
         .chan_mask = DAC_CHANNEL_MASK_CH0,
-        .desc_num = 4,
-        .buf_size = 2048,
+        .desc_num = DAC_DESC_NUM,
+        .buf_size = DAC_BUF_SIZE,
         .freq_hz = OPUS_SAMPLE_RATE,
         .offset = 0,
         .clk_src = DAC_DIGI_CLK_SRC_APLL,   /* Using APLL as clock source to get a wider frequency range */
@@ -476,6 +698,32 @@ void app_main(void) {
         .partition_label = "storage", /* See `partitions.csv' */
         .format_if_mount_failed = true
     };
+    bool standby = false;
+    
+#if CONFIG_PM_ENABLE
+    /**
+     * Scale the CPU down to the XTAL frequency while nothing holds a lock. The decoder, the DAC, an SPP session and the
+     * running mux keep their locks while they need the chip at full speed or awake.
+     */
+    esp_pm_config_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = CONFIG_XTAL_FREQ,
+#if CONFIG_BTDM_CTRL_LPCLK_SEL_EXT_32K_XTAL && CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        /**
+         * Sleep while all tasks are blocked. Only with an external 32 kHz crystal as its low power clock, the BT
+         * controller can keep time in light sleep, with the main XTAL it holds a lock that keeps the chip awake.
+         */
+        .light_sleep_enable = true
+#endif
+    };
+    ESP_ERROR_CHECK(esp_pm_configure(&pm_config));
+#if !CONFIG_BTDM_CTRL_LPCLK_SEL_EXT_32K_XTAL || !CONFIG_FREERTOS_USE_TICKLESS_IDLE
+    ESP_LOGI(TAG, "No light sleep, it needs tickless idle and an external 32 kHz crystal as BT low power clock");
+#endif
+    ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "decoder", &decoder_pm_lock));
+#endif
+    /* Messages of the hot paths before this are written right away. */
+    ESP_ERROR_CHECK(deferred_log_setup());
     
     ESP_LOGI(TAG, "Initializing LITTLEFS");
     
@@ -587,16 +835,13 @@ void app_main(void) {
     ESP_LOGI(TAG,"Own address:[%s]", bd_address_to_string((uint8_t *)esp_bt_dev_get_address(),
                                                           bda_str, sizeof(bda_str)));
     
-    /* Allocate continuous channels */
+    /* Allocate continuous channels, dac_write_opus() enables them, and the main loop disables them when idle. */
     ESP_ERROR_CHECK(dac_continuous_new_channels(&cont_cfg, &dac_handle));
-    /* Enable the continuous channels */
-    ESP_ERROR_CHECK(dac_continuous_enable(dac_handle));
     ESP_LOGI(TAG, "DAC initialized success, DAC DMA is ready");
 
     /* Create a new decoder state. */
-    decoder = opus_decoder_create(OPUS_SAMPLE_RATE, 1, &err);
-    if (err < 0) {
-        ESP_LOGE(TAG, "Failed to create decoder: %s\n", opus_strerror(err));
+    if (opus_profile_decoder_create(&decoder) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to create %s decoder", OPUS_PROFILE_NAME);
         return;
     }
     
@@ -617,26 +862,31 @@ void app_main(void) {
         ESP_LOGE(TAG, "Failed to create mutex for the dac writing function\n");
         return;
     }
+    
+    app_events = xEventGroupCreate();
+    if (!app_events) {
+        ESP_LOGE(TAG, "Failed to create the app event group\n");
+        return;
+    }
    
-    DAC_WRITE_OPUS(__pauw_opstart_geluid_opus, mem);
+    DAC_WRITE_OPUS(__pauw_opstart_geluid_opus, mem, NULL);
     DAC_WRITE_OPUS(
         _______hallo_ik_ben_een_pauw__kom_speel_je_mee_met_mij_want_samen_zijn_met_jou__dat_maakt_me_reuze_blij_opus, 
-        mem);
+        mem, NULL);
+    
+    struct muxed_gesture_config gesture_configs[MUXED_INPUT_N];
+    for (enum muxed_inputs i = MUXED_INPUT_MIN; i <= MUXED_INPUT_MAX; i++)
+        gesture_configs[i] = (struct muxed_gesture_config) {
+            .debounce_ms = INPUT_DEBOUNCE_MS,
+            .multi_press_window_ms = INPUT_MULTI_PRESS_WINDOW_MS
+        };
+    /* Format the littlefs partition if the beak button is pressed since boot for 5 seconds. */
+    gesture_configs[MUXED_INPUT_BEAK_SWITCH].long_press_ms = LITTLEFS_FORMAT_BEAK_PRESSED_TIMEOUT;
+    
+    muxed_gestures_setup(&gesture_configs, &on_gesture);
     
-    muxed_gpio_setup(&on_gpio_states_changed);
-
-    /* Format the littlefs partition if the beak button is pressed for 5 seconds. */
     bool input_switch_levels[19];
     muxed_gpio_get_input_switch_levels(&input_switch_levels);
-    if (input_switch_levels[MUXED_INPUT_BEAK_SWITCH]) {
-        vTaskDelay(LITTLEFS_FORMAT_BEAK_PRESSED_TIMEOUT / portTICK_PERIOD_MS);
-        muxed_gpio_get_input_switch_levels(&input_switch_levels);
-        if (input_switch_levels[MUXED_INPUT_BEAK_SWITCH]) {
-            ESP_LOGW(TAG, "Pressed the beak button for %d seconds. Formatting...",
-                     LITTLEFS_FORMAT_BEAK_PRESSED_TIMEOUT / 1000);
-            esp_littlefs_format(conf.partition_label);
-        }
-    }
     
     if (input_switch_levels[MUXED_INPUT_LEARN_SWITCH])
         mode = LEARN;
@@ -645,6 +895,10 @@ void app_main(void) {
     else
         mode = MUSIC;
     
+    /* The LEDs are animated by their own task, so they keep moving while a clip is playing. */
+    muxed_leds_setup();
+    muxed_leds_play(mode == MUSIC ? &led_rotate_pattern : &led_first_pattern);
+    
     for (;;) {
         switch (mode) {
             case LEARN:
@@ -658,8 +912,47 @@ void app_main(void) {
                 break;
         }
         
-        muxed_gpio_set_output_levels(&gpio_output_states);
-        vTaskDelay(100 / portTICK_PERIOD_MS);
+        /**
+         * Sleep until an input is pressed, the mode switch changes or a clip finishes. The bits are cleared on wake up,
+         * the mode functions find out what happened from mode_changed and the pending inputs.
+         */
+        TickType_t timeout = standby ? portMAX_DELAY : pdMS_TO_TICKS(STANDBY_TIMEOUT_MS);
+        
+        /**
+         * A clip left the DAC on, wake up once its DMA buffers played out to turn it off. While the shell plays a clip,
+         * the end of that clip wakes this loop up.
+         */
+        if (dac_enabled && !xSemaphoreGetMutexHolder(dac_write_opus_mutex))
+            timeout = pdMS_TO_TICKS(DAC_DMA_DRAIN_MS);
+        EventBits_t events = xEventGroupWaitBits(app_events, APP_EVENT_ALL, pdTRUE, pdFALSE, timeout);
+        
+        if (!events && dac_enabled) {
+            dac_disable_when_idle();
+            continue;
+        }
+        /**
+         * Nothing happened for a while, stop the LEDs and the mux until an input wakes it up again. In standby the
+         * loop waits without a timeout, so this happens once per idle period.
+         */
+        if (!events && !standby) {
+            ESP_LOGI(TAG, "No events for %d seconds, going to standby", STANDBY_TIMEOUT_MS / 1000);
+            muxed_leds_play(NULL);
+            muxed_gpio_standby();
+            standby = true;
+            continue;
+        }
+        /* Only an input resumes the mux, a clip the shell played doesn't. The LEDs only have to be animated again. */
+        if (standby && events & ~APP_EVENT_PLAYBACK_FINISHED) {
+            standby = false;
+            if (mode == MUSIC)
+                muxed_leds_play(&led_rotate_pattern);
+        }
+        
+        if (events & APP_EVENT_FORMAT_REQUESTED) {
+            ESP_LOGW(TAG, "Pressed the beak button for %d seconds. Formatting...",
+                     LITTLEFS_FORMAT_BEAK_PRESSED_TIMEOUT / 1000);
+            esp_littlefs_format(conf.partition_label);
+        }
     }
     
     /* NOTE: We should never reach this code. */
@@ -667,7 +960,7 @@ void app_main(void) {
     esp_vfs_littlefs_unregister(conf.partition_label);
     ESP_LOGI(TAG, "LITTLEFS unmounted");
     
-    opus_decoder_destroy(decoder);
+    opus_profile_decoder_destroy(decoder);
     
     free(dac_data->data_front);
     free(dac_data->data_back);
@@ -677,6 +970,7 @@ void app_main(void) {
     vTaskDelete(dac_write_data_task_handle);
     dac_write_data_task_handle = NULL;
     vSemaphoreDelete(dac_write_opus_mutex);
+    vEventGroupDelete(app_events);
   
     ESP_LOGI(TAG, "Done!\n");
     return;
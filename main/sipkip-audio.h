@@ -23,13 +23,14 @@
 
 #define ESP_INTR_FLAG_DEFAULT 0
 
-#define DAC_WRITE_OPUS(opus_name, mem_or_file)                                                              \
+#define DAC_WRITE_OPUS(opus_name, mem_or_file, cancel)                                                      \
     dac_write_opus((struct opus_mem_or_file) {                                                              \
         .is_##mem_or_file = true,                                                                           \
         .mem_or_file.opus = opus_name,                                                                      \
         .mem_or_file.opus_packets = opus_name##_packets,                                                    \
-        .mem_or_file.opus_packets_len = opus_name##_packets_len                                             \
-    })
+        .mem_or_file.opus_packets_len = opus_name##_packets_len,                                            \
+        .mem_or_file.opus_envelope = opus_name##_envelope                                                   \
+    }, cancel)
     
 struct opus_mem_or_file {
     bool is_mem;
@@ -40,22 +41,40 @@ struct opus_mem_or_file {
             unsigned int opus_packets_len;
             const unsigned char *opus;
             const unsigned char *opus_packets;
+            /* One loudness byte per packet, see audio/opusenc.c. */
+            const unsigned char *opus_envelope;
         } mem;
         struct {
             unsigned int opus_packets_len;
             FILE *opus;
             FILE *opus_packets;
+            /* NULL for clips without an envelope. */
+            FILE *opus_envelope;
         } file;
     };
 };
 
 extern SemaphoreHandle_t dac_write_opus_mutex;
-extern volatile bool exit_dac_write_opus_loop;
 
-esp_err_t dac_write_opus(struct opus_mem_or_file opus_mem_or_file);
+struct cancel_token;
+
+/**
+ * @brief     play a clip, waiting for the clip that is playing to finish first
+ *
+ * Returns ESP_ERR_NOT_FINISHED if [cancel] was cancelled, or dac_write_opus_stop() was called, before the clip ended.
+ * [cancel] may be NULL if only dac_write_opus_stop() has to stop it, otherwise it gets the number of packets played.
+ */
+esp_err_t dac_write_opus(struct opus_mem_or_file opus_mem_or_file, struct cancel_token *cancel);
+
+/**
+ * @brief     stop the clip that is playing, if any, the next one plays normally
+ */
+void dac_write_opus_stop(void);
 
 #define LITTLEFS_CHECK_AT_BOOT 0
 #define LITTLEFS_MAX_DEPTH 8
+/* The flash sector size, which esp_littlefs uses as the LittleFS block size. */
+#define LITTLEFS_BLOCK_SIZE 4096
 #define LITTLEFS_BASE_PATH "/littlefs"
 #define LITTLEFS_FORMAT_BEAK_PRESSED_TIMEOUT 5000
 
@@ -1,4 +1,5 @@
 #include <stdint.h>
+#include <stddef.h>
 #include <string.h>
 
 #include "freertos/xtensa_api.h"
@@ -9,50 +10,80 @@
 #include "esp_log.h"
 
 #include "spp-task.h"
+#include "trace.h"
+#include "utils.h"
 
 static const char *const TAG = "spp-task";
 
+/* A message together with the storage for its params, so dispatching an event needs no allocation. */
+struct spp_task_slot {
+    spp_task_msg_t msg;
+    union {
+        uint8_t bytes[SPP_TASK_MAX_PARAM_LEN];
+        max_align_t align;
+    } param;
+};
+
 static void spp_task_task_handler(void *arg);
-static bool spp_task_send_msg(spp_task_msg_t *msg);
+static bool spp_task_send_msg(struct spp_task_slot *slot);
 static void spp_task_work_dispatched(spp_task_msg_t *msg);
 
+static struct spp_task_slot spp_task_slots[CONFIG_SIPKIP_SPP_TASK_QUEUE_LEN];
+/* Pointers to the free slots, and to the slots with messages for the task, each slot is always in one of them. */
+static QueueHandle_t spp_task_free_queue = NULL;
 static QueueHandle_t spp_task_task_queue = NULL;
 static TaskHandle_t spp_task_task_handle = NULL;
+static uint32_t spp_task_dropped = 0;
+
+static void spp_task_drop(uint16_t event, const char *reason) {
+    uint32_t dropped = __atomic_add_fetch(&spp_task_dropped, 1, __ATOMIC_RELAXED);
+
+    ESP_LOGE(TAG, "Dropped event 0x%x, %s (%"PRIu32" dropped in total)", event, reason, dropped);
+}
 
 bool spp_task_work_dispatch(spp_task_cb_t p_cback, uint16_t event, void *p_params, int param_len,
                             spp_task_copy_cb_t p_copy_cback) {
+    struct spp_task_slot *slot;
+    
+    TRACE_INSTANT(TRACE_SPP_DISPATCH, event);
     ESP_LOGD(TAG, "%s event 0x%x, param len %d", __func__, event, param_len);
 
-    spp_task_msg_t msg;
-    memset(&msg, 0, sizeof(spp_task_msg_t));
-
-    msg.sig = SPP_TASK_SIG_WORK_DISPATCH;
-    msg.event = event;
-    msg.cb = p_cback;
-
-    if (param_len == 0) {
-        return spp_task_send_msg(&msg);
-    } else if (p_params && param_len > 0) {
-        if ((msg.param = malloc(param_len)) != NULL) {
-            memcpy(msg.param, p_params, param_len);
-            /* check if caller has provided a copy callback to do the deep copy */
-            if (p_copy_cback) {
-                p_copy_cback(&msg, msg.param, p_params);
-            }
-            return spp_task_send_msg(&msg);
+    if (param_len < 0 || param_len > SPP_TASK_MAX_PARAM_LEN || (param_len && !p_params)) {
+        spp_task_drop(event, "invalid params");
+        return false;
+    }
+    /* Never block the Bluetooth stack, if the task can't keep up the event is dropped. */
+    if (xQueueReceive(spp_task_free_queue, &slot, 0) != pdTRUE) {
+        spp_task_drop(event, "no free slots");
+        return false;
+    }
+
+    slot->msg = (spp_task_msg_t) {
+        .sig = SPP_TASK_SIG_WORK_DISPATCH,
+        .event = event,
+        .cb = p_cback,
+        .param = param_len ? slot->param.bytes : NULL
+    };
+    if (param_len) {
+        memcpy(slot->msg.param, p_params, param_len);
+        /* check if caller has provided a copy callback to do the deep copy */
+        if (p_copy_cback) {
+            p_copy_cback(&slot->msg, slot->msg.param, p_params);
         }
     }
 
-    return false;
+    return spp_task_send_msg(slot);
 }
 
-static bool spp_task_send_msg(spp_task_msg_t *msg) {
-    if (msg == NULL) {
-        return false;
-    }
+uint32_t spp_task_dropped_events(void) {
+    return __atomic_load_n(&spp_task_dropped, __ATOMIC_RELAXED);
+}
 
-    if (xQueueSend(spp_task_task_queue, msg, 10 / portTICK_PERIOD_MS) != pdTRUE) {
+static bool spp_task_send_msg(struct spp_task_slot *slot) {
+    /* There are as many places in the queue as there are slots, so this can't fail for a slot from the pool. */
+    if (xQueueSend(spp_task_task_queue, &slot, 0) != pdTRUE) {
         ESP_LOGE(TAG, "%s xQueue send failed", __func__);
+        xQueueSend(spp_task_free_queue, &slot, 0);
         return false;
     }
     return true;
@@ -60,33 +91,42 @@ static bool spp_task_send_msg(spp_task_msg_t *msg) {
 
 static void spp_task_work_dispatched(spp_task_msg_t *msg) {
     if (msg->cb) {
+        TRACE_BEGIN(TRACE_SPP_DISPATCH, msg->event);
         msg->cb(msg->event, msg->param);
+        TRACE_END(TRACE_SPP_DISPATCH, msg->event);
     }
 }
 
 static void spp_task_task_handler(void *arg) {
-    spp_task_msg_t msg;
+    struct spp_task_slot *slot;
     for (;;) {
-        if (pdTRUE == xQueueReceive(spp_task_task_queue, &msg, (TickType_t)portMAX_DELAY)) {
-            ESP_LOGD(TAG, "%s, sig 0x%x, 0x%x", __func__, msg.sig, msg.event);
-            switch (msg.sig) {
+        if (pdTRUE == xQueueReceive(spp_task_task_queue, &slot, (TickType_t)portMAX_DELAY)) {
+            ESP_LOGD(TAG, "%s, sig 0x%x, 0x%x", __func__, slot->msg.sig, slot->msg.event);
+            switch (slot->msg.sig) {
             case SPP_TASK_SIG_WORK_DISPATCH:
-                spp_task_work_dispatched(&msg);
+                spp_task_work_dispatched(&slot->msg);
                 break;
             default:
-                ESP_LOGW(TAG, "%s, unhandled sig: %d", __func__, msg.sig);
+                ESP_LOGW(TAG, "%s, unhandled sig: %d", __func__, slot->msg.sig);
                 break;
             }
 
-            if (msg.param) {
-                free(msg.param);
-            }
+            xQueueSend(spp_task_free_queue, &slot, 0);
         }
     }
 }
 
 void spp_task_task_start_up(void) {
-    spp_task_task_queue = xQueueCreate(10, sizeof(spp_task_msg_t));
+    spp_task_free_queue = xQueueCreate(CONFIG_SIPKIP_SPP_TASK_QUEUE_LEN, sizeof(struct spp_task_slot *));
+    spp_task_task_queue = xQueueCreate(CONFIG_SIPKIP_SPP_TASK_QUEUE_LEN, sizeof(struct spp_task_slot *));
+    if (!spp_task_free_queue || !spp_task_task_queue) {
+        ESP_LOGE(TAG, "Failed to create the SPP task queues");
+        return;
+    }
+    for (int i = 0; i < CONFIG_SIPKIP_SPP_TASK_QUEUE_LEN; i++) {
+        struct spp_task_slot *slot = &spp_task_slots[i];
+        xQueueSend(spp_task_free_queue, &slot, 0);
+    }
     xTaskCreate(&spp_task_task_handler, "SPP task handler", 2048, NULL, 10, &spp_task_task_handle);
     return;
 }
@@ -100,11 +140,15 @@ void spp_task_task_shut_down(void) {
         vQueueDelete(spp_task_task_queue);
         spp_task_task_queue = NULL;
     }
+    if (spp_task_free_queue) {
+        vQueueDelete(spp_task_free_queue);
+        spp_task_free_queue = NULL;
+    }
 }
 
-void spp_wr_task_start_up(spp_wr_task_cb_t p_cback, int fd) {
+bool spp_wr_task_start_up(spp_wr_task_cb_t p_cback, void *param) {
     // The stack size needs to be so big for this task because we call `dac_write_opus()' in here.
-    xTaskCreate(p_cback, "SPP write/read", 24576, (void *)(ptrdiff_t)fd, 5, NULL);
+    return xTaskCreate(p_cback, "SPP write/read", 24576, param, 5, NULL) == pdPASS;
 }
 void spp_wr_task_shut_down(void) {
     vTaskDelete(NULL);
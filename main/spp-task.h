@@ -3,9 +3,15 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdbool.h>
+
+#include "esp_spp_api.h"
 
 #define SPP_TASK_SIG_WORK_DISPATCH          (0x01)
 
+/* The params of a dispatched event are copied into its message slot, which fits the largest SPP callback param. */
+#define SPP_TASK_MAX_PARAM_LEN              sizeof(esp_spp_cb_param_t)
+
 /**
  * @brief     handler for the dispatched work
  */
@@ -26,10 +32,19 @@ typedef void (* spp_task_copy_cb_t)(spp_task_msg_t *msg, void *p_dest, void *p_s
 
 /**
  * @brief     work dispatcher for the application task
+ *
+ * Doesn't allocate: the message and a copy of [p_params] go into one of CONFIG_SIPKIP_SPP_TASK_QUEUE_LEN preallocated
+ * slots, which is returned to the pool after the callback ran. Returns false and counts the event as dropped if all
+ * slots are in use, or if [param_len] is larger than SPP_TASK_MAX_PARAM_LEN.
  */
 bool spp_task_work_dispatch(spp_task_cb_t p_cback, uint16_t event, void *p_params, int param_len,
                             spp_task_copy_cb_t p_copy_cback);
 
+/**
+ * @brief     number of events spp_task_work_dispatch() dropped since startup
+ */
+uint32_t spp_task_dropped_events(void);
+
 void spp_task_task_start_up(void);
 
 void spp_task_task_shut_down(void);
@@ -38,9 +53,14 @@ void spp_task_task_shut_down(void);
 /**
  * @brief     handler for write and read
  */
-typedef void (* spp_wr_task_cb_t)(void *fd);
+typedef void (* spp_wr_task_cb_t)(void *param);
 
-void spp_wr_task_start_up(spp_wr_task_cb_t p_cback, int fd);
+/**
+ * @brief     start a task that runs [p_cback] with [param], returns false if it couldn't be created
+ *
+ * Every session has its own task, which has to end itself with spp_wr_task_shut_down().
+ */
+bool spp_wr_task_start_up(spp_wr_task_cb_t p_cback, void *param);
 
 void spp_wr_task_shut_down(void);
 
@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_system.h"
+
+#include "stats.h"
+#include "spp-task.h"
+
+/* Tasks with less stack than this left at their high-water mark are flagged, a 2048 byte stack has little to spare. */
+#define STATS_STACK_LOW_BYTES 256
+
+struct stats_counters stats_counters = {0};
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY && CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+/* How many tasks the run time is remembered for at a reset, well above the number that run at once. */
+#define STATS_MAX_TASKS 32
+
+/**
+ * The run time counters at the last reset, the CPU share is measured from there. The counters are microseconds in 32
+ * bits, so the shares are only right for 71 minutes after a reset. Only the shell uses these, a reset racing a print
+ * from another session garbles that print at worst.
+ */
+static struct {
+    TaskHandle_t handle;
+    uint32_t run_time;
+} task_baselines[STATS_MAX_TASKS];
+static int n_task_baselines = 0;
+static uint32_t total_run_time_baseline = 0;
+
+/* Returns the state of all tasks, which has to be freed, or NULL if it couldn't be allocated. */
+static TaskStatus_t *get_tasks(UBaseType_t *n, uint32_t *total_run_time) {
+    /* Leave room for tasks that are created in the meantime. */
+    UBaseType_t len = uxTaskGetNumberOfTasks() + 4;
+    TaskStatus_t *tasks = malloc(len * sizeof(*tasks));
+
+    if (tasks)
+        *n = uxTaskGetSystemState(tasks, len, total_run_time);
+    return tasks;
+}
+
+static uint32_t task_baseline(TaskHandle_t handle, uint32_t run_time) {
+    for (int i = 0; i < n_task_baselines; i++)
+        /* A task that was created after the reset may have the handle of one that was deleted. */
+        if (task_baselines[i].handle == handle && task_baselines[i].run_time <= run_time)
+            return task_baselines[i].run_time;
+    return 0;
+}
+
+static void print_tasks(FILE *out) {
+    uint32_t total_run_time, total;
+    UBaseType_t n;
+    TaskStatus_t *tasks = get_tasks(&n, &total_run_time);
+
+    if (!tasks) {
+        fprintf(out, "Out of memory!\n");
+        return;
+    }
+    /* Every core adds up to the total run time, so the shares of all tasks add up to 100% of all cores. */
+    total = (total_run_time - total_run_time_baseline) * portNUM_PROCESSORS;
+    fprintf(out, "%-16s %4s %10s %6s\n", "Task", "Prio", "Stack left", "CPU");
+    for (UBaseType_t i = 0; i < n; i++) {
+        uint32_t run_time = tasks[i].ulRunTimeCounter - task_baseline(tasks[i].xHandle, tasks[i].ulRunTimeCounter);
+        uint32_t permille = total ? (uint64_t)run_time * 1000 / total : 0;
+
+        fprintf(out, "%-16s %4u %8"PRIu32" B %3"PRIu32".%"PRIu32"%%%s\n", tasks[i].pcTaskName,
+                (unsigned int)tasks[i].uxCurrentPriority, (uint32_t)tasks[i].usStackHighWaterMark, permille / 10,
+                permille % 10, tasks[i].usStackHighWaterMark < STATS_STACK_LOW_BYTES ? " low stack!" : "");
+    }
+    free(tasks);
+}
+
+static void reset_tasks(void) {
+    UBaseType_t n;
+    TaskStatus_t *tasks = get_tasks(&n, &total_run_time_baseline);
+
+    n_task_baselines = 0;
+    if (!tasks)
+        return;
+    for (UBaseType_t i = 0; i < n && n_task_baselines < STATS_MAX_TASKS; i++, n_task_baselines++) {
+        task_baselines[n_task_baselines].handle = tasks[i].xHandle;
+        task_baselines[n_task_baselines].run_time = tasks[i].ulRunTimeCounter;
+    }
+    free(tasks);
+}
+#else
+static void print_tasks(FILE *out) {
+    fprintf(out, "Tasks: needs CONFIG_FREERTOS_USE_TRACE_FACILITY and CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS\n");
+}
+
+static void reset_tasks(void) {}
+#endif
+
+void stats_print(FILE *out) {
+    /* Copied first, so a decoder that runs meanwhile can't make the average disagree with the count. */
+    uint32_t decode_frames = stats_counters.decode_frames, input_events = stats_counters.input_events;
+    uint32_t envelope_frames = stats_counters.envelope_frames, envelope_fades = stats_counters.envelope_fades;
+    uint64_t decode_total_us = stats_counters.decode_total_us;
+    uint64_t envelope_publish_cycles = stats_counters.envelope_publish_cycles;
+    uint64_t envelope_fade_cycles = stats_counters.envelope_fade_cycles;
+    uint64_t input_latency_total_us = stats_counters.input_latency_total_us;
+
+    fprintf(out, "Decode: %"PRIu32" frames, min %"PRIu32" us, avg %"PRIu32" us, max %"PRIu32" us\n", decode_frames,
+            stats_counters.decode_min_us, decode_frames ? (uint32_t)(decode_total_us / decode_frames) : 0,
+            stats_counters.decode_max_us);
+    /* The decoder holds the CPU at CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, the decode time in cycles compares to the rest. */
+    fprintf(out, "Envelope: avg %"PRIu32" cycles to publish (%"PRIu32" frames), %"PRIu32" to fade (%"PRIu32" fades), "
+            "decode avg %"PRIu32" cycles\n",
+            envelope_frames ? (uint32_t)(envelope_publish_cycles / envelope_frames) : 0, envelope_frames,
+            envelope_fades ? (uint32_t)(envelope_fade_cycles / envelope_fades) : 0, envelope_fades,
+            decode_frames ? (uint32_t)(decode_total_us * CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ / decode_frames) : 0);
+    fprintf(out, "Input latency: %"PRIu32" events, min %"PRIu32" us, avg %"PRIu32" us, max %"PRIu32" us\n",
+            input_events, stats_counters.input_latency_min_us,
+            input_events ? (uint32_t)(input_latency_total_us / input_events) : 0, stats_counters.input_latency_max_us);
+    fprintf(out, "DAC underruns: %"PRIu32"\n", __atomic_load_n(&stats_counters.dac_underruns, __ATOMIC_RELAXED));
+    fprintf(out, "Heap: %"PRIu32" B free, %"PRIu32" B lowest\n", esp_get_free_heap_size(),
+            esp_get_minimum_free_heap_size());
+    fprintf(out, "SPP: %"PRIu32" B in, %"PRIu32" B out, %"PRIu32" events dropped since boot\n",
+            __atomic_load_n(&stats_counters.spp_rx_bytes, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats_counters.spp_tx_bytes, __ATOMIC_RELAXED), spp_task_dropped_events());
+    fprintf(out, "Flash: %"PRIu32" B read, %"PRIu32" B written, %"PRIu32" B erased\n",
+            __atomic_load_n(&stats_counters.flash_read_bytes, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats_counters.flash_write_bytes, __ATOMIC_RELAXED),
+            __atomic_load_n(&stats_counters.flash_erase_bytes, __ATOMIC_RELAXED));
+    print_tasks(out);
+}
+
+void stats_reset(void) {
+    memset(&stats_counters, 0, sizeof(stats_counters));
+    reset_tasks();
+}
@@ -0,0 +1,128 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "esp_attr.h"
+#include "esp_cpu.h"
+#include "sdkconfig.h"
+
+/**
+ * Counters of how busy the firmware is, shown and reset by the stats command, to see how much headroom a deployed
+ * device has left. They are always on: an update is a relaxed atomic add, or for the decode times a few plain stores,
+ * since only the decoder updates those and it holds dac_write_opus_mutex while it does. The input latencies are plain
+ * stores as well, only the GPIO task updates them, and so are the envelope cycles, which only the decoder and the LED
+ * task update.
+ *
+ * A reset while a counter is being updated may lose that update, or leave a decode min/max from before the reset,
+ * which is cheaper than a lock on the paths that update them.
+ *
+ * Heap, stack and CPU figures aren't counted here, the stats command asks FreeRTOS and the heap for them. The CPU share
+ * and the stack high-water marks of every task need CONFIG_FREERTOS_USE_TRACE_FACILITY and
+ * CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS.
+ */
+
+struct stats_counters {
+    /* The time opus_profile_decode() took per frame. */
+    uint32_t decode_frames, decode_min_us, decode_max_us;
+    uint64_t decode_total_us;
+    /* The time from the mux interrupt that saw the first edge of an input event until the GPIO task handled it. */
+    uint32_t input_events, input_latency_min_us, input_latency_max_us;
+    uint64_t input_latency_total_us;
+    /**
+     * The CPU cycles per frame of the envelope: the decoder reading and publishing it, and the LED task fading to it.
+     * The decoder runs at CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ, so next to the decode time they show what the envelope adds.
+     */
+    uint32_t envelope_frames, envelope_fades;
+    uint64_t envelope_publish_cycles, envelope_fade_cycles;
+    /* Writes to the DAC that came after the DMA buffers ran dry, each one a gap in the audio. */
+    uint32_t dac_underruns;
+    /* Bytes read from and written to SPP file descriptors, by the shell, XMODEM and RPC. */
+    uint32_t spp_rx_bytes, spp_tx_bytes;
+    /* Bytes read, written and erased on the flash partitions, most of it by LittleFS. */
+    uint32_t flash_read_bytes, flash_write_bytes, flash_erase_bytes;
+};
+
+extern struct stats_counters stats_counters;
+
+static inline void IRAM_ATTR stats_add(uint32_t *counter, uint32_t n) {
+    __atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief     count a decoded frame that took [us] microseconds, only called by the decoder
+ */
+static inline void stats_decode_time(uint32_t us) {
+    if (!stats_counters.decode_frames || us < stats_counters.decode_min_us)
+        stats_counters.decode_min_us = us;
+    if (us > stats_counters.decode_max_us)
+        stats_counters.decode_max_us = us;
+    stats_counters.decode_total_us += us;
+    stats_counters.decode_frames++;
+}
+
+/**
+ * @brief     count an input event that the GPIO task handled [us] microseconds after its first edge, only called by the
+ *            GPIO task
+ */
+static inline void stats_input_latency(uint32_t us) {
+    if (!stats_counters.input_events || us < stats_counters.input_latency_min_us)
+        stats_counters.input_latency_min_us = us;
+    if (us > stats_counters.input_latency_max_us)
+        stats_counters.input_latency_max_us = us;
+    stats_counters.input_latency_total_us += us;
+    stats_counters.input_events++;
+}
+
+/* The start of a section whose CPU cycles are counted, see stats_cycles_since(). */
+struct stats_cycles {
+    esp_cpu_cycle_count_t start;
+    int core;
+};
+
+static inline struct stats_cycles stats_cycles_start(void) {
+    return (struct stats_cycles){ .core = esp_cpu_get_core_id(), .start = esp_cpu_get_cycle_count() };
+}
+
+/**
+ * @brief     the CPU cycles since [since] was started
+ *
+ * The cycle counters of the cores aren't in sync, a section during which the task moved to the other core counts as 0
+ * cycles. That is rare enough for the short sections counted here to not skew the averages.
+ */
+static inline uint32_t stats_cycles_since(struct stats_cycles since) {
+    esp_cpu_cycle_count_t now = esp_cpu_get_cycle_count();
+
+    return esp_cpu_get_core_id() == since.core ? now - since.start : 0;
+}
+
+/**
+ * @brief     count a frame whose envelope took the decoder [cycles] to read and publish, only called by the decoder
+ */
+static inline void stats_envelope_publish(uint32_t cycles) {
+    stats_counters.envelope_publish_cycles += cycles;
+    stats_counters.envelope_frames++;
+}
+
+/**
+ * @brief     count an envelope level that took the LED task [cycles] to fade the LEDs to, only called by the LED task
+ */
+static inline void stats_envelope_fade(uint32_t cycles) {
+    stats_counters.envelope_fade_cycles += cycles;
+    stats_counters.envelope_fades++;
+}
+
+/**
+ * @brief     print the counters, the heap and the tasks to [out]
+ */
+void stats_print(FILE *out);
+
+/**
+ * @brief     zero the counters, and start measuring the CPU share of the tasks from now
+ *
+ * The heap low-water mark is kept by the heap itself, and can't be reset.
+ */
+void stats_reset(void);
+
+#endif /* STATS_H */
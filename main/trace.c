@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+#include "trace.h"
+
+#if CONFIG_SIPKIP_TRACE
+static const char *const trace_point_names[] = {
+    [TRACE_DAC_WRITE_OPUS] = "dac_write_opus",
+    [TRACE_OPUS_DECODE] = "opus_decode",
+    [TRACE_DAC_WRITE_DATA] = "dac_write_data",
+    [TRACE_MUX_ISR] = "mux_isr",
+    [TRACE_SPP_DISPATCH] = "spp_dispatch",
+    [TRACE_XMODEM_RECEIVE] = "xmodem_receive",
+    [TRACE_XMODEM_WRITE] = "xmodem_write"
+};
+
+struct trace_ring trace_rings[portNUM_PROCESSORS];
+
+void trace_print(FILE *out) {
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        const struct trace_ring *ring = &trace_rings[core];
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        uint32_t n = head - __atomic_load_n(&ring->cleared, __ATOMIC_RELAXED);
+
+        if (n > CONFIG_SIPKIP_TRACE_LEN)
+            n = CONFIG_SIPKIP_TRACE_LEN;
+        for (uint32_t i = head - n; i != head; i++) {
+            const struct trace_record *record = &ring->records[i & (CONFIG_SIPKIP_TRACE_LEN - 1)];
+
+            fprintf(out, "%d %"PRIu32" %c %s %"PRIu32" %"PRIx32"\n", core, record->timestamp_us, record->phase,
+                    record->point < TRACE_POINT_N ? trace_point_names[record->point] : "?", record->arg, record->task);
+        }
+    }
+}
+
+void trace_clear(void) {
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+        __atomic_store_n(&trace_rings[core].cleared, __atomic_load_n(&trace_rings[core].head, __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+}
+#else
+void trace_print(FILE *out) {
+    fprintf(out, "Tracing isn't compiled in, it needs CONFIG_SIPKIP_TRACE\n");
+}
+
+void trace_clear(void) {}
+#endif
@@ -0,0 +1,100 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+/**
+ * Trace points in the paths that can make audio stutter while a file is uploaded: the decoder and the DAC, the mux
+ * interrupt, the SPP events and the XMODEM receiver with its LittleFS writes. They are only compiled in with
+ * CONFIG_SIPKIP_TRACE, otherwise the TRACE_* macros are empty.
+ *
+ * Every core has its own ring of the last CONFIG_SIPKIP_TRACE_LEN records. A writer claims a slot by incrementing the
+ * head of the ring of the core it runs on atomically and fills it in, without a lock, so the macros can be used in
+ * interrupts. A task that moves to the other core in between still gets a slot of its own, in the ring of the core it
+ * came from. Every record has the task that made it, so `host/trace2json' pairs the begin and end of a trace point per
+ * task, also when the task moved to the other core in between, like the unpinned SPP and job tasks that run speak.
+ * The trace command prints the rings, and `host/trace2json' turns that into a trace for Perfetto or chrome://tracing.
+ * Like the input trace, a record that is overwritten while it's printed comes out garbled.
+ */
+
+enum trace_point {
+    TRACE_DAC_WRITE_OPUS,    /* A clip, [arg] is the number of packets at the begin and the esp_err_t at the end. */
+    TRACE_OPUS_DECODE,       /* A frame, [arg] is the size of the packet. */
+    TRACE_DAC_WRITE_DATA,    /* A write to the DAC, [arg] is the number of samples. */
+    TRACE_MUX_ISR,           /* An edge seen by the mux interrupt, [arg] is the mask of the inputs that changed. */
+    TRACE_SPP_DISPATCH,      /* An SPP event handed to the SPP task, [arg] is the event. */
+    TRACE_XMODEM_RECEIVE,    /* A file, [arg] is the LittleFS fd at the begin and the esp_err_t at the end. */
+    TRACE_XMODEM_WRITE,      /* A block written to LittleFS, [arg] is the packet number. */
+
+    TRACE_POINT_N
+};
+
+/* The phases of the trace event format of Chrome. */
+enum trace_phase {
+    TRACE_PHASE_BEGIN = 'B',
+    TRACE_PHASE_END = 'E',
+    TRACE_PHASE_INSTANT = 'i'
+};
+
+#if CONFIG_SIPKIP_TRACE
+#if CONFIG_SIPKIP_TRACE_LEN & (CONFIG_SIPKIP_TRACE_LEN - 1)
+#error "CONFIG_SIPKIP_TRACE_LEN has to be a power of two"
+#endif
+
+struct trace_record {
+    uint32_t timestamp_us; /* The low bits of esp_timer_get_time(), which wrap after 71 minutes. */
+    uint32_t arg;
+    uint32_t task;         /* The TaskHandle_t of the task that made the record, 0 in an interrupt. */
+    uint8_t point;         /* enum trace_point. */
+    uint8_t phase;         /* enum trace_phase. */
+};
+
+struct trace_ring {
+    uint32_t head;
+    /* The head at the last clear, the records before it aren't printed. */
+    uint32_t cleared;
+    struct trace_record records[CONFIG_SIPKIP_TRACE_LEN];
+};
+
+extern struct trace_ring trace_rings[portNUM_PROCESSORS];
+
+static inline void IRAM_ATTR trace_record(enum trace_point point, enum trace_phase phase, uint32_t arg) {
+    struct trace_ring *ring = &trace_rings[xPortGetCoreID()];
+    uint32_t slot = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED) & (CONFIG_SIPKIP_TRACE_LEN - 1);
+
+    ring->records[slot] = (struct trace_record) {
+        .timestamp_us = esp_timer_get_time(),
+        .arg = arg,
+        .task = xPortInIsrContext() ? 0 : (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle(),
+        .point = point,
+        .phase = phase
+    };
+}
+
+#define TRACE_BEGIN(point, arg) trace_record(point, TRACE_PHASE_BEGIN, arg)
+#define TRACE_END(point, arg) trace_record(point, TRACE_PHASE_END, arg)
+#define TRACE_INSTANT(point, arg) trace_record(point, TRACE_PHASE_INSTANT, arg)
+#else
+#define TRACE_BEGIN(point, arg) ((void)0)
+#define TRACE_END(point, arg) ((void)0)
+#define TRACE_INSTANT(point, arg) ((void)0)
+#endif
+
+/**
+ * @brief     print the records of every core to [out], oldest first, as `core timestamp_us phase point arg task' lines
+ */
+void trace_print(FILE *out);
+
+/**
+ * @brief     forget the records so far, so the next print only has what happened after this
+ */
+void trace_clear(void);
+
+#endif /* TRACE_H */
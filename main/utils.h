@@ -2,14 +2,38 @@
 #define UTILS_H
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 
 #include "sdkconfig.h"
 
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 
+/**
+ * Lets a long operation be stopped from another task, and report how far it got. The operation checks the token where
+ * it can stop cleanly, and updates the progress in units of its own choosing, total is 0 while it's unknown.
+ */
+struct cancel_token {
+    bool cancelled;
+    uint32_t done, total;
+};
+
+static inline void cancel_token_cancel(struct cancel_token *token) {
+    __atomic_store_n(&token->cancelled, true, __ATOMIC_RELAXED);
+}
+
+static inline bool cancel_token_cancelled(const struct cancel_token *token) {
+    return __atomic_load_n(&token->cancelled, __ATOMIC_RELAXED);
+}
+
+static inline void cancel_token_progress(struct cancel_token *token, uint32_t done, uint32_t total) {
+    __atomic_store_n(&token->done, done, __ATOMIC_RELAXED);
+    __atomic_store_n(&token->total, total, __ATOMIC_RELAXED);
+}
+
 static inline char *bd_address_to_string(uint8_t *bda, char *str, size_t size) {
     if (bda == NULL || str == NULL || size < 18) {
         return NULL;
@@ -60,34 +84,4 @@ static inline char *readable_file_size(size_t size /* in bytes */, char *buf) {
     return buf;
 }
 
-static inline int copy_file(const char *src, const char *dst) {
-    FILE *in = NULL, *out = NULL;
-    size_t in_size, out_size;
-    char buf[CONFIG_LITTLEFS_PAGE_SIZE];
-    int ret_val = 0;
-    
-    in = fopen(src, "rb");
-    if (!in)
-        return -1;
-    
-    out = fopen(dst, "wb");
-    if (!out)
-        ret_val = -1;
-    
-    while (!ret_val) {
-        in_size = fread(buf, sizeof(*buf), sizeof(buf) / sizeof(*buf), in);
-        if (in_size == 0)
-            break;
-        
-        out_size = fwrite(buf, sizeof(*buf), in_size, out);
-        if (out_size == 0)
-            ret_val = -1;
-    }
-    
-    fclose(in);
-    if (out)
-        fclose(out);
-    return ret_val;
-}
-
 #endif /* UTILS_H */
@@ -1,4 +1,7 @@
+#define _GNU_SOURCE /* For fopencookie(). */
+
 #include <stdint.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -13,6 +16,7 @@
 #include "freertos/task.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_pm.h"
 #include "esp_vfs.h"
 #include "esp_bt.h"
 #include "esp_bt_main.h"
@@ -25,78 +29,324 @@
 #include "spp-task.h"
 #include "sipkip-audio.h"
 #include "commands.h"
+#include "rpc.h"
+#include "jobs.h"
+#include "manifest.h"
+#include "stats.h"
+#include "deferred-log.h"
 #include "utils.h"
 
-#define PRINT_PROMPT()                                                                                             \
-    dprintf(spp_fd, "%d@%s > ", spp_fd, DEVICE_NAME)
+#define PRINT_PROMPT(session)                                                                                      \
+    fprintf((session)->out, "%d@%s > ", (session)->fd, DEVICE_NAME)
 
 static const char *const TAG = "vfs-acceptor";
+/* For the message of every command line, the arguments themselves are gone by the time it's written. */
+DEFERRED_LOG_TAG(command_log, "vfs-acceptor")
 
 static const esp_spp_sec_t sec_mask = ESP_SPP_SEC_AUTHENTICATE;
 static const esp_spp_role_t role_slave = ESP_SPP_ROLE_SLAVE;
 
-int spp_fd = -1;
+struct spp_session spp_sessions[CONFIG_SIPKIP_SPP_MAX_SESSIONS] = {
+    [0 ... CONFIG_SIPKIP_SPP_MAX_SESSIONS - 1] = { .fd = -1 }
+};
 
-void spp_read_handle(void *param) {
-    char dummy, buf[SPP_MAX_ARG_LEN], *argv[SPP_MAX_ARGC];
+#if CONFIG_PM_ENABLE
+/* Keeps the CPU at full speed for as long as any client is connected, so transfers aren't slowed down by DFS. */
+static esp_pm_lock_handle_t spp_pm_lock = NULL;
+#endif
+
+/* Write function of the output stream, stdio calls it with the contents of the buffer, a single SPP write if it fits. */
+static ssize_t spp_out_write(void *cookie, const char *buf, size_t size) {
+    struct spp_session *session = cookie;
+    size_t written = 0;
+    
+    while (written < size) {
+        ssize_t ret = write(session->fd, &buf[written], size - written);
+        if (ret < 0) {
+            ESP_LOGE(TAG, "Couldn't write to vfs fd %d: %s!", session->fd, strerror(errno));
+            return written ? written : -1;
+        }
+        stats_add(&stats_counters.spp_tx_bytes, ret);
+        written += ret;
+    }
+    return written;
+}
+
+ssize_t spp_read(int fd, void *buf, size_t size, TickType_t timeout) {
+    TickType_t delay = 1;
+
+    for (;;) {
+        ssize_t ret = read(fd, buf, size);
+
+        if (ret > 0)
+            stats_add(&stats_counters.spp_rx_bytes, ret);
+        if (ret || !timeout)
+            return ret;
+        if (timeout != portMAX_DELAY) {
+            delay = MIN(delay, timeout);
+            timeout -= delay;
+        }
+        vTaskDelay(delay);
+        delay = MIN(delay * 2, pdMS_TO_TICKS(SPP_READ_POLL_MAX_MS));
+    }
+}
+
+char *spp_session_path(const struct spp_session *session, const char *path, char (*buf)[SPP_PATH_MAX]) {
+    size_t len = 0;
+    
+    if (path[0] != '/') {
+        len = strlen(session->cwd);
+        memcpy(*buf, session->cwd, len);
+    }
+    /* Append the components one at a time, so "." and ".." can be dropped before they take up room. */
+    while (*path) {
+        size_t component_len;
+        
+        while (*path == '/')
+            path++;
+        component_len = strcspn(path, "/");
+        if (!component_len || (component_len == 1 && path[0] == '.')) {
+            /* Nothing to append. */
+        } else if (component_len == 2 && path[0] == '.' && path[1] == '.') {
+            while (len && (*buf)[--len] != '/');
+        } else if (len + 1 + component_len < SPP_PATH_MAX) {
+            (*buf)[len++] = '/';
+            memcpy(&(*buf)[len], path, component_len);
+            len += component_len;
+        } else {
+            errno = ENAMETOOLONG;
+            return NULL;
+        }
+        path += component_len;
+    }
+    if (!len)
+        (*buf)[len++] = '/';
+    (*buf)[len] = '\0';
+    return *buf;
+}
+
+/**
+ * Splits [line] into arguments in place, and returns an error message if it can't be split. Unquoting only ever
+ * shortens an argument, so the arguments are written over the line as it's being read.
+ */
+static const char *split_args(char *line, char *argv[SPP_MAX_ARGC], int *argc) {
+    char *in = line, *out = line;
+    
+    for (*argc = 0;;) {
+        char quote = '\0';
+        bool last;
+        
+        while (*in == ' ' || *in == '\t')
+            in++;
+        if (!*in)
+            return NULL;
+        if (*argc == SPP_MAX_ARGC)
+            return "Too many arguments";
+        
+        argv[(*argc)++] = out;
+        for (; *in && (quote || (*in != ' ' && *in != '\t')); in++) {
+            if (quote && *in == quote) {
+                quote = '\0';
+                continue;
+            } else if (!quote && (*in == '"' || *in == '\'')) {
+                quote = *in;
+                continue;
+            } else if (*in == '\\' && quote != '\'' && in[1]) {
+                in++;
+            }
+            *out++ = *in;
+        }
+        if (quote)
+            return "Unterminated quote";
+        
+        /* The terminator may overwrite the separator, so check what it was first. */
+        last = !*in;
+        *out++ = '\0';
+        if (last)
+            return NULL;
+        in++;
+    }
+}
+
+static void run_line(struct spp_session *session, char *line) {
+    const struct vfs_commands *command;
+    char *argv[SPP_MAX_ARGC];
+    const char *error;
     esp_err_t err;
-    spp_fd = (ptrdiff_t)param;
-   
-    PRINT_PROMPT();
+    size_t len = strlen(line);
+    bool background = false;
+    int argc;
+    
+    /* A separate `&' at the end runs the command as a job, quoted or escaped it's an argument. */
+    while (len && (line[len - 1] == ' ' || line[len - 1] == '\t'))
+        len--;
+    if (len && line[len - 1] == '&' && (len == 1 || line[len - 2] == ' ' || line[len - 2] == '\t')) {
+        line[len - 1] = '\0';
+        background = true;
+    }
+    if ((error = split_args(line, argv, &argc))) {
+        fprintf(session->out, "%s!\n", error);
+        return;
+    }
+    /* User just pressed enter probably if argc is 0. */
+    if (!argc)
+        return;
+    
+    command = find_command(argv[0]);
+    if (!command) {
+        fprintf(session->out, "Unknown command: %s!\n", argv[0]);
+        return;
+    }
+    DLOGI(command_log, "vfs fd %d runs %s with %d arguments", session->fd, command->name, argc - 1);
+    if (background) {
+        jobs_start(session, command, argc, argv);
+        return;
+    }
+    session->cancel = (struct cancel_token) {0};
+    session->command = command;
+    if ((err = command->fn(session, argc, argv))) {
+        fprintf(session->out, "Command %s error: %s!\n", command->name, esp_err_to_name(err));
+        fprintf(session->out, "%s", command->usage);
+    }
+    session->command = NULL;
+}
+
+void spp_read_handle(void *param) {
+    struct spp_session *session = param;
+    char *buf = session->line_buf;
+    size_t len = 0;
+    /* Whether the rest of a line that didn't fit in buf is being skipped, and whether the last line ended in "\r". */
+    bool discarding = false, skip_lf = false;
+    
+#if CONFIG_PM_ENABLE
+    if (spp_pm_lock)
+        esp_pm_lock_acquire(spp_pm_lock);
+#endif
+    
+    session->out = fopencookie(session, "w", (cookie_io_functions_t) { .write = &spp_out_write });
+    if (!session->out || setvbuf(session->out, session->out_buf, _IOFBF, sizeof(session->out_buf))) {
+        ESP_LOGE(TAG, "Couldn't open the output stream of vfs fd %d!", session->fd);
+        goto exit;
+    }
+    
+    PRINT_PROMPT(session);
+    fflush(session->out);
 
     for (;;) {
-        const struct vfs_commands *command;
-        static const char *const delim = " \t\n\r";
-        int argc = 0;
+        char *line = buf;
         
-        ssize_t ret = read(spp_fd, buf, sizeof(buf) / sizeof(*buf));
+        /* Keep a byte free to terminate a line that fills the whole buffer. */
+        ssize_t ret = spp_read(session->fd, &buf[len], sizeof(session->line_buf) - 1 - len, portMAX_DELAY);
         if (ret < 0) {
-            ESP_LOGE(TAG, "Couldn't read from vfs fd %d: %s!", spp_fd, strerror(errno));
+            ESP_LOGE(TAG, "Couldn't read from vfs fd %d: %s!", session->fd, strerror(errno));
             goto exit;
-        } else if (!ret) {
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            continue;
         }
+        len += ret;
         
-        while (read(spp_fd, &dummy, sizeof(dummy)) > 0);
-       
-        buf[MIN(ret, sizeof(buf) / sizeof(*buf) - 1)] = '\0';
-        char *pch = strtok(buf, delim);
-        /* User just pressed enter probably if pch is NULL. */
-        if (pch) {
-            while (pch && argc < SPP_MAX_ARGC) {
-                argv[argc] = strdup(pch);
-                if (!argv[argc]) {
-                    ESP_LOGE(TAG, "strdup failed: %s!", strerror(errno));
-                    goto exit;
-                }
-                
-                ESP_LOGI(TAG, "Argument argv[%d]=\"%s\"", argc, argv[argc]);
-                
-                pch = strtok(NULL, delim);
-                argc++;
+        /* Run every complete line, a host may send many commands without waiting for their prompts. */
+        for (char *end = line; end < &buf[len]; end++) {
+            if (skip_lf && end == line && *end == '\n') {
+                line++;
+                skip_lf = false;
+                continue;
             }
+            skip_lf = false;
+            if (*end != '\n' && *end != '\r')
+                continue;
             
-            command = find_command(argv[0]);
-            if (!command) {
-                dprintf(spp_fd, "Unknown command: %s!\n", argv[0]);
-            } else if ((err = command->fn(argc, argv))) {
-                dprintf(spp_fd, "Command %s error: %s!\n", command->name, esp_err_to_name(err));
-                dprintf(spp_fd, "%s", command->usage);
+            skip_lf = *end == '\r';
+            *end = '\0';
+            if (discarding) {
+                fprintf(session->out, "Line too long, the limit is %d characters!\n", SPP_LINE_BUF_LEN - 1);
+                discarding = false;
+            } else {
+                /* Embedded NUL characters would end the line early, they can only be garbage. */
+                for (char *c = line; c < end; c++)
+                    if (!*c)
+                        *c = ' ';
+                run_line(session, line);
             }
-            
-            for (int i = 0; i < argc; i++)
-                free(argv[i]);
+            if (session->rpc) {
+                /* Everything after the rpc command line is for the RPC server. */
+                session->rpc = false;
+                fflush(session->out);
+                if (rpc_serve(session, end + 1, &buf[len] - (end + 1)) != ESP_OK)
+                    goto exit;
+                end = &buf[len] - 1;
+                skip_lf = false;
+            }
+            jobs_report(session);
+            PRINT_PROMPT(session);
+            line = end + 1;
         }
+        /* The output of all lines that arrived together is sent at once, the buffer is only flushed early if it fills. */
+        fflush(session->out);
         
-        PRINT_PROMPT();
+        len -= line - buf;
+        memmove(buf, line, len);
+        if (len == sizeof(session->line_buf) - 1) {
+            discarding = true;
+            len = 0;
+        }
     }
     
 exit:
-    spp_fd = -1;
+    jobs_close(session);
+    if (session->out) {
+        fclose(session->out);
+        session->out = NULL;
+    }
+#if CONFIG_PM_ENABLE
+    if (spp_pm_lock)
+        esp_pm_lock_release(spp_pm_lock);
+#endif
+    ESP_LOGI(TAG, "Session of vfs fd %d closed", session->fd);
+    /* Last, the SPP task may hand out the session again right after this. */
+    session->fd = -1;
     spp_wr_task_shut_down();
 }
 
+/* Called from the SPP task, which is the only one that opens sessions. */
+static void spp_session_open(int fd, uint32_t handle) {
+    struct spp_session *session = NULL;
+    
+    for (int i = 0; i < CONFIG_SIPKIP_SPP_MAX_SESSIONS; i++) {
+        if (spp_sessions[i].fd < 0) {
+            session = &spp_sessions[i];
+            break;
+        }
+    }
+    if (!session) {
+        ESP_LOGW(TAG, "Refusing vfs fd %d, all %d sessions are in use", fd, CONFIG_SIPKIP_SPP_MAX_SESSIONS);
+        dprintf(fd, "Too many sessions, the limit is %d!\n", CONFIG_SIPKIP_SPP_MAX_SESSIONS);
+        esp_spp_disconnect(handle);
+        return;
+    }
+    
+#if CONFIG_PM_ENABLE
+    if (!spp_pm_lock && esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "spp", &spp_pm_lock) != ESP_OK)
+        ESP_LOGE(TAG, "Failed to create the SPP PM lock");
+#endif
+    if (rpc_setup() != ESP_OK)
+        ESP_LOGE(TAG, "Failed to set up RPC");
+    if (jobs_setup() != ESP_OK || manifest_setup() != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to set up the jobs and manifest, refusing vfs fd %d", fd);
+        esp_spp_disconnect(handle);
+        return;
+    }
+    session->handle = handle;
+    session->command = NULL;
+    session->rpc = false;
+    session->rpc_pending = 0;
+    strcpy(session->cwd, LITTLEFS_BASE_PATH);
+    session->fd = fd;
+    if (!spp_wr_task_start_up(&spp_read_handle, session)) {
+        ESP_LOGE(TAG, "Failed to create the reader task of vfs fd %d", fd);
+        session->fd = -1;
+        esp_spp_disconnect(handle);
+    }
+}
+
 void esp_spp_cb(uint16_t e, void *p) {
     esp_spp_cb_event_t event = e;
     esp_spp_cb_param_t *param = p;
@@ -140,7 +390,7 @@ void esp_spp_cb(uint16_t e, void *p) {
         ESP_LOGI(TAG, "ESP_SPP_SRV_OPEN_EVT status:%d handle:%d, rem_bda:[%s]", param->srv_open.status,
                  param->srv_open.handle, bd_address_to_string(param->srv_open.rem_bda, bda_str, sizeof(bda_str)));
         if (param->srv_open.status == ESP_SPP_SUCCESS) {
-            spp_wr_task_start_up(&spp_read_handle, param->srv_open.fd);
+            spp_session_open(param->srv_open.fd, param->srv_open.handle);
         }
         break;
     default:
@@ -1,17 +1,89 @@
 #ifndef VFS_ACCEPTOR_H
 #define VFS_ACCEPTOR_H
 
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "sdkconfig.h"
+#include "freertos/FreeRTOS.h"
 #include "esp_gap_bt_api.h"
 #include "esp_spp_api.h"
 
+#include "sipkip-audio.h"
+#include "utils.h"
+
 #define SPP_SERVER_NAME "SPP_SERVER"
 #define SPP_MAX_ARGC 16
 #define SPP_MAX_ARG_LEN 256
+/* Input that isn't parsed yet is kept in a buffer of this size, which is also the longest command line. */
+#define SPP_LINE_BUF_LEN 1024
+/**
+ * Output is gathered in a buffer of this size before it's written, so it goes out in frames of the largest RFCOMM MTU
+ * instead of one per line. The MTU that gets negotiated isn't reported to the server, so this is the largest possible.
+ */
+#define SPP_OUT_BUF_LEN ESP_SPP_MAX_MTU
+#define SPP_PATH_MAX ((CONFIG_LITTLEFS_OBJ_NAME_LEN + 1) * LITTLEFS_MAX_DEPTH)
+/* The longest spp_read() waits between two reads of a quiet link. */
+#define SPP_READ_POLL_MAX_MS 100
+
+struct vfs_commands;
+
+/**
+ * The state of one connected client. Every session has its own reader task, which is the only one that touches it
+ * after it's opened, except for the fields that other sessions may read to list it.
+ */
+struct spp_session {
+    /* The SPP file descriptor, -1 if the session isn't in use. */
+    volatile int fd;
+    uint32_t handle;
+    /**
+     * Buffered stream on fd for the output of the commands. It's flushed when it's full, and after the prompts of all
+     * lines that were received together, anything that writes to fd directly has to flush it first.
+     */
+    FILE *out;
+    /* The command that is running, NULL while waiting for input. */
+    const struct vfs_commands *volatile command;
+    /* Reset before every command, the commands that take long check it and report their progress in it. */
+    struct cancel_token cancel;
+    /* Set by the rpc command to switch to the binary protocol after it returns, see rpc.h. */
+    bool rpc;
+    /* The number of RPC requests of this session that the RPC worker has yet to answer. */
+    uint32_t rpc_pending;
+    /* Relative paths are resolved against this absolute path, which has no trailing slash. */
+    char cwd[SPP_PATH_MAX];
+    /* The input that was read but doesn't form a complete line yet is kept at the start of line_buf. */
+    char line_buf[SPP_LINE_BUF_LEN];
+    char out_buf[SPP_OUT_BUF_LEN];
+};
+
+extern struct spp_session spp_sessions[CONFIG_SIPKIP_SPP_MAX_SESSIONS];
 
-extern int spp_fd;
+/**
+ * @brief     resolve [path] against the working directory of [session] into [buf], removing "." and ".." components
+ *
+ * Returns [buf], or NULL with errno set to ENAMETOOLONG if the result doesn't fit in SPP_PATH_MAX bytes.
+ */
+char *spp_session_path(const struct spp_session *session, const char *path, char (*buf)[SPP_PATH_MAX]);
+
+/**
+ * @brief     read at most [size] bytes from the SPP file descriptor [fd] into [buf], waiting up to [timeout] ticks for
+ *            them, or forever with portMAX_DELAY
+ *
+ * Returns the number of bytes read, 0 if none arrived in time, or -1 with errno set on an error. The SPP VFS has no
+ * select() and sends no data events in VFS mode, so this polls: every tick right after it's called, and less often the
+ * longer nothing arrives, up to every SPP_READ_POLL_MAX_MS. A client that answers a prompt or a packet right away
+ * waits a tick instead of the whole interval, and an idle session still only wakes up now and then.
+ */
+ssize_t spp_read(int fd, void *buf, size_t size, TickType_t timeout);
 
 /**
- * @brief     read data from file descriptor
+ * @brief     read command lines from the session [param] and run them, until its file descriptor is closed
+ *
+ * Lines end in "\n", "\r" or "\r\n", and any number of them can arrive at once, every line gets its own prompt.
+ * Arguments are separated by whitespace, unless it's quoted with '' or "", or escaped with a backslash, which also
+ * escapes quotes and backslashes outside of '' quotes.
  */
 void spp_read_handle(void *param);
 
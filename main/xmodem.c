@@ -1,3 +1,4 @@
+#include <stdbool.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
@@ -8,17 +9,37 @@
 #include "freertos/task.h"
 
 #include "xmodem.h"
+#include "vfs-acceptor.h"
+#include "stats.h"
+#include "trace.h"
+#include "deferred-log.h"
 
 static const char *const TAG = "xmodem";
+/* For the messages of every block, which would slow the transfer down if they were written to the UART directly. */
+DEFERRED_LOG_TAG(block_log, "xmodem")
 
 static inline int xmodem_read_byte(int fd, TickType_t ticks) {
     unsigned char c;
-    while (!read(fd, &c, 1)) {
-        vTaskDelay(50 / portTICK_PERIOD_MS);
-        if ((ticks -= 50 / portTICK_PERIOD_MS) <= 0)
-            return -1;
+
+    return spp_read(fd, &c, 1, ticks) == 1 ? c : -1;
+}
+
+/* Reads exactly [len] bytes, false if nothing arrived for [ticks] in between. */
+static bool xmodem_read(int fd, unsigned char *buf, size_t len, TickType_t ticks) {
+    while (len) {
+        ssize_t ret = spp_read(fd, buf, len, ticks);
+
+        if (ret <= 0)
+            return false;
+        buf += ret;
+        len -= ret;
     }
-    return c;
+    return true;
+}
+
+static inline void xmodem_write_byte(int fd, unsigned char c) {
+    if (write(fd, &c, 1) > 0)
+        stats_add(&stats_counters.spp_tx_bytes, 1);
 }
 
 static uint16_t xmodem_crc16_ccitt(const unsigned char *buf, ssize_t buf_size) {
@@ -58,7 +79,8 @@ static bool xmodem_check_buffer(int crc, const unsigned char *buf, ssize_t buf_s
 
 static inline void xmodem_flush_input(int fd) {
     char dummy;
-    while (read(fd, &dummy, sizeof(dummy)) > 0);
+    while (read(fd, &dummy, sizeof(dummy)) > 0)
+        stats_add(&stats_counters.spp_rx_bytes, 1);
 }
 
 esp_err_t xmodem_receiver_start(int spp_fd, int littlefs_fd) {
@@ -71,11 +93,12 @@ esp_err_t xmodem_receiver_start(int spp_fd, int littlefs_fd) {
     esp_err_t err = ESP_OK;
     int retry, retransmit = XMODEM_MAX_RETRANSMIT;
    
+    TRACE_BEGIN(TRACE_XMODEM_RECEIVE, littlefs_fd);
     for (;;) {
         for (retry = 0; retry < 16; ++retry) {
-            ESP_LOGI(TAG, "Trying to receive packet number %d for the %dth time", packet_number, retry);
+            DLOGI(block_log, "Trying to receive packet number %d for the %dth time", packet_number, retry);
             if (trychar)
-                write(spp_fd, &trychar, 1);
+                xmodem_write_byte(spp_fd, trychar);
             
             if ((c = xmodem_read_byte(spp_fd, (XMODEM_READ_TIMEOUT_MS / portTICK_PERIOD_MS) << 1)) >= 0) {
                 switch (c) {
@@ -102,13 +125,13 @@ esp_err_t xmodem_receiver_start(int spp_fd, int littlefs_fd) {
                 case XMODEM_EOT:
                     ESP_LOGI(TAG, "Received file with fd %d successfully", littlefs_fd);
                     xmodem_flush_input(spp_fd);
-                    write(spp_fd, (char []) {XMODEM_ACK}, 1);
+                    xmodem_write_byte(spp_fd, XMODEM_ACK);
                     goto exit; /* normal end */
                 case XMODEM_CAN:
                     if ((c = xmodem_read_byte(spp_fd, XMODEM_READ_TIMEOUT_MS / portTICK_PERIOD_MS)) == XMODEM_CAN) {
                         ESP_LOGW(TAG, "Transmitter canceled the file transfer");
                         xmodem_flush_input(spp_fd);
-                        write(spp_fd, (char []) {XMODEM_ACK}, 1);
+                        xmodem_write_byte(spp_fd, XMODEM_ACK);
                         /* canceled by remote */
                         err = ESP_FAIL;
                         goto exit;
@@ -127,9 +150,9 @@ esp_err_t xmodem_receiver_start(int spp_fd, int littlefs_fd) {
         
         ESP_LOGE(TAG, "Sync error, aborting");
         xmodem_flush_input(spp_fd);
-        write(spp_fd, (char []) {XMODEM_CAN}, 1);
-        write(spp_fd, (char []) {XMODEM_CAN}, 1);
-        write(spp_fd, (char []) {XMODEM_CAN}, 1);
+        xmodem_write_byte(spp_fd, XMODEM_CAN);
+        xmodem_write_byte(spp_fd, XMODEM_CAN);
+        xmodem_write_byte(spp_fd, XMODEM_CAN);
         /* Sync error. */
         err = ESP_FAIL;
         goto exit;
@@ -140,9 +163,9 @@ esp_err_t xmodem_receiver_start(int spp_fd, int littlefs_fd) {
         if (!xmodem_buf) {
             ESP_LOGE(TAG, "Failed to allocate memory for xmodem_buffer: %s", strerror(errno));
             xmodem_flush_input(spp_fd);
-            write(spp_fd, (char []) {XMODEM_CAN}, 1);
-            write(spp_fd, (char []) {XMODEM_CAN}, 1);
-            write(spp_fd, (char []) {XMODEM_CAN}, 1);
+            xmodem_write_byte(spp_fd, XMODEM_CAN);
+            xmodem_write_byte(spp_fd, XMODEM_CAN);
+            xmodem_write_byte(spp_fd, XMODEM_CAN);
             /* Failed to allocate memory. */
             err = ESP_FAIL;
             goto exit;
@@ -154,42 +177,43 @@ esp_err_t xmodem_receiver_start(int spp_fd, int littlefs_fd) {
         p = xmodem_buf;
         *p++ = c;
         
-        for (int i = 0;  i < (xmodem_buf_size + (crc ? 1 : 0) + 3); ++i) {
-            if ((c = xmodem_read_byte(spp_fd, XMODEM_READ_TIMEOUT_MS / portTICK_PERIOD_MS)) < 0)
-                goto reject;
-            *p++ = c;
-        }
+        /* The rest of the packet, mostly already received, so it's read in as few calls as possible. */
+        if (!xmodem_read(spp_fd, p, xmodem_buf_size + (crc ? 1 : 0) + 3, XMODEM_READ_TIMEOUT_MS / portTICK_PERIOD_MS))
+            goto reject;
         
         if (xmodem_buf[1] == (unsigned char)(~xmodem_buf[2]) &&
             (xmodem_buf[1] == packet_number || xmodem_buf[1] == (unsigned char)packet_number - 1) &&
             xmodem_check_buffer(crc, &xmodem_buf[3], xmodem_buf_size)) {
             if (xmodem_buf[1] == packet_number) {
+                TRACE_BEGIN(TRACE_XMODEM_WRITE, packet_number);
                 write(littlefs_fd, &xmodem_buf[3], xmodem_buf_size);
+                TRACE_END(TRACE_XMODEM_WRITE, packet_number);
                 ++packet_number;
                 retransmit = XMODEM_MAX_RETRANSMIT + 1;
             }
             if (--retransmit <= 0) {
                 ESP_LOGE(TAG, "Too many retries");
                 xmodem_flush_input(spp_fd);
-                write(spp_fd, (char []) {XMODEM_CAN}, 1);
-                write(spp_fd, (char []) {XMODEM_CAN}, 1);
-                write(spp_fd, (char []) {XMODEM_CAN}, 1);
+                xmodem_write_byte(spp_fd, XMODEM_CAN);
+                xmodem_write_byte(spp_fd, XMODEM_CAN);
+                xmodem_write_byte(spp_fd, XMODEM_CAN);
                 /* Too many retry error. */
                 err = ESP_FAIL;
                 goto exit;
             }
-            write(spp_fd, (char []) {XMODEM_ACK}, 1);
+            xmodem_write_byte(spp_fd, XMODEM_ACK);
             continue;
         }
     reject:
         ESP_LOGW(TAG, "Rejecting packet, because of incorrect CRC/checksum or short read");
         xmodem_flush_input(spp_fd);
-        write(spp_fd, (char []) {XMODEM_NAK}, 1);
+        xmodem_write_byte(spp_fd, XMODEM_NAK);
     }
 exit:
     /* Free memory if apliccable. */
     if (xmodem_buf)
         free(xmodem_buf);
+    TRACE_END(TRACE_XMODEM_RECEIVE, err);
     
     return err;
 }